@@ -174,6 +174,7 @@ LOCAL_SRC_FILES += \
     utils/font-retry.c \
     utils/grabclient.c \
     utils/hsv.c \
+    utils/imgfilter.c \
     utils/logo.c \
     utils/minixpm.c \
     utils/pow2.c \
@@ -341,6 +341,7 @@ randr_scan_monitors (Display *dpy, char **errP)
           m->desc     = (rroi && rroi->name
                          ? strdup (rroi->name)
                          : strdup (buf));
+          m->named_p  = (rroi && rroi->name && *rroi->name);
 
           if (crtci)
             {
@@ -769,6 +770,28 @@ monitor_layouts_differ_p (monitor **a, monitor **b)
 }
 
 
+/* Whether two monitors are plausibly the same output.  If exact_p, they must
+   also have the same geometry; otherwise, a monitor that has since changed
+   size or position (but still has the same RANDR output name) matches.
+   The names of Xinerama and Xlib monitors are just their positions in the
+   list, which say nothing about which output is which, so those only
+   match on geometry.
+ */
+Bool
+same_monitor_p (monitor *a, monitor *b, Bool exact_p)
+{
+  if (!a || !b) return False;
+  if (a->screen != b->screen) return False;
+  if (a->x      == b->x     &&
+      a->y      == b->y     &&
+      a->width  == b->width &&
+      a->height == b->height)
+    return True;
+  if (exact_p) return False;
+  return (a->named_p && b->named_p && !strcmp (a->desc, b->desc));
+}
+
+
 static int
 screen_number (Screen *screen)
 {
@@ -20,6 +20,7 @@ typedef enum { S_SANE, S_ENCLOSED, S_DUPLICATE, S_OVERLAP,
 struct _monitor {
   int id;
   char *desc;
+  Bool named_p;			/* desc is an output name, not a position */
   Screen *screen;
   int x, y, width, height;
   monitor_sanity sanity;	/* I'm not crazy you're the one who's crazy */
@@ -30,6 +31,7 @@ struct _monitor {
 
 extern monitor **scan_monitors (Display *);
 extern Bool monitor_layouts_differ_p (monitor **a, monitor **b);
+extern Bool same_monitor_p (monitor *a, monitor *b, Bool exact_p);
 extern void free_monitors (monitor **monitors);
 extern void describe_monitor_layout (monitor **monitors);
 extern void check_monitor_sanity (monitor **monitors);
@@ -1131,6 +1131,18 @@ kill_screenhack (saver_screen_info *ssi)
 }
 
 
+/* Called when a screen has a new number but has kept its running hack,
+   so that later messages about that hack name the right screen.
+ */
+void
+screenhack_renumbered (saver_screen_info *ssi)
+{
+  struct screenhack_job *job = (ssi->pid ? find_job (ssi->pid) : 0);
+  if (job)
+    job->screen = ssi->number;
+}
+
+
 Bool
 any_screenhacks_running_p (saver_info *si)
 {
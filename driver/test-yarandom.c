@@ -21,6 +21,7 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <string.h>
 #include "blurb.h"
 #include "yarandom.h"
 
@@ -30,11 +31,19 @@ main (int argc, char **argv)
   unsigned long i, n;
   char *f;
   FILE *fd;
+  int mode = 0;
+  ya_rand_state st;
+  unsigned int buf[1024];
 
   progname = argv[0];
-  if (argc != 3)
+  if (argc == 4 && !strcmp (argv[3], "fill"))
+    mode = 1;
+  else if (argc == 4 && !strcmp (argv[3], "thread"))
+    mode = 2;
+  else if (argc != 3)
     {
-      fprintf(stderr, "usage: %s bytes outfile\n", argv[0]);
+      fprintf(stderr, "usage: %s bytes outfile [ fill | thread ]\n",
+              argv[0]);
       exit(1);
     }
 
@@ -43,20 +52,35 @@ main (int argc, char **argv)
 
 # undef ya_rand_init
   ya_rand_init(0);
+  if (mode == 2)   /* Seeding this draws from the default stream. */
+    ya_rand_state_init (&st, 0);
 
   fd = fopen (f, "w");
   if (!fd) { perror (f); exit (1); }
 
   n /= sizeof(uint32_t);
-  for (i = 0; i < n; i++)
+  for (i = 0; i < n; )
     {
-      union { uint32_t i; char s[sizeof(uint32_t)]; } rr;
-      rr.i = random();
-      if (! fwrite (rr.s, sizeof(rr.s), 1, fd))
+      unsigned long m = n - i;
+      if (m > sizeof(buf)/sizeof(*buf)) m = sizeof(buf)/sizeof(*buf);
+
+      if (mode == 1)
+        ya_random_fill (buf, m);
+      else if (mode == 2)
+        ya_random_fill_r (&st, buf, m);
+      else
+        {
+          unsigned long j;
+          for (j = 0; j < m; j++)
+            buf[j] = random();
+        }
+
+      if (! fwrite (buf, sizeof(*buf), m, fd))
         {
           perror ("write");
           exit (1);
         }
+      i += m;
     }
   fclose (fd);
   fprintf (stderr, "%s: %s: wrote %ld bytes\n",
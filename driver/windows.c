@@ -717,15 +717,33 @@ select_visual (saver_screen_info *ssi, const char *visual_name)
    Doesn't change anything if nothing has changed; otherwise, alters and
    reuses existing saver_screen_info structs as much as possible.
    Returns True if anything changed.
+
+   A monitor that still exists (same geometry, or same RANDR output name)
+   keeps its saver_screen_info, and thus its window and its running hack,
+   even if its position in the list changed.  resize_screensaver_window()
+   then moves and resizes that window, and the hack sees a ConfigureNotify
+   and reshapes.  Only newly-added monitors get a new hack, and only
+   departed ones have their hack killed.
  */
 Bool
 update_screen_layout (saver_info *si)
 {
+  saver_preferences *p = &si->prefs;
   monitor **monitors = scan_monitors (si->dpy);
+  monitor **old_monitors = si->monitor_layout;
+  saver_screen_info *old_screens = si->screens;
+  int old_ssi_count = si->ssi_count;
+  saver_screen_info *screens;
+  monitor **old_good, **new_good;
+  int *old_of_new;
+  Bool *taken;
   int count = 0;
   int good_count = 0;
-  int i, j;
+  int old_good_count = 0;
+  int ssi_count;
+  int i, j, k, pass;
   int seen_screens[100] = { 0, };
+  time_t now = time ((time_t *) 0);
 
   if (! monitor_layouts_differ_p (monitors, si->monitor_layout))
     {
@@ -733,9 +751,6 @@ update_screen_layout (saver_info *si)
       return False;
     }
 
-  free_monitors (si->monitor_layout);
-  si->monitor_layout = monitors;
-
   while (monitors[count])
     {
       if (monitors[count]->sanity == S_SANE)
@@ -743,24 +758,133 @@ update_screen_layout (saver_info *si)
       count++;
     }
 
-  if (si->ssi_count == 0)
+  /* Slot N of the old si->screens corresponds to the Nth sane monitor of
+     the old layout. */
+  if (old_monitors)
+    for (i = 0; old_monitors[i]; i++)
+      if (old_monitors[i]->sanity == S_SANE)
+        old_good_count++;
+  if (old_good_count > si->nscreens)
+    old_good_count = si->nscreens;
+
+  old_good   = (monitor **) calloc (old_good_count + 1, sizeof(*old_good));
+  new_good   = (monitor **) calloc (good_count + 1, sizeof(*new_good));
+  old_of_new = (int *) calloc (good_count + 1, sizeof(*old_of_new));
+  taken      = (Bool *) calloc (old_ssi_count + 1, sizeof(*taken));
+  if (!old_good || !new_good || !old_of_new || !taken) abort();
+
+  for (i = 0, j = 0; j < old_good_count; i++)
+    if (old_monitors[i]->sanity == S_SANE)
+      old_good[j++] = old_monitors[i];
+  for (i = 0, j = 0; i < count; i++)
+    if (monitors[i]->sanity == S_SANE)
+      new_good[j++] = monitors[i];
+
+  /* Match new monitors to old ones: first those that haven't changed at
+     all, then those that were merely moved or resized. */
+  for (i = 0; i < good_count; i++)
+    old_of_new[i] = -1;
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < good_count; i++)
+      if (old_of_new[i] < 0)
+        for (k = 0; k < old_good_count; k++)
+          if (!taken[k] &&
+              same_monitor_p (new_good[i], old_good[k], pass == 0))
+            {
+              old_of_new[i] = k;
+              taken[k] = True;
+              break;
+            }
+
+  /* Room for the new layout, and for any old windows that may be parked
+     past it.  Some of those may yet be re-used, so this can be more than
+     is needed, but it doesn't grow each time the layout changes. */
+  ssi_count = good_count;
+  for (k = 0; k < old_ssi_count; k++)
+    if (!taken[k] &&
+        (old_screens[k].screensaver_window || old_screens[k].pid))
+      ssi_count++;
+  if (ssi_count < 10) ssi_count = 10;
+  screens = (saver_screen_info *) calloc (sizeof(*screens), ssi_count);
+  if (! screens) abort();
+
+  for (i = 0; i < good_count; i++)
     {
-      si->ssi_count = 10;
-      si->screens = (saver_screen_info *)
-        calloc (sizeof(*si->screens), si->ssi_count);
+      if (old_of_new[i] >= 0)
+        {
+          k = old_of_new[i];
+          screens[i] = old_screens[k];
+          if (p->verbose_p && old_screens[k].pid)
+            fprintf (stderr, "%s: %d: keeping hack %ld from screen %d\n",
+                     blurb(), i, (unsigned long) old_screens[k].pid, k);
+          continue;
+        }
+
+      /* A new monitor: re-use the window of a departed one on the same
+         X screen, if there is one, but not its hack. */
+      for (k = 0; k < old_ssi_count; k++)
+        if (!taken[k] &&
+            old_screens[k].screensaver_window &&
+            old_screens[k].screen == new_good[i]->screen)
+          {
+            saver_screen_info *ssi = &old_screens[k];
+            taken[k] = True;
+            if (ssi->pid)
+              kill_screenhack (ssi);
+            if (ssi->cycle_id)
+              XtRemoveTimeOut (ssi->cycle_id);
+            ssi->cycle_id = 0;
+            ssi->cycle_at = 0;
+            if (ssi->error_dialog)
+              defer_XDestroyWindow (si->app, si->dpy, ssi->error_dialog);
+            ssi->error_dialog = 0;
+            screens[i] = *ssi;
+            break;
+          }
     }
 
-  if (si->ssi_count < count)
+  /* Keep the windows of departed monitors at the end of the list, past
+     si->nscreens, so that resize_screensaver_window() can shut them down
+     and a later new monitor can re-use them. */
+  j = good_count;
+  for (k = 0; k < old_ssi_count; k++)
+    if (!taken[k])
+      {
+        saver_screen_info *ssi = &old_screens[k];
+        if (ssi->cycle_id)
+          XtRemoveTimeOut (ssi->cycle_id);
+        ssi->cycle_id = 0;
+        ssi->cycle_at = 0;
+        if (ssi->screensaver_window || ssi->pid)
+          {
+            screens[j] = *ssi;
+            screens[j].number = j;
+            screenhack_renumbered (&screens[j]);
+            j++;
+          }
+      }
+
+  /* The cycle timers have pointers into the old array: re-arm them. */
+  for (i = 0; i < good_count; i++)
     {
-      si->screens = (saver_screen_info *)
-        realloc (si->screens, sizeof(*si->screens) * count);
-      memset (si->screens + si->ssi_count, 0,
-              sizeof(*si->screens) * (count - si->ssi_count));
-      si->ssi_count = count;
+      saver_screen_info *ssi = &screens[i];
+      if (ssi->cycle_id)
+        {
+          Time how_long = (ssi->cycle_at > now
+                           ? 1000 * (ssi->cycle_at - now)
+                           : 0);
+          XtRemoveTimeOut (ssi->cycle_id);
+          ssi->cycle_id = XtAppAddTimeOut (si->app, how_long, cycle_timer,
+                                           (XtPointer) ssi);
+        }
     }
 
-  if (! si->screens) abort();
+  free (old_screens);
+  free_monitors (old_monitors);
 
+  si->monitor_layout = monitors;
+  si->screens = screens;
+  si->ssi_count = ssi_count;
   si->nscreens = good_count;
 
   /* Regenerate the list of GL visuals as needed. */
@@ -768,15 +892,15 @@ update_screen_layout (saver_info *si)
     free (si->best_gl_visuals);
   si->best_gl_visuals = 0;
 
-  for (i = 0, j = 0; i < count; i++)
+  for (j = 0; j < good_count; j++)
     {
-      monitor *m = monitors[i];
+      monitor *m = new_good[j];
       saver_screen_info *ssi = &si->screens[j];
       int sn;
-      if (monitors[i]->sanity != S_SANE) continue;
 
       ssi->global = si;
       ssi->number = j;
+      screenhack_renumbered (ssi);
 
       sn = screen_number (m->screen);
       ssi->screen = m->screen;
@@ -786,8 +910,14 @@ update_screen_layout (saver_info *si)
 
       ssi->default_visual =
 	get_visual_resource (ssi->screen, "visualID", "VisualID", False);
-      ssi->current_visual = ssi->default_visual;
-      ssi->current_depth = visual_depth (ssi->screen, ssi->current_visual);
+
+      /* A window that we kept already has a visual, maybe a GL one. */
+      if (! ssi->screensaver_window)
+        {
+          ssi->current_visual = ssi->default_visual;
+          ssi->current_depth = visual_depth (ssi->screen,
+                                             ssi->current_visual);
+        }
 
       ssi->x      = m->x;
       ssi->y      = m->y;
@@ -795,16 +925,16 @@ update_screen_layout (saver_info *si)
       ssi->height = m->height;
 
 # ifndef DEBUG_MULTISCREEN
-      {
-        saver_preferences *p = &si->prefs;
-        if (p->debug_p)
-          ssi->width /= 2;
-      }
+      if (p->debug_p)
+        ssi->width /= 2;
 # endif
-
-      j++;
     }
 
+  free (old_good);
+  free (new_good);
+  free (old_of_new);
+  free (taken);
+
   return True;
 }
 
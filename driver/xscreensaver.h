@@ -83,6 +83,7 @@ extern void hack_environment (saver_info *si);
 extern void init_sigchld (saver_info *si);
 extern void spawn_screenhack (saver_screen_info *ssi);
 extern void kill_screenhack (saver_screen_info *ssi);
+extern void screenhack_renumbered (saver_screen_info *ssi);
 extern Bool any_screenhacks_running_p (saver_info *si);
 extern Bool select_visual (saver_screen_info *ssi, const char *visual_name);
 extern void store_saver_status (saver_info *si);
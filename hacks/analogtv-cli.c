@@ -24,6 +24,15 @@
  *    --logo FILE    Small image overlayed onto the colorbars image.
  *    --audio FILE   Add a soundtrack.
  *
+ *    --batch FILE   Render many clips in one run.  Each line of FILE is the
+ *                   options and files for one clip, as above; blank lines
+ *                   and lines starting with # are ignored.  Images that
+ *                   several clips use are only loaded once, the clips are
+ *                   rendered in parallel, and each clip is encoded on its
+ *                   own thread while the next frames are rendered.
+ *    --jobs N       How many clips to render at once.  Defaults to the
+ *                   number of CPUs.
+ *
  *  Created: 10-Dec-2018 by jwz.
  */
 
@@ -42,6 +51,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <errno.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -53,6 +63,7 @@
 #include "yarandom.h"
 #include "font-retry.h"
 #include "ximage-loader.h"
+#include "imgfilter.h"
 #include "thread_util.h"
 #include "xshm.h"
 #include "analogtv.h"
@@ -62,10 +73,10 @@ const char *progname;
 const char *progclass;
 int mono_p = 0;
 static Bool verbose_p = 0;
+static Bool batch_p = False;
+static unsigned tv_threads = 0;  /* 0 means one per CPU */
 
 #define MAX_MULTICHAN 2
-static int N_CHANNELS=12;
-static int MAX_STATIONS=6;
 
 #define POWERUP_DURATION   6  /* Hardcoded in analogtv.c */
 #define POWERDOWN_DURATION 1  /* Only used here */
@@ -75,6 +86,43 @@ typedef struct chansetting_s {
   double noise_level;
 } chansetting;
 
+/* One output file, and what goes into it. */
+typedef struct clip_s {
+  const char **infiles;		/* null-terminated */
+  int nfiles;
+  const char *outfile, *audiofile, *logofile;
+  int output_w, output_h;
+  int duration, slideshow;
+  Bool powerp;
+
+  /* Loaded by prepare_clip, and shared with any other clips that use the
+     same files at the same size.  Read-only while rendering. */
+  XImage **ximages;
+  XImage *logo, *logo_mask;
+
+  /* Everything random about the clip comes from here rather than random(),
+     which can't be shared by the threads of a batch. */
+  ya_rand_state rng;
+} clip;
+
+static unsigned int
+clip_random (clip *c)
+{
+  return ya_random_r (&c->rng);
+}
+
+static double
+clip_frand (clip *c, double f)
+{
+  return ((double) clip_random (c) * f) / (double) ((unsigned int)~0);
+}
+
+static int
+clip_randsign (clip *c)
+{
+  return (clip_random (c) & 1) ? 1 : -1;
+}
+
 struct state {
   XImage *output_frame;
   Display *dpy;
@@ -82,7 +130,8 @@ struct state {
   analogtv *tv;
   analogtv_font ugly_font;
 
-  int n_stations;
+  int n_stations, max_stations, n_channels;
+  Bool darkp;
   analogtv_input **stations;
   Bool image_loading_p;
   XImage *logo, *logo_mask;
@@ -90,14 +139,17 @@ struct state {
   int curinputi;
   chansetting *chansettings;
   chansetting *cs;
-};
 
-static struct state global_state;
+  double fade_brightness;
+};
 
 
 /* Since this program does not connect to an X server, or in fact link
    with Xlib, we need stubs for the few X11 routines that analogtv.c calls.
    Most are unused. It seems like I am forever implementing subsets of X11.
+
+   The Display that analogtv.c hands back to these is really the state of
+   the clip being rendered, so that several clips can be rendered at once.
  */
 
 Status
@@ -222,7 +274,7 @@ XGetImage (Display *dpy, Drawable d, int x, int y,
 Status
 XGetWindowAttributes (Display *dpy, Window w, XWindowAttributes *xgwa)
 {
-  struct state *st = &global_state;
+  struct state *st = (struct state *) dpy;
   memset (xgwa, 0, sizeof(*xgwa));
   xgwa->width = st->output_frame->width;
   xgwa->height = st->output_frame->height;
@@ -239,7 +291,7 @@ XPutImage (Display *dpy, Drawable d, GC gc, XImage *image,
            int src_x, int src_y, int dest_x, int dest_y,
            unsigned int w, unsigned int h)
 {
-  struct state *st = &global_state;
+  struct state *st = (struct state *) dpy;
   XImage *out = st->output_frame;
   int y;
 
@@ -345,14 +397,14 @@ get_boolean_resource (Display *dpy, char *name, char *class)
   abort();
 }
 
-static int darkp = 0;
 double
 get_float_resource (Display *dpy, char *name, char *class)
 {
+  struct state *st = (struct state *) dpy;
   if (!strcmp(name, "TVTint")) return 5;		/* default 5   */
   if (!strcmp(name, "TVColor")) return 70;		/* default 70  */
   if (!strcmp(name, "TVBrightness"))
-    return (darkp ? -15 : 2);				/* default 2   */
+    return (st->darkp ? -15 : 2);			/* default 2   */
   if (!strcmp(name, "TVContrast")) return 150;		/* default 150 */
   abort();
 }
@@ -521,7 +573,6 @@ flip_ximage (XImage *ximage)
 
 
 /* Scales an XImage, modifying it in place.
-   This doesn't do dithering or smoothing, so it might have artifacts.
    If out of memory, returns False, and the XImage will have been
    destroyed and freed.
  */
@@ -531,15 +582,14 @@ scale_ximage (Screen *screen, Visual *visual,
 {
   Display *dpy = DisplayOfScreen (screen);
   int depth = visual_depth (screen, visual);
-  int x, y;
-  double xscale, yscale;
 
   XImage *ximage2 = XCreateImage (dpy, visual, depth,
                                   ZPixmap, 0, 0,
                                   new_width, new_height, 8, 0);
   ximage2->data = (char *) calloc (ximage2->height, ximage2->bytes_per_line);
 
-  if (!ximage2->data)
+  if (!ximage2->data ||
+      !imgfilter_scale_ximage (ximage, ximage2, 0))
     {
       fprintf (stderr, "%s: out of memory scaling %dx%d image to %dx%d\n",
                progname,
@@ -554,13 +604,6 @@ scale_ximage (Screen *screen, Visual *visual,
       return False;
     }
 
-  /* Brute force scaling... */
-  xscale = (double) ximage->width  / ximage2->width;
-  yscale = (double) ximage->height / ximage2->height;
-  for (y = 0; y < ximage2->height; y++)
-    for (x = 0; x < ximage2->width; x++)
-      XPutPixel (ximage2, x, y, XGetPixel (ximage, x * xscale, y * yscale));
-
   free (ximage->data);
   ximage->data = 0;
 
@@ -573,88 +616,370 @@ scale_ximage (Screen *screen, Visual *visual,
 }
 
 
+#if HAVE_PTHREAD
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define BATCH_LOCK()   PTHREAD_VERIFY (pthread_mutex_lock (&batch_mutex))
+# define BATCH_UNLOCK() PTHREAD_VERIFY (pthread_mutex_unlock (&batch_mutex))
+#else
+# define BATCH_LOCK()   /**/
+# define BATCH_UNLOCK() /**/
+#endif
+
+
+/* Every image that any clip uses, as loaded and at each size that it is
+   used at, so that a file named in many clips is only read once.
+   Only touched from the main thread, before rendering starts.
+ */
+typedef struct image_entry image_entry;
+struct image_entry {
+  const char *file;
+  int w, h;			/* 0 as loaded, -1 for a logo and its mask */
+  XImage *ximage, *mask;
+  image_entry *next;
+};
+
+static image_entry *image_cache = 0;
+
+
+static image_entry *
+find_image (const char *file, int w, int h)
+{
+  image_entry *e;
+  for (e = image_cache; e; e = e->next)
+    if (!strcmp (e->file, file) && e->w == w && e->h == h)
+      return e;
+  return 0;
+}
+
+
+static image_entry *
+add_image (const char *file, int w, int h, XImage *ximage)
+{
+  image_entry *e = (image_entry *) calloc (1, sizeof(*e));
+  if (!e) abort();
+  e->file = file;
+  e->w = w;
+  e->h = h;
+  e->ximage = ximage;
+  e->next = image_cache;
+  image_cache = e;
+  return e;
+}
+
+
+static XImage *
+copy_ximage (XImage *ximage)
+{
+  XImage *ximage2 = XCreateImage (0, 0, ximage->depth, ximage->format, 0,
+                                  NULL, ximage->width, ximage->height,
+                                  ximage->bitmap_pad, 0);
+  ximage2->data = (char *) malloc (ximage2->height * ximage2->bytes_per_line);
+  if (!ximage2->data) abort();
+  memcpy (ximage2->data, ximage->data,
+          ximage2->height * ximage2->bytes_per_line);
+  return ximage2;
+}
+
+
+/* Returns the image in the file, scaled to fit within w x h, keeping its
+   aspect ratio; or unscaled if w is 0.
+ */
+static XImage *
+load_image (const char *file, int w, int h)
+{
+  image_entry *e = find_image (file, 0, 0);
+  XImage *ximage;
+  double r1, r2;
+  int w2, h2;
+
+  if (!e)
+    {
+      ximage = file_to_ximage (0, 0, file);
+      if (!ximage) abort();
+      if (verbose_p > 1)
+        fprintf (stderr, "%s: loaded %s %dx%d\n", progname, file,
+                 ximage->width, ximage->height);
+      flip_ximage (ximage);
+      e = add_image (file, 0, 0, ximage);
+    }
+
+  ximage = e->ximage;
+  if (!w || (ximage->width == w && ximage->height == h))
+    return ximage;
+
+  r1 = (double) w / h;
+  r2 = (double) ximage->width / ximage->height;
+  if (r1 > r2)
+    {
+      w2 = h * r2;
+      h2 = h;
+    }
+  else
+    {
+      w2 = w;
+      h2 = w / r2;
+    }
+
+  e = find_image (file, w2, h2);
+  if (e) return e->ximage;
+
+  ximage = copy_ximage (ximage);
+  if (! scale_ximage (0, 0, ximage, w2, h2))
+    abort();
+  return add_image (file, w2, h2, ximage)->ximage;
+}
+
+
+static XImage *
+load_logo (const char *file, XImage **mask_ret)
+{
+  image_entry *e = find_image (file, -1, -1);
+
+  if (!e)
+    {
+      XImage *logo = file_to_ximage (0, 0, file);
+      XImage *mask;
+      int x, y;
+      if (!logo) abort();
+      if (verbose_p)
+        fprintf (stderr, "%s: loaded %s %dx%d\n", 
+                 progname, file, logo->width, logo->height);
+      flip_ximage (logo);
+      /* Pull the alpha out of the logo and make a separate mask ximage. */
+      mask = XCreateImage (0, 0, logo->depth, logo->format, 0,
+                           NULL, logo->width, logo->height,
+                           logo->bitmap_pad, 0);
+      mask->data = (char *) calloc (mask->height, mask->bytes_per_line);
+
+      for (y = 0; y < logo->height; y++)
+        for (x = 0; x < logo->width; x++) {
+          unsigned long p = XGetPixel (logo, x, y);
+          uint8_t a =                (p & 0xFF000000L) >> 24;
+          XPutPixel (logo, x, y, (p & 0x00FFFFFFL));
+          XPutPixel (mask, x, y, (a ? 0x00FFFFFFL : 0));
+        }
+
+      e = add_image (file, -1, -1, logo);
+      e->mask = mask;
+    }
+
+  *mask_ret = e->mask;
+  return e->ximage;
+}
+
+
+/* Loads and scales all of a clip's images, and decides its size. */
 static void
-analogtv_convert (const char **infiles, const char *outfile,
-                  const char *audiofile, const char *logofile,
-                  int output_w, int output_h,
-                  int duration, int slideshow, Bool powerp)
+prepare_clip (clip *c)
 {
-  unsigned long start_time = time((time_t *)0);
-  struct state *st = &global_state;
-  Display *dpy = 0;
-  Window window = 0;
-  Screen *screen = 0;
-  Visual *visual = 0;
   int i;
-  int nfiles;
-  unsigned long curticks = 0, curticks_sub = 0;
-  time_t lastlog = time((time_t *)0);
-  int frames_left = 0;
-  int channel_changes = 0;
-  int fps = 30;
-  XImage **ximages;
-  XImage *base_image = 0;
-  int *stats;
-  ffmpeg_out_state *ffst = 0;
-
-  /* Load all of the input images.
-   */
-  stats = (int *) calloc(N_CHANNELS, sizeof(*stats));
-  for (nfiles = 0; infiles[nfiles]; nfiles++)
-    ;
-  ximages = calloc (nfiles, sizeof(*ximages));
 
-  {
+  if (!c->output_w || !c->output_h) {
     int maxw = 0, maxh = 0;
-    for (i = 0; i < nfiles; i++)
+    for (i = 0; i < c->nfiles; i++)
       {
-        XImage *ximage = file_to_ximage (0, 0, infiles[i]);
-        ximages[i] = ximage;
-        if (verbose_p > 1)
-          fprintf (stderr, "%s: loaded %s %dx%d\n", progname, infiles[i],
-                   ximage->width, ximage->height);
-        flip_ximage (ximage);
+        XImage *ximage = load_image (c->infiles[i], 0, 0);
         if (ximage->width  > maxw) maxw = ximage->width;
         if (ximage->height > maxh) maxh = ximage->height;
       }
-
-    if (!output_w || !output_h) {
-      output_w = maxw;
-      output_h = maxh;
-    }
+    c->output_w = maxw;
+    c->output_h = maxh;
   }
 
-  output_w &= ~1;  /* can't be odd */
-  output_h &= ~1;
+  c->output_w &= ~1;  /* can't be odd */
+  c->output_h &= ~1;
 
   /* Scale all of the input images to the size of the largest one, or frame.
    */
-  for (i = 0; i < nfiles; i++)
+  c->ximages = (XImage **) calloc (c->nfiles, sizeof(*c->ximages));
+  if (!c->ximages) abort();
+  for (i = 0; i < c->nfiles; i++)
+    c->ximages[i] = load_image (c->infiles[i], c->output_w, c->output_h);
+
+  if (c->logofile)
+    c->logo = load_logo (c->logofile, &c->logo_mask);
+
+  /* Seeding from ya_random() has to happen on this thread. */
+  ya_rand_state_init (&c->rng, 0);
+}
+
+
+/* Encodes one clip's frames on a thread of its own, so that the next
+   frames can be rendered while the last ones are being compressed.
+   Frames are copied into a small queue, and adding one waits only when
+   the encoder has fallen that far behind.
+ */
+#define ENCODER_QUEUE 4
+
+typedef struct {
+  ffmpeg_out_state *ffst;
+  XImage *frames[ENCODER_QUEUE];
+  int head, count;
+  Bool done_p;
+# if HAVE_PTHREAD
+  Bool threaded_p;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+# endif
+} encoder;
+
+
+# if HAVE_PTHREAD
+static void *
+encoder_thread (void *arg)
+{
+  encoder *enc = (encoder *) arg;
+
+  PTHREAD_VERIFY (pthread_mutex_lock (&enc->mutex));
+  while (1)
     {
-      XImage *ximage = ximages[i];
-      if (ximage->width != output_w || ximage->height != output_h)
-        {
-          double r1 = (double) output_w / output_h;
-          double r2 = (double) ximage->width / ximage->height;
-          int w2, h2;
-          if (r1 > r2)
-            {
-              w2 = output_h * r2;
-              h2 = output_h;
-            }
-          else
-            {
-              w2 = output_w;
-              h2 = output_w / r2;
-            }
-          if (! scale_ximage (screen, visual, ximage, w2, h2))
-            abort();
-        }
+      XImage *frame;
+      while (!enc->count && !enc->done_p)
+        PTHREAD_VERIFY (pthread_cond_wait (&enc->cond, &enc->mutex));
+      if (!enc->count)
+        break;
+      frame = enc->frames[enc->head];
+      PTHREAD_VERIFY (pthread_mutex_unlock (&enc->mutex));
+
+      ffmpeg_out_add_frame (enc->ffst, frame);
+
+      PTHREAD_VERIFY (pthread_mutex_lock (&enc->mutex));
+      enc->head = (enc->head + 1) % ENCODER_QUEUE;
+      enc->count--;
+      PTHREAD_VERIFY (pthread_cond_broadcast (&enc->cond));
     }
+  PTHREAD_VERIFY (pthread_mutex_unlock (&enc->mutex));
+  return 0;
+}
+# endif /* HAVE_PTHREAD */
+
+
+static void
+encoder_start (encoder *enc, const char *outfile, const char *audiofile,
+               XImage *like)
+{
+  int i;
+  memset (enc, 0, sizeof(*enc));
+
+  /* Opening and closing ffmpeg streams is not safe to do on several
+     threads at once. */
+  BATCH_LOCK();
+  enc->ffst = ffmpeg_out_init (outfile, audiofile, like->width, like->height,
+                               4, True);
+  BATCH_UNLOCK();
+
+  for (i = 0; i < ENCODER_QUEUE; i++)
+    enc->frames[i] = copy_ximage (like);
+
+# if HAVE_PTHREAD
+  PTHREAD_VERIFY (pthread_mutex_init (&enc->mutex, NULL));
+  PTHREAD_VERIFY (pthread_cond_init (&enc->cond, NULL));
+  enc->threaded_p = !pthread_create (&enc->thread, NULL, encoder_thread, enc);
+# endif
+}
+
+
+static void
+encoder_add_frame (encoder *enc, XImage *frame)
+{
+  XImage *slot;
+
+# if HAVE_PTHREAD
+  if (enc->threaded_p)
+    {
+      PTHREAD_VERIFY (pthread_mutex_lock (&enc->mutex));
+      while (enc->count == ENCODER_QUEUE)
+        PTHREAD_VERIFY (pthread_cond_wait (&enc->cond, &enc->mutex));
+      slot = enc->frames[(enc->head + enc->count) % ENCODER_QUEUE];
+      PTHREAD_VERIFY (pthread_mutex_unlock (&enc->mutex));
+
+      /* Nobody else touches this slot until it is counted. */
+      memcpy (slot->data, frame->data, frame->height * frame->bytes_per_line);
+
+      PTHREAD_VERIFY (pthread_mutex_lock (&enc->mutex));
+      enc->count++;
+      PTHREAD_VERIFY (pthread_cond_broadcast (&enc->cond));
+      PTHREAD_VERIFY (pthread_mutex_unlock (&enc->mutex));
+      return;
+    }
+# endif
+
+  slot = enc->frames[0];
+  memcpy (slot->data, frame->data, frame->height * frame->bytes_per_line);
+  ffmpeg_out_add_frame (enc->ffst, slot);
+}
 
-  memset (st, 0, sizeof(*st));
+
+static void
+encoder_finish (encoder *enc)
+{
+  int i;
+
+# if HAVE_PTHREAD
+  if (enc->threaded_p)
+    {
+      PTHREAD_VERIFY (pthread_mutex_lock (&enc->mutex));
+      enc->done_p = True;
+      PTHREAD_VERIFY (pthread_cond_broadcast (&enc->cond));
+      PTHREAD_VERIFY (pthread_mutex_unlock (&enc->mutex));
+      PTHREAD_VERIFY (pthread_join (enc->thread, NULL));
+    }
+  PTHREAD_VERIFY (pthread_cond_destroy (&enc->cond));
+  PTHREAD_VERIFY (pthread_mutex_destroy (&enc->mutex));
+# endif
+
+  for (i = 0; i < ENCODER_QUEUE; i++)
+    XDestroyImage (enc->frames[i]);
+
+  BATCH_LOCK();
+  ffmpeg_out_close (enc->ffst);
+  BATCH_UNLOCK();
+}
+
+
+static void
+analogtv_convert (clip *c)
+{
+  unsigned long start_time = time((time_t *)0);
+  struct state *st;
+  Display *dpy;
+  Window window = 0;
+  int i;
+  int nfiles = c->nfiles;
+  int output_w = c->output_w, output_h = c->output_h;
+  int duration = c->duration, slideshow = c->slideshow;
+  Bool powerp = c->powerp;
+  unsigned long curticks = 0, curticks_sub = 0;
+  time_t lastlog = time((time_t *)0);
+  int frames_left = 0;
+  int channel_changes = 0;
+  int fps = 30;
+  XImage **ximages = c->ximages;
+  XImage *base_image = 0;
+  int *stats;
+  encoder enc;
+
+  st = (struct state *) calloc (1, sizeof(*st));
+  if (!st) abort();
+  dpy = (Display *) st;
   st->dpy = dpy;
   st->window = window;
+  st->fade_brightness = 9999;
+
+  /* stations should be a multiple of files, but >= 6.
+     channels should be double that. */
+  st->max_stations = 6;
+  if (! slideshow) {
+    st->max_stations = 0;
+    while (st->max_stations < 6)
+      st->max_stations += nfiles;
+    st->max_stations *= 2;
+  }
+  st->n_channels = st->max_stations * 2;
+  st->darkp = (nfiles == 1);
+
+  stats = (int *) calloc(st->n_channels, sizeof(*stats));
 
   st->output_frame = XCreateImage (dpy, 0, ximages[0]->depth,
                                    ximages[0]->format, 0, NULL,
@@ -663,34 +988,21 @@ analogtv_convert (const char **infiles, const char *outfile,
   st->output_frame->data = (char *)
     calloc (st->output_frame->height, st->output_frame->bytes_per_line);
 
-  if (logofile) {
-    int x, y;
-    st->logo = file_to_ximage (0, 0, logofile);
-    if (verbose_p)
-      fprintf (stderr, "%s: loaded %s %dx%d\n", 
-               progname, logofile, st->logo->width, st->logo->height);
-    flip_ximage (st->logo);
-    /* Pull the alpha out of the logo and make a separate mask ximage. */
-    st->logo_mask = XCreateImage (dpy, 0, st->logo->depth, st->logo->format, 0,
-                                  NULL, st->logo->width, st->logo->height,
-                                  st->logo->bitmap_pad, 0);
-    st->logo_mask->data = (char *)
-    calloc (st->logo_mask->height, st->logo_mask->bytes_per_line);
-
-    for (y = 0; y < st->logo->height; y++)
-      for (x = 0; x < st->logo->width; x++) {
-        unsigned long p = XGetPixel (st->logo, x, y);
-        uint8_t a =                     (p & 0xFF000000L) >> 24;
-        XPutPixel (st->logo,      x, y, (p & 0x00FFFFFFL));
-        XPutPixel (st->logo_mask, x, y, (a ? 0x00FFFFFFL : 0));
-      }
-  }
+  st->logo = c->logo;
+  st->logo_mask = c->logo_mask;
 
+  /* analogtv_allocate initializes some statics. */
+  BATCH_LOCK();
   st->tv=analogtv_allocate(dpy, window);
+  BATCH_UNLOCK();
+  if (!st->tv) abort();
+  st->tv->rng = &c->rng;
+  if (tv_threads)
+    analogtv_set_threads (st->tv, tv_threads);
 
   st->stations = (analogtv_input **)
-    calloc (MAX_STATIONS, sizeof(*st->stations));
-  while (st->n_stations < MAX_STATIONS) {
+    calloc (st->max_stations, sizeof(*st->stations));
+  while (st->n_stations < st->max_stations) {
     analogtv_input *input=analogtv_input_allocate();
     st->stations[st->n_stations++]=input;
     input->client_data = st;
@@ -699,23 +1011,23 @@ analogtv_convert (const char **infiles, const char *outfile,
   analogtv_set_defaults(st->tv, "");
   st->tv->need_clear=1;
 
-  if (random()%4==0) {
-    st->tv->tint_control += pow(frand(2.0)-1.0, 7) * 180.0;
+  if (clip_random(c)%4==0) {
+    st->tv->tint_control += pow(clip_frand(c, 2.0)-1.0, 7) * 180.0;
   }
   if (1) {
-    st->tv->color_control += frand(0.3) * RANDSIGN();
+    st->tv->color_control += clip_frand(c, 0.3) * clip_randsign(c);
   }
-  if (darkp) {
-    if (random()%4==0) {
-      st->tv->brightness_control += frand(0.15);
+  if (st->darkp) {
+    if (clip_random(c)%4==0) {
+      st->tv->brightness_control += clip_frand(c, 0.15);
     }
-    if (random()%4==0) {
-      st->tv->contrast_control += frand(0.2) * RANDSIGN();
+    if (clip_random(c)%4==0) {
+      st->tv->contrast_control += clip_frand(c, 0.2) * clip_randsign(c);
     }
   }
 
-  st->chansettings = calloc (N_CHANNELS, sizeof (*st->chansettings));
-  for (i = 0; i < N_CHANNELS; i++) {
+  st->chansettings = calloc (st->n_channels, sizeof (*st->chansettings));
+  for (i = 0; i < st->n_channels; i++) {
     st->chansettings[i].noise_level = 0.06;
     {
       int last_station=42;
@@ -724,27 +1036,27 @@ analogtv_convert (const char **infiles, const char *outfile,
         analogtv_reception *rec=&st->chansettings[i].recs[stati];
         int station;
         while (1) {
-          station=random()%st->n_stations;
+          station=clip_random(c)%st->n_stations;
           if (station!=last_station) break;
-          if ((random()%10)==0) break;
+          if ((clip_random(c)%10)==0) break;
         }
         last_station=station;
         rec->input = st->stations[station];
-        rec->level = pow(frand(1.0), 3.0) * 2.0 + 0.05;
-        rec->ofs=random()%ANALOGTV_SIGNAL_LEN;
-        if (random()%3) {
-          rec->multipath = frand(1.0);
+        rec->level = pow(clip_frand(c, 1.0), 3.0) * 2.0 + 0.05;
+        rec->ofs=clip_random(c)%ANALOGTV_SIGNAL_LEN;
+        if (clip_random(c)%3) {
+          rec->multipath = clip_frand(c, 1.0);
         } else {
           rec->multipath=0.0;
         }
         if (stati) {
           /* We only set a frequency error for ghosting stations,
              because it doesn't matter otherwise */
-          rec->freqerr = (frand(2.0)-1.0) * 3.0;
+          rec->freqerr = (clip_frand(c, 2.0)-1.0) * 3.0;
         }
 
         if (rec->level > 0.3) break;
-        if (random()%4) break;
+        if (clip_random(c)%4) break;
       }
     }
   }
@@ -752,9 +1064,7 @@ analogtv_convert (const char **infiles, const char *outfile,
   st->curinputi=0;
   st->cs = &st->chansettings[st->curinputi];
 
-  ffst = ffmpeg_out_init (outfile, audiofile,
-                          st->output_frame->width, st->output_frame->height,
-                          4, True);
+  encoder_start (&enc, c->outfile, c->audiofile, st->output_frame);
 
  INIT_CHANNELS:
 
@@ -765,21 +1075,21 @@ analogtv_convert (const char **infiles, const char *outfile,
 
   if (slideshow)
     /* First channel (initial unadulterated image) stays for this long */
-    frames_left = fps * (2 + frand(1.5));
+    frames_left = fps * (2 + clip_frand(c, 1.5));
 
   if (slideshow) {
     /* Pick one of the input images and fill all channels with variants
        of it.
      */
-    int n = random() % nfiles;
+    int n = clip_random(c) % nfiles;
     XImage *ximage = ximages[n];
     base_image = ximage;
     if (verbose_p > 1)
       fprintf (stderr, "%s: initializing for %s %dx%d in %d channels\n", 
-               progname, infiles[n], ximage->width, ximage->height,
-               MAX_STATIONS);
+               progname, c->infiles[n], ximage->width, ximage->height,
+               st->max_stations);
 
-    for (i = 0; i < MAX_STATIONS; i++) {
+    for (i = 0; i < st->max_stations; i++) {
       analogtv_input *input = st->stations[i];
       int w = ximage->width  * 0.815;  /* underscan */
       int h = ximage->height * 0.970;
@@ -791,16 +1101,16 @@ analogtv_convert (const char **infiles, const char *outfile,
         input->updater = update_smpte_colorbars;
       }
 
-      analogtv_setup_sync (input, 1, (random()%20)==0);
+      analogtv_setup_sync (input, 1, (clip_random(c)%20)==0);
       analogtv_load_ximage (st->tv, input, ximage, 0, x, y, w, h);
     }
   } else {
     /* Fill all channels with images */
     if (verbose_p > 1)
       fprintf (stderr, "%s: initializing %d files in %d channels\n",
-               progname, nfiles, MAX_STATIONS);
+               progname, nfiles, st->max_stations);
 
-    for (i = 0; i < MAX_STATIONS; i++) {
+    for (i = 0; i < st->max_stations; i++) {
       XImage *ximage = ximages[i % nfiles];
       analogtv_input *input = st->stations[i];
       int w = ximage->width  * 0.815;  /* underscan */
@@ -808,10 +1118,10 @@ analogtv_convert (const char **infiles, const char *outfile,
       int x = (output_w - w) / 2;
       int y = (output_h - h) / 2;
 
-      if (! (random() % 8))  /* Some stations are colorbars */
+      if (! (clip_random(c) % 8))  /* Some stations are colorbars */
         input->updater = update_smpte_colorbars;
 
-      analogtv_setup_sync (input, 1, (random()%20)==0);
+      analogtv_setup_sync (input, 1, (clip_random(c)%20)==0);
       analogtv_load_ximage (st->tv, input, ximage, 0, x, y, w, h);
     }
   }
@@ -832,29 +1142,29 @@ analogtv_convert (const char **infiles, const char *outfile,
 
       if (slideshow && channel_changes == 1) {
         /* Second channel has short duration, 0.25 to 0.75 sec. */
-        frames_left = fps * (0.25 + frand(0.5));
+        frames_left = fps * (0.25 + clip_frand(c, 0.5));
       } else if (slideshow) {
         /* 0.5 - 2.0 sec (was 0.5 - 3.0 sec) */
-        frames_left = fps * (0.5 + frand(1.5));
+        frames_left = fps * (0.5 + clip_frand(c, 1.5));
       } else {
         /* 1 - 7 sec */
-        frames_left = fps * (1 + frand(6));
+        frames_left = fps * (1 + clip_frand(c, 6));
       }
 
       if (slideshow && channel_changes == 2) {
         /* Always use the unadulterated image for the third channel:
            So the effect is, plain, brief blip, plain, then random. */
         st->curinputi = 0;
-        frames_left += fps * (0.1 + frand(0.5));
+        frames_left += fps * (0.1 + clip_frand(c, 0.5));
 
-      } else if (slideshow && st->curinputi != 0 && ((random() % 100) < 75)) {
+      } else if (slideshow && st->curinputi != 0 && ((clip_random(c) % 100) < 75)) {
         /* Use the unadulterated image 75% of the time (was 33%) */
         st->curinputi = 0;
       } else {
         /* Otherwise random */
         int prev = st->curinputi;
       AGAIN:
-        st->curinputi = 1 + (random() % (N_CHANNELS - 1));
+        st->curinputi = 1 + (clip_random(c) % (st->n_channels - 1));
 
         /* In slideshow mode, always alternate to the unadulterated image:
            no two noisy images in a row, always intersperse clean. */
@@ -862,7 +1172,7 @@ analogtv_convert (const char **infiles, const char *outfile,
           st->curinputi = 0;
 
         /* In slideshow mode, do colorbars-only a bit less often. */
-        if (slideshow && st->curinputi == 1 && !(random() % 3))
+        if (slideshow && st->curinputi == 1 && !(clip_random(c) % 3))
           goto AGAIN;
       }
 
@@ -876,19 +1186,19 @@ analogtv_convert (const char **infiles, const char *outfile,
                  progname, curticks/1000.0, st->curinputi);
 
       /* Turn the knobs every now and then */
-      if (! (random() % 5)) {
-        if (random()%4==0) {
-          st->tv->tint_control += pow(frand(2.0)-1.0, 7) * 180.0 * RANDSIGN();
+      if (! (clip_random(c) % 5)) {
+        if (clip_random(c)%4==0) {
+          st->tv->tint_control += pow(clip_frand(c, 2.0)-1.0, 7) * 180.0 * clip_randsign(c);
         }
         if (1) {
-          st->tv->color_control += frand(0.3) * RANDSIGN();
+          st->tv->color_control += clip_frand(c, 0.3) * clip_randsign(c);
         }
-        if (darkp) {
-          if (random()%4==0) {
-            st->tv->brightness_control += frand(0.15);
+        if (st->darkp) {
+          if (clip_random(c)%4==0) {
+            st->tv->brightness_control += clip_frand(c, 0.15);
           }
-          if (random()%4==0) {
-            st->tv->contrast_control += frand(0.2) * RANDSIGN();
+          if (clip_random(c)%4==0) {
+            st->tv->contrast_control += clip_frand(c, 0.2) * clip_randsign(c);
           }
         }
       }
@@ -912,7 +1222,7 @@ analogtv_convert (const char **infiles, const char *outfile,
       /* Noisy image */
       analogtv_reception *rec = &st->cs->recs[i];
       if (rec->input) {
-        analogtv_reception_update(rec);
+        analogtv_reception_update_r(rec, &c->rng);
         recs[rec_count] = rec;
         ++rec_count;
       }
@@ -931,17 +1241,18 @@ analogtv_convert (const char **infiles, const char *outfile,
       }
     }
 
-    ffmpeg_out_add_frame (ffst, st->output_frame);
+    encoder_add_frame (&enc, st->output_frame);
 
     if (powerp &&
         curticks > (duration*1000) - (POWERDOWN_DURATION*1000)) {
       /* Fade out, as there is no power-down animation. */
       double r = ((duration*1000 - curticks) /
                   (double) (POWERDOWN_DURATION*1000));
-      static double ob = 9999;
       double min = -1.5;  /* Usable range is something like -0.75 to 1.0 */
-      if (ob == 9999) ob = st->tv->brightness_control;  /* Terrible */
-      st->tv->brightness_control = min + (ob - min) * r;
+      if (st->fade_brightness == 9999)
+        st->fade_brightness = st->tv->brightness_control;
+      st->tv->brightness_control =
+        min + (st->fade_brightness - min) * r;
     }
 
     if (curtime >= duration) break;
@@ -952,7 +1263,7 @@ analogtv_convert (const char **infiles, const char *outfile,
     curticks     += 1000/fps;
     curticks_sub += 1000/fps;
 
-    if (verbose_p) {
+    if (verbose_p && !batch_p) {
       unsigned long now = time((time_t *)0);
       if (now > (verbose_p == 1 ? lastlog : lastlog + 10)) {
         unsigned long elapsed = now - start_time;
@@ -978,18 +1289,112 @@ analogtv_convert (const char **infiles, const char *outfile,
     }
   }
 
-  if (verbose_p == 1) fprintf(stderr, "\n");
+  if (verbose_p == 1 && !batch_p) fprintf(stderr, "\n");
 
   if (verbose_p > 1) {
     if (channel_changes == 0) channel_changes++;
     fprintf(stderr, "%s: channels shown: %d\n", progname, channel_changes);
-    for (i = 0; i < N_CHANNELS; i++)
+    for (i = 0; i < st->n_channels; i++)
       fprintf(stderr, "%s:   %2d: %3d%%\n", progname,
               i+1, stats[i] * 100 / channel_changes);
   }
 
   free (stats);
-  ffmpeg_out_close (ffst);
+  encoder_finish (&enc);
+
+  if (verbose_p && batch_p) {
+    unsigned long elapsed = time((time_t *)0) - start_time;
+    fprintf (stderr, "%s: wrote %s in %lu:%02lu\n", progname, c->outfile,
+             elapsed / 60, elapsed % 60);
+  }
+
+  analogtv_release (st->tv);
+  for (i = 0; i < st->n_stations; i++)
+    free (st->stations[i]);
+  free (st->stations);
+  free (st->chansettings);
+  XDestroyImage (st->output_frame);
+  free (st);
+}
+
+
+/* Clips are handed out to the threads of one pool as each thread finishes
+   its last, so long and short clips even out.
+ */
+static clip *batch_clips;
+static int batch_nclips, batch_next;
+
+typedef struct {
+  unsigned id;
+} batch_thread;
+
+
+static int
+batch_thread_create (void *self, struct threadpool *pool, unsigned id)
+{
+  ((batch_thread *) self)->id = id;
+  return 0;
+}
+
+
+static void
+batch_thread_destroy (void *self)
+{
+}
+
+
+static void
+batch_thread_run (void *self)
+{
+  while (1)
+    {
+      int i;
+      BATCH_LOCK();
+      i = batch_next++;
+      BATCH_UNLOCK();
+      if (i >= batch_nclips) break;
+      analogtv_convert (&batch_clips[i]);
+    }
+}
+
+
+static void
+analogtv_convert_all (clip *clips, int nclips, unsigned jobs)
+{
+  static const struct threadpool_class cls = {
+    sizeof(batch_thread),
+    batch_thread_create,
+    batch_thread_destroy
+  };
+  struct threadpool pool;
+  unsigned ncpus = hardware_concurrency (0);
+  int err;
+
+  if (!jobs) jobs = ncpus;
+  if (jobs > nclips) jobs = nclips;
+
+  /* Each TV splits its frames across its share of the CPUs. */
+  tv_threads = ncpus / jobs;
+  if (tv_threads < 1) tv_threads = 1;
+
+  if (verbose_p)
+    fprintf (stderr, "%s: %d clips, %u at a time, %u threads each\n",
+             progname, nclips, jobs, tv_threads);
+
+  batch_clips = clips;
+  batch_nclips = nclips;
+  batch_next = 0;
+
+  memset (&pool, 0, sizeof(pool));
+  err = threadpool_create (&pool, &cls, 0, jobs);
+  if (err)
+    {
+      fprintf (stderr, "%s: threads: %s\n", progname, strerror (err));
+      exit (1);
+    }
+  threadpool_run (&pool, batch_thread_run);
+  threadpool_wait (&pool);
+  threadpool_destroy (&pool);
 }
 
 
@@ -999,106 +1404,240 @@ usage(const char *err)
   if (err) fprintf (stderr, "%s: %s unknown\n", progname, err);
   fprintf (stderr, "usage: %s [--verbose] [--duration secs] [--slideshow secs]"
            " [--audio mp3-file] [--powerup] [--size WxH]"
-           " infile.png ... outfile.mp4\n",
-           progname);
+           " infile.png ... outfile.mp4\n"
+           "       %s [--verbose] [--jobs N] --batch manifest-file\n",
+           progname, progname);
   exit (1);
 }
 
-int
-main (int argc, char **argv)
+
+/* Fills in a clip from its options and files.  Returns the argument that
+   was wrong, or NULL.
+ */
+static const char *
+parse_clip (int argc, char **argv, clip *c)
 {
-  int i;
-  const char *infiles[1000];
-  const char *outfile = 0;
-  int duration = 30;
-  Bool powerp = False;
-  char *audio = 0;
-  char *logo = 0;
-  int w = 0, h = 0;
-  int nfiles = 0;
-  int slideshow = 0;
+  const char **infiles;
+  const char *err = 0;
+  int i, nfiles = 0;
 
-  char *s = strrchr (argv[0], '/');
-  progname = s ? s+1 : argv[0];
-  progclass = progname;
+  memset (c, 0, sizeof(*c));
+  c->duration = 30;
 
-  memset (infiles, 0, sizeof(infiles));
+  infiles = (const char **) calloc (argc + 1, sizeof(*infiles));
+  if (!infiles) abort();
 
-  for (i = 1; i < argc; i++)
+  for (i = 0; i < argc; i++)
     {
       if (argv[i][0] == '-' && argv[i][1] == '-')
         argv[i]++;
-       if (!strcmp(argv[i], "-v") ||
-           !strcmp(argv[i], "-verbose"))
-        verbose_p++;
-       else if (!strcmp(argv[i], "-vv")) verbose_p += 2;
-       else if (!strcmp(argv[i], "-vvv")) verbose_p += 3;
-       else if (!strcmp(argv[i], "-vvvv")) verbose_p += 4;
-       else if (!strcmp(argv[i], "-vvvvv")) verbose_p += 5;
-       else if (!strcmp(argv[i], "-duration") && argv[i+1])
+       if (!strcmp(argv[i], "-duration") && argv[i+1])
          {
            char dummy;
            i++;
-           if (1 != sscanf (argv[i], " %d %c", &duration, &dummy))
-             usage(argv[i]);
+           if (1 != sscanf (argv[i], " %d %c", &c->duration, &dummy))
+             {
+               err = argv[i];
+               goto FAIL;
+             }
          }
        else if (!strcmp(argv[i], "-slideshow") && argv[i+1])
          {
            char dummy;
            i++;
-           if (1 != sscanf (argv[i], " %d %c", &slideshow, &dummy))
-             usage(argv[i]);
+           if (1 != sscanf (argv[i], " %d %c", &c->slideshow, &dummy))
+             {
+               err = argv[i];
+               goto FAIL;
+             }
          }
        else if (!strcmp(argv[i], "-audio") && argv[i+1])
-         audio = argv[++i];
+         c->audiofile = argv[++i];
        else if (!strcmp(argv[i], "-size") && argv[i+1])
          {
            char dummy;
            i++;
-           if (2 != sscanf (argv[i], " %d x %d %c", &w, &h, &dummy))
-             usage(argv[i]);
+           if (2 != sscanf (argv[i], " %d x %d %c",
+                            &c->output_w, &c->output_h, &dummy))
+             {
+               err = argv[i];
+               goto FAIL;
+             }
          }
        else if (!strcmp(argv[i], "-logo") && argv[i+1])
-         logo = argv[++i];
+         c->logofile = argv[++i];
        else if (!strcmp(argv[i], "-powerup") ||
                 !strcmp(argv[i], "-power"))
-         powerp = True;
+         c->powerp = True;
        else if (!strcmp(argv[i], "-no-powerup") ||
                 !strcmp(argv[i], "-no-power"))
-         powerp = False;
+         c->powerp = False;
       else if (argv[i][0] == '-')
-        usage(argv[i]);
-      else if (nfiles >= countof(infiles)-1)
-        usage("too many files");
+        {
+          err = argv[i];
+          goto FAIL;
+        }
       else
         infiles[nfiles++] = argv[i];
     }
 
   if (nfiles < 2)
-    usage("");
+    {
+      err = "";
+      goto FAIL;
+    }
 
-  outfile = infiles[nfiles-1];
+  c->outfile = infiles[nfiles-1];
   infiles[--nfiles] = 0;
+  c->infiles = infiles;
+  c->nfiles = nfiles;
 
   if (nfiles == 1)
-    slideshow = duration;
+    c->slideshow = c->duration;
 
-  /* stations should be a multiple of files, but >= 6.
-     channels should be double that. */
-  MAX_STATIONS = 6;
-  if (! slideshow) {
-    MAX_STATIONS = 0;
-    while (MAX_STATIONS < 6)
-      MAX_STATIONS += nfiles;
-    MAX_STATIONS *= 2;
-  }
-  N_CHANNELS = MAX_STATIONS * 2;
+  return 0;
+
+ FAIL:
+  free (infiles);
+  return err;
+}
+
+
+/* Reads a manifest of one clip per line.  Returns how many. */
+static int
+read_manifest (const char *file, clip **clips_ret)
+{
+  FILE *in = fopen (file, "r");
+  clip *clips = 0;
+  int nclips = 0, lineno = 0;
+  char buf[10240];
+
+  if (!in)
+    {
+      fprintf (stderr, "%s: %s: %s\n", progname, file, strerror (errno));
+      exit (1);
+    }
+
+  while (fgets (buf, sizeof(buf), in))
+    {
+      char *args[1000];
+      const char *err;
+      int nargs = 0;
+      char *s;
+
+      lineno++;
+      if (!strchr (buf, '\n') && getc (in) != EOF)
+        {
+          fprintf (stderr, "%s: %s:%d: line too long\n",
+                   progname, file, lineno);
+          exit (1);
+        }
+      for (s = strtok (buf, " \t\r\n"); s; s = strtok (0, " \t\r\n"))
+        {
+          if (nargs == 0 && *s == '#') break;
+          if (nargs >= countof(args) - 1)
+            {
+              fprintf (stderr, "%s: %s:%d: too many files\n",
+                       progname, file, lineno);
+              exit (1);
+            }
+          args[nargs] = strdup (s);
+          if (!args[nargs]) abort();
+          nargs++;
+        }
+      if (!nargs) continue;
+      args[nargs] = 0;
+
+      clips = (clip *) realloc (clips, (nclips + 1) * sizeof(*clips));
+      if (!clips) abort();
+      err = parse_clip (nargs, args, &clips[nclips]);
+      if (err)
+        {
+          fprintf (stderr, "%s: %s:%d: %s\n", progname, file, lineno,
+                   (*err ? err : "needs an input and an output file"));
+          exit (1);
+        }
+      nclips++;
+    }
+
+  fclose (in);
+  *clips_ret = clips;
+  return nclips;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int i;
+  char **args = (char **) calloc (argc + 1, sizeof(*args));
+  int nargs = 0;
+  const char *batchfile = 0;
+  unsigned jobs = 0;
+  clip *clips = 0;
+  int nclips = 0;
+
+  char *s = strrchr (argv[0], '/');
+  progname = s ? s+1 : argv[0];
+  progclass = progname;
+
+  if (!args) abort();
+
+  for (i = 1; i < argc; i++)
+    {
+      const char *a = argv[i];
+      if (a[0] == '-' && a[1] == '-')
+        a++;
+       if (!strcmp(a, "-v") ||
+           !strcmp(a, "-verbose"))
+        verbose_p++;
+       else if (!strcmp(a, "-vv")) verbose_p += 2;
+       else if (!strcmp(a, "-vvv")) verbose_p += 3;
+       else if (!strcmp(a, "-vvvv")) verbose_p += 4;
+       else if (!strcmp(a, "-vvvvv")) verbose_p += 5;
+       else if (!strcmp(a, "-batch") && argv[i+1])
+         batchfile = argv[++i];
+       else if (!strcmp(a, "-jobs") && argv[i+1])
+         {
+           char dummy;
+           i++;
+           if (1 != sscanf (argv[i], " %u %c", &jobs, &dummy) || !jobs)
+             usage(argv[i]);
+         }
+      else
+        args[nargs++] = argv[i];
+    }
 
-  darkp = (nfiles == 1);
+  if (batchfile)
+    {
+      if (nargs)
+        usage(args[0]);
+      batch_p = True;
+      nclips = read_manifest (batchfile, &clips);
+      if (!nclips)
+        usage("");
+    }
+  else
+    {
+      const char *err;
+      clips = (clip *) calloc (1, sizeof(*clips));
+      if (!clips) abort();
+      err = parse_clip (nargs, args, clips);
+      if (err)
+        usage(err);
+      nclips = 1;
+    }
 
 # undef ya_rand_init
   ya_rand_init (0);
-  analogtv_convert (infiles, outfile, audio, logo,
-                    w, h, duration, slideshow, powerp);
+
+  for (i = 0; i < nclips; i++)
+    prepare_clip (&clips[i]);
+
+  if (batch_p)
+    analogtv_convert_all (clips, nclips, jobs);
+  else
+    analogtv_convert (clips);
+
   exit (0);
 }
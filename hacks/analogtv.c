@@ -121,7 +121,8 @@ do { \
 #define FASTRND_C 12345
 #define FASTRND (fastrnd = fastrnd*FASTRND_A+FASTRND_C)
 
-static void analogtv_ntsc_to_yiq(const analogtv *it, int lineno, const float *signal,
+static void analogtv_ntsc_to_yiq(const analogtv *it, int colormode,
+                                 const float *multiq2, const float *signal,
                                  int start, int end, struct analogtv_yiq_s *it_yiq);
 
 static float puramp(const analogtv *it, float tc, float start, float over)
@@ -198,6 +199,20 @@ analogtv_init(void)
 
 }
 
+/* random() and frand(), or the same from a private generator. */
+static unsigned int
+analogtv_random(ya_rand_state *rng)
+{
+  return rng ? ya_random_r(rng) : random();
+}
+
+static double
+analogtv_frand(ya_rand_state *rng, double f)
+{
+  if (!rng) return frand(f);
+  return ((double) ya_random_r(rng) * f) / (double) ((unsigned int)~0);
+}
+
 void
 analogtv_set_defaults(analogtv *it, char *prefix)
 {
@@ -220,8 +235,8 @@ analogtv_set_defaults(analogtv *it, char *prefix)
   it->hashnoise_on=0;
   it->hashnoise_enable=1;
 
-  it->horiz_desync=frand(10.0)-5.0;
-  it->squeezebottom=frand(5.0)-1.0;
+  it->horiz_desync=analogtv_frand(it->rng, 10.0)-5.0;
+  it->squeezebottom=analogtv_frand(it->rng, 5.0)-1.0;
 
 #ifdef DEBUG
   printf("analogtv: prefix=%s\n",prefix);
@@ -297,6 +312,62 @@ analogtv_alloc_image(analogtv *it)
   }
 }
 
+/* Rows of demodulated picture, and of demodulated noise, for lines whose
+   input doesn't change.  See analogtv_thread_draw_lines. */
+
+/* How many rows of noise to lay over the cached lines. */
+#define ANALOGTV_NOISE_ROWS 32
+
+typedef struct analogtv_scan_s {
+  /* The input that the cached row was made from, or 0 if the row isn't
+     valid; and the input that this line had on the last frame. */
+  unsigned int signature, last_signature;
+
+  /* Everything else that went into the row. */
+  unsigned signal_offset;
+  int scanstart_i,scanend_i,squishright_i,squishdiv,pixrate;
+  int scl,scr;
+  float pixbright;
+  int colormode;
+  float multiq2[4];
+  float agclevel, brightadd;
+
+  int x0, x1;                   /* The pixels that the beam reached. */
+} analogtv_scan;
+
+static void
+analogtv_free_scans(analogtv *it)
+{
+  free(it->scans);
+  free(it->scan_rgb);
+  free(it->noise_scans);
+  free(it->noise_rgb);
+  it->scans=NULL;
+  it->scan_rgb=NULL;
+  it->noise_scans=NULL;
+  it->noise_rgb=NULL;
+}
+
+static void
+analogtv_alloc_scans(analogtv *it)
+{
+  /* On failure, it->scans is NULL, and every line is drawn the long way.
+     The colormap path never uses them. */
+
+  size_t row=it->subwidth*3*sizeof(float);
+
+  analogtv_free_scans(it);
+  if (it->use_cmap) return;
+
+  it->scans=(analogtv_scan *)calloc(ANALOGTV_VISLINES, sizeof(analogtv_scan));
+  it->scan_rgb=(float *)malloc(ANALOGTV_VISLINES*row);
+  it->noise_scans=(analogtv_scan *)calloc(2, sizeof(analogtv_scan));
+  it->noise_rgb=(float *)malloc(2*ANALOGTV_NOISE_ROWS*row);
+
+  if (!it->scans || !it->scan_rgb || !it->noise_scans || !it->noise_rgb)
+    analogtv_free_scans(it);
+}
+
 
 static void
 analogtv_configure(analogtv *it)
@@ -410,6 +481,7 @@ analogtv_configure(analogtv *it)
 
     analogtv_free_image(it);
     analogtv_alloc_image(it);
+    analogtv_alloc_scans(it);
   }
 
   it->screen_xo = (it->xgwa.width-it->usewidth)/2;
@@ -434,6 +506,14 @@ typedef struct analogtv_thread_s
   size_t signal_start, signal_end;
 } analogtv_thread;
 
+/* The pool lives apart from the analogtv, so that a new one can be made
+   before the old one is let go. */
+struct analogtv_threads
+{
+  analogtv *it;
+  struct threadpool pool;
+};
+
 #define SIGNAL_OFFSET(thread_id) \
   ((ANALOGTV_SIGNAL_LEN * (thread_id) / threads->count) & align)
 
@@ -441,9 +521,11 @@ static int analogtv_thread_create(void *thread_raw, struct threadpool *threads,
                                   unsigned thread_id)
 {
   analogtv_thread *thread = (analogtv_thread *)thread_raw;
+  struct analogtv_threads *parent;
   unsigned align;
 
-  thread->it = GET_PARENT_OBJ(analogtv, threads, threads);
+  parent = GET_PARENT_OBJ(struct analogtv_threads, pool, threads);
+  thread->it = parent->it;
   thread->thread_id = thread_id;
 
   align = thread_memory_alignment(thread->it->dpy) /
@@ -464,25 +546,52 @@ static void analogtv_thread_destroy(void *thread_raw)
 {
 }
 
+static const struct threadpool_class analogtv_thread_class = {
+  sizeof(analogtv_thread),
+  analogtv_thread_create,
+  analogtv_thread_destroy
+};
+
+static struct analogtv_threads *
+analogtv_threads_new(analogtv *it, unsigned count, int *error)
+{
+  struct analogtv_threads *threads=
+    (struct analogtv_threads *)calloc(1, sizeof(*threads));
+  if (!threads) {
+    *error=ENOMEM;
+    return NULL;
+  }
+  threads->it=it;
+  *error=threadpool_create(&threads->pool, &analogtv_thread_class, it->dpy,
+                           count);
+  if (*error) {
+    free(threads);
+    return NULL;
+  }
+  return threads;
+}
+
+static void
+analogtv_threads_free(struct analogtv_threads *threads)
+{
+  if (!threads) return;
+  threadpool_destroy(&threads->pool);
+  free(threads);
+}
+
 analogtv *
 analogtv_allocate(Display *dpy, Window window)
 {
-  static const struct threadpool_class cls = {
-    sizeof(analogtv_thread),
-    analogtv_thread_create,
-    analogtv_thread_destroy
-  };
-
   XGCValues gcv;
   analogtv *it=NULL;
-  int i;
+  int i, error;
   const size_t rx_signal_len = ANALOGTV_SIGNAL_LEN + 2*ANALOGTV_H;
 
   analogtv_init();
 
   it=(analogtv *)calloc(1,sizeof(analogtv));
   if (!it) return 0;
-  it->threads.count=0;
+  it->threads=NULL;
   it->rx_signal=NULL;
   it->signal_subtotals=NULL;
 
@@ -499,10 +608,11 @@ analogtv_allocate(Display *dpy, Window window)
                      (rx_signal_len / ANALOGTV_SUBTOTAL_LEN)))
     goto fail;
 
-  if (threadpool_create(&it->threads, &cls, dpy, hardware_concurrency(dpy)))
+  it->threads=analogtv_threads_new(it, hardware_concurrency(dpy), &error);
+  if (!it->threads)
     goto fail;
 
-  assert(it->threads.count);
+  assert(it->threads->pool.count);
 
   it->shrinkpulse=-1;
 
@@ -581,8 +691,7 @@ analogtv_allocate(Display *dpy, Window window)
 
  fail:
   if (it) {
-    if(it->threads.count)
-      threadpool_destroy(&it->threads);
+    analogtv_threads_free(it->threads);
     thread_free(it->signal_subtotals);
     thread_free(it->rx_signal);
     free(it);
@@ -590,6 +699,28 @@ analogtv_allocate(Display *dpy, Window window)
   return NULL;
 }
 
+int
+analogtv_set_threads(analogtv *it, unsigned count)
+{
+  struct analogtv_threads *threads;
+  int error;
+
+  if (!count) count=1;
+  if (count == it->threads->pool.count) return 0;
+
+  /* Keep the old pool unless a new one can be had, even of one thread. */
+  threads=analogtv_threads_new(it, count, &error);
+  if (!threads && count > 1) {
+    if (it->threads->pool.count == 1) return 0;
+    threads=analogtv_threads_new(it, 1, &error);
+  }
+  if (!threads) return error;
+
+  analogtv_threads_free(it->threads);
+  it->threads=threads;
+  return 0;
+}
+
 void
 analogtv_release(analogtv *it)
 {
@@ -601,7 +732,8 @@ analogtv_release(analogtv *it)
   it->gc=NULL;
   if (it->n_colors) XFreeColors(it->dpy, it->colormap, it->colors, it->n_colors, 0L);
   it->n_colors=0;
-  threadpool_destroy(&it->threads);
+  analogtv_threads_free(it->threads);
+  analogtv_free_scans(it);
   thread_free(it->rx_signal);
   thread_free(it->signal_subtotals);
   free(it);
@@ -708,31 +840,88 @@ analogtv_set_demod(analogtv *it)
   return 0;
 }
 
-#if 0
-unsigned int
-analogtv_line_signature(analogtv_input *input, int lineno)
+/* A hash of one line of the input, sync and all. */
+static unsigned int
+analogtv_line_signature(const analogtv_input *input, int lineno)
 {
+  const signed char *sig=input->signal[lineno];
+  unsigned int hash=2166136261u;
+  unsigned int word;
   int i;
-  char *origsignal=&input->signal[(lineno+input->vsync)
-                                  %ANALOGTV_V][input->line_hsync[lineno]];
-  unsigned int hash=0;
 
-  /* probably lame */
-  for (i=0; i<ANALOGTV_PIC_LEN; i++) {
-    int c=origsignal[i];
-    hash = hash + (hash<<17) + c;
+  for (i=0; i<ANALOGTV_H; i+=sizeof(word)) {
+    memcpy(&word, sig+i, sizeof(word));
+    hash = (hash ^ word) * 16777619u;
   }
+  return hash;
+}
 
-  hash += input->line_hsync[lineno];
-  hash ^= hash >> 2;
-  /*
-  hash += input->hashnoise_times[lineno];
-  hash ^= hash >> 2;
-  */
+static unsigned int
+analogtv_mix_signature(unsigned int hash, unsigned int x)
+{
+  hash = (hash ^ x) * 16777619u;
+  return hash ^ (hash >> 15);
+}
 
-  return hash;
+/* Works out a signature for every line of the signal that is about to be
+   received, from the lines of the inputs that will be added into it, and
+   how.  Returns whether any of them changed since the last frame. */
+static int
+analogtv_update_signatures(analogtv *it,
+                           const analogtv_reception *const *recs,
+                           unsigned rec_count)
+{
+  unsigned int rows[ANALOGTV_V], sigs[ANALOGTV_V];
+  int lineno, changed=0;
+  unsigned i;
+
+  for (lineno=0; lineno<ANALOGTV_V; lineno++)
+    sigs[lineno]=2166136261u;
+
+  for (i=0; i<rec_count; i++) {
+    const analogtv_reception *rec=recs[i];
+    unsigned ofs=(unsigned)rec->ofs % ANALOGTV_SIGNAL_LEN;
+    unsigned int params=2166136261u;
+    float f[2+ANALOGTV_GHOSTFIR_LEN];
+    int j;
+
+    f[0]=rec->level;
+    f[1]=rec->hfloss;
+    for (j=0; j<ANALOGTV_GHOSTFIR_LEN; j++)
+      f[2+j]=rec->ghostfir[j];
+    for (j=0; j<(int)(sizeof(f)/sizeof(f[0])); j++) {
+      unsigned int word;
+      memcpy(&word, &f[j], sizeof(word));
+      params=analogtv_mix_signature(params, word);
+    }
+
+    for (lineno=0; lineno<ANALOGTV_V; lineno++)
+      rows[lineno]=analogtv_line_signature(rec->input, lineno);
+
+    /* Line L of the signal is made of the end of one line of the input,
+       and the start of the next. */
+    for (lineno=0; lineno<ANALOGTV_V; lineno++) {
+      unsigned pos=(lineno*ANALOGTV_H + ofs) % ANALOGTV_SIGNAL_LEN;
+      unsigned row=pos/ANALOGTV_H, col=pos%ANALOGTV_H;
+      unsigned int hash=analogtv_mix_signature(sigs[lineno], params);
+      hash=analogtv_mix_signature(hash, rows[row]);
+      if (col) {
+        hash=analogtv_mix_signature(hash, rows[(row+1) % ANALOGTV_V]);
+        hash=analogtv_mix_signature(hash, col);
+      }
+      sigs[lineno]=hash;
+    }
+  }
+
+  for (lineno=0; lineno<ANALOGTV_V; lineno++) {
+    if (!sigs[lineno]) sigs[lineno]=1;  /* 0 means "not valid". */
+    if (sigs[lineno] != it->line_signature[lineno]) {
+      it->line_signature[lineno]=sigs[lineno];
+      changed=1;
+    }
+  }
+  return changed;
 }
-#endif
 
 
 /* Here we model the analog circuitry of an NTSC television.
@@ -754,36 +943,26 @@ analogtv_line_signature(analogtv_input *input, int lineno)
 
 */
 
-static void
-analogtv_ntsc_to_yiq(const analogtv *it, int lineno, const float *signal,
-                     int start, int end, struct analogtv_yiq_s *it_yiq)
+/* Works out from the colorburst whether a line is in color, and if so, the
+   I and Q reference signals to demodulate it with.  'phasecorr' is where
+   the line starts in the signal, mod 4. */
+static int
+analogtv_line_chroma(const analogtv *it, int lineno, int phasecorr,
+                     float multiq2[4])
 {
-  enum {MAXDELAY=32};
-  int i;
-  const float *sp;
-  int phasecorr=(signal-it->rx_signal)&3;
-  struct analogtv_yiq_s *yiq;
   int colormode;
-  float agclevel=it->agclevel;
-  float brightadd=it->brightness_control*100.0 - ANALOGTV_BLACK_LEVEL;
-  float delay[MAXDELAY+ANALOGTV_PIC_LEN], *dp;
-  float multiq2[4];
-
-  {
-
-    double cb_i=(it->line_cb_phase[lineno][(2+phasecorr)&3]-
-                 it->line_cb_phase[lineno][(0+phasecorr)&3])/16.0;
-    double cb_q=(it->line_cb_phase[lineno][(3+phasecorr)&3]-
-                 it->line_cb_phase[lineno][(1+phasecorr)&3])/16.0;
+  double cb_i=(it->line_cb_phase[lineno][(2+phasecorr)&3]-
+               it->line_cb_phase[lineno][(0+phasecorr)&3])/16.0;
+  double cb_q=(it->line_cb_phase[lineno][(3+phasecorr)&3]-
+               it->line_cb_phase[lineno][(1+phasecorr)&3])/16.0;
 
-    colormode = (cb_i * cb_i + cb_q * cb_q) > 2.8;
+  colormode = (cb_i * cb_i + cb_q * cb_q) > 2.8;
 
-    if (colormode) {
-      multiq2[0] = (cb_i*it->tint_i - cb_q*it->tint_q) * it->color_control;
-      multiq2[1] = (cb_q*it->tint_i + cb_i*it->tint_q) * it->color_control;
-      multiq2[2]=-multiq2[0];
-      multiq2[3]=-multiq2[1];
-    }
+  if (colormode) {
+    multiq2[0] = (cb_i*it->tint_i - cb_q*it->tint_q) * it->color_control;
+    multiq2[1] = (cb_q*it->tint_i + cb_i*it->tint_q) * it->color_control;
+    multiq2[2]=-multiq2[0];
+    multiq2[3]=-multiq2[1];
   }
 
 #if 0
@@ -798,6 +977,22 @@ analogtv_ntsc_to_yiq(const analogtv *it, int lineno, const float *signal,
   }
 #endif
 
+  return colormode;
+}
+
+static void
+analogtv_ntsc_to_yiq(const analogtv *it, int colormode,
+                     const float *multiq2, const float *signal,
+                     int start, int end, struct analogtv_yiq_s *it_yiq)
+{
+  enum {MAXDELAY=32};
+  int i;
+  const float *sp;
+  struct analogtv_yiq_s *yiq;
+  float agclevel=it->agclevel;
+  float brightadd=it->brightness_control*100.0 - ANALOGTV_BLACK_LEVEL;
+  float delay[MAXDELAY+ANALOGTV_PIC_LEN], *dp;
+
   dp=delay+ANALOGTV_PIC_LEN-MAXDELAY;
   for (i=0; i<5; i++) dp[i]=0.0f;
 
@@ -899,9 +1094,9 @@ analogtv_setup_frame(analogtv *it)
   if (it->flutter_horiz_desync) {
     /* Horizontal sync during vertical sync instability. */
     it->horiz_desync += -0.10*(it->horiz_desync-3.0) +
-      ((int)(random()&0xff)-0x80) *
-      ((int)(random()&0xff)-0x80) *
-      ((int)(random()&0xff)-0x80) * 0.000001;
+      ((int)(analogtv_random(it->rng)&0xff)-0x80) *
+      ((int)(analogtv_random(it->rng)&0xff)-0x80) *
+      ((int)(analogtv_random(it->rng)&0xff)-0x80) * 0.000001;
   }
 
   /* it wasn't used
@@ -912,19 +1107,19 @@ analogtv_setup_frame(analogtv *it)
 
   /* let's leave it to process shrinkpulse */
   if (it->hashnoise_enable && !it->hashnoise_on) {
-    if (random()%10000==0) {
+    if (analogtv_random(it->rng)%10000==0) {
       it->hashnoise_on=1;
-      it->shrinkpulse=random()%ANALOGTV_V;
+      it->shrinkpulse=analogtv_random(it->rng)%ANALOGTV_V;
     }
   }
-  if (random()%1000==0) {
+  if (analogtv_random(it->rng)%1000==0) {
     it->hashnoise_on=0;
   }
 
 #if 0  /* never used */
   if (it->hashnoise_on) {
     it->hashnoise_rpm += (15000.0 - it->hashnoise_rpm)*0.05 +
-      ((int)(random()%2000)-1000)*0.1;
+      ((int)(analogtv_random(it->rng)%2000)-1000)*0.1;
   } else {
     it->hashnoise_rpm -= 100 + 0.01*it->hashnoise_rpm;
     if (it->hashnoise_rpm<0.0) it->hashnoise_rpm=0.0;
@@ -948,7 +1143,7 @@ analogtv_setup_frame(analogtv *it)
       }
       /* hnc += hni + (int)(random()%65536)-32768; */
       {
-        hnc += (int)(random()%65536)-32768;
+        hnc += (int)(analogtv_random(it->rng)%65536)-32768;
         if ((hnc >= 0) && (INT_MAX - hnc < hni)) break;
         hnc += hni;
       }
@@ -1210,11 +1405,13 @@ static void analogtv_init_signal(const analogtv *it, double noiselevel, unsigned
   }
 }
 
-static void analogtv_add_signal(const analogtv *it, const analogtv_reception *rec, unsigned start, unsigned end, int ec)
+/* Adds the part of a reception from 'start' to 'end' into 'out', which is
+   where 'start' is in rx_signal, or a copy of it. */
+static void analogtv_add_signal(const analogtv *it, const analogtv_reception *rec, float *out, unsigned start, unsigned end, int ec)
 {
   analogtv_input *inp=rec->input;
-  float *ps=it->rx_signal + start;
-  float *pe=it->rx_signal + end;
+  float *ps=out;
+  float *pe=out + (end - start);
   float *p=ps;
   signed char *ss=&inp->signal[0][0];
   signed char *se=&inp->signal[0][0] + ANALOGTV_SIGNAL_LEN;
@@ -1323,7 +1520,7 @@ static void analogtv_thread_add_signals(void *thread_raw)
     analogtv_init_signal (it, it->noiselevel, start, end);
 
     for (i = 0; i != it->rec_count; ++i) {
-      analogtv_add_signal (it, it->recs[i], start, end,
+      analogtv_add_signal (it, it->recs[i], it->rx_signal + start, start, end,
                            !i ? it->channel_change_cycles : 0);
     }
 
@@ -1352,10 +1549,6 @@ static int analogtv_get_line(const analogtv *it, int lineno, int *slineno,
                   it->useheight/2)*it->puheight) + it->useheight/2;
   *ybot=(int)(((*slineno+1)*it->useheight/ANALOGTV_VISLINES -
                   it->useheight/2)*it->puheight) + it->useheight/2;
-#if 0
-  int linesig=analogtv_line_signature(input,lineno)
-    + it->hashnoise_times[lineno];
-#endif
   *signal_offset = ((lineno+it->cur_vsync+ANALOGTV_V) % ANALOGTV_V) * ANALOGTV_H +
                     it->line_hsync[lineno];
 
@@ -1498,6 +1691,358 @@ analogtv_blast_imagerow(const analogtv *it,
   }
 }
 
+/*
+  Interpolate the 600-dotclock line into however many horizontal screen
+  pixels we're using; see analogtv_draw for what all this models.
+*/
+static void
+analogtv_scan_geometry(const analogtv *it, int lineno, int slineno,
+                       unsigned signal_offset, analogtv_scan *scan)
+{
+  float bloomthisrow,shiftthisrow;
+  float viswidth,middle;
+  float scanwidth;
+  int scw;
+
+  bloomthisrow = -10.0f * it->crtload[lineno];
+  if (bloomthisrow<-10.0f) bloomthisrow=-10.0f;
+  if (bloomthisrow>2.0f) bloomthisrow=2.0f;
+  if (slineno<16) {
+    shiftthisrow=it->horiz_desync * (expf(-0.17f*slineno) *
+                                     (0.7f+cosf(slineno*0.6f)));
+  } else {
+    shiftthisrow=0.0f;
+  }
+
+  viswidth=ANALOGTV_PIC_LEN * 0.79f - 5.0f*bloomthisrow;
+  middle=ANALOGTV_PIC_LEN/2 - shiftthisrow;
+
+  scanwidth=it->width_control * puramp(it, 0.5f, 0.3f, 1.0f);
+
+  scw=it->subwidth*scanwidth;
+  if (scw>it->subwidth) scw=it->usewidth;
+  scan->scl=it->subwidth/2 - scw/2;
+  scan->scr=it->subwidth/2 + scw/2;
+
+  scan->pixrate=(int)((viswidth*65536.0f*1.0f)/it->subwidth)/scanwidth;
+  scan->scanstart_i=(int)((middle-viswidth*0.5f)*65536.0f);
+  scan->scanend_i=(ANALOGTV_PIC_LEN-1)*65536;
+  scan->squishright_i=(int)((middle+viswidth*(0.25f + 0.25f*puramp(it, 2.0f, 0.0f, 1.1f)
+                                              - it->squish_control)) *65536.0f);
+  scan->squishdiv=it->subwidth/15;
+
+  scan->pixbright=it->contrast_control * puramp(it, 1.0f, 0.0f, 1.0f)
+    / (0.5f+0.5f*it->puheight) * 1024.0f/100.0f;
+
+  scan->signal_offset=signal_offset;
+  scan->agclevel=it->agclevel;
+  scan->brightadd=it->brightness_control*100.0 - ANALOGTV_BLACK_LEVEL;
+
+  assert(scan->scanstart_i>=0);
+
+#ifdef DEBUG
+  if (0) printf("scan %d: %0.3f %0.3f %0.3f scl=%d scr=%d scw=%d\n",
+                lineno,
+                scan->scanstart_i/65536.0f,
+                scan->squishright_i/65536.0f,
+                scan->scanend_i/65536.0f,
+                scan->scl,scan->scr,scw);
+#endif
+}
+
+/* Converts a line of YIQ into RGB in raw_rgb[scl] to raw_rgb[scr]. Negative
+   values are left in unless 'clamp', so that noise can be added later. */
+static void
+analogtv_scan_rgb(analogtv_scan *scan, const struct analogtv_yiq_s *yiq,
+                  float *raw_rgb, int clamp)
+{
+  float *rgb_start=raw_rgb+scan->scl*3;
+  float *rgb_end=raw_rgb+scan->scr*3;
+  float pixbright=scan->pixbright;
+  int pixmultinc=scan->pixrate;
+  int i=scan->scanstart_i;
+  float *rrp=rgb_start;
+
+  while (i<0 && rrp!=rgb_end) {
+    rrp[0]=rrp[1]=rrp[2]=0;
+    i+=pixmultinc;
+    rrp+=3;
+  }
+  scan->x0=(rrp-raw_rgb)/3;
+  while (i<scan->scanend_i && rrp!=rgb_end) {
+    float pixfrac=(i&0xffff)/65536.0f;
+    float invpixfrac=1.0f-pixfrac;
+    int pati=i>>16;
+    float r,g,b;
+
+    float interpy=(yiq[pati].y*invpixfrac + yiq[pati+1].y*pixfrac);
+    float interpi=(yiq[pati].i*invpixfrac + yiq[pati+1].i*pixfrac);
+    float interpq=(yiq[pati].q*invpixfrac + yiq[pati+1].q*pixfrac);
+
+    /*
+      According to the NTSC spec, Y,I,Q are generated as:
+
+      y=0.30 r + 0.59 g + 0.11 b
+      i=0.60 r - 0.28 g - 0.32 b
+      q=0.21 r - 0.52 g + 0.31 b
+
+      So if you invert the implied 3x3 matrix you get what standard
+      televisions implement with a bunch of resistors (or directly in the
+      CRT -- don't ask):
+
+      r = y + 0.948 i + 0.624 q
+      g = y - 0.276 i - 0.639 q
+      b = y - 1.105 i + 1.729 q
+    */
+
+    r=(interpy + 0.948f*interpi + 0.624f*interpq) * pixbright;
+    g=(interpy - 0.276f*interpi - 0.639f*interpq) * pixbright;
+    b=(interpy - 1.105f*interpi + 1.729f*interpq) * pixbright;
+    if (clamp) {
+      if (r<0.0f) r=0.0f;
+      if (g<0.0f) g=0.0f;
+      if (b<0.0f) b=0.0f;
+    }
+    rrp[0]=r;
+    rrp[1]=g;
+    rrp[2]=b;
+
+    if (i>=scan->squishright_i) {
+      pixmultinc += pixmultinc/scan->squishdiv;
+      pixbright += pixbright/scan->squishdiv/2;
+    }
+    i+=pixmultinc;
+    rrp+=3;
+  }
+  scan->x1=(rrp-raw_rgb)/3;
+  while (rrp != rgb_end) {
+    rrp[0]=rrp[1]=rrp[2]=0.0f;
+    rrp+=3;
+  }
+}
+
+/* The colorburst wobbles by a percent or so with the noise: that much
+   difference in the color is invisible. */
+static int
+analogtv_chroma_matches(const float *a, const float *b)
+{
+  float tolerance=(fabsf(a[0]) + fabsf(a[1])) / 32;
+  return (fabsf(a[0] - b[0]) <= tolerance &&
+          fabsf(a[1] - b[1]) <= tolerance);
+}
+
+/* Whether a cached row was drawn near enough to the way this line would be
+   that nobody could tell. The bloom and the sync wander a little with the
+   noise, even when the picture is still. */
+static int
+analogtv_scan_matches(const analogtv_scan *a, const analogtv_scan *b)
+{
+  if (a->signal_offset != b->signal_offset ||
+      a->scl != b->scl || a->scr != b->scr ||
+      a->squishdiv != b->squishdiv ||
+      a->colormode != b->colormode ||
+      a->agclevel != b->agclevel ||
+      a->brightadd != b->brightadd)
+    return 0;
+
+  if (abs(a->scanstart_i - b->scanstart_i) > 4096 ||
+      abs(a->squishright_i - b->squishright_i) > 4096 ||
+      abs(a->pixrate - b->pixrate) > a->pixrate/4096 ||
+      fabsf(a->pixbright - b->pixbright) > a->pixbright/4096)
+    return 0;
+
+  if (a->colormode && !analogtv_chroma_matches(a->multiq2, b->multiq2))
+    return 0;
+
+  return 1;
+}
+
+/* Makes the row for a line from its input alone, without any noise. */
+static void
+analogtv_scan_clean(const analogtv *it, analogtv_scan *scan, float *rgb)
+{
+  float clean[ANALOGTV_PIC_LEN+16];
+  struct analogtv_yiq_s yiq[ANALOGTV_PIC_LEN+10];
+  int start=(scan->scanstart_i>>16)-10, end=(scan->scanend_i>>16)+10;
+  unsigned base=scan->signal_offset & ~3;
+
+  /* add_signal works 4 samples at a time, lined up with rx_signal. */
+  unsigned from=(scan->signal_offset+start) & ~3;
+  unsigned to=(scan->signal_offset+end+3) & ~3;
+  unsigned i;
+
+  memset(clean + (from-base), 0, (to-from)*sizeof(clean[0]));
+  for (i=0; i<it->rec_count; i++)
+    analogtv_add_signal(it, it->recs[i], clean + (from-base), from, to, 0);
+
+  analogtv_ntsc_to_yiq(it, scan->colormode, scan->multiq2,
+                       clean + (scan->signal_offset & 3), start, end, yiq);
+  analogtv_scan_rgb(scan, yiq, rgb, 0);
+}
+
+/* Keeps the cached row for a line up to date.  Returns whether the line can
+   be drawn from that, instead of from rx_signal. */
+static int
+analogtv_scan_cached(const analogtv *it, int lineno, const analogtv_scan *scan)
+{
+  analogtv_scan *cached=&it->scans[lineno-ANALOGTV_TOP];
+  float *rgb=it->scan_rgb + (lineno-ANALOGTV_TOP)*it->subwidth*3;
+  int line=scan->signal_offset / ANALOGTV_H;
+  unsigned int signature;
+
+  /* The line, and its ghosts, come from this line of rx_signal and the ones
+     on either side. */
+  signature=analogtv_mix_signature(
+    it->line_signature[(line+ANALOGTV_V-1) % ANALOGTV_V],
+    it->line_signature[line % ANALOGTV_V]);
+  signature=analogtv_mix_signature(signature,
+    it->line_signature[(line+1) % ANALOGTV_V]);
+  if (!signature) signature=1;
+
+  if (cached->signature == signature && analogtv_scan_matches(cached, scan)) {
+    /* Still good. */
+  }
+  else if (it->rx_reused ||
+           (cached->last_signature == signature &&
+            analogtv_scan_matches(cached, scan))) {
+    /* The same input twice in a row: it is probably going to stay. Or
+       rx_signal is stale, and there's no other way to draw the line. */
+    *cached=*scan;
+    analogtv_scan_clean(it, cached, rgb);
+    cached->signature=signature;
+  }
+  else {
+    /* Remember how it was drawn, to compare with next time. */
+    *cached=*scan;
+    cached->signature=0;
+  }
+
+  cached->last_signature=signature;
+  return cached->signature && it->noise_scans[cached->colormode].signature;
+}
+
+/* Draws a line from its cached row, with a row from the noise bank, shifted
+   over by a random amount, added on. */
+static void
+analogtv_scan_noise(const analogtv *it, int lineno, float *raw_rgb)
+{
+  const analogtv_scan *scan=&it->scans[lineno-ANALOGTV_TOP];
+  const float *rgb=it->scan_rgb + (lineno-ANALOGTV_TOP)*it->subwidth*3;
+  const float *noise;
+  unsigned int fastrnd=it->random0 ^ (lineno * 2654435761u);
+  unsigned w=it->subwidth, row, shift, j;
+  float level=it->noiselevel;  /* The noise goes as its square root, squared. */
+  int x;
+
+  FASTRND;
+  row=(fastrnd>>16) % ANALOGTV_NOISE_ROWS;
+  FASTRND;
+  shift=(fastrnd>>8) % w;
+  noise=it->noise_rgb + (scan->colormode*ANALOGTV_NOISE_ROWS + row)*w*3;
+
+  memcpy(raw_rgb + scan->scl*3, rgb + scan->scl*3,
+         (scan->scr - scan->scl)*3*sizeof(float));
+
+  j=scan->x0 + shift;
+  for (x=scan->x0; x<scan->x1; x++, j++) {
+    float *rrp=raw_rgb + x*3;
+    float r,g,b;
+
+    if (j>=w) j-=w;
+    r=rgb[x*3+0] + noise[j*3+0]*level;
+    g=rgb[x*3+1] + noise[j*3+1]*level;
+    b=rgb[x*3+2] + noise[j*3+2]*level;
+    rrp[0]=r<0.0f ? 0.0f : r;
+    rrp[1]=g<0.0f ? 0.0f : g;
+    rrp[2]=b<0.0f ? 0.0f : b;
+  }
+}
+
+/* Fills the noise bank for one colormode: rows of what analogtv_init_signal
+   adds at a noise level of 1, demodulated the way 'scan' would be. */
+static void
+analogtv_make_noise(const analogtv *it, const analogtv_scan *scan)
+{
+  analogtv_scan *bank=&it->noise_scans[scan->colormode];
+  float *rgb=it->noise_rgb + scan->colormode*ANALOGTV_NOISE_ROWS*it->subwidth*3;
+  float sig[ANALOGTV_PIC_LEN+10];
+  struct analogtv_yiq_s yiq[ANALOGTV_PIC_LEN+10];
+  float noisemul=sqrt(150.0)/(float)0x7fffffff;
+  unsigned int fastrnd=analogtv_random(it->rng);
+  unsigned int fastrnd_offset;
+  long reach;
+  float nm1,nm2;
+  int row, i;
+
+  /* ntsc_to_yiq can do at most ANALOGTV_PIC_LEN-32 samples. Skip the
+     filters' startup, and don't run off the end. */
+  *bank=*scan;
+  bank->scanstart_i=56*65536;
+  bank->scanend_i=(ANALOGTV_PIC_LEN+6)*65536;
+  bank->squishright_i=bank->scanend_i;
+  bank->scl=0;
+  bank->scr=it->subwidth;
+  reach=(long)(ANALOGTV_PIC_LEN-50)*65536;
+  if ((long)bank->pixrate*it->subwidth > reach)
+    bank->pixrate=reach/it->subwidth;
+
+  for (row=0; row<ANALOGTV_NOISE_ROWS; row++) {
+    fastrnd_offset = fastrnd - 0x7fffffff;
+    nm1 = (fastrnd_offset <= INT_MAX ? (int)fastrnd_offset : -1 - (int)(UINT_MAX - fastrnd_offset)) * noisemul;
+    for (i=0; i<ANALOGTV_PIC_LEN+10; i++) {
+      nm2=nm1;
+      fastrnd = (fastrnd*FASTRND_A+FASTRND_C) & 0xffffffffu;
+      fastrnd_offset = fastrnd - 0x7fffffff;
+      nm1 = (fastrnd_offset <= INT_MAX ? (int)fastrnd_offset : -1 - (int)(UINT_MAX - fastrnd_offset)) * noisemul;
+      sig[i]=nm1*nm2;
+    }
+
+    analogtv_ntsc_to_yiq(it, bank->colormode, bank->multiq2, sig,
+                         40, ANALOGTV_PIC_LEN+8, yiq);
+    for (i=40; i<ANALOGTV_PIC_LEN+8; i++)
+      yiq[i].y -= bank->brightadd;
+    analogtv_scan_rgb(bank, yiq, rgb + row*it->subwidth*3, 0);
+  }
+
+  bank->signature=1;
+}
+
+/* Remakes the noise banks if the picture settings they were made with have
+   changed, as during power-up. */
+static void
+analogtv_update_noise(const analogtv *it)
+{
+  int done[2]={0,0};
+  int lineno;
+
+  for (lineno=ANALOGTV_TOP; lineno<ANALOGTV_BOT; lineno++) {
+    int slineno, ytop, ybot;
+    unsigned signal_offset;
+    analogtv_scan scan;
+    const analogtv_scan *bank;
+
+    if (! analogtv_get_line(it, lineno, &slineno, &ytop, &ybot,
+        &signal_offset))
+      continue;
+
+    scan.colormode=analogtv_line_chroma(it, lineno, signal_offset&3,
+                                        scan.multiq2);
+    if (done[scan.colormode]) continue;
+    done[scan.colormode]=1;
+
+    analogtv_scan_geometry(it, lineno, slineno, signal_offset, &scan);
+    bank=&it->noise_scans[scan.colormode];
+    if (!bank->signature ||
+        bank->agclevel != scan.agclevel ||
+        fabsf(bank->pixbright - scan.pixbright) > bank->pixbright/64 ||
+        (scan.colormode &&
+         !analogtv_chroma_matches(bank->multiq2, scan.multiq2)))
+      analogtv_make_noise(it, &scan);
+
+    if (done[0] && done[1]) break;
+  }
+}
+
 static void analogtv_thread_draw_lines(void *thread_raw)
 {
   const analogtv_thread *thread = (analogtv_thread *)thread_raw;
@@ -1515,7 +2060,7 @@ static void analogtv_thread_draw_lines(void *thread_raw)
 
   for (lineno=ANALOGTV_TOP + thread->thread_id;
        lineno<ANALOGTV_BOT;
-       lineno += it->threads.count) {
+       lineno += it->threads->pool.count) {
     int i,j,x,y;
 
     int slineno, ytop, ybot;
@@ -1523,13 +2068,9 @@ static void analogtv_thread_draw_lines(void *thread_raw)
 
     const float *signal;
 
-    int scanstart_i,scanend_i,squishright_i,squishdiv,pixrate;
-    float *rgb_start, *rgb_end;
-    float pixbright;
+    analogtv_scan scan;
     int pixmultinc;
 
-    float *rrp;
-
     struct analogtv_yiq_s yiq[ANALOGTV_PIC_LEN+10];
 
     if (! analogtv_get_line(it, lineno, &slineno, &ytop, &ybot,
@@ -1538,54 +2079,9 @@ static void analogtv_thread_draw_lines(void *thread_raw)
 
     signal = it->rx_signal + signal_offset;
 
-    {
-
-      float bloomthisrow,shiftthisrow;
-      float viswidth,middle;
-      float scanwidth;
-      int scw,scl,scr;
-
-      bloomthisrow = -10.0f * it->crtload[lineno];
-      if (bloomthisrow<-10.0f) bloomthisrow=-10.0f;
-      if (bloomthisrow>2.0f) bloomthisrow=2.0f;
-      if (slineno<16) {
-        shiftthisrow=it->horiz_desync * (expf(-0.17f*slineno) *
-                                         (0.7f+cosf(slineno*0.6f)));
-      } else {
-        shiftthisrow=0.0f;
-      }
-
-      viswidth=ANALOGTV_PIC_LEN * 0.79f - 5.0f*bloomthisrow;
-      middle=ANALOGTV_PIC_LEN/2 - shiftthisrow;
-
-      scanwidth=it->width_control * puramp(it, 0.5f, 0.3f, 1.0f);
-
-      scw=it->subwidth*scanwidth;
-      if (scw>it->subwidth) scw=it->usewidth;
-      scl=it->subwidth/2 - scw/2;
-      scr=it->subwidth/2 + scw/2;
-
-      pixrate=(int)((viswidth*65536.0f*1.0f)/it->subwidth)/scanwidth;
-      scanstart_i=(int)((middle-viswidth*0.5f)*65536.0f);
-      scanend_i=(ANALOGTV_PIC_LEN-1)*65536;
-      squishright_i=(int)((middle+viswidth*(0.25f + 0.25f*puramp(it, 2.0f, 0.0f, 1.1f)
-                                            - it->squish_control)) *65536.0f);
-      squishdiv=it->subwidth/15;
-
-      rgb_start=raw_rgb_start+scl*3;
-      rgb_end=raw_rgb_start+scr*3;
-
-      assert(scanstart_i>=0);
-
-#ifdef DEBUG
-      if (0) printf("scan %d: %0.3f %0.3f %0.3f scl=%d scr=%d scw=%d\n",
-                    lineno,
-                    scanstart_i/65536.0f,
-                    squishright_i/65536.0f,
-                    scanend_i/65536.0f,
-                    scl,scr,scw);
-#endif
-    }
+    analogtv_scan_geometry(it, lineno, slineno, signal_offset, &scan);
+    scan.colormode=analogtv_line_chroma(it, lineno, signal_offset&3,
+                                        scan.multiq2);
 
     if (it->use_cmap) {
       for (y=ytop; y<ybot; y++) {
@@ -1595,19 +2091,20 @@ static void analogtv_thread_draw_lines(void *thread_raw)
           * puramp(it, 1.0f, 0.0f, 1.0f) / (0.5f+0.5f*it->puheight) * 0.070f;
         float levelmult_iq = levelmult * 0.090f;
 
-        analogtv_ntsc_to_yiq(it, lineno, signal,
-                             (scanstart_i>>16)-10, (scanend_i>>16)+10, yiq);
-        pixmultinc=pixrate;
+        analogtv_ntsc_to_yiq(it, scan.colormode, scan.multiq2, signal,
+                             (scan.scanstart_i>>16)-10,
+                             (scan.scanend_i>>16)+10, yiq);
+        pixmultinc=scan.pixrate;
 
         x=0;
-        i=scanstart_i;
+        i=scan.scanstart_i;
         while (i<0 && x<it->usewidth) {
           XPutPixel(it->image, x, y, it->colors[0]);
           i+=pixmultinc;
           x++;
         }
 
-        while (i<scanend_i && x<it->usewidth) {
+        while (i<scan.scanend_i && x<it->usewidth) {
           float pixfrac=(i&0xffff)/65536.0f;
           float invpixfrac=(1.0f-pixfrac);
           int pati=i>>16;
@@ -1646,8 +2143,8 @@ static void analogtv_thread_draw_lines(void *thread_raw)
                       it->colors[cmi]);
             x++;
           }
-          if (i >= squishright_i) {
-            pixmultinc += pixmultinc/squishdiv;
+          if (i >= scan.squishright_i) {
+            pixmultinc += pixmultinc/scan.squishdiv;
           }
           i+=pixmultinc;
         }
@@ -1658,64 +2155,13 @@ static void analogtv_thread_draw_lines(void *thread_raw)
       }
     }
     else {
-      analogtv_ntsc_to_yiq(it, lineno, signal,
-                           (scanstart_i>>16)-10, (scanend_i>>16)+10, yiq);
-
-      pixbright=it->contrast_control * puramp(it, 1.0f, 0.0f, 1.0f)
-        / (0.5f+0.5f*it->puheight) * 1024.0f/100.0f;
-      pixmultinc=pixrate;
-      i=scanstart_i; rrp=rgb_start;
-      while (i<0 && rrp!=rgb_end) {
-        rrp[0]=rrp[1]=rrp[2]=0;
-        i+=pixmultinc;
-        rrp+=3;
-      }
-      while (i<scanend_i && rrp!=rgb_end) {
-        float pixfrac=(i&0xffff)/65536.0f;
-        float invpixfrac=1.0f-pixfrac;
-        int pati=i>>16;
-        float r,g,b;
-
-        float interpy=(yiq[pati].y*invpixfrac + yiq[pati+1].y*pixfrac);
-        float interpi=(yiq[pati].i*invpixfrac + yiq[pati+1].i*pixfrac);
-        float interpq=(yiq[pati].q*invpixfrac + yiq[pati+1].q*pixfrac);
-
-        /*
-          According to the NTSC spec, Y,I,Q are generated as:
-
-          y=0.30 r + 0.59 g + 0.11 b
-          i=0.60 r - 0.28 g - 0.32 b
-          q=0.21 r - 0.52 g + 0.31 b
-
-          So if you invert the implied 3x3 matrix you get what standard
-          televisions implement with a bunch of resistors (or directly in the
-          CRT -- don't ask):
-
-          r = y + 0.948 i + 0.624 q
-          g = y - 0.276 i - 0.639 q
-          b = y - 1.105 i + 1.729 q
-        */
-
-        r=(interpy + 0.948f*interpi + 0.624f*interpq) * pixbright;
-        g=(interpy - 0.276f*interpi - 0.639f*interpq) * pixbright;
-        b=(interpy - 1.105f*interpi + 1.729f*interpq) * pixbright;
-        if (r<0.0f) r=0.0f;
-        if (g<0.0f) g=0.0f;
-        if (b<0.0f) b=0.0f;
-        rrp[0]=r;
-        rrp[1]=g;
-        rrp[2]=b;
-
-        if (i>=squishright_i) {
-          pixmultinc += pixmultinc/squishdiv;
-          pixbright += pixbright/squishdiv/2;
-        }
-        i+=pixmultinc;
-        rrp+=3;
-      }
-      while (rrp != rgb_end) {
-        rrp[0]=rrp[1]=rrp[2]=0.0f;
-        rrp+=3;
+      if (it->scans && analogtv_scan_cached(it, lineno, &scan)) {
+        analogtv_scan_noise(it, lineno, raw_rgb_start);
+      } else {
+        analogtv_ntsc_to_yiq(it, scan.colormode, scan.multiq2, signal,
+                             (scan.scanstart_i>>16)-10,
+                             (scan.scanend_i>>16)+10, yiq);
+        analogtv_scan_rgb(&scan, yiq, raw_rgb_start, 1);
       }
 
       analogtv_blast_imagerow(it, raw_rgb_start, raw_rgb_end,
@@ -1734,6 +2180,7 @@ analogtv_draw(analogtv *it, double noiselevel,
   /*  int bigloadchange,drawcount;*/
   double baseload;
   int overall_top, overall_bot;
+  int changed;
 
   /* AnalogTV isn't very interesting if there isn't enough RAM. */
   if (!it->image)
@@ -1758,28 +2205,46 @@ analogtv_draw(analogtv *it, double noiselevel,
   analogtv_setup_frame(it);
   analogtv_set_demod(it);
 
-  it->random0 = random();
-  it->random1 = random();
+  it->random0 = analogtv_random(it->rng);
+  it->random1 = analogtv_random(it->rng);
   it->noiselevel = noiselevel;
   it->recs = recs;
   it->rec_count = rec_count;
-  threadpool_run(&it->threads, analogtv_thread_add_signals);
-  threadpool_wait(&it->threads);
 
-  it->channel_change_cycles=0;
+  /* If none of the input has changed, the signal from last time is as good
+     as a new one: all that differs is the noise, and the lines drawn from
+     their cached rows get fresh noise anyway. */
+  changed = it->scans ? analogtv_update_signatures(it, recs, rec_count) : 1;
+  if (it->channel_change_cycles && it->scans) {
+    for (i=0; i<ANALOGTV_VISLINES; i++)
+      it->scans[i].signature = it->scans[i].last_signature = 0;
+  }
+  it->rx_reused = (it->scans && it->rx_valid && !changed &&
+                   noiselevel == it->rx_noiselevel);
 
-  /* rx_signal has an extra 2 lines at the end, where we copy the
-     first 2 lines so we can index into it while only worrying about
-     wraparound on a per-line level */
-  memcpy(&it->rx_signal[ANALOGTV_SIGNAL_LEN],
-         &it->rx_signal[0],
-         2*ANALOGTV_H*sizeof(it->rx_signal[0]));
+  if (!it->rx_reused) {
+    threadpool_run(&it->threads->pool, analogtv_thread_add_signals);
+    threadpool_wait(&it->threads->pool);
 
-  /* Repeat for signal_subtotals. */
+    /* Channel change noise shouldn't stick around. */
+    it->rx_valid = !it->channel_change_cycles;
+    it->rx_noiselevel = noiselevel;
 
-  memcpy(&it->signal_subtotals[ANALOGTV_SIGNAL_LEN / ANALOGTV_SUBTOTAL_LEN],
-         &it->signal_subtotals[0],
-         (2*ANALOGTV_H/ANALOGTV_SUBTOTAL_LEN)*sizeof(it->signal_subtotals[0]));
+    /* rx_signal has an extra 2 lines at the end, where we copy the
+       first 2 lines so we can index into it while only worrying about
+       wraparound on a per-line level */
+    memcpy(&it->rx_signal[ANALOGTV_SIGNAL_LEN],
+           &it->rx_signal[0],
+           2*ANALOGTV_H*sizeof(it->rx_signal[0]));
+
+    /* Repeat for signal_subtotals. */
+
+    memcpy(&it->signal_subtotals[ANALOGTV_SIGNAL_LEN / ANALOGTV_SUBTOTAL_LEN],
+           &it->signal_subtotals[0],
+           (2*ANALOGTV_H/ANALOGTV_SUBTOTAL_LEN)*sizeof(it->signal_subtotals[0]));
+  }
+
+  it->channel_change_cycles=0;
 
   analogtv_sync(it); /* Requires the add_signals be complete. */
 
@@ -1815,19 +2280,6 @@ analogtv_draw(analogtv *it, double noiselevel,
       it->shrinkpulse=-1;
     }
 
-#if 0
-    if (it->hashnoise_rpm>0.0 &&
-        !(bigloadchange ||
-          it->redraw_all ||
-          (slineno<20 && it->flutter_horiz_desync) ||
-          it->gaussiannoise_level>30 ||
-          ((it->gaussiannoise_level>2.0 ||
-            it->multipath) && random()%4) ||
-          linesig != it->onscreen_signature[lineno])) {
-      continue;
-    }
-    it->onscreen_signature[lineno] = linesig;
-#endif
     /*    drawcount++;*/
 
     /*
@@ -1901,8 +2353,11 @@ analogtv_draw(analogtv *it, double noiselevel,
     }
   }
 
-  threadpool_run(&it->threads, analogtv_thread_draw_lines);
-  threadpool_wait(&it->threads);
+  if (it->scans)
+    analogtv_update_noise(it);
+
+  threadpool_run(&it->threads->pool, analogtv_thread_draw_lines);
+  threadpool_wait(&it->threads->pool);
 
 #if 0
   /* poor attempt at visible retrace */
@@ -2171,24 +2626,30 @@ void analogtv_channel_noise(analogtv_input *it, analogtv_input *s2)
 
 void
 analogtv_reception_update(analogtv_reception *rec)
+{
+  analogtv_reception_update_r(rec, NULL);
+}
+
+void
+analogtv_reception_update_r(analogtv_reception *rec, ya_rand_state *rng)
 {
   int i;
 
   if (rec->multipath > 0.0) {
     for (i=0; i<ANALOGTV_GHOSTFIR_LEN; i++) {
       rec->ghostfir2[i] +=
-        -(rec->ghostfir2[i]/16.0) + rec->multipath * (frand(0.02)-0.01);
+        -(rec->ghostfir2[i]/16.0) + rec->multipath * (analogtv_frand(rng, 0.02)-0.01);
     }
-    if (random()%20==0) {
-      rec->ghostfir2[random()%(ANALOGTV_GHOSTFIR_LEN)]
-        = rec->multipath * (frand(0.08)-0.04);
+    if (analogtv_random(rng)%20==0) {
+      rec->ghostfir2[analogtv_random(rng)%(ANALOGTV_GHOSTFIR_LEN)]
+        = rec->multipath * (analogtv_frand(rng, 0.08)-0.04);
     }
     for (i=0; i<ANALOGTV_GHOSTFIR_LEN; i++) {
       rec->ghostfir[i] = 0.8*rec->ghostfir[i] + 0.2*rec->ghostfir2[i];
     }
 
     if (0) {
-      rec->hfloss2 += -(rec->hfloss2/16.0) + rec->multipath * (frand(0.08)-0.04);
+      rec->hfloss2 += -(rec->hfloss2/16.0) + rec->multipath * (analogtv_frand(rng, 0.08)-0.04);
       rec->hfloss = 0.5*rec->hfloss + 0.5*rec->hfloss2;
     }
 
@@ -14,6 +14,7 @@
 
 #include "thread_util.h"
 #include "xshm.h"
+#include "yarandom.h"
 
 #if defined(HAVE_IPHONE) || defined(HAVE_ANDROID)
 # define HAVE_MOBILE
@@ -135,11 +136,21 @@ typedef struct analogtv_s {
   Screen *screen;
   XWindowAttributes xgwa;
 
-  struct threadpool threads;
+  struct analogtv_threads *threads;	/* swapped by analogtv_set_threads */
 
-#if 0
-  unsigned int onscreen_signature[ANALOGTV_V];
-#endif
+  /* If set, the noise and drift come from this rather than random(), so
+     that TVs on different threads don't share a generator. */
+  ya_rand_state *rng;
+
+  /* Lines of the picture whose input hasn't changed are demodulated once,
+     and fresh noise is laid over them on each frame.  See analogtv_draw. */
+  unsigned int line_signature[ANALOGTV_V];
+  struct analogtv_scan_s *scans;	/* ANALOGTV_VISLINES of them */
+  float *scan_rgb;			/* subwidth*3 floats for each */
+  struct analogtv_scan_s *noise_scans;	/* without color, and with */
+  float *noise_rgb;			/* ANALOGTV_NOISE_ROWS rows of each */
+  double rx_noiselevel;			/* what rx_signal was made with */
+  int rx_valid, rx_reused;
 
   int n_colors;
 
@@ -254,6 +265,13 @@ void analogtv_reconfigure(analogtv *it);
 
 void analogtv_set_defaults(analogtv *it, char *prefix);
 void analogtv_release(analogtv *it);
+
+/* Splits each frame across this many threads, instead of one per CPU, as
+   when several TVs are being run at once.  If that many can't be had, it
+   makes do with one.  Returns an errno if not even that, and then the
+   threads it had are left as they were. */
+int analogtv_set_threads(analogtv *it, unsigned count);
+
 int analogtv_set_demod(analogtv *it);
 void analogtv_setup_frame(analogtv *it);
 void analogtv_setup_sync(analogtv_input *input, int do_cb, int do_ssavi);
@@ -265,6 +283,8 @@ int analogtv_load_ximage(analogtv *it, analogtv_input *input,
                          int xoff, int yoff, int width, int height);
 
 void analogtv_reception_update(analogtv_reception *inp);
+/* The same, drawing from rng instead of random() if it isn't NULL. */
+void analogtv_reception_update_r(analogtv_reception *inp, ya_rand_state *rng);
 
 void analogtv_setup_teletext(analogtv_input *input);
 
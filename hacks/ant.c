@@ -73,6 +73,7 @@ static const char sccsid[] = "@(#)ant.c	5.00 2000/11/01 xlockmore";
 # include "xlock.h"		/* in xlockmore distribution */
 #endif /* STANDALONE */
 #include "automata.h"
+#include "xbatch.h"
 
 #ifdef MODE_ant
 
@@ -179,6 +180,7 @@ typedef struct {
 	GC          stippledGC;
 # endif /* DO_STIPPLE */
 	Pixmap      pixmaps[NUMSTIPPLES - 1];
+	xbatch     *batch;
 	union {
 		XPoint      hexagon[7];		/* Need more than 6 for truchet */
 		XPoint      triangle[2][4];	/* Need more than 3 for truchet */
@@ -478,7 +480,7 @@ position_of_neighbor(antfarmstruct * ap, int dir, int *pcol, int *prow)
 }
 
 static void
-fillcell(ModeInfo * mi, GC gc, int col, int row)
+fillcell(ModeInfo * mi, int col, int row)
 {
 	antfarmstruct *ap = &antfarms[MI_SCREEN(mi)];
 
@@ -488,13 +490,13 @@ fillcell(ModeInfo * mi, GC gc, int col, int row)
 		ap->shape.hexagon[0].x = ap->xb + ccol * ap->xs;
 		ap->shape.hexagon[0].y = ap->yb + crow * ap->ys;
 		if (ap->xs == 1 && ap->ys == 1)
-			XDrawPoint(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_point(ap->batch,
 			ap->shape.hexagon[0].x, ap->shape.hexagon[0].y);
 		else
-			XFillPolygon(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_fill_polygon(ap->batch,
 			    ap->shape.hexagon, 6, Convex, CoordModePrevious);
 	} else if (ap->neighbors == 4 || ap->neighbors == 8) {
-		XFillRectangle(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+		xbatch_fill_rectangle(ap->batch,
 		ap->xb + ap->xs * col, ap->yb + ap->ys * row,
 	 	ap->xs - (ap->xs > 3), ap->ys - (ap->ys > 3));
 	} else {		/* TRI */
@@ -503,7 +505,7 @@ fillcell(ModeInfo * mi, GC gc, int col, int row)
 		ap->shape.triangle[orient][0].x = ap->xb + col * ap->xs;
 		ap->shape.triangle[orient][0].y = ap->yb + row * ap->ys;
 		if (ap->xs <= 3 || ap->ys <= 3)
-			XDrawPoint(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_point(ap->batch,
 			((orient) ? -1 : 1) + ap->shape.triangle[orient][0].x,
 				       ap->shape.triangle[orient][0].y);
 		else {
@@ -511,7 +513,7 @@ fillcell(ModeInfo * mi, GC gc, int col, int row)
 				ap->shape.triangle[orient][0].x += (ap->xs / 2 - 1);
 			else
 				ap->shape.triangle[orient][0].x -= (ap->xs / 2 - 1);
-			XFillPolygon(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_fill_polygon(ap->batch,
 				     ap->shape.triangle[orient], 3, Convex, CoordModePrevious);
 		}
 	}
@@ -637,27 +639,27 @@ static void
 drawcell(ModeInfo * mi, int col, int row, unsigned char color)
 {
 	antfarmstruct *ap = &antfarms[MI_SCREEN(mi)];
-	GC          gc;
 
 	if (!color) {
-		XSetForeground(MI_DISPLAY(mi), MI_GC(mi), MI_BLACK_PIXEL(mi));
-		gc = MI_GC(mi);
+		xbatch_set_foreground(ap->batch, MI_GC(mi), MI_BLACK_PIXEL(mi));
 # ifdef DO_STIPPLE
 	} else if (MI_NPIXELS(mi) <= 2) {
 		XGCValues   gcv;
+
+		/* Cells already batched need the old stipple. */
+		xbatch_flush(ap->batch);
 		gcv.foreground = MI_WHITE_PIXEL(mi);
 		gcv.background = MI_BLACK_PIXEL(mi);
         gcv.stipple = ap->pixmaps[color - 1];
 		XChangeGC(MI_DISPLAY(mi), ap->stippledGC,
 			  GCStipple | GCForeground | GCBackground, &gcv);
-		gc = ap->stippledGC;
+		xbatch_set_gc(ap->batch, ap->stippledGC);
 # endif /* !DO_STIPPLE */
 	} else {
-		XSetForeground(MI_DISPLAY(mi), MI_GC(mi),
+		xbatch_set_foreground(ap->batch, MI_GC(mi),
 			       MI_PIXEL(mi, ap->colors[color - 1]));
-		gc = MI_GC(mi);
 	}
-	fillcell(mi, gc, col, row);
+	fillcell(mi, col, row);
 }
 
 static void
@@ -666,6 +668,8 @@ drawtruchet(ModeInfo * mi, int col, int row,
 {
 	antfarmstruct *ap = &antfarms[MI_SCREEN(mi)];
 
+	/* The arcs go on top of the cell. */
+	xbatch_flush(ap->batch);
 	if (!color)
 		XSetForeground(MI_DISPLAY(mi), MI_GC(mi), MI_WHITE_PIXEL(mi));
 	else if (MI_NPIXELS(mi) > 2 || color > ap->ncolors / 2)
@@ -682,9 +686,11 @@ draw_anant(ModeInfo * mi, int direction, int col, int row)
 	Display    *display = MI_DISPLAY(mi);
 	Window      window = MI_WINDOW(mi);
 
-	XSetForeground(display, MI_GC(mi), MI_WHITE_PIXEL(mi));
-	fillcell(mi, MI_GC(mi), col, row);
+	xbatch_set_foreground(ap->batch, MI_GC(mi), MI_WHITE_PIXEL(mi));
+	fillcell(mi, col, row);
 	if (ap->eyes) {		/* Draw Eyes */
+		/* The eyes go on top of the body. */
+		xbatch_flush(ap->batch);
 		XSetForeground(display, MI_GC(mi), MI_BLACK_PIXEL(mi));
 		if (ap->neighbors == 6) {
 			int         ccol = 2 * col + !(row & 1), crow = 2 * row;
@@ -989,6 +995,10 @@ free_ant(ModeInfo * mi)
 		XFreePixmap(display, ap->pixmaps[shade]);
 	}
 	ap->init_bits = 0;
+	if (ap->batch != NULL) {
+		xbatch_free(ap->batch);
+		ap->batch = (xbatch *) NULL;
+	}
 	if (ap->tape != NULL) {
 		(void) free((void *) ap->tape);
 		ap->tape = (unsigned char *) NULL;
@@ -1021,6 +1031,11 @@ init_ant(ModeInfo * mi)
 	ap = &antfarms[MI_SCREEN(mi)];
 
 	ap->redrawing = 0;
+	if (ap->batch == NULL &&
+	    (ap->batch = xbatch_new(display, MI_WINDOW(mi))) == NULL) {
+		free_ant(mi);
+		return;
+	}
 #ifdef DO_STIPPLE
 	if (MI_NPIXELS(mi) <= 2) {
           Window      window = MI_WINDOW(mi);
@@ -1306,6 +1321,7 @@ draw_ant(ModeInfo * mi)
 		draw_anant(mi, anant->direction, anant->col, anant->row);
 	}
 	if (++ap->generation > MI_CYCLES(mi)) {
+		xbatch_flush(ap->batch);
 		init_ant(mi);
 	}
 	if (ap->redrawing) {
@@ -1325,6 +1341,7 @@ draw_ant(ModeInfo * mi)
 			}
 		}
 	}
+	xbatch_flush(ap->batch);
 }
 
 #ifndef STANDALONE
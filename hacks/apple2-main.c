@@ -1883,6 +1883,9 @@ apple2_event (Display *dpy, Window window, void *closure, XEvent *event)
 {
   struct state *st = (struct state *) closure;
 
+  if (st->sim && event->xany.type == Expose)
+    st->sim->redraw = 1;
+
   if (st->sim &&
       st->controller == terminal_controller &&
       event->xany.type == KeyPress) {
@@ -554,6 +554,25 @@ a2_make_font(apple2_sim_t *sim)
 
 #endif /* 0 */
 
+static void
+a2_make_text_dots(apple2_sim_t *sim)
+{
+  int rev, c, y, i;
+  for (rev=0; rev<2; rev++) {
+    for (c=0; c<64; c++) {
+      for (y=0; y<8; y++) {
+        for (i=0; i<7; i++) {
+          unsigned long pix=XGetPixel(sim->text_im, (c^0x20)*7+i, y);
+          sim->text_dots[rev][c][y][i*2] =
+            sim->text_dots[rev][c][y][i*2+1] = ((pix^rev)
+                                                ?ANALOGTV_WHITE_LEVEL
+                                                :ANALOGTV_BLACK_LEVEL);
+        }
+      }
+    }
+  }
+}
+
 apple2_sim_t *
 apple2_start(Display *dpy, Window window, int delay,
              void (*controller)(apple2_sim_t *sim,
@@ -591,6 +610,8 @@ apple2_start(Display *dpy, Window window, int delay,
 
 
   a2_make_font(sim);
+  a2_make_text_dots(sim);
+  sim->shown_cb=-1;
 
   sim->stepno=0;
   a2_goto(sim->st,23,0);
@@ -611,12 +632,134 @@ apple2_start(Display *dpy, Window window, int delay,
   return sim;
 }
 
+/* How often to run the TV when nothing on the screen has changed. */
+#define A2_IDLE_REFRESH 1.0
+
+/* Draws one scan line into sim->inp, if it is not already what's there.
+   Returns whether it changed. */
+static int
+a2_update_line(apple2_sim_t *sim, int row)
+{
+  apple2_state_t *st=sim->st;
+  int textrow=row/8;
+  int col, i;
+  signed char *pp;
+  unsigned char mode, blink=0;
+  const unsigned char *bytes;
+
+  if ((st->gr_mode&A2_GR_HIRES) && (row<160 || (st->gr_mode&A2_GR_FULL))) {
+    mode=A2_GR_HIRES;
+    bytes=st->hireslines[row];
+  }
+  else if ((st->gr_mode&A2_GR_LORES) &&
+           (row<160 || (st->gr_mode&A2_GR_FULL))) {
+    mode=A2_GR_LORES;
+    bytes=st->textlines[textrow];
+  }
+  else {
+    mode=A2_GR_FULL;  /* text */
+    bytes=st->textlines[textrow];
+    /* The blink phase only matters to lines with blinking characters. */
+    for (col=0; col<40; col++) {
+      if ((bytes[col] & 0xc0) == 0x40) {
+        blink=1+st->blink;
+        break;
+      }
+    }
+  }
+
+  if (sim->shown[row].mode == mode &&
+      sim->shown[row].blink == blink &&
+      !memcmp(sim->shown[row].bytes, bytes, 40))
+    return 0;
+  sim->shown[row].mode=mode;
+  sim->shown[row].blink=blink;
+  memcpy(sim->shown[row].bytes, bytes, 40);
+
+  /* First we generate the pattern that the video circuitry shifts out
+     of memory. It has a 14.something MHz dot clock, equal to 4 times
+     the color burst frequency. So each group of 4 bits defines a color.
+     Each character position, or byte in hires, defines 14 dots, so odd
+     and even bytes have different color spaces. So, pattern[0..600]
+     gets the dots for one scan line. */
+
+  pp=&sim->inp->signal[row+ANALOGTV_TOP+4][ANALOGTV_PIC_START+100];
+
+  /* Put back what analogtv_setup_sync left there. */
+  memset(pp-1, ANALOGTV_BLACK_LEVEL, 40*14+2);
+
+  if (mode==A2_GR_HIRES) {
+
+    /* Emulate the mysterious pink line, due to a bit getting
+       stuck in a shift register between the end of the last
+       row and the beginning of this one. */
+    if ((bytes[0] & 0x80) && (bytes[39]&0x40)) {
+      pp[-1]=ANALOGTV_WHITE_LEVEL;
+    }
+
+    for (col=0; col<40; col++) {
+      unsigned char b=bytes[col];
+      int shift=(b&0x80)?0:1;
+
+      /* Each of the low 7 bits in hires mode corresponded to 2 dot
+         clocks, shifted by one if the high bit was set. */
+      for (i=0; i<7; i++) {
+        pp[shift+1] = pp[shift] = (((b>>i)&1)
+                                   ?ANALOGTV_WHITE_LEVEL
+                                   :ANALOGTV_BLACK_LEVEL);
+        pp+=2;
+      }
+    }
+  }
+  else if (mode==A2_GR_LORES) {
+    for (col=0; col<40; col++) {
+      unsigned char nib=((bytes[col] >> (((row/4)&1)*4)) & 0xf);
+      /* The low or high nybble was shifted out one bit at a time. */
+      for (i=0; i<14; i++) {
+        *pp = (((nib>>((col*14+i)&3))&1)
+               ?ANALOGTV_WHITE_LEVEL
+               :ANALOGTV_BLACK_LEVEL);
+        pp++;
+      }
+    }
+  }
+  else {
+    for (col=0; col<40; col++) {
+      int rev;
+      int c=bytes[col];
+      /* hi bits control inverse/blink as follows:
+         0x00: inverse
+         0x40: blink
+         0x80: normal
+         0xc0: normal */
+      rev=!(c&0x80) && (!(c&0x40) || st->blink);
+      memcpy(pp+1, sim->text_dots[rev][c&0x3f][row%8], 14);
+      pp+=14;
+    }
+  }
+
+  return 1;
+}
+
+/* Whether running the TV again on the same input would look the same,
+   but for the noise: the power-up ramps in analogtv.c are all at full
+   strength 8 time constants after they start, the last at 6+8*3
+   seconds, nothing is fluttering, and there is no hash noise. */
+static int
+a2_tv_steady(apple2_sim_t *sim)
+{
+  return (sim->dec->powerup >= 30.0 &&
+          !sim->dec->flutter_horiz_desync &&
+          !sim->dec->hashnoise_on &&
+          sim->reception.multipath <= 0.0);
+}
+
 int
 apple2_one_frame (apple2_sim_t *sim)
 {
     double blinkphase;
     int i;
-    int textrow;
+    int row, changed;
 
     if (sim->stepno==A2CONTROLLER_DONE)
       goto DONE;  /* when caller says we're done, be done, dammit! */
@@ -746,94 +889,31 @@ apple2_one_frame (apple2_sim_t *sim)
     }
 
 
-    analogtv_setup_sync(sim->inp, sim->st->gr_mode? 1 : 0, 0);
-    analogtv_setup_frame(sim->dec);
-
-    for (textrow=0; textrow<24; textrow++) {
-      int row;
-      for (row=textrow*8; row<textrow*8+8; row++) {
-
-        /* First we generate the pattern that the video circuitry shifts out
-           of memory. It has a 14.something MHz dot clock, equal to 4 times
-           the color burst frequency. So each group of 4 bits defines a color.
-           Each character position, or byte in hires, defines 14 dots, so odd
-           and even bytes have different color spaces. So, pattern[0..600]
-           gets the dots for one scan line. */
-
-        signed char *pp=&sim->inp->signal[row+ANALOGTV_TOP+4][ANALOGTV_PIC_START+100];
-
-        if ((sim->st->gr_mode&A2_GR_HIRES) &&
-            (row<160 || (sim->st->gr_mode&A2_GR_FULL))) {
-          int col;
+    if (sim->shown_cb != (sim->st->gr_mode ? 1 : 0)) {
+      /* This blanks the whole picture, so every line must be drawn again. */
+      sim->shown_cb = sim->st->gr_mode ? 1 : 0;
+      analogtv_setup_sync(sim->inp, sim->shown_cb, 0);
+      memset(sim->shown, 0, sizeof(sim->shown));
+    }
 
-          /* Emulate the mysterious pink line, due to a bit getting
-             stuck in a shift register between the end of the last
-             row and the beginning of this one. */
-          if ((sim->st->hireslines[row][0] & 0x80) &&
-              (sim->st->hireslines[row][39]&0x40)) {
-            pp[-1]=ANALOGTV_WHITE_LEVEL;
-          }
+    changed=0;
+    for (row=0; row<192; row++) {
+      if (a2_update_line(sim, row))
+        changed=1;
+    }
 
-          for (col=0; col<40; col++) {
-            unsigned char b=sim->st->hireslines[row][col];
-            int shift=(b&0x80)?0:1;
-
-            /* Each of the low 7 bits in hires mode corresponded to 2 dot
-               clocks, shifted by one if the high bit was set. */
-            for (i=0; i<7; i++) {
-              pp[shift+1] = pp[shift] = (((b>>i)&1)
-                                         ?ANALOGTV_WHITE_LEVEL
-                                         :ANALOGTV_BLACK_LEVEL);
-              pp+=2;
-            }
-          }
-        }
-        else if ((sim->st->gr_mode&A2_GR_LORES) &&
-                 (row<160 || (sim->st->gr_mode&A2_GR_FULL))) {
-          int col;
-          for (col=0; col<40; col++) {
-            unsigned char nib=((sim->st->textlines[textrow][col] >> (((row/4)&1)*4))
-                        & 0xf);
-            /* The low or high nybble was shifted out one bit at a time. */
-            for (i=0; i<14; i++) {
-              *pp = (((nib>>((col*14+i)&3))&1)
-                     ?ANALOGTV_WHITE_LEVEL
-                     :ANALOGTV_BLACK_LEVEL);
-              pp++;
-            }
-          }
-        }
-        else {
-          int col;
-          for (col=0; col<40; col++) {
-            int rev;
-            int c=sim->st->textlines[textrow][col]&0xff;
-            /* hi bits control inverse/blink as follows:
-               0x00: inverse
-               0x40: blink
-               0x80: normal
-               0xc0: normal */
-            rev=!(c&0x80) && (!(c&0x40) || sim->st->blink);
-
-            for (i=0; i<7; i++) {
-              unsigned long pix=XGetPixel(sim->text_im,
-                                          ((c&0x3f)^0x20)*7+i,
-                                          row%8);
-              pp[1] = pp[2] = ((pix^rev)
-                               ?ANALOGTV_WHITE_LEVEL
-                               :ANALOGTV_BLACK_LEVEL);
-              pp+=2;
-            }
-          }
-        }
+    if (changed || !a2_tv_steady(sim) || sim->dec->need_clear ||
+        sim->redraw || sim->curtime >= sim->shown_time + A2_IDLE_REFRESH) {
+      analogtv_setup_frame(sim->dec);
+      analogtv_reception_update(&sim->reception);
+      {
+        const analogtv_reception *rec = &sim->reception;
+        analogtv_draw(sim->dec, 0.02, &rec, 1);
       }
+      sim->shown_time=sim->curtime;
+      sim->redraw=0;
     }
-    analogtv_reception_update(&sim->reception);
-    {
-      const analogtv_reception *rec = &sim->reception;
-      analogtv_draw(sim->dec, 0.02, &rec, 1);
-    }
- 
+
     return 1;
 }
 
@@ -58,6 +58,22 @@ struct apple2_sim_s {
   XWindowAttributes xgwa;
   XImage *text_im;
 
+  /* The dots that the video circuitry shifts out for each row of each
+     character of text_im, normal and inverse. */
+  signed char text_dots[2][64][8][14];
+
+  /* What each scan line of inp was last drawn from.  Lines that still
+     match are left alone, and when none have changed the TV is only run
+     now and then, to keep the noise alive. */
+  struct {
+    unsigned char mode;
+    unsigned char blink;
+    unsigned char bytes[40];
+  } shown[192];
+  int shown_cb;
+  double shown_time;
+  int redraw;   /* set on Expose, to run the TV even if nothing changed */
+
   struct timeval basetime_tv;
   double curtime;
   double delay;
@@ -106,6 +106,32 @@ typedef struct {
   Bit16 value;
 } Pointer;
 
+/* The fast core runs each instruction through a handler made for its
+   opcode and address mode, with the parameter already read.  Every
+   address that has been run from remembers its handler, and a store to
+   memory forgets the three instructions that could contain that byte, so
+   code that changes itself still works. */
+typedef void (*FastFunc) (machine_6502 *, Bit16 operand);
+
+typedef struct {
+  FastFunc func;   /* NULL if not decoded yet */
+  Bit16 operand;
+  Bit16 next;      /* the address of the following instruction */
+} Decoded;
+
+enum {
+  DISPLAY_START = 0x200,
+  DISPLAY_END = 0x600
+};
+
+struct m6502_Program {
+  FastFunc handlers[0x100];     /* by opcode */
+  Decoded decoded[MEM_64K];     /* by address */
+  Bit8 codePages[0x100];        /* pages that have had code decoded */
+  /* Display bytes stored since they were last plotted, one bit apiece. */
+  Bit8 dirty[(DISPLAY_END - DISPLAY_START) / 8];
+};
+
 
 /*static void *emalloc(size_t n) {
   void *p = malloc(n);
@@ -137,8 +163,11 @@ static void checkAddress(Bit32 address){
  *
  */
 
+static void forgetDecoded(machine_6502 *machine, Bit16 addr);
+
 static void stackPush(machine_6502 *machine, Bit8 value ) {
   if(machine->regSP >= STACK_BOTTOM){
+    forgetDecoded(machine, machine->regSP);
     machine->memory[machine->regSP--] = value;
   }
   else{
@@ -226,14 +255,49 @@ static void updateDisplayPixel(machine_6502 *machine, Bit16 addr){
 }
 
 /*
- * memStoreByte() - Poke a byte, don't touch any registers
+ * forgetDecoded() - Forget any instruction that contains this byte
+ *
+ */
+
+static void forgetDecoded(machine_6502 *machine, Bit16 addr) {
+  Decoded *decoded = machine->program->decoded;
+  if (! machine->program->codePages[addr >> 8])
+    return;
+  decoded[addr].func = NULL;
+  decoded[(Bit16) (addr - 1)].func = NULL;
+  decoded[(Bit16) (addr - 2)].func = NULL;
+}
+
+/*
+ * flushDisplay() - Plot the display bytes stored since last time
+ *
+ */
+
+static void flushDisplay(machine_6502 *machine) {
+  Bit8 *dirty = machine->program->dirty;
+  int i, b;
+  for (i = 0; i < (DISPLAY_END - DISPLAY_START) / 8; i++)
+    if (dirty[i]) {
+      for (b = 0; b < 8; b++)
+        if (dirty[i] & (1 << b))
+          updateDisplayPixel(machine, DISPLAY_START + i * 8 + b);
+      dirty[i] = 0;
+    }
+}
+
+/*
+ * memStoreByte() - Poke a byte, don't touch any registers.
+ *                  Display bytes are plotted by flushDisplay().
  *
  */
 
 static void memStoreByte( machine_6502 *machine, int addr, int value ) {
   machine->memory[ addr ] = (value & 0xff);
-  if( (addr >= 0x200) && (addr<=0x5ff) )
-    updateDisplayPixel(machine, addr );
+  forgetDecoded(machine, addr);
+  if( (addr >= DISPLAY_START) && (addr < DISPLAY_END) ) {
+    int i = addr - DISPLAY_START;
+    machine->program->dirty[i >> 3] |= 1 << (i & 7);
+  }
 }
 
 
@@ -468,11 +532,9 @@ static void warnValue(BOOL isValue){
   }
 }
 
-static void jmpADC(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
+static void opADC(machine_6502 *machine, BOOL isValue, Pointer ptr){
   Bit16 tmp;
   Bit8 c = bitOn(machine->regP, CARRY_FL);
-  BOOL isValue = getValue(machine, adm, &ptr);
 
   warnValue(isValue);
   
@@ -519,17 +581,13 @@ static void jmpADC(machine_6502 *machine, m6502_AddrMode adm){
   manZeroNeg(machine,machine->regA);
 }
 
-static void jmpAND(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opAND(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regA &= ptr.value;
   manZeroNeg(machine,machine->regA);
 }
 
-static void jmpASL(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opASL(machine_6502 *machine, BOOL isValue, Pointer ptr){
   if (isValue){
       machine->regP = setBit(machine->regP, CARRY_FL, bitOn(ptr.value, NEGATIVE_FL));
       ptr.value = ptr.value << 1;
@@ -546,9 +604,7 @@ static void jmpASL(machine_6502 *machine, m6502_AddrMode adm){
   
 }
 
-static void jmpBIT(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBIT(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regP = setBit(machine->regP, ZERO_FL, !(ptr.value & machine->regA));
   machine->regP = setBit(machine->regP, OVERFLOW_FL, bitOn(ptr.value, OVERFLOW_FL));
@@ -563,67 +619,51 @@ static void jumpBranch(machine_6502 *machine, Bit16 offset){
     machine->regPC = machine->regPC + offset;
 }
 
-static void jmpBPL(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBPL(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOff(machine->regP,NEGATIVE_FL))
     jumpBranch(machine, ptr.addr);
     
 }
 
-static void jmpBMI(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBMI(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOn(machine->regP,NEGATIVE_FL))
     jumpBranch(machine, ptr.addr);
 
 }
 
-static void jmpBVC(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBVC(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOff(machine->regP,OVERFLOW_FL))
     jumpBranch(machine, ptr.addr);
 }
 
-static void jmpBVS(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBVS(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOn(machine->regP,OVERFLOW_FL))
     jumpBranch(machine, ptr.addr);
 }
 
-static void jmpBCC(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBCC(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOff(machine->regP,CARRY_FL))
     jumpBranch(machine, ptr.addr);
 }
 
-static void jmpBCS(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBCS(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOn(machine->regP,CARRY_FL))
     jumpBranch(machine, ptr.addr);
 }
 
-static void jmpBNE(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBNE(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOff(machine->regP, ZERO_FL))
     jumpBranch(machine, ptr.addr);
 }
 
-static void jmpBEQ(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opBEQ(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (bitOn(machine->regP, ZERO_FL))
     jumpBranch(machine, ptr.addr);
@@ -634,30 +674,22 @@ static void doCompare(machine_6502 *machine, Bit16 reg, Pointer *ptr){
   manZeroNeg(machine,(reg - ptr->value));
 }
 
-static void jmpCMP(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opCMP(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   doCompare(machine,machine->regA,&ptr);
 }
 
-static void jmpCPX(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opCPX(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   doCompare(machine,machine->regX,&ptr);
 }
 
-static void jmpCPY(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opCPY(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   doCompare(machine,machine->regY,&ptr);
 }
 
-static void jmpDEC(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opDEC(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   if (ptr.value > 0)
     ptr.value--;
@@ -667,9 +699,7 @@ static void jmpDEC(machine_6502 *machine, m6502_AddrMode adm){
   manZeroNeg(machine,ptr.value);
 }
 
-static void jmpEOR(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opEOR(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regA ^= ptr.value;
   manZeroNeg(machine, machine->regA);
@@ -703,61 +733,47 @@ static void jmpSED(machine_6502 *machine, m6502_AddrMode adm){
   machine->regP = setBit(machine->regP, DECIMAL_FL, 1);
 }
 
-static void jmpINC(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opINC(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   ptr.value = (ptr.value + 1) & 0xFF;
   memStoreByte(machine, ptr.addr, ptr.value);
   manZeroNeg(machine,ptr.value);
 }
 
-static void jmpJMP(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opJMP(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regPC = ptr.addr;
 }
 
-static void jmpJSR(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  /* Move past the 2 byte parameter. JSR is always followed by
-     absolute address. */
-  Bit16 currAddr = machine->regPC + 2;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opJSR(machine_6502 *machine, BOOL isValue, Pointer ptr){
+  /* The 2 byte parameter has been read, so the PC is already past it.
+     JSR is always followed by absolute address. */
+  Bit16 currAddr = machine->regPC;
   warnValue(isValue);
   stackPush(machine, (currAddr >> 8) & 0xff);
   stackPush(machine, currAddr & 0xff);
   machine->regPC = ptr.addr;  
 }
 
-static void jmpLDA(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opLDA(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regA = ptr.value;
   manZeroNeg(machine, machine->regA);
 }
 
-static void jmpLDX(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opLDX(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regX = ptr.value;
   manZeroNeg(machine, machine->regX);
 }
 
-static void jmpLDY(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opLDY(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regY = ptr.value;
   manZeroNeg(machine, machine->regY);
 }
 
-static void jmpLSR(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opLSR(machine_6502 *machine, BOOL isValue, Pointer ptr){
   if (isValue){
     machine->regP = 
       setBit(machine->regP, CARRY_FL, 
@@ -781,9 +797,7 @@ static void jmpNOP(machine_6502 *machine, m6502_AddrMode adm){
   /* no operation */
 }
 
-static void jmpORA(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opORA(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   machine->regA |= ptr.value;
   manZeroNeg(machine,machine->regA);
@@ -837,10 +851,8 @@ static void jmpINY(machine_6502 *machine, m6502_AddrMode adm){
   manZeroNeg(machine, machine->regY);
 }
 
-static void jmpROR(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
+static void opROR(machine_6502 *machine, BOOL isValue, Pointer ptr){
   Bit8 cf;
-  BOOL isValue = getValue(machine, adm, &ptr);
   if (isValue) { 
     cf = bitOn(machine->regP, CARRY_FL);
     machine->regP = 
@@ -862,10 +874,8 @@ static void jmpROR(machine_6502 *machine, m6502_AddrMode adm){
   }
 }
 
-static void jmpROL(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
+static void opROL(machine_6502 *machine, BOOL isValue, Pointer ptr){
   Bit8 cf;
-  BOOL isValue = getValue(machine, adm, &ptr);
   if (isValue) { 
     cf = bitOn(machine->regP, CARRY_FL);
     machine->regP = 
@@ -892,21 +902,17 @@ static void jmpRTI(machine_6502 *machine, m6502_AddrMode adm){
   machine->regPC = stackPop(machine);
 }
 
-static void jmpRTS(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opRTS(machine_6502 *machine, BOOL isValue, Pointer ptr){
   Bit16 nr = stackPop(machine);
   Bit16 nl = stackPop(machine);
   warnValue(! isValue);
   machine->regPC = (nl << 8) | nr;
 }
 
-static void jmpSBC(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
+static void opSBC(machine_6502 *machine, BOOL isValue, Pointer ptr){
   /*Bit8 vflag;*/
   Bit8 c = bitOn(machine->regP, CARRY_FL);
   Bit16 tmp, w;
-  BOOL isValue = getValue(machine, adm, &ptr);
   warnValue(isValue);
   /*vflag = (bitOn(machine->regA,NEGATIVE_FL) &&
 	   bitOn(ptr.value, NEGATIVE_FL));*/
@@ -957,9 +963,7 @@ static void jmpSBC(machine_6502 *machine, m6502_AddrMode adm){
   manZeroNeg(machine,machine->regA);
 }
 
-static void jmpSTA(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opSTA(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   memStoreByte(machine,ptr.addr,machine->regA);
 }
@@ -991,22 +995,183 @@ static void jmpPLP(machine_6502 *machine, m6502_AddrMode adm){
   machine->regP = setBit(machine->regP, FUTURE_FL, 1);
 }
 
-static void jmpSTX(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opSTX(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   memStoreByte(machine,ptr.addr,machine->regX);
 }
 
-static void jmpSTY(machine_6502 *machine, m6502_AddrMode adm){
-  Pointer ptr;
-  BOOL isValue = getValue(machine, adm, &ptr);
+static void opSTY(machine_6502 *machine, BOOL isValue, Pointer ptr){
   warnValue(isValue);
   memStoreByte(machine,ptr.addr,machine->regY);
 }
 
 
 
+/* The jump functions of the opcode table read the parameter, as the
+   address mode says, and then do the operation. */
+#define JUMP(name)                                                      \
+  static void jmp##name(machine_6502 *machine, m6502_AddrMode adm){     \
+    Pointer ptr;                                                        \
+    BOOL isValue = getValue(machine, adm, &ptr);                        \
+    op##name(machine, isValue, ptr);                                    \
+  }
+
+JUMP(ADC) JUMP(AND) JUMP(ASL) JUMP(BIT) JUMP(BPL) JUMP(BMI) JUMP(BVC)
+JUMP(BVS) JUMP(BCC) JUMP(BCS) JUMP(BNE) JUMP(BEQ) JUMP(CMP) JUMP(CPX)
+JUMP(CPY) JUMP(DEC) JUMP(EOR) JUMP(INC) JUMP(JMP) JUMP(JSR) JUMP(LDA)
+JUMP(LDX) JUMP(LDY) JUMP(LSR) JUMP(ORA) JUMP(ROR) JUMP(ROL) JUMP(RTS)
+JUMP(SBC) JUMP(STA) JUMP(STX) JUMP(STY)
+
+
+
+/* FAST CORE */
+
+/* These get the value the same way getValue() does, from a parameter
+   that has already been read. */
+
+static BOOL fetchSINGLE(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  pointer->value = 0;
+  pointer->addr = 0;
+  return FALSE;
+}
+
+static BOOL fetchIMMEDIATE_VALUE(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  pointer->value = operand;
+  pointer->addr = 0;
+  return TRUE;
+}
+
+static BOOL fetchINDIRECT_X(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  Bit8 zp = operand + machine->regX;
+  pointer->addr = memReadByte(machine,zp) + 
+    (memReadByte(machine,zp+1)<<8);
+  pointer->value = memReadByte(machine, pointer->addr);
+  return TRUE;
+}
+
+static BOOL fetchINDIRECT_Y(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  Bit8 zp = operand;
+  pointer->addr = memReadByte(machine,zp) + 
+    (memReadByte(machine,zp+1)<<8) + machine->regY;
+  pointer->value = memReadByte(machine, pointer->addr);
+  return TRUE;
+}
+
+static BOOL fetchZERO(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  pointer->addr = operand;
+  pointer->value = memReadByte(machine, pointer->addr);
+  return TRUE;
+}
+
+static BOOL fetchZERO_X(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  pointer->addr = operand + machine->regX;
+  pointer->value = memReadByte(machine, pointer->addr);
+  return TRUE;
+}
+
+static BOOL fetchZERO_Y(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  pointer->addr = operand + machine->regY;
+  pointer->value = memReadByte(machine, pointer->addr);
+  return TRUE;
+}
+
+static BOOL fetchABS_OR_BRANCH(machine_6502 *machine, Bit16 operand, Pointer *pointer){
+  pointer->value = 0;
+  pointer->addr = operand;
+  return TRUE;
+}
+
+#define fetchABS_VALUE fetchZERO
+#define fetchABS_X     fetchZERO_X
+#define fetchABS_Y     fetchZERO_Y
+
+/* The number of parameter bytes that follow the opcode, by address mode. */
+static const Bit8 operandLength[] = {
+  0,                    /* SINGLE */
+  1, 1, 1,              /* IMMEDIATE_VALUE, IMMEDIATE_GREAT, IMMEDIATE_LESS */
+  1, 1,                 /* INDIRECT_X, INDIRECT_Y */
+  1, 1, 1,              /* ZERO, ZERO_X, ZERO_Y */
+  2, 1, 2, 2,           /* ABS_VALUE, ABS_OR_BRANCH, ABS_X, ABS_Y */
+  2, 2,                 /* ABS_LABEL_X, ABS_LABEL_Y */
+  0                     /* DCB_PARAM */
+};
+
+#define FAST(name, mode)                                                \
+  static void fast##name##_##mode(machine_6502 *machine, Bit16 operand){ \
+    Pointer ptr;                                                        \
+    BOOL isValue = fetch##mode(machine, operand, &ptr);                 \
+    op##name(machine, isValue, ptr);                                    \
+  }
+
+/* An operation that takes a parameter gets a handler for each address
+   mode that opcodes can have, in the order of m6502_AddrMode. */
+#define FAST_PARAM(name)                                                \
+  FAST(name, SINGLE) FAST(name, IMMEDIATE_VALUE)                        \
+  FAST(name, INDIRECT_X) FAST(name, INDIRECT_Y)                         \
+  FAST(name, ZERO) FAST(name, ZERO_X) FAST(name, ZERO_Y)                \
+  FAST(name, ABS_VALUE) FAST(name, ABS_OR_BRANCH)                       \
+  FAST(name, ABS_X) FAST(name, ABS_Y)
+
+#define PARAM_ROW(name)                                                 \
+  { jmp##name,                                                          \
+    { fast##name##_SINGLE, fast##name##_IMMEDIATE_VALUE, NULL, NULL,    \
+      fast##name##_INDIRECT_X, fast##name##_INDIRECT_Y,                 \
+      fast##name##_ZERO, fast##name##_ZERO_X, fast##name##_ZERO_Y,      \
+      fast##name##_ABS_VALUE, fast##name##_ABS_OR_BRANCH,               \
+      fast##name##_ABS_X, fast##name##_ABS_Y } }
+
+/* The others only come as SINGLE. */
+#define FAST_SINGLE(name)                                               \
+  static void fast##name(machine_6502 *machine, Bit16 operand){         \
+    jmp##name(machine, SINGLE);                                         \
+  }
+
+#define SINGLE_ROW(name) { jmp##name, { fast##name } }
+
+FAST_PARAM(ADC) FAST_PARAM(AND) FAST_PARAM(ASL) FAST_PARAM(BIT)
+FAST_PARAM(BPL) FAST_PARAM(BMI) FAST_PARAM(BVC) FAST_PARAM(BVS)
+FAST_PARAM(BCC) FAST_PARAM(BCS) FAST_PARAM(BNE) FAST_PARAM(BEQ)
+FAST_PARAM(CMP) FAST_PARAM(CPX) FAST_PARAM(CPY) FAST_PARAM(DEC)
+FAST_PARAM(EOR) FAST_PARAM(INC) FAST_PARAM(JMP) FAST_PARAM(JSR)
+FAST_PARAM(LDA) FAST_PARAM(LDX) FAST_PARAM(LDY) FAST_PARAM(LSR)
+FAST_PARAM(ORA) FAST_PARAM(ROR) FAST_PARAM(ROL) FAST_PARAM(RTS)
+FAST_PARAM(SBC) FAST_PARAM(STA) FAST_PARAM(STX) FAST_PARAM(STY)
+
+FAST_SINGLE(CLC) FAST_SINGLE(SEC) FAST_SINGLE(CLI) FAST_SINGLE(SEI)
+FAST_SINGLE(CLV) FAST_SINGLE(CLD) FAST_SINGLE(SED) FAST_SINGLE(NOP)
+FAST_SINGLE(TAX) FAST_SINGLE(TXA) FAST_SINGLE(DEX) FAST_SINGLE(INX)
+FAST_SINGLE(TAY) FAST_SINGLE(TYA) FAST_SINGLE(DEY) FAST_SINGLE(INY)
+FAST_SINGLE(RTI) FAST_SINGLE(TXS) FAST_SINGLE(TSX) FAST_SINGLE(PHA)
+FAST_SINGLE(PLA) FAST_SINGLE(PHP) FAST_SINGLE(PLP)
+
+/* Opcode 0x00 stops the program. */
+static void fastBRK(machine_6502 *machine, Bit16 operand){
+  machine->codeRunning = FALSE;
+}
+
+static const struct {
+  void (*func) (machine_6502*, m6502_AddrMode);
+  FastFunc fast[DCB_PARAM + 1];
+} fastFuncs[] = {
+  PARAM_ROW(ADC), PARAM_ROW(AND), PARAM_ROW(ASL), PARAM_ROW(BIT),
+  PARAM_ROW(BPL), PARAM_ROW(BMI), PARAM_ROW(BVC), PARAM_ROW(BVS),
+  PARAM_ROW(BCC), PARAM_ROW(BCS), PARAM_ROW(BNE), PARAM_ROW(BEQ),
+  PARAM_ROW(CMP), PARAM_ROW(CPX), PARAM_ROW(CPY), PARAM_ROW(DEC),
+  PARAM_ROW(EOR), PARAM_ROW(INC), PARAM_ROW(JMP), PARAM_ROW(JSR),
+  PARAM_ROW(LDA), PARAM_ROW(LDX), PARAM_ROW(LDY), PARAM_ROW(LSR),
+  PARAM_ROW(ORA), PARAM_ROW(ROR), PARAM_ROW(ROL), PARAM_ROW(RTS),
+  PARAM_ROW(SBC), PARAM_ROW(STA), PARAM_ROW(STX), PARAM_ROW(STY),
+
+  SINGLE_ROW(CLC), SINGLE_ROW(SEC), SINGLE_ROW(CLI), SINGLE_ROW(SEI),
+  SINGLE_ROW(CLV), SINGLE_ROW(CLD), SINGLE_ROW(SED), SINGLE_ROW(NOP),
+  SINGLE_ROW(TAX), SINGLE_ROW(TXA), SINGLE_ROW(DEX), SINGLE_ROW(INX),
+  SINGLE_ROW(TAY), SINGLE_ROW(TYA), SINGLE_ROW(DEY), SINGLE_ROW(INY),
+  SINGLE_ROW(RTI), SINGLE_ROW(TXS), SINGLE_ROW(TSX), SINGLE_ROW(PHA),
+  SINGLE_ROW(PLA), SINGLE_ROW(PHP), SINGLE_ROW(PLP)
+};
+
+
+
 /* OPCODES */
 static void assignOpCodes(m6502_Opcodes *opcodes){
 
@@ -1136,6 +1301,43 @@ static int opIndex(machine_6502 *machine, Bit8 opcode, m6502_AddrMode *adm){
   return machine->opcache[opcode].index;
 }
 
+/* buildFastHandlers() - Pick the fast core's handler for each opcode,
+   from the same opcode and address mode that execute() would use. */
+static void buildFastHandlers(machine_6502 *machine){
+  unsigned int opcode, i;
+  for (opcode = 0; opcode < 0x100; opcode++) {
+    m6502_AddrMode adm;
+    int opidx = opIndex(machine, opcode, &adm);
+    FastFunc fast = NULL;
+    if (opcode == 0x00)
+      fast = fastBRK;
+    else
+      for (i = 0; i < sizeof(fastFuncs) / sizeof(*fastFuncs); i++)
+        if (fastFuncs[i].func == machine->opcodes[opidx].func)
+          fast = fastFuncs[i].fast[adm];
+    if (! fast) abort();
+    machine->program->handlers[opcode] = fast;
+  }
+}
+
+/* decode() - Read the instruction at addr for the fast core. */
+static Decoded *decode(machine_6502 *machine, Bit16 addr){
+  Decoded *d = &machine->program->decoded[addr];
+  Bit8 opcode = machine->memory[addr];
+  Bit16 p1 = addr + 1, p2 = addr + 2;
+  int length = (opcode == 0x00 ? 0 :
+                operandLength[machine->opcache[opcode].adm]);
+  d->func = machine->program->handlers[opcode];
+  d->operand = (length == 0 ? 0 :
+                length == 1 ? machine->memory[p1] :
+                machine->memory[p1] + (machine->memory[p2] << 8));
+  d->next = addr + 1 + length;
+  machine->program->codePages[addr >> 8] = 1;
+  machine->program->codePages[p1 >> 8] = 1;
+  machine->program->codePages[p2 >> 8] = 1;
+  return d;
+}
+
 
 /* Assembly parser */
 
@@ -1726,6 +1928,10 @@ static void reset(machine_6502 *machine){
 
   for(x=0; x < MEM_64K; x++)
     machine->memory[x] = 0;
+  memset(machine->program->decoded, 0, sizeof(machine->program->decoded));
+  memset(machine->program->codePages, 0,
+         sizeof(machine->program->codePages));
+  memset(machine->program->dirty, 0, sizeof(machine->program->dirty));
 
   machine->codeCompiledOK = FALSE;
   machine->regA = 0;
@@ -2106,16 +2312,41 @@ static void execute(machine_6502 *machine){
   }
 }
 
+/*
+ *  executeFast() - Executes up to insno instructions, the same way
+ *                  execute() would, but with predecoded handlers.
+ *                  Returns how many it executed.
+ *
+ */
+
+static int executeFast(machine_6502 *machine, int insno){
+  Decoded *decoded = machine->program->decoded;
+  int n = 0;
+  for (; n < insno && machine->codeRunning; n++) {
+    Decoded *d = &decoded[machine->regPC];
+    if (! d->func)
+      d = decode(machine, machine->regPC);
+    machine->regPC = d->next;
+    d->func(machine, d->operand);
+    if (machine->regPC == 0)
+      machine->codeRunning = FALSE;
+  }
+  return n;
+}
+
 machine_6502 *m6502_build(void){
   machine_6502 *machine;
   machine = ecalloc(1, sizeof(machine_6502));
+  machine->program = ecalloc(1, sizeof(*machine->program));
   assignOpCodes(machine->opcodes);
   buildIndexCache(machine);
+  buildFastHandlers(machine);
   reset(machine);
   return machine;
 }
 
 void m6502_destroy6502(machine_6502 *machine){
+  free(machine->program);
   free(machine);
 }
 
@@ -2202,6 +2433,7 @@ void m6502_eval_file(machine_6502 *machine, const char *filename, m6502_Plotter
 #endif
     execute(machine);
   }while(machine->codeRunning);
+  flushDisplay(machine);
 }
 
 void m6502_start_eval_file(machine_6502 *machine, const char *filename, m6502_Plotter plot, void *plotterState){
@@ -2220,6 +2452,7 @@ void m6502_start_eval_file(machine_6502 *machine, const char *filename, m6502_Pl
   machine->defaultCodePC = machine->regPC = PROG_START;
   machine->codeRunning = TRUE;
   execute(machine);
+  flushDisplay(machine);
 }
 #endif /* READ_FILES */
 
@@ -2237,6 +2470,7 @@ void m6502_start_eval_string(machine_6502 *machine, const char *code,
   machine->defaultCodePC = machine->regPC = PROG_START;
   machine->codeRunning = TRUE;
   execute(machine);
+  flushDisplay(machine);
 }
 
 /* void start_eval_binary(machine_6502 *machine, Bit8 *program, */
@@ -2259,16 +2493,97 @@ void m6502_start_eval_string(machine_6502 *machine, const char *code,
 /* } */
 
 void m6502_next_eval(machine_6502 *machine, int insno){
-  int i = 0;
-  for (i = 1; i < insno; i++){
-    if (machine->codeRunning){
-#if 0
-      trace(machine, stdout);
-#endif
+  executeFast(machine, insno - 1);
+  flushDisplay(machine);
+}
+  
+
+
+#ifdef SELFTEST
+
+/* Runs each of the demos for a while on execute() and on the fast core,
+   checks that they end up the same, and prints how many instructions per
+   second each of them ran.
+ */
+
+# ifdef __GNUC__
+  __extension__
+# endif
+static const char * const demo_files[] = {
+# include "m6502.h"
+};
+
+#include <time.h>
+
+/* Both cores must see the same random numbers at $fe, so this stands in
+   for yarandom.o with a generator that can be started over. */
+static unsigned int bench_random_state;
+
+unsigned int ya_random(void){
+  bench_random_state = bench_random_state * 1103515245 + 12345;
+  return bench_random_state >> 1;
+}
+
+#define BENCH_INSNS 20000000
+
+/* Returns the number of seconds it took to run up to BENCH_INSNS, and
+   how many it ran. */
+static double run(machine_6502 *machine, const char *code, BOOL fast_p,
+                  int *insns){
+  clock_t start;
+  int i;
+  bench_random_state = 1;
+  m6502_start_eval_string(machine, code, NULL, NULL);
+  start = clock();
+  if (fast_p)
+    i = executeFast(machine, BENCH_INSNS);
+  else
+    for (i = 0; i < BENCH_INSNS && machine->codeRunning; i++)
       execute(machine);
-    }
+  flushDisplay(machine);
+  *insns = i;
+  return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv){
+  machine_6502 *slow = m6502_build();
+  machine_6502 *fast = m6502_build();
+  double slow_total = 0, fast_total = 0, insns_total = 0;
+  int errors = 0;
+  unsigned int i;
+
+  for (i = 0; i < sizeof(demo_files) / sizeof(*demo_files); i++) {
+    int slow_insns, fast_insns;
+    double slow_secs = run(slow, demo_files[i], FALSE, &slow_insns);
+    double fast_secs = run(fast, demo_files[i], TRUE,  &fast_insns);
+    BOOL same_p = (slow_insns == fast_insns &&
+                   slow->regA == fast->regA &&
+                   slow->regX == fast->regX &&
+                   slow->regY == fast->regY &&
+                   slow->regP == fast->regP &&
+                   slow->regPC == fast->regPC &&
+                   slow->regSP == fast->regSP &&
+                   slow->codeRunning == fast->codeRunning &&
+                   !memcmp(slow->memory, fast->memory, MEM_64K));
+    if (! same_p) errors++;
+    slow_total += slow_secs;
+    fast_total += fast_secs;
+    insns_total += slow_insns;
+    if (slow_insns < BENCH_INSNS)
+      fprintf(stderr, "demo %2u: stopped after %d instructions%s\n", i,
+              slow_insns, (same_p ? "" : "  DIFFERENT"));
     else
-      break;
+      fprintf(stderr, "demo %2u: %6.1f M/sec, fast %6.1f M/sec%s\n", i,
+              slow_insns / slow_secs / 1e6, fast_insns / fast_secs / 1e6,
+              (same_p ? "" : "  DIFFERENT"));
   }
+  fprintf(stderr, "total:   %6.1f M/sec, fast %6.1f M/sec, %.2fx faster\n",
+          insns_total / slow_total / 1e6, insns_total / fast_total / 1e6,
+          slow_total / fast_total);
+
+  m6502_destroy6502(slow);
+  m6502_destroy6502(fast);
+  return errors ? 1 : 0;
 }
-  
+
+#endif /* SELFTEST */
@@ -60,6 +60,9 @@ typedef enum{
 
 typedef struct machine_6502 machine_6502;
 
+/* The fast core's predecoded program, private to asm6502.c */
+struct m6502_Program;
+
 typedef struct {
   char name[MAX_CMD_LEN];
   Bit8 Imm;
@@ -82,9 +85,10 @@ typedef struct {
   m6502_AddrMode adm;
 } m6502_OpcodeIndex;
 
-/* Plotter is a function that will be called everytime a pixel
-   needs to be updated. The first two parameter are the x and y
-   values. The third parameter is the color index:
+/* Plotter is a function that will be called for each pixel that
+   was stored to, at the end of each start_eval or next_eval. The
+   first two parameter are the x and y values. The third parameter
+   is the color index:
 
    Color Index Table
    00 black      #000000
@@ -127,9 +131,10 @@ struct machine_6502 {
   m6502_Opcodes opcodes[NUM_OPCODES];
   int screen[32][32];
   int codeLen;
-  m6502_OpcodeIndex opcache[0xff];
+  m6502_OpcodeIndex opcache[0x100];
   m6502_Plotter plot;
   void *plotterState;
+  struct m6502_Program *program;
 };
 
 /* build6502() - Creates an instance of the 6502 machine */
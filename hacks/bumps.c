@@ -33,9 +33,15 @@
 
 #include <math.h>
 #include <time.h>
+#include <errno.h>
 #include <inttypes.h>
 #include "screenhack.h"
 #include "xshm.h"
+#include "thread_util.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 
 
 /* Defines: */
@@ -60,6 +66,7 @@ static const char *bumps_defaults [] = {
 #ifdef HAVE_XSHM_EXTENSION
   "*useSHM:		True",
 #endif /* HAVE_XSHM_EXTENSION */
+  THREAD_DEFAULTS
 #ifdef HAVE_MOBILE
   "*ignoreRotation: True",
   "*rotateImages:   True",
@@ -78,6 +85,7 @@ static XrmOptionDescRec bumps_options [] = {
   { "-shm",			".useSHM",		XrmoptionNoArg, "True" },
   { "-no-shm",		".useSHM",		XrmoptionNoArg, "False" },
 #endif /* HAVE_XSHM_EXTENSION */
+  THREAD_OPTIONS
 
   { 0, 0, 0, 0 }
 };
@@ -116,8 +124,13 @@ typedef struct
 	uint8_t bytesPerPixel;
 	uint16_t iWinWidth, iWinHeight;
 	uint16_t *aBumpMap;				/* The actual bump map. */
+	int16_t *aNormals;				/* Its slope, as X,Y pairs. */
+	uint32_t *aLightPixels;			/* The light map, as pixels. */
 	SSpotLight SpotLight;
 
+	struct threadpool pool;
+	int32_t nLightXPos, nLightYPos;	/* Where this frame's spotlight is. */
+
         int delay;
         int duration;
         time_t start_time;
@@ -130,6 +143,7 @@ static void SetPalette(Display *, SBumps *, XWindowAttributes * );
 static void InitBumpMap(Display *, SBumps *, XWindowAttributes * );
 static void InitBumpMap_2(Display *, SBumps *);
 static void SoftenBumpMap( SBumps * );
+static void InitNormals( SBumps * );
 
 
 
@@ -159,6 +173,29 @@ static void PutPixel8( int8_t *pData, uint32_t pixel )
 	*(uint8_t *)pData = (uint8_t)pixel;
 }
 
+/* Each thread draws a stripe of the rows of the spotlight. */
+typedef struct
+{
+	SBumps *pBumps;
+	unsigned id;
+	int32_t *aIndex;		/* One row of light map indexes. */
+} SBumpsThread;
+
+static int BumpsThreadCreate( void *self, struct threadpool *pool, unsigned id )
+{
+	SBumpsThread *pThread = (SBumpsThread *)self;
+	pThread->pBumps = GET_PARENT_OBJ( SBumps, pool, pool );
+	pThread->id = id;
+	pThread->aIndex = malloc( pThread->pBumps->SpotLight.nFalloffDiameter * sizeof(int32_t) );
+	return pThread->aIndex ? 0 : ENOMEM;
+}
+
+static void BumpsThreadDestroy( void *self )
+{
+	SBumpsThread *pThread = (SBumpsThread *)self;
+	free( pThread->aIndex );
+}
+
 /* Creates the light map, which is a circular image... going from black around the edges
  * to white in the center. */
 static void CreateSpotLight( SSpotLight *pSpotLight, uint16_t iDiameter, uint16_t nColorCount )
@@ -201,6 +238,21 @@ static void CreateSpotLight( SSpotLight *pSpotLight, uint16_t iDiameter, uint16_
 }
 
 
+/* Looks up the color of every spot on the light map ahead of time.  One
+ * past the end is the background, for when the light misses. */
+static void CreateLightPixels( SBumps *pBumps )
+{
+	SSpotLight *pSpotLight = &pBumps->SpotLight;
+	int32_t nSize = pSpotLight->nLightDiameter * pSpotLight->nLightDiameter;
+	int32_t i;
+
+	pBumps->aLightPixels = malloc( ( nSize + 1 ) * sizeof(uint32_t) );
+	for( i=0; i<nSize; i++ )
+		pBumps->aLightPixels[ i ] = pBumps->aColors[ pSpotLight->aLightMap[ i ] ];
+	pBumps->aLightPixels[ nSize ] = pBumps->aColors[ 0 ];
+}
+
+
 /* Calculates the position of the spot light on the screen. */
 static void CalcLightPos( SBumps *pBumps )
 {
@@ -303,7 +355,22 @@ static void CreateBumps( SBumps *pBumps, Display *dpy, Window NewWin )
 	
 	SetPalette(dpy, pBumps, &XWinAttribs );
 	CreateSpotLight( &pBumps->SpotLight, iDiameter, pBumps->nColorCount );
+	CreateLightPixels( pBumps );
 	InitBumpMap(dpy, pBumps, &XWinAttribs );
+
+	{
+		static const struct threadpool_class cls = {
+			sizeof(SBumpsThread),
+			BumpsThreadCreate,
+			BumpsThreadDestroy
+		};
+		int err = threadpool_create( &pBumps->pool, &cls, dpy, hardware_concurrency( dpy ) );
+		if( err )
+		{
+			fprintf( stderr, "%s: threadpool: %s\n", progname, strerror( err ) );
+			exit( 1 );
+		}
+	}
 }
 
 
@@ -470,6 +537,50 @@ static void InitBumpMap_2(Display *dpy, SBumps *pBumps)
 
 /*	free( pBumps->xColors );
     pBumps->xColors = 0;*/
+
+	InitNormals( pBumps );
+}
+
+
+/* The slope of the bump map doesn't change until the next image, so it is
+ * worked out once here, as X,Y pairs that Execute() can add the light's
+ * position to two at a time.  The edges, where the slope can't be taken,
+ * are way out of range so that they always miss the light.  The heights
+ * are much less than 32767, but clamp anyway.
+ */
+#define NORMAL_NONE	-32768
+
+static void InitNormals( SBumps *pBumps )
+{
+	int32_t iWidth = pBumps->iWinWidth, iHeight = pBumps->iWinHeight;
+	int32_t x, y;
+
+	free( pBumps->aNormals );
+	pBumps->aNormals = malloc( iWidth * iHeight * 2 * sizeof(int16_t) );
+
+	for( y=0; y<iHeight; y++ )
+	{
+		const uint16_t *pBOffset = pBumps->aBumpMap + y * iWidth;
+		int16_t *pNOffset = pBumps->aNormals + y * iWidth * 2;
+		for( x=0; x<iWidth; x++, pNOffset+=2 )
+		{
+			if( y == 0 || y >= iHeight-2 || x == 0 || x >= iWidth-2 )
+			{
+				pNOffset[ 0 ] = pNOffset[ 1 ] = NORMAL_NONE;
+			}
+			else
+			{
+				int32_t nX = pBOffset[ x+1 ] - pBOffset[ x ];
+				int32_t nY = pBOffset[ x+iWidth ] - pBOffset[ x ];
+				pNOffset[ 0 ] = ( nX < -32767 ) ? -32767 : ( nX > 32767 ) ? 32767 : nX;
+				pNOffset[ 1 ] = ( nY < -32767 ) ? -32767 : ( nY > 32767 ) ? 32767 : nY;
+			}
+		}
+	}
+
+	/* Only the slope is needed from now on. */
+	free( pBumps->aBumpMap );
+	pBumps->aBumpMap = NULL;
 }
 
 /* Soften the bump map.  This is to avoid pixelated-looking ridges.
@@ -517,59 +628,122 @@ static void SoftenBumpMap( SBumps *pBumps )
 }
 
 
+/* Works out which spot on the light map lands on each pixel of one row,
+ * as an index into aLightPixels.  That's right folks, all the magic of bump
+ * mapping is in here: the light is offset by the slope of the bumps.
+ * (kinda disappointing, isn't it?)
+ */
+static void LightRow( const SBumps *pBumps, const int16_t *pNOffset, int32_t iLightX, int32_t iLightY,
+                      int32_t nCount, int32_t *pIndex )
+{
+	int32_t nDiameter = pBumps->SpotLight.nLightDiameter;
+	int32_t nMiss = nDiameter * nDiameter;
+	int32_t i = 0;
+
+#ifdef __SSE2__
+	/* Four pixels at a time: add the light to each X,Y pair, test both
+	 * halves against the light map's size, and then multiply-add the pair
+	 * by 1,Diameter to get the index.  Adding with saturation keeps the
+	 * edges out of range. */
+	{
+		const __m128i vDiameter = _mm_set1_epi16( nDiameter );
+		const __m128i vNegative = _mm_set1_epi16( -1 );
+		const __m128i vStride = _mm_set1_epi32( ( nDiameter << 16 ) | 1 );
+		const __m128i vMiss = _mm_set1_epi32( nMiss );
+		const __m128i vStep = _mm_set1_epi32( 4 );
+		const __m128i vAll = _mm_set1_epi32( -1 );
+		__m128i vLight = _mm_set_epi16( iLightY, iLightX+3, iLightY, iLightX+2,
+		                                iLightY, iLightX+1, iLightY, iLightX );
+		for( ; i+4<=nCount; i+=4, pNOffset+=8, vLight=_mm_add_epi16( vLight, vStep ) )
+		{
+			__m128i vN = _mm_adds_epi16( _mm_loadu_si128( (const __m128i *)pNOffset ), vLight );
+			__m128i vIn = _mm_and_si128( _mm_cmpgt_epi16( vN, vNegative ),
+			                             _mm_cmplt_epi16( vN, vDiameter ) );
+			__m128i vIndex = _mm_madd_epi16( vN, vStride );
+			vIn = _mm_cmpeq_epi32( vIn, vAll );
+			vIndex = _mm_or_si128( _mm_and_si128( vIn, vIndex ), _mm_andnot_si128( vIn, vMiss ) );
+			_mm_storeu_si128( (__m128i *)( pIndex + i ), vIndex );
+		}
+	}
+#endif /* __SSE2__ */
+
+	for( ; i<nCount; i++, pNOffset+=2 )
+	{
+		int32_t nX = pNOffset[ 0 ] + iLightX + i;
+		int32_t nY = pNOffset[ 1 ] + iLightY;
+
+		if( nX<0 || nX>=nDiameter || nY<0 || nY>=nDiameter )
+			pIndex[ i ] = nMiss;
+		else
+			pIndex[ i ] = ( nY * nDiameter ) + nX;
+	}
+}
+
+
+/* Draws this thread's stripe of the rows of the spotlight. */
+static void ExecuteStripe( void *self )
+{
+	SBumpsThread *pThread = (SBumpsThread *)self;
+	SBumps *pBumps = pThread->pBumps;
+	SSpotLight *pSpotLight = &pBumps->SpotLight;
+	XImage *pXImage = pBumps->pXImage;
+	int32_t nFalloff = pSpotLight->nFalloffDiameter;
+	int32_t nLightXPos = pBumps->nLightXPos, nLightYPos = pBumps->nLightYPos;
+	int32_t iRow0 = nFalloff * pThread->id / pBumps->pool.count;
+	int32_t iRow1 = nFalloff * (pThread->id + 1) / pBumps->pool.count;
+	int32_t iX0, iX1, iRow, i;
+
+	/* Only the part of each row that is on the screen. */
+	iX0 = ( nLightXPos < 0 ) ? -nLightXPos : 0;
+	iX1 = ( nLightXPos + nFalloff > pBumps->iWinWidth ) ? pBumps->iWinWidth - nLightXPos : nFalloff;
+	if( iX1 <= iX0 ) return;
+
+	for( iRow=iRow0; iRow<iRow1; iRow++ )
+	{
+		int32_t iScreenY = nLightYPos + iRow;
+		int32_t *pIndex = pThread->aIndex;
+		int8_t *pDOffset;
+
+		if( iScreenY < 0 )							continue;
+		else if( iScreenY >= pBumps->iWinHeight )	break;
+
+		LightRow( pBumps, pBumps->aNormals + ( iScreenY * pBumps->iWinWidth + nLightXPos + iX0 ) * 2,
+		          iX0 - pSpotLight->nLightRadius, iRow - pSpotLight->nLightRadius,
+		          iX1 - iX0, pIndex );
+
+		pDOffset = (int8_t *) &pXImage->data[ iRow * pXImage->bytes_per_line + iX0 * pBumps->bytesPerPixel ];
+		if( pBumps->bytesPerPixel == 4 )
+		{
+			uint32_t *pPixel = (uint32_t *)pDOffset;
+			for( i=0; i<iX1-iX0; i++ )
+				pPixel[ i ] = pBumps->aLightPixels[ pIndex[ i ] ];
+		}
+		else
+		{
+			for( i=0; i<iX1-iX0; i++, pDOffset+=pBumps->bytesPerPixel )
+				MyPutPixel( pDOffset, pBumps->aLightPixels[ pIndex[ i ] ] );
+		}
+	}
+}
+
+
 /* This is where we slap down some pixels... */
 static void Execute( SBumps *pBumps )
 {
 	int32_t nLightXPos, nLightYPos;
-	int32_t iScreenX, iScreenY;
 	int32_t iLightX, iLightY;
-	uint16_t *pBOffset;
-	int8_t *pDOffset;
 	int32_t nX, nY;
-	uint16_t nColor;
-	int32_t nLightOffsetFar = pBumps->SpotLight.nFalloffDiameter - pBumps->SpotLight.nLightRadius;
 
 	CalcLightPos( pBumps );
 	
 	/* Offset to upper left hand corner. */
 	nLightXPos = pBumps->SpotLight.nXPos - pBumps->SpotLight.nFalloffRadius;
 	nLightYPos = pBumps->SpotLight.nYPos - pBumps->SpotLight.nFalloffRadius;
-	
-	for( iScreenY=nLightYPos, iLightY=-pBumps->SpotLight.nLightRadius; iLightY<nLightOffsetFar; ++iScreenY, ++iLightY )
-	{
-		if( iScreenY < 0 )							continue;
-		else if( iScreenY >= pBumps->iWinHeight )	break;
-
-    /* warning: pointer targets in assignment differ in signedness
-       Should pDOffset be a int8?  I can't tell.  -jwz, 22-Jul-2003 */
-		pDOffset = (int8_t *) &pBumps->pXImage->data[ (iLightY+pBumps->SpotLight.nLightRadius) * pBumps->pXImage->bytes_per_line ];
-		pBOffset = pBumps->aBumpMap + ( iScreenY * pBumps->iWinWidth ) + nLightXPos;
-		for( iScreenX=nLightXPos, iLightX=-pBumps->SpotLight.nLightRadius; iLightX<nLightOffsetFar; ++iScreenX, ++iLightX, ++pBOffset, pDOffset+=pBumps->bytesPerPixel )
-		{
-			if( iScreenX < 0 )							continue;
-			else if( iScreenX >= pBumps->iWinWidth )	break;
-			else if( iScreenY == 0 || iScreenY >= pBumps->iWinHeight-2 ||
-					 iScreenX == 0 || iScreenX >= pBumps->iWinWidth-2 )
-			{
-				MyPutPixel( pDOffset, pBumps->aColors[ 0 ] );
-				continue;
-			}
 
-			/* That's right folks, all the magic of bump mapping occurs in these two lines.  (kinda disappointing, isn't it?) */
-			nX = ( pBOffset[ 1 ] - pBOffset[ 0 ] ) + iLightX;
-			nY = ( pBOffset[ pBumps->iWinWidth ] - pBOffset[ 0 ] ) + iLightY;
-
-			if( nX<0 || nX>=pBumps->SpotLight.nLightDiameter
-			 || nY<0 || nY>=pBumps->SpotLight.nLightDiameter )
-			{
-				MyPutPixel( pDOffset, pBumps->aColors[ 0 ] );
-				continue;
-			}
-				
-			nColor = pBumps->SpotLight.aLightMap[ ( nY * pBumps->SpotLight.nLightDiameter ) + nX ];
-			MyPutPixel( pDOffset, pBumps->aColors[ nColor ] );
-		}
-	}	
+	pBumps->nLightXPos = nLightXPos;
+	pBumps->nLightYPos = nLightYPos;
+	threadpool_run( &pBumps->pool, ExecuteStripe );
+	threadpool_wait( &pBumps->pool );
 
 	/* Allow the spotlight to go *slightly* off the screen by clipping the XImage. */
 	iLightX = iLightY = 0;	/* Use these for XImages X and Y now.	*/
@@ -606,7 +780,10 @@ static void DestroySpotLight( SSpotLight *pSpotLight ) { free( pSpotLight->aLigh
 /* Clean up */
 static void DestroyBumps( SBumps *pBumps )
 {
+	threadpool_destroy( &pBumps->pool );
 	DestroySpotLight( &pBumps->SpotLight );
+	free( pBumps->aLightPixels );
+	free( pBumps->aNormals );
     free (pBumps->xColors);
 	free( pBumps->aColors );
 	free( pBumps->aBumpMap );
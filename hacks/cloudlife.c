@@ -26,6 +26,7 @@
  */
 
 #include "screenhack.h"
+#include "thread_util.h"
 
 #ifndef MAX_WIDTH
 #include <limits.h>
@@ -50,6 +51,20 @@ struct field {
     unsigned int cell_size;
     unsigned char *cells;
     unsigned char *new_cells;
+    unsigned char *linger;	/* frames left to keep redrawing each cell */
+    unsigned char *row_dirty;	/* whether any cell in the row has linger */
+    unsigned char linger_frames;
+};
+
+/* Each thread runs the rules over one horizontal band of the field.  The
+   inner loops work on whole rows of bytes with no branches, so that the
+   compiler can turn them into SIMD adds and compares. */
+struct life_thread {
+    struct state *st;
+    unsigned int id;
+    unsigned int buf_width;
+    unsigned char *weights[3];	/* neighbour weight of rows y-1, y, y+1 */
+    unsigned char *col_sums;
 };
 
 struct state {
@@ -75,6 +90,8 @@ struct state {
   XColor *colors;
 
   struct field *field;
+  struct threadpool threadpool;
+  unsigned int *thread_counts;	/* population of each thread's band */
 
   XPoint fg_points[MAX_WIDTH];
   XPoint bg_points[MAX_WIDTH];
@@ -109,9 +126,29 @@ init_field(struct state *st)
 
     f->cells = NULL;
     f->new_cells = NULL;
+    f->linger = NULL;
+    f->row_dirty = NULL;
+
+    /* Cells that haven't changed state stop being drawn once each pixel of
+       the cell has most likely been drawn already. */
+    {
+      unsigned int size = 1 << f->cell_size;
+      unsigned int frames = 2 * size * size;
+      f->linger_frames = (frames > 255 ? 255 : frames < 1 ? 1 : frames);
+    }
     return f;
 }
 
+static void
+free_field(struct field *f)
+{
+    free(f->cells);
+    free(f->new_cells);
+    free(f->linger);
+    free(f->row_dirty);
+    free(f);
+}
+
 static void 
 resize_field(struct field * f, unsigned int w, unsigned int h)
 {
@@ -121,22 +158,27 @@ resize_field(struct field * f, unsigned int w, unsigned int h)
 
     f->cells = xrealloc(f->cells, s);
     f->new_cells = xrealloc(f->new_cells, s);
+    f->linger = xrealloc(f->linger, s);
+    f->row_dirty = xrealloc(f->row_dirty, h);
     memset(f->cells, 0, s);
     memset(f->new_cells, 0, s);
+    memset(f->linger, 0, s);
+    memset(f->row_dirty, 0, h);
 }
 
-static inline unsigned char 
-*cell_at(struct field * f, unsigned int x, unsigned int y)
+/* Every cell is about to change: draw them all for a while. */
+static void
+touch_field(struct field * f)
 {
-    return (f->cells + x * sizeof(unsigned char) + 
-                       y * f->width * sizeof(unsigned char));
+    memset(f->linger, f->linger_frames, f->width * f->height);
+    memset(f->row_dirty, 1, f->height);
 }
 
 static inline unsigned char 
-*new_cell_at(struct field * f, unsigned int x, unsigned int y)
+*cell_at(struct field * f, unsigned int x, unsigned int y)
 {
-    return (f->new_cells + x * sizeof(unsigned char) + 
-                           y * f->width * sizeof(unsigned char));
+    return (f->cells + x * sizeof(unsigned char) + 
+                       y * f->width * sizeof(unsigned char));
 }
 
 static void
@@ -150,11 +192,20 @@ draw_field(struct state *st, struct field * f)
 
     /* columns 0 and width-1 are off screen and not drawn. */
     for (y = 1; y < f->height - 1; y++) {
+	const unsigned char *linger = f->linger + y * f->width;
+
+	/* Nothing in this row has changed in a long time. */
+	if (!f->row_dirty[y])
+	    continue;
+
 	fg_count = 0;
 	bg_count = 0;
 
 	/* rows 0 and height-1 are off screen and not drawn. */
 	for (x = 1; x < f->width - 1; x++) {
+	    if (!linger[x])
+		continue;
+
 	    rx = random();
 	    ry = rx >> f->cell_size;
 	    rx &= mask;
@@ -177,63 +228,156 @@ draw_field(struct state *st, struct field * f)
     }
 }
 
-static inline unsigned int 
-cell_value(unsigned char c, unsigned int age)
+/* Each neighbour counts 1 if it is alive, or 3 if it is older than max_age.
+ */
+static inline void
+row_weights(const unsigned char *cells, unsigned char *w, unsigned int n,
+            unsigned char max_age)
 {
-    if (!c) {
-	return 0;
-    } else if (c > age) {
-	return (3);
-    } else {
-	return (1);
+    unsigned int x;
+    for (x = 0; x < n; x++) {
+	unsigned char c = cells[x];
+	w[x] = (c > max_age ? 3 : c ? 1 : 0);
     }
 }
 
-static inline unsigned int 
-is_alive(struct field * f, unsigned int x, unsigned int y)
+/* Runs the rules over one row.  Returns the sum of the new ages (the
+   population measure that do_tick has always returned).  Cells that were
+   born or died get their linger count reset; *changed says whether any
+   cell in the row still needs drawing.
+ */
+static inline unsigned int
+tick_row(const unsigned char *above, const unsigned char *here,
+         const unsigned char *below, unsigned char *sums,
+         const unsigned char *cells, unsigned char *new_cells,
+         unsigned char *linger, unsigned int n, unsigned char linger_frames,
+         unsigned char *changed)
 {
-    unsigned int count;
-    unsigned int i, j;
-    unsigned char *p;
+    unsigned int x;
+    unsigned int count = 0;
+    unsigned char any = 0;
+
+    for (x = 0; x < n; x++)
+	sums[x] = above[x] + here[x] + below[x];
+
+    /* Written with all-ones/all-zeroes byte masks rather than branches. */
+    for (x = 1; x < n - 1; x++) {
+	unsigned char neighbours = sums[x-1] + sums[x] + sums[x+1] - here[x];
+	unsigned char c = cells[x];
+	unsigned char was = -(c != 0);
+	unsigned char three = -(neighbours == 3);
+	unsigned char two = -(neighbours == 2);
+	unsigned char v = ((was & (two | three) & (unsigned char) (c + 1)) |
+			   (~was & three & 1));
+	unsigned char flipped = was ^ (unsigned char) -(v != 0);
+	unsigned char l = linger[x];
+	linger[x] = ((flipped & linger_frames) |
+		     (~flipped & (unsigned char) (l - (l != 0))));
+	new_cells[x] = v;
+    }
 
-    count = 0;
+    /* columns 0 and width-1 are only ever seeded by populate_edges. */
+    new_cells[0] = 0;
+    new_cells[n - 1] = 0;
 
-    for (i = x - 1; i <= x + 1; i++) {
-	for (j = y - 1; j <= y + 1; j++) {
-	    if (y != j || x != i) {
-		count += cell_value(*cell_at(f, i, j), f->max_age);
-	    }
-	}
+    for (x = 1; x < n - 1; x++) {
+	count += new_cells[x];
+	any |= linger[x];
     }
 
-    p = cell_at(f, x, y);
-    if (*p) {
-	if (count == 2 || count == 3) {
-	    return ((*p) + 1);
-	} else {
-	    return (0);
-	}
-    } else {
-	if (count == 3) {
-	    return (1);
-	} else {
-	    return (0);
-	}
+    *changed = (any != 0);
+    return count;
+}
+
+static void
+life_thread_run(void *self_raw)
+{
+    struct life_thread *self = (struct life_thread *) self_raw;
+    struct field *f = self->st->field;
+    unsigned int w = f->width;
+    unsigned int rows = f->height - 2;
+    unsigned int nthreads = self->st->threadpool.count;
+    unsigned int y0 = 1 + rows * self->id / nthreads;
+    unsigned int y1 = 1 + rows * (self->id + 1) / nthreads;
+    unsigned char max_age = f->max_age;
+    unsigned char *above, *here, *below;
+    unsigned int y, count = 0;
+
+    self->st->thread_counts[self->id] = 0;
+    if (y0 >= y1)
+	return;
+
+    if (self->buf_width < w) {
+	int i;
+	for (i = 0; i < 3; i++)
+	    self->weights[i] = xrealloc(self->weights[i], w);
+	self->col_sums = xrealloc(self->col_sums, w);
+	self->buf_width = w;
     }
+
+    above = self->weights[0];
+    here  = self->weights[1];
+    below = self->weights[2];
+    row_weights(f->cells + (y0 - 1) * w, above, w, max_age);
+    row_weights(f->cells + y0 * w, here, w, max_age);
+
+    for (y = y0; y < y1; y++) {
+	unsigned char *t;
+	row_weights(f->cells + (y + 1) * w, below, w, max_age);
+	count += tick_row(above, here, below, self->col_sums,
+				f->cells + y * w, f->new_cells + y * w,
+				f->linger + y * w, w, f->linger_frames,
+				f->row_dirty + y);
+	t = above;
+	above = here;
+	here = below;
+	below = t;
+    }
+    self->st->thread_counts[self->id] = count;
+}
+
+static int
+life_thread_create(void *self_raw, struct threadpool *pool, unsigned id)
+{
+    struct life_thread *self = (struct life_thread *) self_raw;
+    self->st = GET_PARENT_OBJ(struct state, threadpool, pool);
+    self->id = id;
+    self->buf_width = 0;
+    self->weights[0] = self->weights[1] = self->weights[2] = NULL;
+    self->col_sums = NULL;
+    return 0;
+}
+
+static void
+life_thread_destroy(void *self_raw)
+{
+    struct life_thread *self = (struct life_thread *) self_raw;
+    free(self->weights[0]);
+    free(self->weights[1]);
+    free(self->weights[2]);
+    free(self->col_sums);
 }
 
 static unsigned int 
-do_tick(struct field * f)
+do_tick(struct state *st, struct field * f)
 {
-    unsigned int x, y;
     unsigned int count = 0;
-    for (x = 1; x < f->width - 1; x++) {
-	for (y = 1; y < f->height - 1; y++) {
-	    count += *new_cell_at(f, x, y) = is_alive(f, x, y);
-	}
-    }
-    memcpy(f->cells, f->new_cells, f->width * f->height *
-           sizeof(unsigned char));
+    unsigned char *t;
+    unsigned int i;
+
+    threadpool_run(&st->threadpool, life_thread_run);
+    threadpool_wait(&st->threadpool);
+
+    for (i = 0; i < st->threadpool.count; i++)
+	count += st->thread_counts[i];
+
+    /* rows 0 and height-1 are only ever seeded by populate_edges. */
+    memset(f->new_cells, 0, f->width);
+    memset(f->new_cells + (f->height - 1) * f->width, 0, f->width);
+
+    t = f->cells;
+    f->cells = f->new_cells;
+    f->new_cells = t;
     return count;
 }
 
@@ -255,11 +399,12 @@ populate_field(struct field * f, unsigned int p)
 {
     unsigned int x, y;
 
-    for (x = 0; x < f->width; x++) {
-	for (y = 0; y < f->height; y++) {
+    for (y = 0; y < f->height; y++) {
+	for (x = 0; x < f->width; x++) {
 	    *cell_at(f, x, y) = random_cell(p);
 	}
     }
+    touch_field(f);
 }
 
 static void 
@@ -315,6 +460,22 @@ cloudlife_init (Display *dpy, Window window)
                                         "background", "Background");
     st->bgc = XCreateGC(st->dpy, st->window, GCForeground, &st->gcv);
 
+    {
+      static const struct threadpool_class cls = {
+        sizeof(struct life_thread),
+        life_thread_create,
+        life_thread_destroy
+      };
+      int error = threadpool_create(&st->threadpool, &cls, st->dpy,
+                                    hardware_concurrency(st->dpy));
+      if (error) {
+        fprintf(stderr, "%s: threadpool: %s\n", progname, strerror(error));
+        exit(1);
+      }
+      st->thread_counts = xrealloc(NULL, st->threadpool.count *
+                                   sizeof(*st->thread_counts));
+    }
+
     return st;
 }
 
@@ -330,6 +491,7 @@ cloudlife_draw (Display *dpy, Window window, void *closure)
         st->colorindex = st->ncolors;
       st->colorindex--;
       XSetForeground(st->dpy, st->fgc, st->colors[st->colorindex].pixel);
+      touch_field(st->field);   /* the settled cells need the new color too */
     }
     st->colortimer--;
   } 
@@ -345,13 +507,13 @@ cloudlife_draw (Display *dpy, Window window, void *closure)
 
   draw_field(st, st->field);
 
-  if (do_tick(st->field) < (st->field->height + st->field->width) / 4) {
+  if (do_tick(st, st->field) < (st->field->height + st->field->width) / 4) {
     populate_field(st->field, st->density);
   }
 
   if (st->cycles % (st->field->max_age /2) == 0) {
     populate_edges(st->field, st->density);
-    do_tick(st->field);
+    do_tick(st, st->field);
     populate_edges(st->field, 0);
   }
 
@@ -382,11 +544,8 @@ cloudlife_event (Display *dpy, Window window, void *closure, XEvent *event)
     {
       XClearWindow (dpy, window);
       st->cycles = 0;
-      if (st->field) {
-        free (st->field->cells);
-        free (st->field->new_cells);
-        free (st->field);
-      }
+      if (st->field)
+        free_field (st->field);
       st->field = init_field(st);
       return True;
     }
@@ -397,9 +556,10 @@ static void
 cloudlife_free (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
-  free (st->field->cells);
-  free (st->field->new_cells);
-  free (st->field);
+  if (st->threadpool.count)
+    threadpool_destroy (&st->threadpool);
+  free (st->thread_counts);
+  free_field (st->field);
   free (st->colors);
   XFreeGC (dpy, st->fgc);
   XFreeGC (dpy, st->bgc);
@@ -417,6 +577,7 @@ static const char *cloudlife_defaults[] = {
     "*maxAge:		64",
     "*initialDensity:	30",
     "*cellSize:		3",
+    THREAD_DEFAULTS
 #ifdef HAVE_MOBILE
     "*ignoreRotation:   True",
 #endif
@@ -432,6 +593,7 @@ static XrmOptionDescRec cloudlife_options[] = {
     {"-cell-size", ".cellSize", XrmoptionSepArg, 0},
     {"-initial-density", ".initialDensity", XrmoptionSepArg, 0},
     {"-max-age", ".maxAge", XrmoptionSepArg, 0},
+    THREAD_OPTIONS
     {0, 0, 0, 0}
 };
 
@@ -69,6 +69,7 @@ static const char sccsid[] = "@(#)demon.c	5.00 2000/11/01 xlockmore";
 # include "xlock.h"		/* in xlockmore distribution */
 #endif /* STANDALONE */
 #include "automata.h"
+#include "xbatch.h"
 
 #ifdef MODE_demon
 
@@ -138,6 +139,7 @@ typedef struct {
 	int         init_bits;
 	GC          stippledGC;
 	Pixmap      pixmaps[NUMSTIPPLES - 1];
+	xbatch     *batch;
 	union {
 		XPoint      hexagon[6];
 		XPoint      triangle[2][3];
@@ -156,18 +158,18 @@ static void
 drawcell(ModeInfo * mi, int col, int row, unsigned char state)
 {
 	demonstruct *dp = &demons[MI_SCREEN(mi)];
-	GC          gc;
 
 	if (!state) {
-		XSetForeground(MI_DISPLAY(mi), MI_GC(mi), MI_BLACK_PIXEL(mi));
-		gc = MI_GC(mi);
+		xbatch_set_foreground(dp->batch, MI_GC(mi), MI_BLACK_PIXEL(mi));
 	} else if (MI_NPIXELS(mi) >= NUMSTIPPLES) {
-		XSetForeground(MI_DISPLAY(mi), MI_GC(mi),
+		xbatch_set_foreground(dp->batch, MI_GC(mi),
 			   MI_PIXEL(mi, (((int) state - 1) * MI_NPIXELS(mi) /
 					 (dp->states - 1)) % MI_NPIXELS(mi)));
-		gc = MI_GC(mi);
 	} else {
 		XGCValues   gcv;
+
+		/* Cells already batched need the old stipple. */
+		xbatch_flush(dp->batch);
 #ifdef DO_STIPPLE
 		gcv.stipple = dp->pixmaps[(state - 1) % (NUMSTIPPLES - 1)];
 #endif /* DO_STIPPLE */
@@ -175,7 +177,7 @@ drawcell(ModeInfo * mi, int col, int row, unsigned char state)
 		gcv.background = MI_BLACK_PIXEL(mi);
 		XChangeGC(MI_DISPLAY(mi), dp->stippledGC,
 			  GCStipple | GCForeground | GCBackground, &gcv);
-		gc = dp->stippledGC;
+		xbatch_set_gc(dp->batch, dp->stippledGC);
 	}
 	if (dp->neighbors == 6) {
 		int         ccol = 2 * col + !(row & 1), crow = 2 * row;
@@ -183,13 +185,13 @@ drawcell(ModeInfo * mi, int col, int row, unsigned char state)
 		dp->shape.hexagon[0].x = dp->xb + ccol * dp->xs;
 		dp->shape.hexagon[0].y = dp->yb + crow * dp->ys;
 		if (dp->xs == 1 && dp->ys == 1)
-			XDrawPoint(MI_DISPLAY(mi), MI_WINDOW(mi),
-				       gc, dp->shape.hexagon[0].x, dp->shape.hexagon[0].y);
+			xbatch_point(dp->batch,
+				     dp->shape.hexagon[0].x, dp->shape.hexagon[0].y);
 		else
-			XFillPolygon(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_fill_polygon(dp->batch,
 			    dp->shape.hexagon, 6, Convex, CoordModePrevious);
 	} else if (dp->neighbors == 4 || dp->neighbors == 8) {
-		XFillRectangle(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+		xbatch_fill_rectangle(dp->batch,
 		dp->xb + dp->xs * col, dp->yb + dp->ys * row,
 		dp->xs - (dp->xs > 3), dp->ys - (dp->ys > 3));
 	} else {		/* TRI */
@@ -198,7 +200,7 @@ drawcell(ModeInfo * mi, int col, int row, unsigned char state)
 		dp->shape.triangle[orient][0].x = dp->xb + col * dp->xs;
 		dp->shape.triangle[orient][0].y = dp->yb + row * dp->ys;
 		if (dp->xs <= 3 || dp->ys <= 3)
-			XDrawPoint(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_point(dp->batch,
 			((orient) ? -1 : 1) + dp->shape.triangle[orient][0].x,
 				       dp->shape.triangle[orient][0].y);
 		else {
@@ -206,7 +208,7 @@ drawcell(ModeInfo * mi, int col, int row, unsigned char state)
 				dp->shape.triangle[orient][0].x += (dp->xs / 2 - 1);
 			else
 				dp->shape.triangle[orient][0].x -= (dp->xs / 2 - 1);
-			XFillPolygon(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_fill_polygon(dp->batch,
 				     dp->shape.triangle[orient], 3, Convex, CoordModePrevious);
 
 		}
@@ -294,6 +296,10 @@ free_demon(ModeInfo * mi)
 		XFreePixmap(display, dp->pixmaps[shade]);
 	}
 	dp->init_bits = 0;
+	if (dp->batch != NULL) {
+		xbatch_free(dp->batch);
+		dp->batch = (xbatch *) NULL;
+	}
 	free_struct(dp);
 }
 
@@ -301,21 +307,19 @@ static Bool
 draw_state(ModeInfo * mi, int state)
 {
 	demonstruct *dp = &demons[MI_SCREEN(mi)];
-	GC          gc;
-	XRectangle *rects;
 	CellList   *current;
 
 	if (!state) {
-		XSetForeground(MI_DISPLAY(mi), MI_GC(mi), MI_BLACK_PIXEL(mi));
-		gc = MI_GC(mi);
+		xbatch_set_foreground(dp->batch, MI_GC(mi), MI_BLACK_PIXEL(mi));
 	} else if (MI_NPIXELS(mi) >= NUMSTIPPLES) {
-		XSetForeground(MI_DISPLAY(mi), MI_GC(mi),
+		xbatch_set_foreground(dp->batch, MI_GC(mi),
 			   MI_PIXEL(mi, (((int) state - 1) * MI_NPIXELS(mi) /
 					 (dp->states - 1)) % MI_NPIXELS(mi)));
-		gc = MI_GC(mi);
 	} else {
 		XGCValues   gcv;
 
+		xbatch_flush(dp->batch);
+
 #ifdef DO_STIPPLE
 		gcv.stipple = dp->pixmaps[(state - 1) % (NUMSTIPPLES - 1)];
 #endif /* DO_STIPPLE */
@@ -323,9 +327,9 @@ draw_state(ModeInfo * mi, int state)
 		gcv.background = MI_BLACK_PIXEL(mi);
 		XChangeGC(MI_DISPLAY(mi), dp->stippledGC,
 			  GCStipple | GCForeground | GCBackground, &gcv);
-		gc = dp->stippledGC;
+		xbatch_set_gc(dp->batch, dp->stippledGC);
 	}
-	if (dp->neighbors == 6) {	/* Draw right away, slow */
+	if (dp->neighbors == 6) {
 		current = dp->cellList[state];
 		while (current) {
 			int         col, row, ccol, crow;
@@ -336,35 +340,22 @@ draw_state(ModeInfo * mi, int state)
 			dp->shape.hexagon[0].x = dp->xb + ccol * dp->xs;
 			dp->shape.hexagon[0].y = dp->yb + crow * dp->ys;
 			if (dp->xs == 1 && dp->ys == 1)
-				XDrawPoint(MI_DISPLAY(mi), MI_WINDOW(mi),
-					       gc, dp->shape.hexagon[0].x, dp->shape.hexagon[0].y);
+				xbatch_point(dp->batch,
+					     dp->shape.hexagon[0].x, dp->shape.hexagon[0].y);
 			else
-				XFillPolygon(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+				xbatch_fill_polygon(dp->batch,
 					     dp->shape.hexagon, 6, Convex, CoordModePrevious);
 			current = current->next;
 		}
 	} else if (dp->neighbors == 4 || dp->neighbors == 8) {
-		/* Take advantage of XDrawRectangles */
-		int         ncells = 0;
-
-		/* Create Rectangle list from part of the cellList */
-		if ((rects = (XRectangle *) malloc(dp->ncells[state] *
-			 sizeof (XRectangle))) == NULL) {
-			return False;
-		}
 		current = dp->cellList[state];
 		while (current) {
-			rects[ncells].x = dp->xb + current->pt.x * dp->xs;
-			rects[ncells].y = dp->yb + current->pt.y * dp->ys;
-			rects[ncells].width = dp->xs - (dp->xs > 3);
-			rects[ncells].height = dp->ys - (dp->ys > 3);
+			xbatch_fill_rectangle(dp->batch,
+				dp->xb + current->pt.x * dp->xs,
+				dp->yb + current->pt.y * dp->ys,
+				dp->xs - (dp->xs > 3), dp->ys - (dp->ys > 3));
 			current = current->next;
-			ncells++;
 		}
-		/* Finally get to draw */
-		XFillRectangles(MI_DISPLAY(mi), MI_WINDOW(mi), gc, rects, ncells);
-		/* Free up rects list and the appropriate part of the cellList */
-		(void) free((void *) rects);
 	} else {		/* TRI */
 		current = dp->cellList[state];
 		while (current) {
@@ -376,7 +367,7 @@ draw_state(ModeInfo * mi, int state)
 			dp->shape.triangle[orient][0].x = dp->xb + col * dp->xs;
 			dp->shape.triangle[orient][0].y = dp->yb + row * dp->ys;
 			if (dp->xs <= 3 || dp->ys <= 3)
-				XDrawPoint(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+				xbatch_point(dp->batch,
 					       ((orient) ? -1 : 1) + dp->shape.triangle[orient][0].x,
 				      dp->shape.triangle[orient][0].y);
 			else {
@@ -384,7 +375,7 @@ draw_state(ModeInfo * mi, int state)
 					dp->shape.triangle[orient][0].x += (dp->xs / 2 - 1);
 				else
 					dp->shape.triangle[orient][0].x -= (dp->xs / 2 - 1);
-				XFillPolygon(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+				xbatch_fill_polygon(dp->batch,
 					     dp->shape.triangle[orient], 3, Convex, CoordModePrevious);
 			}
 			current = current->next;
@@ -425,6 +416,11 @@ init_demon (ModeInfo * mi)
 
 	dp->generation = 0;
 	dp->redrawing = 0;
+	if (dp->batch == NULL &&
+	    (dp->batch = xbatch_new(MI_DISPLAY(mi), MI_WINDOW(mi))) == NULL) {
+		free_demon(mi);
+		return;
+	}
 #ifdef DO_STIPPLE
 	if (MI_NPIXELS(mi) < NUMSTIPPLES) {
           Window window = MI_WINDOW(mi);
@@ -930,6 +926,7 @@ draw_demon (ModeInfo * mi)
 			}
 		}
 	}
+	xbatch_flush(dp->batch);
 }
 
 #ifndef STANDALONE
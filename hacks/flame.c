@@ -50,10 +50,11 @@
 
 #include <math.h>
 #include "screenhack.h"
+#include "accumimage.h"
+#include "thread_util.h"
 
 #include <signal.h>		/* so we can ignore SIGFPE */
 
-#define POINT_BUFFER_SIZE 10
 #define MAXLEV 4
 #define MAXKINDS  10
 
@@ -69,13 +70,12 @@ struct state {
   int variation;
   int snum;
   int anum;
-  int num_points;
-  int total_points;
   int pixcol;
+  int color;			/* the color of this frame's points */
   int ncolors;
   XColor *colors;
-  XRectangle points [POINT_BUFFER_SIZE];
-  GC gc;
+  unsigned long background;
+  accumimage *accum;
 
   int delay, delay2;
   int width, height;
@@ -84,7 +84,6 @@ struct state {
 
   int flame_alt;
   int do_reset;
-  int scale;
 };
 
 
@@ -110,7 +109,6 @@ static void *
 flame_init (Display *dpy, Window window)
 {
   struct state *st = (struct state *) calloc (1, sizeof(*st));
-  XGCValues gcv;
   XWindowAttributes xgwa;
   Colormap cmap;
 
@@ -133,14 +131,10 @@ flame_init (Display *dpy, Window window)
   st->max_points = get_integer_resource (st->dpy, "iterations", "Integer");
   if (st->max_points <= 0) st->max_points = 100;
 
-  st->scale = 1;
-  if (st->width > 2560 || st->height > 2560)
-    st->scale *= 2;  /* Retina displays */
-
   st->max_levels = st->max_points;
 
   st->max_total = get_integer_resource (st->dpy, "points", "Integer");
-  if (st->max_total <= 0) st->max_total = 10000;
+  if (st->max_total <= 0) st->max_total = 200000;
 
   st->delay = get_integer_resource (st->dpy, "delay", "Integer");
   if (st->delay < 0) st->delay = 0;
@@ -163,184 +157,196 @@ flame_init (Display *dpy, Window window)
 	mono_p = True, st->ncolors = 0;
     }
 
-  gcv.foreground = get_pixel_resource (st->dpy, cmap, "foreground", "Foreground");
-  gcv.background = get_pixel_resource (st->dpy, cmap, "background", "Background");
+  st->background = get_pixel_resource (st->dpy, cmap,
+                                       "background", "Background");
 
-  if (! mono_p)
+  if (mono_p)
     {
-      st->pixcol = halfrandom (st, st->ncolors);
-      gcv.foreground = (st->colors [st->pixcol].pixel);
+      if (! st->colors)
+        st->colors = (XColor *) malloc (sizeof (*st->colors));
+      st->ncolors = 1;
+      st->colors[0].pixel = get_pixel_resource (st->dpy, cmap,
+                                                "foreground", "Foreground");
+      XQueryColor (st->dpy, cmap, &st->colors[0]);
     }
+  else
+    st->pixcol = halfrandom (st, st->ncolors);
+  st->color = st->pixcol;
 
-  st->gc = XCreateGC (st->dpy, st->window, GCForeground | GCBackground, &gcv);
   return st;
 }
 
-static int
-recurse (struct state *st, double x, double y, int l, Display *dpy, Window win)
+/* Applies function i, with the current variation if it is one of the
+   alternate ones. */
+static void
+transform (const struct state *st, int i, double *xp, double *yp)
 {
-  int i;
+  double x = *xp, y = *yp;
   double nx, ny;
 
-  if (l == st->max_levels)
-    {
-      st->total_points++;
-      if (st->total_points > st->max_total) /* how long each fractal runs */
-	return 0;
+  /* Scale back when values get very large. Spot sez:
+     "I think this happens on HPUX.  I think it's non-IEEE
+     to generate an exception instead of a silent NaN."
+   */
+  if ((fabs(x) > 1.0E5) || (fabs(y) > 1.0E5))
+    x = x / y;
 
-      if (x > -1.0 && x < 1.0 && y > -1.0 && y < 1.0)
-	{
-	  st->points[st->num_points].x = (int) ((st->width / 2) * (x + 1.0));
-	  st->points[st->num_points].y = (int) ((st->height / 2) * (y + 1.0));
-          st->points[st->num_points].width = 
-            st->points[st->num_points].height = st->scale;
-	  st->num_points++;
-	  if (st->num_points >= POINT_BUFFER_SIZE)
-	    {
-	      XFillRectangles (st->dpy, win, st->gc, st->points,
-                               st->num_points);
-	      st->num_points = 0;
-	    }
-	}
-    }
-  else
+  nx = st->f[0][0][i] * x + st->f[0][1][i] * y + st->f[0][2][i];
+  ny = st->f[1][0][i] * x + st->f[1][1][i] * y + st->f[1][2][i];
+  if (i < st->anum)
     {
-      for (i = 0; i < st->snum; i++)
+      switch (st->variation)
 	{
-
-	  /* Scale back when values get very large. Spot sez:
-	     "I think this happens on HPUX.  I think it's non-IEEE
-	     to generate an exception instead of a silent NaN."
-	   */
-	  if ((fabs(x) > 1.0E5) || (fabs(y) > 1.0E5))
-	    x = x / y;
-
-	  nx = st->f[0][0][i] * x + st->f[0][1][i] * y + st->f[0][2][i];
-	  ny = st->f[1][0][i] * x + st->f[1][1][i] * y + st->f[1][2][i];
-	  if (i < st->anum)
-	    {
-	      switch (st->variation)
-		{
-		case 0:	/* sinusoidal */
-		  nx = sin(nx);
-		  ny = sin(ny);
-		  break;
-		case 1:	/* complex */
-		  {
-		    double r2 = nx * nx + ny * ny + 1e-6;
-		    nx = nx / r2;
-		    ny = ny / r2;
-		  }
-		  break;
-		case 2:	/* bent */
-		  if (nx < 0.0)
-		    nx = nx * 2.0;
-		  if (ny < 0.0)
-		    ny = ny / 2.0;
-		  break;
-		case 3:	/* swirl */
-		  {
-		    double r = (nx * nx + ny * ny);	/* times k here is fun */
-		    double c1 = sin(r);
-		    double c2 = cos(r);
-		    double t = nx;
-
-		    if (nx > 1e4 || nx < -1e4 || ny > 1e4 || ny < -1e4)
-		      ny = 1e4;
-		    else
-		      ny = c2 * t + c1 * ny;
-		    nx = c1 * nx - c2 * ny;
-		  }
-		  break;
-		case 4:	/* horseshoe */
-		  {
-		    double r, c1, c2, t;
-
-		    /* Avoid atan2: DOMAIN error message */
-		    if (nx == 0.0 && ny == 0.0)
-		      r = 0.0;
-		    else
-		      r = atan2(nx, ny);      /* times k here is fun */
-		    c1 = sin(r);
-		    c2 = cos(r);
-		    t = nx;
-
-		    nx = c1 * nx - c2 * ny;
-		    ny = c2 * t + c1 * ny;
-		  }
-		  break;
-		case 5:	/* drape */
-		  {
-		    double t;
-
-		    /* Avoid atan2: DOMAIN error message */
-		    if (nx == 0.0 && ny == 0.0)
-		      t = 0.0;
-		    else
-		      t = atan2(nx, ny) / M_PI;
-
-		    if (nx > 1e4 || nx < -1e4 || ny > 1e4 || ny < -1e4)
-		      ny = 1e4;
-		    else
-		      ny = sqrt(nx * nx + ny * ny) - 1.0;
-		    nx = t;
-		  }
-		  break;
-		case 6:	/* broken */
-		  if (nx > 1.0)
-		    nx = nx - 1.0;
-		  if (nx < -1.0)
-		    nx = nx + 1.0;
-		  if (ny > 1.0)
-		    ny = ny - 1.0;
-		  if (ny < -1.0)
-		    ny = ny + 1.0;
-		  break;
-		case 7:	/* spherical */
-		  {
-		    double r = 0.5 + sqrt(nx * nx + ny * ny + 1e-6);
-
-		    nx = nx / r;
-		    ny = ny / r;
-		  }
-		  break;
-		case 8:	/*  */
-		  nx = atan(nx) / M_PI_2;
-		  ny = atan(ny) / M_PI_2;
-		  break;
+	case 0:	/* sinusoidal */
+	  nx = sin(nx);
+	  ny = sin(ny);
+	  break;
+	case 1:	/* complex */
+	  {
+	    double r2 = nx * nx + ny * ny + 1e-6;
+	    nx = nx / r2;
+	    ny = ny / r2;
+	  }
+	  break;
+	case 2:	/* bent */
+	  if (nx < 0.0)
+	    nx = nx * 2.0;
+	  if (ny < 0.0)
+	    ny = ny / 2.0;
+	  break;
+	case 3:	/* swirl */
+	  {
+	    double r = (nx * nx + ny * ny);	/* times k here is fun */
+	    double c1 = sin(r);
+	    double c2 = cos(r);
+	    double t = nx;
+
+	    if (nx > 1e4 || nx < -1e4 || ny > 1e4 || ny < -1e4)
+	      ny = 1e4;
+	    else
+	      ny = c2 * t + c1 * ny;
+	    nx = c1 * nx - c2 * ny;
+	  }
+	  break;
+	case 4:	/* horseshoe */
+	  {
+	    double r, c1, c2, t;
+
+	    /* Avoid atan2: DOMAIN error message */
+	    if (nx == 0.0 && ny == 0.0)
+	      r = 0.0;
+	    else
+	      r = atan2(nx, ny);      /* times k here is fun */
+	    c1 = sin(r);
+	    c2 = cos(r);
+	    t = nx;
+
+	    nx = c1 * nx - c2 * ny;
+	    ny = c2 * t + c1 * ny;
+	  }
+	  break;
+	case 5:	/* drape */
+	  {
+	    double t;
+
+	    /* Avoid atan2: DOMAIN error message */
+	    if (nx == 0.0 && ny == 0.0)
+	      t = 0.0;
+	    else
+	      t = atan2(nx, ny) / M_PI;
+
+	    if (nx > 1e4 || nx < -1e4 || ny > 1e4 || ny < -1e4)
+	      ny = 1e4;
+	    else
+	      ny = sqrt(nx * nx + ny * ny) - 1.0;
+	    nx = t;
+	  }
+	  break;
+	case 6:	/* broken */
+	  if (nx > 1.0)
+	    nx = nx - 1.0;
+	  if (nx < -1.0)
+	    nx = nx + 1.0;
+	  if (ny > 1.0)
+	    ny = ny - 1.0;
+	  if (ny < -1.0)
+	    ny = ny + 1.0;
+	  break;
+	case 7:	/* spherical */
+	  {
+	    double r = 0.5 + sqrt(nx * nx + ny * ny + 1e-6);
+
+	    nx = nx / r;
+	    ny = ny / r;
+	  }
+	  break;
+	case 8:	/*  */
+	  nx = atan(nx) / M_PI_2;
+	  ny = atan(ny) / M_PI_2;
+	  break;
 /* #if 0 */  /* core dumps on some machines, why not all? */
-		case 9:	/* complex sine */
-		  {
-		    double u = nx;
-		    double v = ny;
-		    double ev = exp(v);
-		    double emv = exp(-v);
-
-		    nx = (ev + emv) * sin(u) / 2.0;
-		    ny = (ev - emv) * cos(u) / 2.0;
-		  }
-		  break;
-		case 10:	/* polynomial */
-		  if (nx < 0)
-		    nx = -nx * nx;
-		  else
-		    nx = nx * nx;
-		  if (ny < 0)
-		    ny = -ny * ny;
-		  else
-		    ny = ny * ny;
-		  break;
+	case 9:	/* complex sine */
+	  {
+	    double u = nx;
+	    double v = ny;
+	    double ev = exp(v);
+	    double emv = exp(-v);
+
+	    nx = (ev + emv) * sin(u) / 2.0;
+	    ny = (ev - emv) * cos(u) / 2.0;
+	  }
+	  break;
+	case 10:	/* polynomial */
+	  if (nx < 0)
+	    nx = -nx * nx;
+	  else
+	    nx = nx * nx;
+	  if (ny < 0)
+	    ny = -ny * ny;
+	  else
+	    ny = ny * ny;
+	  break;
 /* #endif */
-		default:
-		  nx = sin(nx);
-		  ny = sin(ny);
-		}
-	    }
-	  if (!recurse (st, nx, ny, l + 1, st->dpy, win))
-	    return 0;
+	default:
+	  nx = sin(nx);
+	  ny = sin(ny);
 	}
     }
-  return 1;
+
+  /* Start over from the middle if the orbit has gone to NaN. */
+  if (nx != nx || ny != ny)
+    nx = ny = 0;
+
+  *xp = nx;
+  *yp = ny;
+}
+
+
+/* Plays the chaos game: applies the functions in a random order, and
+   plots every point after the first few, which are still on their way to
+   the attractor.  Each thread does its share of the points of the frame.
+   This lands on the same set as applying every sequence of max_levels
+   functions to the origin, which is what this used to do, depth-first,
+   stopping after 'points' of them.
+ */
+static void
+flame_points (void *closure, accumimage_buffer *b,
+              unsigned thread, unsigned nthreads)
+{
+  const struct state *st = (const struct state *) closure;
+  long n = ((long) st->max_total * (thread + 1) / nthreads -
+            (long) st->max_total * thread / nthreads);
+  double hw = b->width / 2, hh = b->height / 2;
+  double x = 0, y = 0;
+  long i;
+
+  for (i = -20; i < n; i++)
+    {
+      transform (st, accumimage_random (b) % st->snum, &x, &y);
+      if (i >= 0 && x > -1.0 && x < 1.0 && y > -1.0 && y < 1.0)
+        ACCUMIMAGE_PLOT (b, (int) (hw * (x + 1.0)), (int) (hh * (y + 1.0)),
+                         st->color);
+    }
 }
 
 static unsigned long
@@ -350,10 +356,21 @@ flame_draw (Display *dpy, Window window, void *closure)
   int i, j, k;
   unsigned long this_delay = st->delay;
 
+  if (!st->accum)
+    {
+      st->accum = accumimage_new (st->dpy, st->window,
+                                  st->colors, st->ncolors, st->background);
+      if (!st->accum)
+        {
+          fprintf (stderr, "%s: out of memory\n", progname);
+          exit (1);
+        }
+    }
+
   if (st->do_reset)
     {
       st->do_reset = 0;
-      XClearWindow (st->dpy, st->window);
+      accumimage_clear (st->accum);
     }
 
   if (!(st->cur_level++ % st->max_levels))
@@ -367,7 +384,7 @@ flame_draw (Display *dpy, Window window, void *closure)
     {
       if (st->ncolors > 2)
 	{
-	  XSetForeground (st->dpy, st->gc, st->colors [st->pixcol].pixel);
+	  st->color = st->pixcol;
 	  if (--st->pixcol < 0)
 	    st->pixcol = st->ncolors - 1;
 	}
@@ -389,10 +406,8 @@ flame_draw (Display *dpy, Window window, void *closure)
 	for (j = 0; j < 3; j++)
 	  st->f[i][j][k] = ((double) (random() & 1023) / 512.0 - 1.0);
     }
-  st->num_points = 0;
-  st->total_points = 0;
-  recurse (st, 0.0, 0.0, 0, st->dpy, st->window);
-  XFillRectangles (st->dpy, st->window, st->gc, st->points, st->num_points);
+  accumimage_run (st->accum, flame_points, st);
+  accumimage_draw (st->accum);
 
   return this_delay;
 }
@@ -426,10 +441,11 @@ static const char *flame_defaults [] = {
   "*iterations:	25",
   "*delay:	50000",
   "*delay2:	2000000",
-  "*points:	10000",
+  "*points:	200000",
 #ifdef HAVE_MOBILE
   "*ignoreRotation: True",
 #endif
+  THREAD_DEFAULTS
   0
 };
 
@@ -439,6 +455,7 @@ static XrmOptionDescRec flame_options [] = {
   { "-delay",		".delay",	XrmoptionSepArg, 0 },
   { "-delay2",		".delay2",	XrmoptionSepArg, 0 },
   { "-points",		".points",	XrmoptionSepArg, 0 },
+  THREAD_OPTIONS
   { 0, 0, 0, 0 }
 };
 
@@ -449,6 +466,9 @@ flame_reshape (Display *dpy, Window window, void *closure,
   struct state *st = (struct state *) closure;
   st->width = w;
   st->height = h;
+  accumimage_free (st->accum);
+  st->accum = 0;
+  st->do_reset = 1;
 }
 
 static Bool
@@ -467,7 +487,7 @@ static void
 flame_free (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
-  XFreeGC (dpy, st->gc);
+  accumimage_free (st->accum);
   free (st->colors);
   free (st);
 }
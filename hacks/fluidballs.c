@@ -26,7 +26,13 @@
 
 #include <math.h>
 #include "screenhack.h"
+#include "thread_util.h"
 #include <stdio.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 
 #ifdef HAVE_DOUBLE_BUFFER_EXTENSION
 #include "xdbe.h"
@@ -69,6 +75,31 @@ typedef struct {
   float e;		/* coeficient of elasticity */
   float max_radius;	/* largest radius of any ball */
 
+  /* Each step the balls are sorted into a grid of cells one largest-ball
+     diameter wide, so that a ball can only touch the balls in its own cell
+     and the eight around it.  Cells are numbered row by row, so the three
+     cells of a row are one run of the sorted arrays. */
+  float cell_size;
+  int grid_w, grid_h;
+  int *cell_start;	/* where each cell begins in the sorted arrays */
+  int cells_size;
+  int *cell;		/* the cell of each ball */
+  int *sorted;		/* ball numbers, in cell order */
+  float *sx, *sy, *sr;	/* and their positions and radiuses */
+  float *svx, *svy, *sm;	/* velocities and masses, if threaded */
+  int *hits;		/* scratch for the single-threaded pass */
+  float *moved;		/* how far each ball has been pushed this step */
+  float max_moved;	/* the most that any ball has */
+
+  /* If non-zero, each frame is this many steps, each of which moves every
+     ball at once, as if the others held still, on a thread pool. */
+  int substeps;
+  float *npx, *npy, *nvx, *nvy;	/* where those steps put the balls */
+  struct threadpool pool;
+  int *collisions;	/* how many each thread saw, counting pairs twice */
+
+  XArc *arcs;		/* for drawing the balls all at once */
+
   Bool random_sizes_p;  /* Whether balls should be various sizes up to max. */
   Bool shake_p;		/* Whether to mess with gravity when things settle. */
   Bool dbuf;            /* Whether we're using double buffering. */
@@ -90,6 +121,30 @@ typedef struct {
 
 } b_state;
 
+typedef struct {
+  b_state *state;
+  unsigned id;
+  int *hits;
+} b_thread;
+
+
+static int
+b_thread_create (void *self, struct threadpool *pool, unsigned id)
+{
+  b_thread *t = (b_thread *) self;
+  t->state = GET_PARENT_OBJ (b_state, pool, pool);
+  t->id = id;
+  t->hits = (int *) malloc ((t->state->count + 1) * sizeof(*t->hits));
+  return t->hits ? 0 : ENOMEM;
+}
+
+static void
+b_thread_destroy (void *self)
+{
+  b_thread *t = (b_thread *) self;
+  free (t->hits);
+}
+
 
 /* Draws the frames per second string */
 static void 
@@ -396,6 +451,43 @@ fluidballs_init (Display *dpy, Window window)
   memcpy (state->opx, state->px, sizeof (*state->opx) * (state->count + 1));
   memcpy (state->opy, state->py, sizeof (*state->opx) * (state->count + 1));
 
+  state->cell_size = state->max_radius * 2;
+  state->cell   = (int *)   malloc (sizeof (*state->cell)   * (state->count + 1));
+  state->sorted = (int *)   malloc (sizeof (*state->sorted) * state->count);
+  state->hits   = (int *)   malloc (sizeof (*state->hits)   * state->count);
+  state->moved  = (float *) malloc (sizeof (*state->moved)  * (state->count + 1));
+  state->sx     = (float *) malloc (sizeof (*state->sx)     * state->count);
+  state->sy     = (float *) malloc (sizeof (*state->sy)     * state->count);
+  state->sr     = (float *) malloc (sizeof (*state->sr)     * state->count);
+  state->svx    = (float *) malloc (sizeof (*state->svx)    * state->count);
+  state->svy    = (float *) malloc (sizeof (*state->svy)    * state->count);
+  state->sm     = (float *) malloc (sizeof (*state->sm)     * state->count);
+  state->arcs   = (XArc *)  malloc (sizeof (*state->arcs)   * state->count);
+
+  state->substeps = get_integer_resource (dpy, "substeps", "Integer");
+  if (state->substeps < 0 || state->substeps > 100) state->substeps = 0;
+  if (state->substeps)
+    {
+      static const struct threadpool_class cls = {
+        sizeof(b_thread),
+        b_thread_create,
+        b_thread_destroy
+      };
+      unsigned nthreads = hardware_concurrency (dpy);
+      int error;
+      state->npx = (float *) malloc (sizeof (*state->npx) * (state->count+1));
+      state->npy = (float *) malloc (sizeof (*state->npy) * (state->count+1));
+      state->nvx = (float *) malloc (sizeof (*state->nvx) * (state->count+1));
+      state->nvy = (float *) malloc (sizeof (*state->nvy) * (state->count+1));
+      state->collisions = (int *) calloc (nthreads, sizeof(*state->collisions));
+      error = threadpool_create (&state->pool, &cls, dpy, nthreads);
+      if (error)
+        {
+          fprintf (stderr, "%s: threadpool: %s\n", progname, strerror(error));
+          exit (1);
+        }
+    }
+
   return state;
 }
 
@@ -503,60 +595,51 @@ check_wall_clock (b_state *state, float max_d)
     }
 }
 
+static void
+ball_arc (b_state *state, XArc *arc, float x, float y, float r)
+{
+  int x1 = (x - r - state->xmin);
+  int y1 = (y - r - state->ymin);
+  int x2 = (x + r - state->xmin);
+  int y2 = (y + r - state->ymin);
+  arc->x = x1;
+  arc->y = y1;
+  arc->width  = x2 - x1;
+  arc->height = y2 - y1;
+  arc->angle1 = 0;
+  arc->angle2 = 360*64;
+}
+
+
 /* Erases the balls at their previous positions, and draws the new ones.
  */
 static void
 repaint_balls (b_state *state)
 {
   int a;
-# ifndef HAVE_JWXYZ
-  int x1a, x2a, y1a, y2a;
-# endif
-  int x1b, x2b, y1b, y2b;
   float max_d = 0;
 
 #ifdef HAVE_JWXYZ	/* Don't second-guess Quartz's double-buffering */
   XClearWindow (state->dpy, state->b);
-#endif
-
-  for (a=1; a <= state->count; a++)
+#else  /* !HAVE_JWXYZ */
+# ifdef HAVE_DOUBLE_BUFFER_EXTENSION
+  if (!state->dbeclear_p || !state->backb)
+# endif /* HAVE_DOUBLE_BUFFER_EXTENSION */
     {
-      GC gc;
-# ifndef HAVE_JWXYZ
-      x1a = (state->opx[a] - state->r[a] - state->xmin);
-      y1a = (state->opy[a] - state->r[a] - state->ymin);
-      x2a = (state->opx[a] + state->r[a] - state->xmin);
-      y2a = (state->opy[a] + state->r[a] - state->ymin);
-# endif
-
-      x1b = (state->px[a] - state->r[a] - state->xmin);
-      y1b = (state->py[a] - state->r[a] - state->ymin);
-      x2b = (state->px[a] + state->r[a] - state->xmin);
-      y2b = (state->py[a] + state->r[a] - state->ymin);
-
-#ifndef HAVE_JWXYZ	/* Don't second-guess Quartz's double-buffering */
-#ifdef HAVE_DOUBLE_BUFFER_EXTENSION
-      if (!state->dbeclear_p || !state->backb)
-#endif /* HAVE_DOUBLE_BUFFER_EXTENSION */
-	{
-/*	  if (x1a != x1b || y1a != y1b)   -- leaves turds if we optimize this */
-	    {
-	      gc = state->erase_gc;
-	      XFillArc (state->dpy, state->b, gc,
-			x1a, y1a, x2a-x1a, y2a-y1a,
-			0, 360*64);
-	    }
-	}
+      /* Erase them all before drawing any, so that no ball loses a bite
+         to the erasing of its neighbour. */
+      for (a=1; a <= state->count; a++)
+        ball_arc (state, &state->arcs[a-1],
+                  state->opx[a], state->opy[a], state->r[a]);
+      XFillArcs (state->dpy, state->b, state->erase_gc,
+                 state->arcs, state->count);
+    }
 #endif /* !HAVE_JWXYZ */
 
-      if (state->mouse_ball == a)
-        gc = state->draw_gc2;
-      else
-        gc = state->draw_gc;
-
-      XFillArc (state->dpy, state->b, gc,
-                x1b, y1b, x2b-x1b, y2b-y1b,
-                0, 360*64);
+  for (a=1; a <= state->count; a++)
+    {
+      ball_arc (state, &state->arcs[a-1],
+                state->px[a], state->py[a], state->r[a]);
 
       if (state->shake_p)
         {
@@ -572,6 +655,11 @@ repaint_balls (b_state *state)
       state->opy[a] = state->py[a];
     }
 
+  XFillArcs (state->dpy, state->b, state->draw_gc, state->arcs, state->count);
+  if (state->mouse_ball)
+    XFillArcs (state->dpy, state->b, state->draw_gc2,
+               &state->arcs[state->mouse_ball-1], 1);
+
   if (state->fps_p
 #ifdef HAVE_DOUBLE_BUFFER_EXTENSION
       && (state->backb ? state->dbeclear_p : 1)
@@ -609,16 +697,318 @@ repaint_balls (b_state *state)
 }
 
 
-/* Implements the laws of physics: move balls to their new positions.
+/* The grid cell that a point is in, or the nearest one.
+ */
+static int
+cell_of (const b_state *state, float px, float py)
+{
+  int x = (px - state->xmin) / state->cell_size;
+  int y = (py - state->ymin) / state->cell_size;
+  if (x < 0) x = 0; else if (x >= state->grid_w) x = state->grid_w - 1;
+  if (y < 0) y = 0; else if (y >= state->grid_h) y = state->grid_h - 1;
+  return y * state->grid_w + x;
+}
+
+
+/* Sorts the balls into the grid, and copies what the collision tests need
+   into the sorted arrays.
  */
 static void
-update_balls (b_state *state)
+bin_balls (b_state *state)
+{
+  int a, c, ncells;
+  float inv = 1 / state->cell_size;
+
+  state->grid_w = (state->xmax - state->xmin) * inv + 1;
+  state->grid_h = (state->ymax - state->ymin) * inv + 1;
+  if (state->grid_w < 1) state->grid_w = 1;
+  if (state->grid_h < 1) state->grid_h = 1;
+  ncells = state->grid_w * state->grid_h;
+
+  if (ncells + 1 > state->cells_size)
+    {
+      state->cells_size = ncells + 1;
+      free (state->cell_start);
+      state->cell_start = (int *)
+        malloc (state->cells_size * sizeof(*state->cell_start));
+      if (!state->cell_start) abort();
+    }
+
+  memset (state->cell_start, 0, (ncells + 1) * sizeof(*state->cell_start));
+  for (a=1; a <= state->count; a++)
+    {
+      c = cell_of (state, state->px[a], state->py[a]);
+      state->cell[a] = c;
+      state->cell_start[c]++;
+    }
+
+  /* Turn the counts into the end of each cell, then hand out places from
+     the end backward, leaving each cell_start at the start of its cell and
+     each cell's balls in ascending order. */
+  for (c = 1; c < ncells; c++)
+    state->cell_start[c] += state->cell_start[c-1];
+  state->cell_start[ncells] = state->count;
+
+  for (a = state->count; a >= 1; a--)
+    {
+      int j = --state->cell_start[state->cell[a]];
+      state->sorted[j] = a;
+      state->sx[j]  = state->px[a];
+      state->sy[j]  = state->py[a];
+      state->sr[j]  = state->r[a];
+      if (state->substeps)
+        {
+          state->svx[j] = state->vx[a];
+          state->svy[j] = state->vy[a];
+          state->sm[j]  = state->m[a];
+        }
+    }
+}
+
+
+/* Stores in hits the places in the sorted arrays of the balls that overlap
+   a ball of radius r at x,y in the given cell, and returns how many.  The
+   search covers the cells up to 'rings' away, which must be far enough
+   for r plus the largest radius.  hits must have room for every ball.
+ */
+static int
+touching (const b_state *state, int c, int rings,
+          float x, float y, float r, int *hits)
+{
+  int cx = c % state->grid_w;
+  int cy = c / state->grid_w;
+  int x0 = (cx > rings ? cx - rings : 0);
+  int x1 = (cx < state->grid_w - 1 - rings ? cx + rings : state->grid_w - 1);
+  int row, n = 0;
+
+  for (row = (cy > rings ? cy - rings : 0);
+       row <= cy + rings && row < state->grid_h;
+       row++)
+    {
+      int j  = state->cell_start[row * state->grid_w + x0];
+      int j1 = state->cell_start[row * state->grid_w + x1 + 1];
+
+#ifdef __SSE2__
+      __m128 x4 = _mm_set1_ps (x);
+      __m128 y4 = _mm_set1_ps (y);
+      __m128 r4 = _mm_set1_ps (r);
+      for (; j + 4 <= j1; j += 4)
+        {
+          __m128 dx = _mm_sub_ps (_mm_loadu_ps (state->sx + j), x4);
+          __m128 dy = _mm_sub_ps (_mm_loadu_ps (state->sy + j), y4);
+          __m128 rr = _mm_add_ps (_mm_loadu_ps (state->sr + j), r4);
+          int m = _mm_movemask_ps (
+            _mm_cmplt_ps (_mm_add_ps (_mm_mul_ps (dx, dx),
+                                      _mm_mul_ps (dy, dy)),
+                          _mm_mul_ps (rr, rr)));
+          if (m & 1) hits[n++] = j;
+          if (m & 2) hits[n++] = j + 1;
+          if (m & 4) hits[n++] = j + 2;
+          if (m & 8) hits[n++] = j + 3;
+        }
+#endif /* __SSE2__ */
+
+      for (; j < j1; j++)
+        {
+          float dx = state->sx[j] - x;
+          float dy = state->sy[j] - y;
+          float rr = state->sr[j] + r;
+          if (dx * dx + dy * dy < rr * rr)
+            hits[n++] = j;
+        }
+    }
+  return n;
+}
+
+
+static int
+cmp_ints (const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+
+/* If balls a and b overlap, pushes them apart and bounces them.
+ */
+static Bool
+collide (b_state *state, int a, int b)
 {
-  int a, b;
   float d, vxa, vya, vxb, vyb, dd, cdx, cdy;
   float ma, mb, vca, vcb, dva, dvb;
   float dee2;
 
+  d = ((state->px[a] - state->px[b]) *
+       (state->px[a] - state->px[b]) +
+       (state->py[a] - state->py[b]) *
+       (state->py[a] - state->py[b]));
+  dee2 = (state->r[a] + state->r[b]) *
+         (state->r[a] + state->r[b]);
+  if (d >= dee2)
+    return False;
+
+  d = sqrt(d);
+  dd = state->r[a] + state->r[b] - d;
+
+  state->moved[a] += 0.5 * dd;
+  state->moved[b] += 0.5 * dd;
+  if (state->moved[a] > state->max_moved) state->max_moved = state->moved[a];
+  if (state->moved[b] > state->max_moved) state->max_moved = state->moved[b];
+
+  cdx = (state->px[b] - state->px[a]) / d;
+  cdy = (state->py[b] - state->py[a]) / d;
+
+  /* Move each ball apart from the other by half the
+   * 'collision' distance.
+   */
+  state->px[a] -= 0.5 * dd * cdx;
+  state->py[a] -= 0.5 * dd * cdy;
+  state->px[b] += 0.5 * dd * cdx;
+  state->py[b] += 0.5 * dd * cdy;
+
+  ma = state->m[a];
+  mb = state->m[b];
+
+  vxa = state->vx[a];
+  vya = state->vy[a];
+  vxb = state->vx[b];
+  vyb = state->vy[b];
+
+  vca = vxa * cdx + vya * cdy; /* the component of each velocity */
+  vcb = vxb * cdx + vyb * cdy; /* along the axis of the collision */
+
+  /* elastic collison */
+  dva = (vca * (ma - mb) + vcb * 2 * mb) / (ma + mb) - vca;
+  dvb = (vcb * (mb - ma) + vca * 2 * ma) / (ma + mb) - vcb;
+
+  dva *= state->e; /* some energy lost to inelasticity */
+  dvb *= state->e;
+
+#if 0
+  dva += (frand (50) - 25) / ma;   /* q: why are elves so chaotic? */
+  dvb += (frand (50) - 25) / mb;   /* a: brownian motion. */
+#endif
+
+  vxa += dva * cdx;
+  vya += dva * cdy;
+  vxb += dvb * cdx;
+  vyb += dvb * cdy;
+
+  state->vx[a] = vxa;
+  state->vy[a] = vya;
+  state->vx[b] = vxb;
+  state->vy[b] = vyb;
+  return True;
+}
+
+
+/* Forces a ball to be on screen, then applies gravity to it over time t.
+ */
+static void
+confine_and_fall (const b_state *state, int a, float t,
+                  float *px, float *py, float *vx, float *vy)
+{
+  float r = state->r[a];
+  if (*px <= (state->xmin + r))
+    {
+      *px = state->xmin + r;
+      *vx = -*vx * state->e;
+    }
+  if (*px >= (state->xmax - r))
+    {
+      *px = state->xmax - r;
+      *vx = -*vx * state->e;
+    }
+  if (*py <= (state->ymin + r))
+    {
+      *py = state->ymin + r;
+      *vy = -*vy * state->e;
+    }
+  if (*py >= (state->ymax - r))
+    {
+      *py = state->ymax - r;
+      *vy = -*vy * state->e;
+    }
+
+  if (a != state->mouse_ball)
+    {
+      *vx += state->accx * t;
+      *vy += state->accy * t;
+      *px += *vx * t;
+      *py += *vy * t;
+    }
+}
+
+
+/* One step of the threaded mode, for this thread's share of the sorted
+   balls.  Each ball is pushed and bounced by everything it overlaps as of
+   the start of the step, and the result goes in the n arrays, so the
+   threads never write to the same ball.
+ */
+static void
+substep_thread (void *self)
+{
+  b_thread *t = (b_thread *) self;
+  b_state *state = t->state;
+  int j0 = (int) ((long) state->count * t->id       / state->pool.count);
+  int j1 = (int) ((long) state->count * (t->id + 1) / state->pool.count);
+  float h = state->tc / state->substeps;
+  int collisions = 0;
+  int j, k;
+
+  for (j = j0; j < j1; j++)
+    {
+      int a = state->sorted[j];
+      float x = state->sx[j], y = state->sy[j], r = state->sr[j];
+      float vx = state->svx[j], vy = state->svy[j], ma = state->sm[j];
+      float dx = 0, dy = 0, dvx = 0, dvy = 0;
+      int n = touching (state, state->cell[a], 1, x, y, r, t->hits);
+
+      for (k = 0; k < n; k++)
+        {
+          int jb = t->hits[k];
+          float d, dd, cdx, cdy, mb, vca, vcb, dva;
+          if (jb == j) continue;
+          d = ((x - state->sx[jb]) * (x - state->sx[jb]) +
+               (y - state->sy[jb]) * (y - state->sy[jb]));
+          d = sqrt(d);
+          if (d <= 0) continue;
+          dd = r + state->sr[jb] - d;
+          cdx = (state->sx[jb] - x) / d;
+          cdy = (state->sy[jb] - y) / d;
+          dx -= 0.5 * dd * cdx;
+          dy -= 0.5 * dd * cdy;
+
+          mb  = state->sm[jb];
+          vca = vx * cdx + vy * cdy;
+          vcb = state->svx[jb] * cdx + state->svy[jb] * cdy;
+          dva = ((vca * (ma - mb) + vcb * 2 * mb) / (ma + mb) - vca) *
+                state->e;
+          dvx += dva * cdx;
+          dvy += dva * cdy;
+          collisions++;
+        }
+
+      x  += dx;
+      y  += dy;
+      vx += dvx;
+      vy += dvy;
+      confine_and_fall (state, a, h, &x, &y, &vx, &vy);
+      state->npx[a] = x;
+      state->npy[a] = y;
+      state->nvx[a] = vx;
+      state->nvy[a] = vy;
+    }
+  state->collisions[t->id] = collisions;
+}
+
+
+/* Implements the laws of physics: move balls to their new positions.
+ */
+static void
+update_balls (b_state *state)
+{
+  int a, j, k;
+
   check_window_moved (state);
 
   /* If we're currently tracking the mouse, update that ball first.
@@ -639,104 +1029,83 @@ update_balls (b_state *state)
          state->tc);
     }
 
-  /* For each ball, compute the influence of every other ball. */
-  for (a=1; a <= state->count -  1; a++)
-    for (b=a + 1; b <= state->count; b++)
-      {
-         d = ((state->px[a] - state->px[b]) *
-              (state->px[a] - state->px[b]) +
-              (state->py[a] - state->py[b]) *
-              (state->py[a] - state->py[b]));
-         dee2 = (state->r[a] + state->r[b]) *
-                (state->r[a] + state->r[b]);
-         if (d < dee2)
-         {
-            state->collision_count++;
-            d = sqrt(d);
-            dd = state->r[a] + state->r[b] - d;
-
-            cdx = (state->px[b] - state->px[a]) / d;
-            cdy = (state->py[b] - state->py[a]) / d;
-
-            /* Move each ball apart from the other by half the
-             * 'collision' distance.
-             */
-            state->px[a] -= 0.5 * dd * cdx;
-            state->py[a] -= 0.5 * dd * cdy;
-            state->px[b] += 0.5 * dd * cdx;
-            state->py[b] += 0.5 * dd * cdy;
-
-            ma = state->m[a];
-            mb = state->m[b];
-
-            vxa = state->vx[a];
-            vya = state->vy[a];
-            vxb = state->vx[b];
-            vyb = state->vy[b];
-
-            vca = vxa * cdx + vya * cdy; /* the component of each velocity */
-            vcb = vxb * cdx + vyb * cdy; /* along the axis of the collision */
-
-            /* elastic collison */
-            dva = (vca * (ma - mb) + vcb * 2 * mb) / (ma + mb) - vca;
-            dvb = (vcb * (mb - ma) + vca * 2 * ma) / (ma + mb) - vcb;
-
-            dva *= state->e; /* some energy lost to inelasticity */
-            dvb *= state->e;
-
-#if 0
-            dva += (frand (50) - 25) / ma;   /* q: why are elves so chaotic? */
-            dvb += (frand (50) - 25) / mb;   /* a: brownian motion. */
-#endif
-
-            vxa += dva * cdx;
-            vya += dva * cdy;
-            vxb += dvb * cdx;
-            vyb += dvb * cdy;
-
-            state->vx[a] = vxa;
-            state->vy[a] = vya;
-            state->vx[b] = vxb;
-            state->vy[b] = vyb;
-         }
-      }
-
-   /* Force all balls to be on screen.
-    */
-  for (a=1; a <= state->count; a++)
+  if (state->substeps)
     {
-      if (state->px[a] <= (state->xmin + state->r[a]))
-        {
-          state->px[a] = state->xmin + state->r[a];
-          state->vx[a] = -state->vx[a] * state->e;
-        }
-      if (state->px[a] >= (state->xmax - state->r[a]))
+      int s;
+      for (s = 0; s < state->substeps; s++)
         {
-          state->px[a] = state->xmax - state->r[a];
-          state->vx[a] = -state->vx[a] * state->e;
+          float *f;
+          int collisions = 0;
+          bin_balls (state);
+          threadpool_run (&state->pool, substep_thread);
+          threadpool_wait (&state->pool);
+          for (k = 0; k < (int) state->pool.count; k++)
+            collisions += state->collisions[k];
+          state->collision_count += collisions / 2;
+          f = state->px; state->px = state->npx; state->npx = f;
+          f = state->py; state->py = state->npy; state->npy = f;
+          f = state->vx; state->vx = state->nvx; state->nvx = f;
+          f = state->vy; state->vy = state->nvy; state->nvy = f;
         }
-      if (state->py[a] <= (state->ymin + state->r[a]))
-        {
-          state->py[a] = state->ymin + state->r[a];
-          state->vy[a] = -state->vy[a] * state->e;
-        }
-      if (state->py[a] >= (state->ymax - state->r[a]))
+      return;
+    }
+
+  /* For each ball, bounce it off each later ball that it touches, in
+     order, as the old loop over every pair did.  The grid has where the
+     balls were at the start of the step, and the collisions before this
+     one may have pushed them since, so look as much further out as any
+     ball has been pushed, plus some slop.  If this ball is itself pushed
+     by more than half the slop, look again for the balls after the last
+     one done.
+   */
+  bin_balls (state);
+  memset (state->moved, 0, sizeof (*state->moved) * (state->count + 1));
+  state->max_moved = 0;
+  for (a=1; a <= state->count - 1; a++)
+    {
+      float slop = state->max_radius;
+      int after = a;
+      Bool again = True;
+      while (again)
         {
-          state->py[a] = state->ymax - state->r[a];
-          state->vy[a] = -state->vy[a] * state->e;
+          float reach = state->r[a] + state->max_moved + slop;
+          float moved = state->moved[a];
+          int rings = ceil ((reach + state->max_radius) / state->cell_size);
+          int n = touching (state,
+                            cell_of (state, state->px[a], state->py[a]),
+                            rings, state->px[a], state->py[a], reach,
+                            state->hits);
+          int nb = 0;
+          for (j = 0; j < n; j++)
+            {
+              int b = state->sorted[state->hits[j]];
+              if (b > after)
+                state->hits[nb++] = b;
+            }
+          qsort (state->hits, nb, sizeof(*state->hits), cmp_ints);
+
+          again = False;
+          for (j = 0; j < nb; j++)
+            {
+              int b = state->hits[j];
+              if (collide (state, a, b))
+                {
+                  state->collision_count++;
+                  if (state->moved[a] - moved > slop / 2)
+                    {
+                      after = b;
+                      again = True;
+                      break;
+                    }
+                }
+            }
         }
     }
 
-  /* Apply gravity to all balls.
-   */
   for (a=1; a <= state->count; a++)
-    if (a != state->mouse_ball)
-      {
-        state->vx[a] += state->accx * state->tc;
-        state->vy[a] += state->accy * state->tc;
-        state->px[a] += state->vx[a] * state->tc;
-        state->py[a] += state->vy[a] * state->tc;
-      }
+    confine_and_fall (state, a, state->tc,
+                      &state->px[a], &state->py[a],
+                      &state->vx[a], &state->vy[a]);
 }
 
 
@@ -828,6 +1197,25 @@ fluidballs_free (Display *dpy, Window window, void *closure)
   free (state->py);
   free (state->opx);
   free (state->opy);
+  if (state->pool.count)
+    threadpool_destroy (&state->pool);
+  free (state->npx);
+  free (state->npy);
+  free (state->nvx);
+  free (state->nvy);
+  free (state->collisions);
+  free (state->cell_start);
+  free (state->cell);
+  free (state->sorted);
+  free (state->hits);
+  free (state->moved);
+  free (state->sx);
+  free (state->sy);
+  free (state->sr);
+  free (state->svx);
+  free (state->svy);
+  free (state->sm);
+  free (state->arcs);
   free (state);
 }
 
@@ -848,6 +1236,7 @@ static const char *fluidballs_defaults [] = {
   "*shake:		True",
   "*shakeThreshold:	0.015",
   "*doubleBuffer:	True",
+  "*substeps:		0",
 #ifdef HAVE_DOUBLE_BUFFER_EXTENSION
   "*useDBE:		True",
   "*useDBEClear:	True",
@@ -855,6 +1244,7 @@ static const char *fluidballs_defaults [] = {
 #ifdef HAVE_MOBILE
   "*ignoreRotation:	True",
 #endif
+  THREAD_DEFAULTS
   0
 };
 
@@ -873,6 +1263,8 @@ static XrmOptionDescRec fluidballs_options [] = {
   { "-nonrandom",	".random",	XrmoptionNoArg, "False" },
   { "-db",		".doubleBuffer", XrmoptionNoArg,  "True" },
   { "-no-db",		".doubleBuffer", XrmoptionNoArg,  "False" },
+  { "-substeps",	".substeps",	XrmoptionSepArg, 0 },
+  THREAD_OPTIONS
   { 0, 0, 0, 0 }
 };
 
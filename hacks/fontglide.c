@@ -38,6 +38,19 @@
 # include <unistd.h>
 #endif
 
+/* A piece of text as rendered in one sentence's font and colors.  Words
+   with the same text share one, so that each is only measured once, and
+   only rendered once: the first time that any of them is on screen.
+ */
+typedef struct glyph_run glyph_run;
+struct glyph_run {
+  char *text;
+  int lbearing, rbearing, ascent, descent, width;   /* as in word */
+  Pixmap pixmap, mask;
+  glyph_run *next;
+};
+
+
 typedef struct {
   char *text;
 
@@ -53,7 +66,8 @@ typedef struct {
   int nticks, tick;
   int start_x,  start_y;
   int target_x, target_y;
-  Pixmap pixmap, mask;
+  glyph_run *run;
+  Bool drawable_p;	/* False if only measured */
 } word;
 
 
@@ -70,6 +84,8 @@ typedef struct {
 
   int nwords;
   word **words;
+  glyph_run *runs;
+  Pixmap clip_mask;	/* the one fg_gc has now */
 
   enum { IN, PAUSE, OUT } anim_state;
   enum { LEFT, CENTER, RIGHT } alignment;
@@ -751,119 +767,170 @@ make_mask (Screen *screen, Visual *visual, Drawable drawable)
 }
 
 
-/* Gets some random text, and creates a "word" object from it.
+/* Finds or measures the run for some text in this sentence's font.
  */
-static word *
-new_word (state *s, sentence *se, const char *txt, Bool alloc_p)
+static glyph_run *
+find_run (state *s, sentence *se, const char *txt)
 {
-  word *w;
+  glyph_run *r;
   XGlyphInfo extents;
   int bw = s->border_width;
 
-  if (!txt)
-    return 0;
+  for (r = se->runs; r; r = r->next)
+    if (!strcmp (r->text, txt))
+      return r;
 
-  w = (word *) calloc (1, sizeof(*w));
+  r = (glyph_run *) calloc (1, sizeof(*r));
   XftTextExtentsUtf8 (s->dpy, se->xftfont, (FcChar8 *) txt, strlen(txt),
                       &extents);
 
-  w->lbearing = -extents.x;
-  w->rbearing = extents.width - extents.x;
-  w->ascent   = extents.y;
-  w->descent  = extents.height - extents.y;
-  w->width    = extents.xOff;
-
-  w->lbearing -= bw;
-  w->rbearing += bw;
-  w->descent  += bw;
-  w->ascent   += bw;
+  r->lbearing = -extents.x;
+  r->rbearing = extents.width - extents.x;
+  r->ascent   = extents.y;
+  r->descent  = extents.height - extents.y;
+  r->width    = extents.xOff;
+
+  r->lbearing -= bw;
+  r->rbearing += bw;
+  r->descent  += bw;
+  r->ascent   += bw;
+
+  r->text = strdup (txt);
+  r->next = se->runs;
+  se->runs = r;
+  return r;
+}
 
-  if (s->mode == SCROLL && !alloc_p) abort();
 
-  if (alloc_p)
-    {
-      int i, j;
-      XGCValues gcv;
-      GC gc_fg, gc_bg, gc_black;
-      XftDraw *xftdraw;
-      int width  = w->rbearing - w->lbearing;
-      int height = w->ascent + w->descent;
+/* Renders the run's text and border into a pixmap, and makes its mask.
+ */
+static void
+render_run (state *s, sentence *se, glyph_run *r)
+{
+  int bw = s->border_width;
+  int i, j;
+  XGCValues gcv;
+  GC gc_fg, gc_bg, gc_black;
+  XftDraw *xftdraw;
+  int width  = r->rbearing - r->lbearing;
+  int height = r->ascent + r->descent;
 
-      if (width <= 0)  width  = 1;
-      if (height <= 0) height = 1;
+  if (width <= 0)  width  = 1;
+  if (height <= 0) height = 1;
 
-      w->pixmap = XCreatePixmap (s->dpy, s->b, width, height, s->xgwa.depth);
-      xftdraw = XftDrawCreate (s->dpy, w->pixmap, s->xgwa.visual,
-                               s->xgwa.colormap);
+  r->pixmap = XCreatePixmap (s->dpy, s->b, width, height, s->xgwa.depth);
+  xftdraw = XftDrawCreate (s->dpy, r->pixmap, s->xgwa.visual,
+                           s->xgwa.colormap);
 
-      gcv.foreground = se->xftcolor_fg.pixel;
-      gc_fg = XCreateGC (s->dpy, w->pixmap, GCForeground, &gcv);
+  gcv.foreground = se->xftcolor_fg.pixel;
+  gc_fg = XCreateGC (s->dpy, r->pixmap, GCForeground, &gcv);
 
-      gcv.foreground = se->xftcolor_bg.pixel;
-      gc_bg = XCreateGC (s->dpy, w->pixmap, GCForeground, &gcv);
+  gcv.foreground = se->xftcolor_bg.pixel;
+  gc_bg = XCreateGC (s->dpy, r->pixmap, GCForeground, &gcv);
 
-      gcv.foreground = BlackPixelOfScreen (s->xgwa.screen);
-      gc_black = XCreateGC (s->dpy, w->pixmap, GCForeground, &gcv);
+  gcv.foreground = BlackPixelOfScreen (s->xgwa.screen);
+  gc_black = XCreateGC (s->dpy, r->pixmap, GCForeground, &gcv);
 
-      XFillRectangle (s->dpy, w->pixmap, gc_black, 0, 0, width, height);
+  XFillRectangle (s->dpy, r->pixmap, gc_black, 0, 0, width, height);
 
 # ifdef DEBUG
-      if (s->debug_p)
-        {
-          /* bounding box (behind the characters) */
-          XDrawRectangle (s->dpy, w->pixmap, (se->dark_p ? gc_bg : gc_fg),
-                          0, 0, width-1, height-1);
-        }
+  if (s->debug_p)
+    {
+      /* bounding box (behind the characters) */
+      XDrawRectangle (s->dpy, r->pixmap, (se->dark_p ? gc_bg : gc_fg),
+                      0, 0, width-1, height-1);
+    }
 # endif /* DEBUG */
 
-      /* Draw background text for border */
-      for (i = -bw; i <= bw; i++)
-        for (j = -bw; j <= bw; j++)
-          XftDrawStringUtf8 (xftdraw, &se->xftcolor_bg, se->xftfont,
-                             -w->lbearing + i, w->ascent + j,
-                             (FcChar8 *) txt, strlen(txt));
+  /* Draw background text for border */
+  for (i = -bw; i <= bw; i++)
+    for (j = -bw; j <= bw; j++)
+      XftDrawStringUtf8 (xftdraw, &se->xftcolor_bg, se->xftfont,
+                         -r->lbearing + i, r->ascent + j,
+                         (FcChar8 *) r->text, strlen(r->text));
 
-      /* Draw foreground text */
-      XftDrawStringUtf8 (xftdraw, &se->xftcolor_fg, se->xftfont,
-                         -w->lbearing, w->ascent,
-                         (FcChar8 *) txt, strlen(txt));
+  /* Draw foreground text */
+  XftDrawStringUtf8 (xftdraw, &se->xftcolor_fg, se->xftfont,
+                     -r->lbearing, r->ascent,
+                     (FcChar8 *) r->text, strlen(r->text));
 
 # ifdef DEBUG
-      if (s->debug_p)
+  if (s->debug_p)
+    {
+      if (r->ascent != height)
         {
-          if (w->ascent != height)
-            {
-              /* baseline (on top of the characters) */
-              XDrawLine (s->dpy, w->pixmap, (se->dark_p ? gc_bg : gc_fg),
-                         0, w->ascent, width-1, w->ascent);
-            }
+          /* baseline (on top of the characters) */
+          XDrawLine (s->dpy, r->pixmap, (se->dark_p ? gc_bg : gc_fg),
+                     0, r->ascent, width-1, r->ascent);
+        }
 
-          if (w->lbearing < 0)
-            {
-              /* left edge of charcell */
-              XDrawLine (s->dpy, w->pixmap, (se->dark_p ? gc_bg : gc_fg),
-                         -w->lbearing, 0,
-                         -w->lbearing, height-1);
-            }
+      if (r->lbearing < 0)
+        {
+          /* left edge of charcell */
+          XDrawLine (s->dpy, r->pixmap, (se->dark_p ? gc_bg : gc_fg),
+                     -r->lbearing, 0,
+                     -r->lbearing, height-1);
+        }
 
-          if (w->rbearing != w->width)
-            {
-              /* right edge of charcell */
-              XDrawLine (s->dpy, w->pixmap, (se->dark_p ? gc_bg : gc_fg),
-                         w->width - w->lbearing, 0,
-                         w->width - w->lbearing, height-1);
-            }
+      if (r->rbearing != r->width)
+        {
+          /* right edge of charcell */
+          XDrawLine (s->dpy, r->pixmap, (se->dark_p ? gc_bg : gc_fg),
+                     r->width - r->lbearing, 0,
+                     r->width - r->lbearing, height-1);
         }
+    }
 # endif /* DEBUG */
 
-      w->mask = make_mask (s->xgwa.screen, s->xgwa.visual, w->pixmap);
+  r->mask = make_mask (s->xgwa.screen, s->xgwa.visual, r->pixmap);
 
-      XftDrawDestroy (xftdraw);
-      XFreeGC (s->dpy, gc_fg);
-      XFreeGC (s->dpy, gc_bg);
-      XFreeGC (s->dpy, gc_black);
+  XftDrawDestroy (xftdraw);
+  XFreeGC (s->dpy, gc_fg);
+  XFreeGC (s->dpy, gc_bg);
+  XFreeGC (s->dpy, gc_black);
+}
+
+
+static void
+free_runs (state *s, sentence *se)
+{
+  while (se->runs)
+    {
+      glyph_run *r = se->runs;
+      se->runs = r->next;
+      if (r->pixmap) XFreePixmap (s->dpy, r->pixmap);
+      if (r->mask)   XFreePixmap (s->dpy, r->mask);
+      free (r->text);
+      free (r);
     }
+  se->clip_mask = 0;
+}
+
 
+/* Gets some random text, and creates a "word" object from it.
+ */
+static word *
+new_word (state *s, sentence *se, const char *txt, Bool alloc_p)
+{
+  word *w;
+  glyph_run *r;
+
+  if (!txt)
+    return 0;
+
+  w = (word *) calloc (1, sizeof(*w));
+  r = find_run (s, se, txt);
+
+  w->lbearing = r->lbearing;
+  w->rbearing = r->rbearing;
+  w->ascent   = r->ascent;
+  w->descent  = r->descent;
+  w->width    = r->width;
+
+  if (s->mode == SCROLL && !alloc_p) abort();
+
+  w->run = r;
+  w->drawable_p = alloc_p;
   w->text = strdup (txt);
   return w;
 }
@@ -873,8 +940,6 @@ static void
 free_word (state *s, word *w)
 {
   if (w->text)   free (w->text);
-  if (w->pixmap) XFreePixmap (s->dpy, w->pixmap);
-  if (w->mask)   XFreePixmap (s->dpy, w->mask);
   free (w);
 }
 
@@ -899,6 +964,7 @@ free_sentence (state *s, sentence *se)
     free_word (s, se->words[i]);
   if (se->words)
     free (se->words);
+  free_runs (s, se);
   if (se->font_name)
     free (se->font_name);
   if (se->fg_gc)
@@ -1235,6 +1301,7 @@ populate_sentence (state *s, sentence *se)
         free_word (s, se->words[i]);
       free (se->words);
     }
+  free_runs (s, se);  /* the colors have changed */
 
   se->words = (word **) calloc (array_size, sizeof(*se->words));
   se->nwords = 0;
@@ -1393,8 +1460,9 @@ populate_sentence (state *s, sentence *se)
 static void
 draw_word (state *s, sentence *se, word *word)
 {
+  glyph_run *r = word->run;
   int x, y, w, h;
-  if (! word->pixmap) return;
+  if (! word->drawable_p) return;
 
   x = word->x + word->lbearing;
   y = word->y - word->ascent;
@@ -1407,9 +1475,18 @@ draw_word (state *s, sentence *se, word *word)
       y > s->xgwa.height)
     return;
 
-  XSetClipMask (s->dpy, se->fg_gc, word->mask);
+  if (! r->pixmap)
+    render_run (s, se, r);
+
+  /* Changing the clip mask is not free, and in "chars" mode, the same
+     letters often come one after another. */
+  if (se->clip_mask != r->mask)
+    {
+      XSetClipMask (s->dpy, se->fg_gc, r->mask);
+      se->clip_mask = r->mask;
+    }
   XSetClipOrigin (s->dpy, se->fg_gc, x, y);
-  XCopyArea (s->dpy, word->pixmap, s->b, se->fg_gc,
+  XCopyArea (s->dpy, r->pixmap, s->b, se->fg_gc,
              0, 0, w, h, x, y);
 }
 
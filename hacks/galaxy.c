@@ -24,6 +24,8 @@ static const char sccsid[] = "@(#)galaxy.c 4.04 97/07/28 xlockmore";
  * other special, indirect and consequential damages.
  *
  * Revision History:
+ * 19-Oct-26: Stars are kept as arrays of floats, moved several at a time
+ *            on a thread pool, and drawn into an XImage; added -stars.
  * 26-Aug-00: robert.nagtegaal@phil.uu.nl and roland@tschai.demon.nl:
  *            various improvements
  * 10-May-97: jwz@jwz.org: turned into a standalone program.
@@ -46,25 +48,36 @@ static const char sccsid[] = "@(#)galaxy.c 4.04 97/07/28 xlockmore";
 					"*ncolors:  64   \n" \
 					"*fpsSolid:  true   \n" \
 					"*ignoreRotation: True \n" \
+					THREAD_DEFAULTS_XLOCK
 
 /*				    "*lowrez: True \n" \ */
 
 # define UNIFORM_COLORS
 # define release_galaxy 0
 # define reshape_galaxy 0
-# define galaxy_handle_event 0
 # include "xlockmore.h"    /* from the xscreensaver distribution */
 #else  /* !STANDALONE */
 # include "xlock.h"     /* from the xlockmore distribution */
 #endif /* !STANDALONE */
 
+#include <limits.h>
+
+#include "thread_util.h"
+#include "xshm.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 static Bool tracks;
 static Bool spin;
 static Bool dbufp;
+static int max_stars;
 
 #define DEF_TRACKS "True"
 #define DEF_SPIN   "True"
 #define DEF_DBUF   "True"
+#define DEF_STARS  "3000"
 
 static XrmOptionDescRec opts[] =
 {
@@ -74,6 +87,8 @@ static XrmOptionDescRec opts[] =
  {"+spin",   ".galaxy.spin",   XrmoptionNoArg, "off"},
  {"-dbuf",   ".galaxy.dbuf",   XrmoptionNoArg, "on"},
  {"+dbuf",   ".galaxy.dbuf",   XrmoptionNoArg, "off"},
+ {"-stars",  ".galaxy.stars",  XrmoptionSepArg, 0},
+ THREAD_OPTIONS
 };
 
 static argtype vars[] =
@@ -81,6 +96,7 @@ static argtype vars[] =
  {&tracks, "tracks", "Tracks", DEF_TRACKS, t_Bool},
  {&spin,   "spin",   "Spin",   DEF_SPIN,   t_Bool},
  {&dbufp,  "dbuf",   "Dbuf",   DEF_DBUF,   t_Bool}, 
+ {&max_stars, "stars", "Stars", DEF_STARS, t_Int},
 };
 
 static OptionStruct desc[] =
@@ -88,6 +104,7 @@ static OptionStruct desc[] =
  {"-/+tracks", "turn on/off star tracks"},
  {"-/+spin",   "do/don't spin viewpoint"},
  {"-/+dbuf",   "turn on/off double buffering."},
+ {"-stars num", "maximum number of stars per galaxy"},
 };
 
 ENTRYPOINT ModeSpecOpt galaxy_opts =
@@ -104,7 +121,7 @@ ENTRYPOINT ModeSpecOpt galaxy_opts =
 
 #define MINSIZE       1
 #define MINGALAXIES    2
-#define MAX_STARS    3000
+#define MIN_STARS    2
 #define MAX_IDELTAT    50
 /* These come originally from the Cluster-version */
 #define DEFAULT_GALAXIES  3
@@ -128,21 +145,38 @@ ENTRYPOINT ModeSpecOpt galaxy_opts =
 # define COLORSTEP (MI_NCOLORS(mi)/COLORBASE)
 
 
+/* The stars of all galaxies live in one set of arrays, a structure of
+   arrays so that the integrator can do several stars at once.  Each galaxy
+   owns a contiguous run of them.
+ */
 typedef struct {
- double      pos[3], vel[3];
-} Star;
+ float      *pos[3], *vel[3];
+ int        *pixel; /* offset in the image, or -1 if off screen */
+ int         count;
+} Stars;
 
 
 typedef struct {
  int         mass;
+ int         start; /* first star in Stars */
  int         nstars;
- Star       *stars;
- XRectangle *oldpoints;
- XRectangle *newpoints;
  double      pos[3], vel[3];
  int         galcol;
+ unsigned long color;
 } Galaxy;
 
+/* The galaxy cores as seen by the stars of one galaxy in one frame. */
+typedef struct {
+ float       pos[3];
+ float       pull; /* mass * DELTAT^2 * QCONS */
+ float       close_pull; /* the pull when closer than EPSILON */
+} Core;
+
+/* A part of the image: x0 <= x < x1, y0 <= y < y1.  Empty if x0 >= x1. */
+typedef struct {
+ int         x0, y0, x1, y1;
+} Box;
+
 typedef struct {
  double      mat[3][3]; /* Movement of stars(?) */
  double      scale; /* Scale */
@@ -159,32 +193,98 @@ typedef struct {
 y-axis*/
  double      rot_x; /* rotation of eye around center of universe, around
 x-axis */
+
+ Stars       stars;
+ Core       *cores; /* ngalaxies x ngalaxies */
+ float       view[6]; /* projection: cox, six, cor, sir, and the scale */
+
+ XImage     *image;
+ XShmSegmentInfo shm_info;
+ unsigned long black;
+ Bool        fast_pixels; /* 32 bit pixels in our byte order */
+ Bool        shared_bytes; /* pixels smaller than a byte: one thread draws */
+ Bool        erase_p; /* the threads erase each star's old pixel */
+ Box         drawn; /* where the stars on the window are */
+
+ struct threadpool pool;
+ Box        *boxes; /* where each thread's stars landed this frame */
 } unistruct;
 
+struct galaxy_thread {
+ unistruct  *gp;
+ unsigned    id;
+};
+
 static unistruct *universes = NULL;
 
-ENTRYPOINT void
-free_galaxy(ModeInfo * mi)
+
+/* Fills the image with black. */
+static void
+clear_image(unistruct *gp)
 {
- unistruct  *gp = &universes[MI_SCREEN(mi)];
- if (gp->galaxies != NULL) {
-  int         i;
+  XImage     *image = gp->image;
+  int         x, y;
+
+  if (gp->black == 0)
+    memset (image->data, 0, image->bytes_per_line * image->height);
+  else
+    for (y = 0; y < image->height; y++)
+      for (x = 0; x < image->width; x++)
+        XPutPixel (image, x, y, gp->black);
+}
 
-  for (i = 0; i < gp->ngalaxies; i++) {
-   Galaxy     *gt = &gp->galaxies[i];
-
-   if (gt->stars != NULL)
-    (void) free((void *) gt->stars);
-   if (gt->oldpoints != NULL)
-       (void) free((void *) gt->oldpoints);
-   if (gt->newpoints != NULL)
-       (void) free((void *) gt->newpoints);
-  }
+
+static void
+empty_box(Box *b)
+{
+  b->x0 = b->y0 = INT_MAX;
+  b->x1 = b->y1 = INT_MIN;
+}
+
+static void
+add_box(Box *to, const Box *b)
+{
+  to->x0 = MIN(to->x0, b->x0);
+  to->y0 = MIN(to->y0, b->y0);
+  to->x1 = MAX(to->x1, b->x1);
+  to->y1 = MAX(to->y1, b->y1);
+}
+
+
+static void
+free_stars(unistruct *gp)
+{
+ int         i;
+ for (i = 0; i < 3; i++) {
+  free(gp->stars.pos[i]);
+  free(gp->stars.vel[i]);
+  gp->stars.pos[i] = gp->stars.vel[i] = NULL;
+ }
+ free(gp->stars.pixel);
+ gp->stars.pixel = NULL;
+ gp->stars.count = 0;
+ free(gp->cores);
+ gp->cores = NULL;
+ if (gp->galaxies != NULL) {
   (void) free((void *) gp->galaxies);
   gp->galaxies = NULL;
  }
 }
 
+ENTRYPOINT void
+free_galaxy(ModeInfo * mi)
+{
+ unistruct  *gp = &universes[MI_SCREEN(mi)];
+ free_stars(gp);
+ if (gp->pool.count)
+  threadpool_destroy(&gp->pool);
+ free(gp->boxes);
+ gp->boxes = NULL;
+ if (gp->image)
+  destroy_xshm_image(MI_DISPLAY(mi), gp->image, &gp->shm_info);
+ gp->image = NULL;
+}
+
 static void
 startover(ModeInfo * mi)
 {
@@ -192,21 +292,46 @@ startover(ModeInfo * mi)
  int         i, j; /* more tmp */
  double      w1, w2; /* more tmp */
  double      d, v, w, h; /* yet more tmp */
+ int         per_galaxy = MAX(max_stars, MIN_STARS);
+ int         total;
 
  gp->step = 0;
  gp->rot_y = 0;
  gp->rot_x = 0;
 
- if (MI_BATCHCOUNT(mi) < -MINGALAXIES)
-  free_galaxy(mi);
+ free_stars(gp);
  gp->ngalaxies = MI_BATCHCOUNT(mi);
  if (gp->ngalaxies < -MINGALAXIES)
   gp->ngalaxies = NRAND(-gp->ngalaxies - MINGALAXIES + 1) + MINGALAXIES;
 
  else if (gp->ngalaxies < MINGALAXIES)
   gp->ngalaxies = MINGALAXIES;
- if (gp->galaxies == NULL)
-  gp->galaxies = (Galaxy *) calloc(gp->ngalaxies, sizeof (Galaxy));
+ gp->galaxies = (Galaxy *) calloc(gp->ngalaxies, sizeof (Galaxy));
+ gp->cores = (Core *) calloc(gp->ngalaxies * gp->ngalaxies,
+                             sizeof (*gp->cores));
+
+ total = 0;
+ for (i = 0; i < gp->ngalaxies; ++i) {
+  Galaxy     *gt = &gp->galaxies[i];
+  gt->nstars = (NRAND(per_galaxy / 2)) + per_galaxy / 2;
+  gt->start = total;
+  total += gt->nstars;
+ }
+
+ gp->stars.count = total;
+ for (i = 0; i < 3; i++) {
+  gp->stars.pos[i] = (float *) malloc(total * sizeof (float));
+  gp->stars.vel[i] = (float *) malloc(total * sizeof (float));
+  if (!gp->stars.pos[i] || !gp->stars.vel[i]) {
+   fprintf(stderr, "%s: out of memory (%d stars)\n", progname, total);
+   exit(1);
+  }
+ }
+ gp->stars.pixel = (int *) malloc(total * sizeof (int));
+ if (!gp->galaxies || !gp->cores || !gp->stars.pixel) {
+  fprintf(stderr, "%s: out of memory (%d stars)\n", progname, total);
+  exit(1);
+ }
 
  for (i = 0; i < gp->ngalaxies; ++i) {
   Galaxy     *gt = &gp->galaxies[i];
@@ -217,15 +342,6 @@ startover(ModeInfo * mi)
    gt->galcol += 2; /* Mult 8; 16..31 no green stars */
   /* Galaxies still may have some green stars but are not all green. */
 
-  if (gt->stars != NULL) {
-   (void) free((void *) gt->stars);
-   gt->stars = NULL;
-  }
-  gt->nstars = (NRAND(MAX_STARS / 2)) + MAX_STARS / 2;
-  gt->stars = (Star *) malloc(gt->nstars * sizeof (Star));
-  gt->oldpoints = (XRectangle *) malloc(gt->nstars * sizeof (*gt->oldpoints));
-  gt->newpoints = (XRectangle *) malloc(gt->nstars * sizeof (*gt->newpoints));
-
   w1 = 2.0 * M_PI * FLOATRAND;
   w2 = 2.0 * M_PI * FLOATRAND;
   sinw1 = SINF(w1);
@@ -257,12 +373,9 @@ startover(ModeInfo * mi)
 
   gp->size = GALAXYRANGESIZE * FLOATRAND + GALAXYMINSIZE;
 
-  for (j = 0; j < gt->nstars; ++j) {
-   Star       *st = &gt->stars[j];
-   XRectangle *oldp = &gt->oldpoints[j];
-   XRectangle *newp = &gt->newpoints[j];
-
+  for (j = gt->start; j < gt->start + gt->nstars; ++j) {
    double      sinw, cosw;
+   int         k;
 
    w = 2.0 * M_PI * FLOATRAND;
    sinw = SINF(w);
@@ -271,36 +384,24 @@ startover(ModeInfo * mi)
    h = FLOATRAND * exp(-2.0 * (d / gp->size)) / 5.0 * gp->size;
    if (FLOATRAND < 0.5)
     h = -h;
-   st->pos[0] = gp->mat[0][0] * d * cosw + gp->mat[1][0] * d * sinw +
-gp->mat[2][0] * h + gt->pos[0];
-   st->pos[1] = gp->mat[0][1] * d * cosw + gp->mat[1][1] * d * sinw +
-gp->mat[2][1] * h + gt->pos[1];
-   st->pos[2] = gp->mat[0][2] * d * cosw + gp->mat[1][2] * d * sinw +
-gp->mat[2][2] * h + gt->pos[2];
-
    v = sqrt(gt->mass * QCONS / sqrt(d * d + h * h));
-   st->vel[0] = -gp->mat[0][0] * v * sinw + gp->mat[1][0] * v * cosw +
-gt->vel[0];
-   st->vel[1] = -gp->mat[0][1] * v * sinw + gp->mat[1][1] * v * cosw +
-gt->vel[1];
-   st->vel[2] = -gp->mat[0][2] * v * sinw + gp->mat[1][2] * v * cosw +
-gt->vel[2];
-
-   st->vel[0] *= DELTAT;
-   st->vel[1] *= DELTAT;
-   st->vel[2] *= DELTAT;
-
-   oldp->x = 0;
-   oldp->y = 0;
-   oldp->width = oldp->height = gp->pscale;
-   newp->x = 0;
-   newp->y = 0;
-   newp->width = newp->height = gp->pscale;
-  }
 
+   for (k = 0; k < 3; k++) {
+    gp->stars.pos[k][j] = gp->mat[0][k] * d * cosw +
+                          gp->mat[1][k] * d * sinw +
+                          gp->mat[2][k] * h + gt->pos[k];
+    gp->stars.vel[k][j] = (-gp->mat[0][k] * v * sinw +
+                           gp->mat[1][k] * v * cosw +
+                           gt->vel[k]) * DELTAT;
+   }
+   gp->stars.pixel[j] = -1;
+  }
  }
 
+ if (gp->image)
+  clear_image(gp);
  XClearWindow(MI_DISPLAY(mi), MI_WINDOW(mi));
+ empty_box(&gp->drawn);
 
 #if 0
  (void) printf("ngalaxies=%d, f_hititerations=%d\n", gp->ngalaxies,
@@ -310,10 +411,238 @@ gp->f_hititerations);
 #endif /*0 */
 }
 
+
+/* Moves stars j0 ... j1-1 of galaxy i, and works out where they land in
+   the image, adding those pixels to the box.
+ */
+static void
+move_stars(unistruct *gp, int i, int j0, int j1, Box *box)
+{
+  const Core *cores = gp->cores + i * gp->ngalaxies;
+  int         ncores = gp->ngalaxies;
+  float      *px = gp->stars.pos[0], *py = gp->stars.pos[1],
+             *pz = gp->stars.pos[2];
+  float      *vx = gp->stars.vel[0], *vy = gp->stars.vel[1],
+             *vz = gp->stars.vel[2];
+  float       cox = gp->view[0], six = gp->view[1];
+  float       cor = gp->view[2], sir = gp->view[3];
+  float       scale = gp->view[4];
+  int         w = gp->image->width - gp->pscale + 1;
+  int         h = gp->image->height - gp->pscale + 1;
+  int         stride = (gp->fast_pixels
+                        ? gp->image->bytes_per_line / 4
+                        : gp->image->width);
+  int         j = j0, k;
+
+#ifdef __SSE2__
+  {
+    const __m128 eps = _mm_set1_ps (EPSILON);
+    for (; j + 4 <= j1; j += 4) {
+      __m128 x  = _mm_loadu_ps (px + j);
+      __m128 y  = _mm_loadu_ps (py + j);
+      __m128 z  = _mm_loadu_ps (pz + j);
+      __m128 v0 = _mm_loadu_ps (vx + j);
+      __m128 v1 = _mm_loadu_ps (vy + j);
+      __m128 v2 = _mm_loadu_ps (vz + j);
+
+      for (k = 0; k < ncores; k++) {
+        __m128 d0 = _mm_sub_ps (_mm_set1_ps (cores[k].pos[0]), x);
+        __m128 d1 = _mm_sub_ps (_mm_set1_ps (cores[k].pos[1]), y);
+        __m128 d2 = _mm_sub_ps (_mm_set1_ps (cores[k].pos[2]), z);
+        __m128 d = _mm_add_ps (_mm_add_ps (_mm_mul_ps (d0, d0),
+                                           _mm_mul_ps (d1, d1)),
+                               _mm_mul_ps (d2, d2));
+        __m128 farp = _mm_cmpgt_ps (d, eps);
+        __m128 f = _mm_div_ps (_mm_set1_ps (cores[k].pull),
+                               _mm_mul_ps (d, _mm_sqrt_ps (d)));
+        f = _mm_or_ps (_mm_and_ps (farp, f),
+                       _mm_andnot_ps (farp, _mm_set1_ps (cores[k].close_pull)));
+        v0 = _mm_add_ps (v0, _mm_mul_ps (d0, f));
+        v1 = _mm_add_ps (v1, _mm_mul_ps (d1, f));
+        v2 = _mm_add_ps (v2, _mm_mul_ps (d2, f));
+      }
+
+      _mm_storeu_ps (vx + j, v0);
+      _mm_storeu_ps (vy + j, v1);
+      _mm_storeu_ps (vz + j, v2);
+      _mm_storeu_ps (px + j, _mm_add_ps (x, v0));
+      _mm_storeu_ps (py + j, _mm_add_ps (y, v1));
+      _mm_storeu_ps (pz + j, _mm_add_ps (z, v2));
+    }
+  }
+#endif /* __SSE2__ */
+
+  for (; j < j1; j++) {
+    float v0 = vx[j], v1 = vy[j], v2 = vz[j];
+    for (k = 0; k < ncores; k++) {
+      float d0 = cores[k].pos[0] - px[j];
+      float d1 = cores[k].pos[1] - py[j];
+      float d2 = cores[k].pos[2] - pz[j];
+      float d = d0 * d0 + d1 * d1 + d2 * d2;
+      if (d > EPSILON)
+        d = cores[k].pull / (d * sqrtf(d));
+      else
+        d = cores[k].close_pull;
+      v0 += d0 * d;
+      v1 += d1 * d;
+      v2 += d2 * d;
+    }
+    vx[j] = v0;
+    vy[j] = v1;
+    vz[j] = v2;
+    px[j] += v0;
+    py[j] += v1;
+    pz[j] += v2;
+  }
+
+  for (j = j0; j < j1; j++) {
+    int x = (int) ((cox * px[j] - six * pz[j]) * scale) + gp->midx;
+    int y = (int) ((cor * py[j] - sir * (six * px[j] + cox * pz[j]))
+                   * scale) + gp->midy;
+    if (x >= 0 && x < w && y >= 0 && y < h) {
+      gp->stars.pixel[j] = y * stride + x;
+      if (x < box->x0) box->x0 = x;
+      if (y < box->y0) box->y0 = y;
+      if (x + gp->pscale > box->x1) box->x1 = x + gp->pscale;
+      if (y + gp->pscale > box->y1) box->y1 = y + gp->pscale;
+    } else {
+      gp->stars.pixel[j] = -1;
+    }
+  }
+}
+
+
+static void
+put_star(unistruct *gp, int offset, unsigned long color)
+{
+  XImage     *image = gp->image;
+  int         i, j;
+
+  if (gp->fast_pixels) {
+    uint32_t *p = (uint32_t *) image->data + offset;
+    int stride = image->bytes_per_line / 4;
+    for (j = 0; j < gp->pscale; j++, p += stride)
+      for (i = 0; i < gp->pscale; i++)
+        p[i] = color;
+  } else {
+    int x = offset % image->width;
+    int y = offset / image->width;
+    for (j = 0; j < gp->pscale; j++)
+      for (i = 0; i < gp->pscale; i++)
+        XPutPixel (image, x + i, y + j, color);
+  }
+}
+
+
+/* Calls fn on this thread's share of each galaxy's stars. */
+static void
+thread_share(struct galaxy_thread *t,
+             void (*fn) (struct galaxy_thread *, int i, int j0, int j1))
+{
+  unistruct  *gp = t->gp;
+  int         n = gp->stars.count;
+  int         j0 = (int) ((long) n * t->id / gp->pool.count);
+  int         j1 = (int) ((long) n * (t->id + 1) / gp->pool.count);
+  int         i;
+
+  for (i = 0; i < gp->ngalaxies; i++) {
+    Galaxy *gt = &gp->galaxies[i];
+    int a = MAX(j0, gt->start);
+    int b = MIN(j1, gt->start + gt->nstars);
+    if (a < b)
+      fn(t, i, a, b);
+  }
+}
+
+
+static void
+erase_stars(unistruct *gp, int i, int j0, int j1)
+{
+  int         j;
+  for (j = j0; j < j1; j++)
+    if (gp->stars.pixel[j] >= 0)
+      put_star(gp, gp->stars.pixel[j], gp->black);
+}
+
+
+/* Writes from several threads may land on the same pixel; any of them
+   winning is fine.  But not on the same byte, unless it is the same
+   pixel: see shared_bytes. */
+static void
+draw_stars(unistruct *gp, int i, int j0, int j1)
+{
+  unsigned long color = gp->galaxies[i].color;
+  int         j;
+  for (j = j0; j < j1; j++)
+    if (gp->stars.pixel[j] >= 0)
+      put_star(gp, gp->stars.pixel[j], color);
+}
+
+
+static void
+erase_and_move_share(struct galaxy_thread *t, int i, int j0, int j1)
+{
+  if (t->gp->erase_p)
+    erase_stars(t->gp, i, j0, j1);
+  move_stars(t->gp, i, j0, j1, &t->gp->boxes[t->id]);
+}
+
+static void
+draw_share(struct galaxy_thread *t, int i, int j0, int j1)
+{
+  draw_stars(t->gp, i, j0, j1);
+}
+
+
+static void
+move_thread(void *self)
+{
+  struct galaxy_thread *t = (struct galaxy_thread *) self;
+  empty_box(&t->gp->boxes[t->id]);
+  thread_share(t, erase_and_move_share);
+}
+
+static void
+draw_thread(void *self)
+{
+  thread_share((struct galaxy_thread *) self, draw_share);
+}
+
+
+static int
+galaxy_thread_create(void *self, struct threadpool *pool, unsigned id)
+{
+  struct galaxy_thread *t = (struct galaxy_thread *) self;
+  t->gp = GET_PARENT_OBJ(unistruct, pool, pool);
+  t->id = id;
+  return 0;
+}
+
+static void
+galaxy_thread_destroy(void *self)
+{
+}
+
+
+static Bool
+bigendian (void)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  u.i = 1;
+  return !u.c[0];
+}
+
+
 ENTRYPOINT void
 init_galaxy(ModeInfo * mi)
 {
  unistruct  *gp;
+ static const struct threadpool_class cls = {
+  sizeof(struct galaxy_thread),
+  galaxy_thread_create,
+  galaxy_thread_destroy
+ };
+ int         error;
 
  MI_INIT (mi, universes);
  gp = &universes[MI_SCREEN(mi)];
@@ -335,6 +664,33 @@ init_galaxy(ModeInfo * mi)
      gp->scale /= gp->pscale;
    }
 
+ gp->image = create_xshm_image(MI_DISPLAY(mi), MI_VISUAL(mi), MI_DEPTH(mi),
+                               ZPixmap, &gp->shm_info,
+                               MI_WIDTH(mi), MI_HEIGHT(mi));
+ if (!gp->image) {
+  fprintf(stderr, "%s: out of memory\n", progname);
+  exit(1);
+ }
+ gp->black = MI_WIN_BLACK_PIXEL(mi);
+ gp->fast_pixels = (gp->image->bits_per_pixel == 32 &&
+                    gp->image->byte_order ==
+                    (bigendian() ? MSBFirst : LSBFirst));
+ /* XPutPixel of a 1 or 4 bit pixel rewrites the byte around it, and
+    could undo a neighbor that another thread has just drawn. */
+ gp->shared_bytes = (gp->image->bits_per_pixel < 8);
+
+ error = threadpool_create(&gp->pool, &cls, MI_DISPLAY(mi),
+                           hardware_concurrency(MI_DISPLAY(mi)));
+ if (error) {
+  fprintf(stderr, "%s: threadpool: %s\n", progname, strerror(error));
+  exit(1);
+ }
+ gp->boxes = (Box *) calloc(gp->pool.count, sizeof (*gp->boxes));
+ if (!gp->boxes) {
+  fprintf(stderr, "%s: out of memory\n", progname);
+  exit(1);
+ }
+
  startover(mi);
 }
 
@@ -346,11 +702,7 @@ draw_galaxy(ModeInfo * mi)
   GC          gc = MI_GC(mi);
   unistruct  *gp = &universes[MI_SCREEN(mi)];
   double      d, eps, cox, six, cor, sir;  /* tmp */
-  int         i, j, k; /* more tmp */
-  XRectangle *dummy = NULL;
-
-  if (! dbufp)
-    XClearWindow(MI_DISPLAY(mi), MI_WINDOW(mi));
+  int         i, k; /* more tmp */
 
   if(spin){
     gp->rot_y += 0.01;
@@ -362,50 +714,33 @@ draw_galaxy(ModeInfo * mi)
   cor = COSF(gp->rot_x);
   sir = SINF(gp->rot_x);
 
+  gp->view[0] = cox;
+  gp->view[1] = six;
+  gp->view[2] = cor;
+  gp->view[3] = sir;
+  gp->view[4] = gp->scale * gp->pscale;
+
   eps = 1/(EPSILON * sqrt_EPSILON * DELTAT * DELTAT * QCONS);
 
+  /* The stars of galaxy i see the cores of galaxies 0 ... i-1 where they
+     are after this frame's move, and the rest where they were before it.
+     Record that before moving the cores, and moving the cores doesn't
+     depend on the stars, so the stars can all be moved in parallel
+     afterward. */
+  for (i = 0; i < gp->ngalaxies; ++i)
+    for (k = 0; k < gp->ngalaxies; ++k) {
+      Galaxy     *gtk = &gp->galaxies[k];
+      Core       *c = &gp->cores[i * gp->ngalaxies + k];
+      c->pos[0] = gtk->pos[0];
+      c->pos[1] = gtk->pos[1];
+      c->pos[2] = gtk->pos[2];
+      c->pull  = gtk->mass * DELTAT * DELTAT * QCONS;
+      c->close_pull = gtk->mass / (eps * sqrt(eps));
+    }
+
   for (i = 0; i < gp->ngalaxies; ++i) {
     Galaxy     *gt = &gp->galaxies[i];
 
-    for (j = 0; j < gp->galaxies[i].nstars; ++j) {
-      Star       *st = &gt->stars[j];
-      XRectangle *newp = &gt->newpoints[j];
-      double      v0 = st->vel[0];
-      double      v1 = st->vel[1];
-      double      v2 = st->vel[2];
-
-      for (k = 0; k < gp->ngalaxies; ++k) {
-        Galaxy     *gtk = &gp->galaxies[k];
-        double      d0 = gtk->pos[0] - st->pos[0];
-        double      d1 = gtk->pos[1] - st->pos[1];
-        double      d2 = gtk->pos[2] - st->pos[2];
-
-        d = d0 * d0 + d1 * d1 + d2 * d2;
-        if (d > EPSILON)
-          d = gtk->mass / (d * sqrt(d)) * DELTAT * DELTAT * QCONS;
-        else
-          d = gtk->mass / (eps * sqrt(eps));
-        v0 += d0 * d;
-        v1 += d1 * d;
-        v2 += d2 * d;
-      }
-
-      st->vel[0] = v0;
-      st->vel[1] = v1;
-      st->vel[2] = v2;
-
-      st->pos[0] += v0;
-      st->pos[1] += v1;
-      st->pos[2] += v2;
-
-      newp->x = (short) (((cox * st->pos[0]) - (six * st->pos[2])) *
-                         gp->scale * gp->pscale) + gp->midx;
-      newp->y = (short) (((cor * st->pos[1]) - (sir * ((six * st->pos[0]) +
-                                                       (cox * st->pos[2]))))
-                         * gp->scale * gp->pscale) + gp->midy;
-      newp->width = newp->height = gp->pscale;
-    }
-
     for (k = i + 1; k < gp->ngalaxies; ++k) {
       Galaxy     *gtk = &gp->galaxies[k];
       double      d0 = gtk->pos[0] - gt->pos[0];
@@ -433,16 +768,51 @@ draw_galaxy(ModeInfo * mi)
     gt->pos[1] += gt->vel[1] * DELTAT;
     gt->pos[2] += gt->vel[2] * DELTAT;
 
-    if (dbufp) {
-      XSetForeground(display, gc, MI_WIN_BLACK_PIXEL(mi));
-      XFillRectangles(display, window, gc, gt->oldpoints, gt->nstars);
+    for (k = i + 1; k < gp->ngalaxies; ++k) {
+      Core       *c = &gp->cores[k * gp->ngalaxies + i];
+      c->pos[0] = gt->pos[0];
+      c->pos[1] = gt->pos[1];
+      c->pos[2] = gt->pos[2];
+    }
+
+    gt->color = MI_PIXEL(mi, COLORSTEP * gt->galcol);
+  }
+
+  /* Either each thread erases the old pixels of its own stars, or we wipe
+     the whole image.  All erasing is done before any drawing.  If pixels
+     share bytes, only this thread erases and draws. */
+  gp->erase_p = dbufp && !gp->shared_bytes;
+  if (! dbufp)
+    clear_image (gp);
+  else if (gp->shared_bytes)
+    for (i = 0; i < gp->ngalaxies; ++i) {
+      Galaxy *gt = &gp->galaxies[i];
+      erase_stars(gp, i, gt->start, gt->start + gt->nstars);
     }
-    XSetForeground(display, gc, MI_PIXEL(mi, COLORSTEP * gt->galcol));
-    XFillRectangles (display, window, gc, gt->newpoints, gt->nstars);
 
-    dummy = gt->oldpoints;
-    gt->oldpoints = gt->newpoints;
-    gt->newpoints = dummy;
+  threadpool_run(&gp->pool, move_thread);
+  threadpool_wait(&gp->pool);
+  if (gp->shared_bytes)
+    for (i = 0; i < gp->ngalaxies; ++i) {
+      Galaxy *gt = &gp->galaxies[i];
+      draw_stars(gp, i, gt->start, gt->start + gt->nstars);
+    }
+  else {
+    threadpool_run(&gp->pool, draw_thread);
+    threadpool_wait(&gp->pool);
+  }
+
+  /* Only what has changed: where the stars were, and where they are. */
+  {
+    Box         box = gp->drawn;
+    empty_box(&gp->drawn);
+    for (i = 0; i < (int) gp->pool.count; i++)
+      add_box(&gp->drawn, &gp->boxes[i]);
+    add_box(&box, &gp->drawn);
+    if (box.x0 < box.x1 && box.y0 < box.y1)
+      put_xshm_image(display, window, gc, gp->image,
+                     box.x0, box.y0, box.x0, box.y0,
+                     box.x1 - box.x0, box.y1 - box.y0, &gp->shm_info);
   }
 
   gp->step++;
@@ -450,6 +820,19 @@ draw_galaxy(ModeInfo * mi)
     startover(mi);
 }
 
+ENTRYPOINT Bool
+galaxy_handle_event (ModeInfo *mi, XEvent *event)
+{
+  unistruct  *gp = &universes[MI_SCREEN(mi)];
+  if (event->xany.type == Expose && gp->image) {
+    /* Put the whole image next time. */
+    gp->drawn.x0 = gp->drawn.y0 = 0;
+    gp->drawn.x1 = gp->image->width;
+    gp->drawn.y1 = gp->image->height;
+  }
+  return False;
+}
+
 #ifndef STANDALONE
 ENTRYPOINT void
 refresh_galaxy(ModeInfo * mi)
@@ -230,16 +230,15 @@ get_one_line (fliptext_configuration *sc)
 
   /* Fill as much as we can into sc->buf, but stop at newline.
    */
-  while (target > 0)
+  if (target > 0)
     {
-      int c = textclient_getc (sc->tc);
-      if (c <= 0)
-        break;
-      sc->buf[sc->buf_tail++] = (char) c;
-      sc->buf[sc->buf_tail] = 0;
-      target--;
-      if (c == '\r' || c == '\n')
-        break;
+      /* textclient_read stops after a newline. */
+      int n = textclient_read (sc->tc, sc->buf + sc->buf_tail, target);
+      if (n > 0)
+        {
+          sc->buf_tail += n;
+          sc->buf[sc->buf_tail] = 0;
+        }
     }
 
   while (!result)
@@ -27,11 +27,15 @@
 
 #include "xlockmore.h"
 #include "ximage-loader.h"
+#include "glsl-utils.h"
 
 #include "images/gen/matrix3_png.h"
 
 #ifdef USE_GL /* whole file */
 
+#if defined(HAVE_GLSL) && (!defined(HAVE_JWXYZ) || defined(HAVE_GLES3))
+# define USE_INSTANCING
+#endif
 
 #define DEF_SPEED       "1.0"
 #define DEF_DENSITY     "20"
@@ -146,6 +150,13 @@ typedef struct {
 } strip;
 
 
+typedef struct {
+  GLfloat tx, ty;
+  GLfloat r, g, b, a;
+  GLfloat x, y, z;
+} glyph_vertex;
+
+
 typedef struct {
   GLXContext *glx_context;
   Bool button_down_p;
@@ -166,6 +177,23 @@ typedef struct {
   int real_char_rows;
   GLfloat brightness_ramp[WAVE_SIZE];
 
+  /* Every glyph of the frame goes in here, back to front, and they are
+     all drawn at once at the end, instead of a glBegin apiece. */
+  glyph_vertex *verts;
+  int nverts;
+
+# ifdef USE_INSTANCING
+  /* Or, on GL 3.3 and GLES 3.0, just one quad, and the position, size,
+     character and color of each glyph, drawn with glDrawArraysInstanced. */
+  Bool instancing_p;
+  GLuint program;
+  GLint corner_index, glyph_pos_index, glyph_tex_index, glyph_color_index;
+  GLint mvp_index, tex_size_index, texture_index, texture_p_index;
+  GLuint corner_buffer, instance_buffer;
+  GLfloat *instances;
+  int ninstances;
+# endif /* USE_INSTANCING */
+
 } matrix_configuration;
 
 static matrix_configuration *mps = NULL;
@@ -346,6 +374,203 @@ tick_strip (ModeInfo *mi, strip *s)
 }
 
 
+#ifdef USE_INSTANCING
+
+/* Floats per glyph: position and size, character, color. */
+#define INSTANCE_STRIDE 10
+
+static const GLchar *instancing_version_3_0 =
+  "#version 130\n";
+static const GLchar *instancing_version_3_0_es =
+  "#version 300 es\n"
+  "precision highp float;\n"
+  "precision highp int;\n";
+
+/* Stretches the unit quad over each glyph and its character in the font
+   texture, as draw_glyph does on the CPU when there is no instancing. */
+static const GLchar *instancing_vertex_shader =
+  "in vec2 Corner;\n"
+  "in vec4 GlyphPosition;\n"
+  "in vec2 GlyphTexCoord;\n"
+  "in vec4 GlyphColor;\n"
+  "\n"
+  "uniform mat4 MatMVP;\n"
+  "uniform vec2 TexSize;\n"
+  "\n"
+  "out vec2 TexCoord;\n"
+  "out vec4 Color;\n"
+  "\n"
+  "void main(void)\n"
+  "{\n"
+  "  vec3 p = GlyphPosition.xyz + vec3(Corner * GlyphPosition.w, 0.0);\n"
+  "  TexCoord = GlyphTexCoord + Corner * TexSize;\n"
+  "  Color = GlyphColor;\n"
+  "  gl_Position = MatMVP * vec4(p, 1.0);\n"
+  "}\n";
+
+/* GL_MODULATE. */
+static const GLchar *instancing_fragment_shader =
+  "in vec2 TexCoord;\n"
+  "in vec4 Color;\n"
+  "\n"
+  "uniform sampler2D Texture;\n"
+  "uniform bool TextureP;\n"
+  "\n"
+  "out vec4 FragColor;\n"
+  "\n"
+  "void main(void)\n"
+  "{\n"
+  "  if (TextureP)\n"
+  "    FragColor = Color * texture(Texture, TexCoord);\n"
+  "  else\n"
+  "    FragColor = Color;\n"
+  "}\n";
+
+
+/* Returns False if this GL can't draw instances, and the glyphs will
+   be drawn from mp->verts instead.
+ */
+static Bool
+init_instancing (ModeInfo *mi)
+{
+  matrix_configuration *mp = &mps[MI_SCREEN(mi)];
+  /* Two triangles, since GLES has no GL_QUADS. */
+  static const GLfloat corners[] = { 0, 0,  1, 0,  1, 1,
+                                     0, 0,  1, 1,  0, 1 };
+  GLint gl_major, gl_minor, glsl_major, glsl_minor;
+  GLboolean gl_gles3;
+  const GLchar *vertex_shader_source[2];
+  const GLchar *fragment_shader_source[2];
+
+  if (!glsl_GetGlAndGlslVersions (&gl_major, &gl_minor,
+                                  &glsl_major, &glsl_minor, &gl_gles3))
+    return False;
+  if (!gl_gles3)
+    {
+      /* glVertexAttribDivisor is in OpenGL 3.3. */
+      if (gl_major < 3 || (gl_major == 3 && gl_minor < 3) ||
+          glsl_major < 1 || (glsl_major == 1 && glsl_minor < 30))
+        return False;
+      vertex_shader_source[0] = instancing_version_3_0;
+      fragment_shader_source[0] = instancing_version_3_0;
+    }
+  else
+    {
+      if (gl_major < 3 || glsl_major < 3)
+        return False;
+      vertex_shader_source[0] = instancing_version_3_0_es;
+      fragment_shader_source[0] = instancing_version_3_0_es;
+    }
+  vertex_shader_source[1] = instancing_vertex_shader;
+  fragment_shader_source[1] = instancing_fragment_shader;
+
+  if (!glsl_CompileAndLinkShaders (2, vertex_shader_source,
+                                   2, fragment_shader_source,
+                                   &mp->program))
+    return False;
+
+  mp->corner_index = glGetAttribLocation (mp->program, "Corner");
+  mp->glyph_pos_index = glGetAttribLocation (mp->program, "GlyphPosition");
+  mp->glyph_tex_index = glGetAttribLocation (mp->program, "GlyphTexCoord");
+  mp->glyph_color_index = glGetAttribLocation (mp->program, "GlyphColor");
+  mp->mvp_index = glGetUniformLocation (mp->program, "MatMVP");
+  mp->tex_size_index = glGetUniformLocation (mp->program, "TexSize");
+  mp->texture_index = glGetUniformLocation (mp->program, "Texture");
+  mp->texture_p_index = glGetUniformLocation (mp->program, "TextureP");
+  if (mp->corner_index == -1 || mp->glyph_pos_index == -1 ||
+      mp->glyph_tex_index == -1 || mp->glyph_color_index == -1 ||
+      mp->mvp_index == -1)
+    {
+      glDeleteProgram (mp->program);
+      return False;
+    }
+
+  mp->instances = (GLfloat *)
+    malloc (mp->nstrips * (GRID_SIZE + 1) * INSTANCE_STRIDE *
+            sizeof(*mp->instances));
+  if (!mp->instances) abort();
+
+  glGenBuffers (1, &mp->corner_buffer);
+  glBindBuffer (GL_ARRAY_BUFFER, mp->corner_buffer);
+  glBufferData (GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+  glGenBuffers (1, &mp->instance_buffer);
+  glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+  return True;
+}
+
+
+static void
+free_instancing (ModeInfo *mi)
+{
+  matrix_configuration *mp = &mps[MI_SCREEN(mi)];
+  if (!mp->instancing_p) return;
+  glDeleteBuffers (1, &mp->corner_buffer);
+  glDeleteBuffers (1, &mp->instance_buffer);
+  glDeleteProgram (mp->program);
+  free (mp->instances);
+}
+
+
+/* Draws the glyphs that draw_glyph has collected in mp->instances,
+   using the matrices that draw_matrix has set up.
+ */
+static void
+draw_instances (ModeInfo *mi)
+{
+  matrix_configuration *mp = &mps[MI_SCREEN(mi)];
+  GLfloat mvp[16], mv[16];
+  GLsizei stride = INSTANCE_STRIDE * sizeof(GLfloat);
+
+  glGetFloatv (GL_PROJECTION_MATRIX, mvp);
+  glGetFloatv (GL_MODELVIEW_MATRIX, mv);
+  glsl_MultMatrix (mvp, mv);
+
+  glUseProgram (mp->program);
+  glUniformMatrix4fv (mp->mvp_index, 1, GL_FALSE, mvp);
+  glUniform2f (mp->tex_size_index, mp->tex_char_width, mp->tex_char_height);
+  glUniform1i (mp->texture_index, 0);
+  glUniform1i (mp->texture_p_index, do_texture);
+
+  glBindBuffer (GL_ARRAY_BUFFER, mp->corner_buffer);
+  glEnableVertexAttribArray (mp->corner_index);
+  glVertexAttribPointer (mp->corner_index, 2, GL_FLOAT, GL_FALSE, 0,
+                         (const void *) 0);
+
+  glBindBuffer (GL_ARRAY_BUFFER, mp->instance_buffer);
+  glBufferData (GL_ARRAY_BUFFER, mp->ninstances * stride, mp->instances,
+                GL_STREAM_DRAW);
+  glEnableVertexAttribArray (mp->glyph_pos_index);
+  glVertexAttribPointer (mp->glyph_pos_index, 4, GL_FLOAT, GL_FALSE, stride,
+                         (const void *) 0);
+  glVertexAttribDivisor (mp->glyph_pos_index, 1);
+  glEnableVertexAttribArray (mp->glyph_tex_index);
+  glVertexAttribPointer (mp->glyph_tex_index, 2, GL_FLOAT, GL_FALSE, stride,
+                         (const void *) (4 * sizeof(GLfloat)));
+  glVertexAttribDivisor (mp->glyph_tex_index, 1);
+  glEnableVertexAttribArray (mp->glyph_color_index);
+  glVertexAttribPointer (mp->glyph_color_index, 4, GL_FLOAT, GL_FALSE, stride,
+                         (const void *) (6 * sizeof(GLfloat)));
+  glVertexAttribDivisor (mp->glyph_color_index, 1);
+
+  glDrawArraysInstanced (GL_TRIANGLES, 0, 6, mp->ninstances);
+
+  glVertexAttribDivisor (mp->glyph_pos_index, 0);
+  glVertexAttribDivisor (mp->glyph_tex_index, 0);
+  glVertexAttribDivisor (mp->glyph_color_index, 0);
+  glDisableVertexAttribArray (mp->corner_index);
+  glDisableVertexAttribArray (mp->glyph_pos_index);
+  glDisableVertexAttribArray (mp->glyph_tex_index);
+  glDisableVertexAttribArray (mp->glyph_color_index);
+  glBindBuffer (GL_ARRAY_BUFFER, 0);
+  glUseProgram (0);
+
+  mp->ninstances = 0;
+}
+
+#endif /* USE_INSTANCING */
+
+
 /* Draw a single character at the given position and brightness.
  */
 static void
@@ -359,6 +584,7 @@ draw_glyph (ModeInfo *mi, int glyph, Bool highlight,
   GLfloat h = mp->tex_char_height;
   GLfloat cx = 0, cy = 0;
   GLfloat S = 1;
+  GLfloat r, g, b, a;
   Bool spinner_p = (glyph < 0);
 
   if (glyph == 0) abort();
@@ -391,8 +617,6 @@ draw_glyph (ModeInfo *mi, int glyph, Bool highlight,
     }
 
   {
-    GLfloat r, g, b, a;
-
     if (highlight)
       brightness *= 2;
 
@@ -418,32 +642,103 @@ draw_glyph (ModeInfo *mi, int glyph, Bool highlight,
 
         a *= mp->brightness_ramp[i];
       }
-
-    glColor4f (r,g,b,a);
   }
 
-  glBegin (wire ? GL_LINE_LOOP : GL_QUADS);
-  glNormal3f (0, 0, 1);
-  glTexCoord2f (cx,   cy);   glVertex3f (x,   y,   z);
-  glTexCoord2f (cx+w, cy);   glVertex3f (x+S, y,   z);
-  glTexCoord2f (cx+w, cy+h); glVertex3f (x+S, y+S, z);
-  glTexCoord2f (cx,   cy+h); glVertex3f (x,   y+S, z);
-  glEnd ();
-
-  if (wire && spinner_p)
+  if (wire)
     {
-      glBegin (GL_LINES);
+      glColor4f (r,g,b,a);
+      glBegin (GL_LINE_LOOP);
       glVertex3f (x,   y,   z);
+      glVertex3f (x+S, y,   z);
       glVertex3f (x+S, y+S, z);
       glVertex3f (x,   y+S, z);
-      glVertex3f (x+S, y,   z);
-      glEnd();
+      glEnd ();
+
+      if (spinner_p)
+        {
+          glBegin (GL_LINES);
+          glVertex3f (x,   y,   z);
+          glVertex3f (x+S, y+S, z);
+          glVertex3f (x,   y+S, z);
+          glVertex3f (x+S, y,   z);
+          glEnd();
+        }
+    }
+# ifdef USE_INSTANCING
+  else if (mp->instancing_p)
+    {
+      GLfloat *v = mp->instances + mp->ninstances * INSTANCE_STRIDE;
+      v[0] = x; v[1] = y; v[2] = z; v[3] = S;
+      v[4] = cx; v[5] = cy;
+      v[6] = r; v[7] = g; v[8] = b; v[9] = a;
+      mp->ninstances++;
+    }
+# endif /* USE_INSTANCING */
+  else
+    {
+      /* Two triangles, since GLES has no GL_QUADS for glDrawArrays. */
+      static const int corners[6] = { 0, 1, 2, 0, 2, 3 };
+      glyph_vertex *v = mp->verts + mp->nverts;
+      int i;
+      for (i = 0; i < 6; i++, v++)
+        {
+          int dx = (corners[i] == 1 || corners[i] == 2);
+          int dy = (corners[i] >= 2);
+          v->tx = cx + dx * w;
+          v->ty = cy + dy * h;
+          v->r = r; v->g = g; v->b = b; v->a = a;
+          v->x = x + dx * S;
+          v->y = y + dy * S;
+          v->z = z;
+        }
+      mp->nverts += 6;
     }
 
   mi->polygon_count++;
 }
 
 
+/* Draws all of the glyphs that draw_glyph has collected.
+ */
+static void
+flush_glyphs (ModeInfo *mi)
+{
+  matrix_configuration *mp = &mps[MI_SCREEN(mi)];
+  int stride = sizeof(*mp->verts);
+
+# ifdef USE_INSTANCING
+  if (mp->instancing_p)
+    {
+      if (mp->ninstances)
+        draw_instances (mi);
+      return;
+    }
+# endif /* USE_INSTANCING */
+
+  if (!mp->nverts) return;
+
+  glNormal3f (0, 0, 1);
+  glEnableClientState (GL_VERTEX_ARRAY);
+  glEnableClientState (GL_COLOR_ARRAY);
+  glVertexPointer (3, GL_FLOAT, stride, &mp->verts[0].x);
+  glColorPointer (4, GL_FLOAT, stride, &mp->verts[0].r);
+  if (do_texture)
+    {
+      glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+      glTexCoordPointer (2, GL_FLOAT, stride, &mp->verts[0].tx);
+    }
+
+  glDrawArrays (GL_TRIANGLES, 0, mp->nverts);
+
+  glDisableClientState (GL_VERTEX_ARRAY);
+  glDisableClientState (GL_COLOR_ARRAY);
+  if (do_texture)
+    glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+
+  mp->nverts = 0;
+}
+
+
 /* Draw all the visible glyphs in the strip.
  */
 static void
@@ -885,6 +1180,18 @@ init_matrix (ModeInfo *mi)
 
 
   mp->strips = calloc (mp->nstrips, sizeof(strip));
+
+  /* Each strip draws at most all of its cells and its spinner. */
+# ifdef USE_INSTANCING
+  if (!wire)
+    mp->instancing_p = init_instancing (mi);
+  if (!mp->instancing_p)
+# endif /* USE_INSTANCING */
+    {
+      mp->verts = (glyph_vertex *)
+        malloc (mp->nstrips * (GRID_SIZE + 1) * 6 * sizeof(*mp->verts));
+      if (!mp->verts) abort();
+    }
   for (i = 0; i < mp->nstrips; i++)
     {
       strip *s = &mp->strips[i];
@@ -1038,6 +1345,7 @@ draw_matrix (ModeInfo *mi)
         draw_strip (mi, s);
       }
     free (sorted);
+    flush_glyphs (mi);
   }
 
   auto_track (mi);
@@ -1068,6 +1376,10 @@ free_matrix (ModeInfo *mi)
   if (!mp->glx_context) return;
   glXMakeCurrent(MI_DISPLAY(mi), MI_WINDOW(mi), *mp->glx_context);
   if (mp->strips) free (mp->strips);
+  if (mp->verts) free (mp->verts);
+# ifdef USE_INSTANCING
+  free_instancing (mi);
+# endif
   if (mp->texture) glDeleteTextures (1, &mp->texture);
 }
 
@@ -10,11 +10,14 @@
  */
 #include "xlockmore.h"
 #include "glschool.h"
+#include "thread_util.h"
+#include <errno.h>
 
 #define sws_opts			xlockmore_opts
 #define DEFAULTS    "*delay:		20000       \n" \
                     "*showFPS:      False       \n" \
                     "*wireframe:    False       \n" \
+                    THREAD_DEFAULTS_XLOCK
 
 #define release_glschool		(0)
 #define glschool_handle_event	(xlockmore_no_events)
@@ -73,6 +76,7 @@ static XrmOptionDescRec opts[] = {
 	{ "-minradius",	".minradius",	XrmoptionSepArg, 0 },
 	{ "-distcomp",	".distcomp",	XrmoptionSepArg, 0 },
 	{ "-momentum",	".momentum",	XrmoptionSepArg, 0 },
+	THREAD_OPTIONS
 };
 
 static argtype vars[] = {
@@ -108,11 +112,56 @@ typedef struct {
         int		fish_polys, box_polys;
 	XColor		*colors;
 	School		*school;
+	glschool_instancing	*instancing;
+	struct threadpool	pool;
 	GLXContext	*context;
 } glschool_configuration;
 
+typedef struct {
+	glschool_configuration	*sc;
+	unsigned				id;
+} glschool_thread;
+
 static glschool_configuration	*scs = NULL;
 
+
+static int
+glschool_thread_create(void *self, struct threadpool *pool, unsigned id)
+{
+	glschool_thread	*t = (glschool_thread *)self;
+	t->sc = GET_PARENT_OBJ(glschool_configuration, pool, pool);
+	t->id = id;
+	return 0;
+}
+
+static void
+glschool_thread_destroy(void *self)
+{
+}
+
+static void
+glschool_thread_run(void *self)
+{
+	glschool_thread	*t = (glschool_thread *)self;
+	School			*s = t->sc->school;
+	int				n = SCHOOL_NFISH(s);
+	unsigned		count = t->sc->pool.count;
+
+	glschool_computeAccelerationsRange(s,
+									   (int)((long)n * t->id / count),
+									   (int)((long)n * (t->id+1) / count));
+}
+
+/* Each fish's steering depends only on where the others were, so the
+   school is split across the threads after the grid is made. */
+static void
+computeAccelerations(glschool_configuration *sc)
+{
+	glschool_buildGrid(sc->school);
+	threadpool_run(&sc->pool, glschool_thread_run);
+	threadpool_wait(&sc->pool);
+}
+
 ENTRYPOINT void
 reshape_glschool(ModeInfo *mi, int width, int height)
 {
@@ -137,6 +186,12 @@ init_glschool(ModeInfo *mi)
 	int						height = MI_HEIGHT(mi);
 	Bool					wire = MI_IS_WIREFRAME(mi);
 	glschool_configuration	*sc;
+	static const struct threadpool_class cls = {
+		sizeof(glschool_thread),
+		glschool_thread_create,
+		glschool_thread_destroy
+	};
+	int						error;
 
 	MI_INIT (mi, scs);
 	sc = &scs[MI_SCREEN(mi)];
@@ -161,6 +216,14 @@ init_glschool(ModeInfo *mi)
 		exit(1);
 	}
 
+	error = threadpool_create(&sc->pool, &cls, MI_DISPLAY(mi),
+							  hardware_concurrency(MI_DISPLAY(mi)));
+	if (error) {
+		sc->pool.count = 0;
+		fprintf(stderr, "%s: threadpool: %s\n", progname, strerror(error));
+		exit(1);
+	}
+
 	reshape_glschool(mi, width, height);
 
 	glschool_initGLEnv(DoFog);
@@ -168,7 +231,9 @@ init_glschool(ModeInfo *mi)
 	glschool_createDrawLists(&SCHOOL_BBOX(sc->school), 
                                  &sc->bboxList, &sc->goalList, &sc->fishList,
                                  &sc->fish_polys, &sc->box_polys, wire);
-	glschool_computeAccelerations(sc->school);
+	if (!wire)
+		sc->instancing = glschool_initInstancing(DoFog);
+	computeAccelerations(sc);
 }
 
 ENTRYPOINT void
@@ -196,11 +261,12 @@ draw_glschool(ModeInfo *mi)
 
 	glschool_applyMovements(sc->school);
 	glschool_drawSchool(sc->colors, sc->school, sc->bboxList, 
-                            sc->goalList, sc->fishList, sc->rotCounter, 
+                            sc->goalList, sc->fishList, sc->instancing,
+                            sc->rotCounter, 
                               sc->drawGoal, sc->drawBBox, 
                             sc->fish_polys, sc->box_polys,
                             &mi->polygon_count);
-	glschool_computeAccelerations(sc->school);
+	computeAccelerations(sc);
 
 	if (mi->fps_p)
 		do_fps(mi);
@@ -218,6 +284,8 @@ free_glschool(ModeInfo *mi)
         if (!sc->context) return;
 	glXMakeCurrent(MI_DISPLAY(mi), MI_WINDOW(mi), *sc->context);
 
+        if (sc->pool.count) threadpool_destroy (&sc->pool);
+        if (sc->instancing) glschool_freeInstancing (sc->instancing);
         if (sc->school) glschool_freeSchool (sc->school);
         if (sc->colors) free (sc->colors);
         if (glIsList(sc->bboxList)) glDeleteLists(sc->bboxList, 1);
@@ -11,6 +11,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef HAVE_CONFIG_H
 # include "config.h"
@@ -175,6 +176,19 @@ glschool_initSchool(int nFish, double accLimit, double maxV, double minV, double
 		return (School *)0;
 	}
 
+	s->cellStart = (int *)0;
+	s->cellsSize = 0;
+	s->fishCell = (int *)malloc(sizeof(int)*(nFish+1));
+	s->sorted = (int *)malloc(sizeof(int)*(nFish+1));
+	if (s->fishCell == (int *)0 || s->sorted == (int *)0) {
+		perror("initSchool grid allocation failed: ");
+		free(s->fishCell);
+		free(s->sorted);
+		free(SCHOOL_FISHES(s));
+		free(s);
+		return (School *)0;
+	}
+
 	SCHOOL_NFISH(s) = nFish;
 	SCHOOL_ACCLIMIT(s) = accLimit;
 	SCHOOL_MAXVEL(s) = maxV;
@@ -196,6 +210,9 @@ void
 glschool_freeSchool(School *s)
 {
 	free(SCHOOL_FISHES(s));
+	free(s->cellStart);
+	free(s->fishCell);
+	free(s->sorted);
 	free(s);
 }
 
@@ -254,6 +271,76 @@ glschool_computeNormalAndThetaToPlusZ(double *v, double *xV)
 }
 
 
+#define MAX_GRID_DIM	64
+
+static int
+cellCoord(School *s, double pos, int i)
+{
+	int c = (int)((pos - BBOX_IMIN(&SCHOOL_BBOX(s), i)) / s->cellSize[i]);
+	if (c < 0) return 0;
+	if (c >= s->gridDims[i]) return s->gridDims[i] - 1;
+	return c;
+}
+
+
+void
+glschool_buildGrid(School *s)
+{
+	int		i;
+	int		c;
+	int		nCells;
+	int		nFish = SCHOOL_NFISH(s);
+	Fish	*fishes = SCHOOL_FISHES(s);
+	double	reach = (SCHOOL_MINRADIUS(s) + SCHOOL_DISTCOMP(s)) * 1.001;
+
+	for(i = 0; i < 3; i++) {
+		double range = SCHOOL_IRANGE(s, i);
+		/* With a negative exponent, far fish are the neighbors: one cell. */
+		if (SCHOOL_DISTEXP(s) <= 0.0 || SCHOOL_MINRADIUS(s) <= 0.0 ||
+			range <= reach) {
+			s->gridDims[i] = 1;
+			s->cellSize[i] = (range > 0.0 ? range : 1.0);
+			continue;
+		}
+		s->gridDims[i] = (int)(range / reach);
+		if (s->gridDims[i] > MAX_GRID_DIM) s->gridDims[i] = MAX_GRID_DIM;
+		s->cellSize[i] = range / s->gridDims[i];
+	}
+
+	nCells = s->gridDims[0] * s->gridDims[1] * s->gridDims[2];
+	if (nCells + 1 > s->cellsSize) {
+		free(s->cellStart);
+		s->cellsSize = nCells + 1;
+		s->cellStart = (int *)malloc(sizeof(int)*s->cellsSize);
+		if (s->cellStart == (int *)0) {
+			perror("buildGrid allocation failed: ");
+			exit(1);
+		}
+	}
+
+	memset(s->cellStart, 0, sizeof(int)*(nCells + 1));
+	for(i = 0; i < nFish; i++) {
+		Fish *f = &fishes[i];
+		c = ((cellCoord(s, FISH_Z(f), 2) * s->gridDims[1] +
+			  cellCoord(s, FISH_Y(f), 1)) * s->gridDims[0] +
+			 cellCoord(s, FISH_X(f), 0));
+		s->fishCell[i] = c;
+		s->cellStart[c]++;
+	}
+
+	/* Counts to ends, then hand out places from the end backward, which
+	   leaves each cellStart at the start of its cell. */
+	for(c = 1; c < nCells; c++)
+		s->cellStart[c] += s->cellStart[c-1];
+	s->cellStart[nCells] = nFish;
+	for(i = nFish-1; i >= 0; i--)
+		s->sorted[--s->cellStart[s->fishCell[i]]] = i;
+}
+
+
+/* Only looks at the fish in the cells around ref in the grid made by the
+   last call to glschool_buildGrid.
+ */
 int
 glschool_computeGroupVectors(School *s, Fish *ref, double *avoidance, double *centroid, double *avgVel)
 {
@@ -263,17 +350,37 @@ glschool_computeGroupVectors(School *s, Fish *ref, double *avoidance, double *ce
 	double	diffVect[3];
 	int		neighborCount = 0;
 	Fish	*test = (Fish *)0;
-	int		nFish = SCHOOL_NFISH(s);
 	double	distExp = SCHOOL_DISTEXP(s);
 	double	distComp = SCHOOL_DISTCOMP(s);
 	double	minRadiusExp = SCHOOL_MINRADIUSEXP(s);
 	Fish	*fishes = SCHOOL_FISHES(s);
-
-	for(i = 0, test = fishes; i < nFish; i++, test++) {
+	int		*dims = s->gridDims;
+	int		cell = s->fishCell[ref - fishes];
+	int		cx = cell % dims[0];
+	int		cy = (cell / dims[0]) % dims[1];
+	int		cz = cell / (dims[0] * dims[1]);
+	int		x0 = (cx > 0 ? cx-1 : cx);
+	int		x1 = (cx < dims[0]-1 ? cx+1 : cx);
+	int		y, z, j, j1;
+	double	reach = SCHOOL_MINRADIUS(s) + distComp;
+	double	reach2 = (distExp > 0.0 && SCHOOL_MINRADIUS(s) > 0.0
+					  ? reach * reach * 1.001 : HUGE_VAL);
+
+	for(z = (cz > 0 ? cz-1 : cz); z <= cz+1 && z < dims[2]; z++)
+	for(y = (cy > 0 ? cy-1 : cy); y <= cy+1 && y < dims[1]; y++)
+	for(j = s->cellStart[(z*dims[1] + y)*dims[0] + x0],
+		j1 = s->cellStart[(z*dims[1] + y)*dims[0] + x1 + 1];
+		j < j1; j++) {
+		i = s->sorted[j];
+		test = &fishes[i];
 		if (test == ref) continue;
 
 		getDifferenceVector(FISH_POS(ref), FISH_POS(test), diffVect);
 
+		/* Skip the pow() for those plainly too far away. */
+		if (diffVect[0]*diffVect[0] + diffVect[1]*diffVect[1] +
+			diffVect[2]*diffVect[2] > reach2) continue;
+
 		dist = norm(diffVect) - distComp;
 		if (dist < 0.0) dist = 0.1;
 
@@ -297,6 +404,18 @@ glschool_computeGroupVectors(School *s, Fish *ref, double *avoidance, double *ce
 
 void
 glschool_computeAccelerations(School *s)
+{
+	glschool_buildGrid(s);
+	glschool_computeAccelerationsRange(s, 0, SCHOOL_NFISH(s));
+}
+
+
+/* Sets the accelerations of fish first ... last-1, from the grid made by
+   the last glschool_buildGrid.  Each fish only writes to itself, so the
+   school can be split into ranges computed in parallel.
+ */
+void
+glschool_computeAccelerationsRange(School *s, int first, int last)
 {
 	int		i;
 	int		j;
@@ -309,7 +428,6 @@ glschool_computeAccelerations(School *s)
 	double	centroid[3];
 	double	avoidance[3];
 	Fish	*ref = (Fish *)0;
-	int		nFish = SCHOOL_NFISH(s);
 	double	*goal = SCHOOL_GOAL(s);
 	double	distExp = SCHOOL_DISTEXP(s);
 	double	distComp = SCHOOL_DISTCOMP(s);
@@ -321,7 +439,7 @@ glschool_computeAccelerations(School *s)
 	double	minRadius = SCHOOL_MINRADIUS(s);
 	Fish	*fishes = SCHOOL_FISHES(s);
 
-	for(i = 0, ref = fishes; i < nFish; i++, ref++) {
+	for(i = first, ref = fishes + first; i < last; i++, ref++) {
 		clearVector(avgVel);
 		clearVector(centroid);
 		clearVector(avoidance);
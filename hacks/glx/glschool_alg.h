@@ -80,6 +80,18 @@ typedef struct {
 	double		boxRanges[3];
 	BBox		theBox;
 	Fish		*theFish;
+
+	/* Each fish only reacts to those within minRadius + distComp of it, so
+	   glschool_buildGrid sorts them into cells at least that big, and a fish
+	   need only look in its own cell and the 26 around it.  Cells are
+	   numbered x fastest, so three neighboring cells in x are one run of
+	   'sorted'. */
+	double		cellSize[3];
+	int			gridDims[3];
+	int			*cellStart;		/* where each cell begins in 'sorted' */
+	int			cellsSize;
+	int			*fishCell;		/* the cell of each fish */
+	int			*sorted;		/* fish numbers, in cell order */
 } School;
 
 #define SCHOOL_NFISH(s)			((s)->nFish)
@@ -119,7 +131,9 @@ extern School		*glschool_initSchool(int, double, double, double, double, double,
 extern void		glschool_newGoal(School *);
 extern void		glschool_setBBox(School *, double, double, double, double, double, double);
 
+extern void		glschool_buildGrid(School *);
 extern void		glschool_computeAccelerations(School *);
+extern void		glschool_computeAccelerationsRange(School *, int, int);
 extern double		glschool_computeNormalAndThetaToPlusZ(double *, double *);
 int			glschool_computeGroupVectors(School *, Fish *, double *, double *, double *);
 
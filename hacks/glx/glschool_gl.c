@@ -13,6 +13,7 @@
 #include "glschool_gl.h"
 #include "sphere.h"
 #include "tube.h"
+#include "glsl-utils.h"
 
 void
 glschool_drawGoal(double *goal, GLuint goalList)
@@ -221,10 +222,342 @@ glschool_getColorVect(XColor *colors, int index, double *colorVect)
 	colorVect[2] = colors[index].blue / 65535.0;
 }
 
+#if defined(HAVE_GLSL) && (!defined(HAVE_JWXYZ) || defined(HAVE_GLES3))
+# define USE_INSTANCING
+#endif
+
+#ifdef USE_INSTANCING
+
+#define FISH_FACES		16
+
+/* Floats per vertex of the fish mesh: position, normal. */
+#define MESH_STRIDE		6
+/* Floats per fish: position, rotation quaternion, color. */
+#define INSTANCE_STRIDE	10
+
+struct glschool_instancing {
+	GLuint		program;
+	GLint		posIndex, normIndex;
+	GLint		fishPosIndex, fishRotIndex, fishColIndex;
+	GLint		projIndex, lightIndex, fogIndex;
+	GLuint		meshBuffer, instanceBuffer;
+	int			nVertices;
+	GLfloat		*instances;
+	int			instancesSize;
+	GLfloat		fogDensity;
+};
+
+static const GLchar *instancing_version_3_0 =
+	"#version 130\n";
+static const GLchar *instancing_version_3_0_es =
+	"#version 300 es\n"
+	"precision highp float;\n"
+	"precision highp int;\n";
+
+/* Places and turns each fish as glschool_drawSchool used to with
+   glTranslatef and glRotatef, and lights it as the fixed-function light
+   set up by glschool_initLights and glschool_initGLEnv would. */
+static const GLchar *instancing_vertex_shader =
+	"in vec3 VertexPosition;\n"
+	"in vec3 VertexNormal;\n"
+	"in vec3 FishPosition;\n"
+	"in vec4 FishRotation;\n"
+	"in vec3 FishColor;\n"
+	"\n"
+	"uniform mat4 MatProj;\n"
+	"\n"
+	"out vec3 Position;\n"
+	"out vec3 Normal;\n"
+	"out vec3 Color;\n"
+	"\n"
+	"vec3 rotate(vec3 v)\n"
+	"{\n"
+	"  vec3 q = FishRotation.xyz;\n"
+	"  return v + 2.0*cross(q,cross(q,v)+FishRotation.w*v);\n"
+	"}\n"
+	"\n"
+	"void main(void)\n"
+	"{\n"
+	"  Position = rotate(VertexPosition)+FishPosition;\n"
+	"  Normal = rotate(VertexNormal);\n"
+	"  Color = FishColor;\n"
+	"  gl_Position = MatProj*vec4(Position,1.0);\n"
+	"}\n";
+
+static const GLchar *instancing_fragment_shader =
+	"in vec3 Position;\n"
+	"in vec3 Normal;\n"
+	"in vec3 Color;\n"
+	"\n"
+	"uniform vec3 LightPosition;\n"
+	"uniform float FogDensity;\n"
+	"\n"
+	"out vec4 FragColor;\n"
+	"\n"
+	"void main(void)\n"
+	"{\n"
+	"  vec3 n = normalize(Normal);\n"
+	"  vec3 l = normalize(LightPosition-Position);\n"
+	"  vec3 h = normalize(l+vec3(0.0,0.0,1.0));\n"
+	"  float ndotl = max(0.0,dot(n,l));\n"
+	"  float pf = 0.0;\n"
+	"  vec3 color;\n"
+	"  float fog;\n"
+	"  if (ndotl > 0.0)\n"
+	"    pf = pow(max(0.0,dot(n,h)),128.0);\n"
+	"  color = clamp(Color*(0.3+ndotl)+vec3(pf),0.0,1.0);\n"
+	"  fog = FogDensity*Position.z;\n"
+	"  fog = clamp(exp(-fog*fog),0.0,1.0);\n"
+	"  FragColor = vec4(mix(vec3(0.0,0.0,0.15),color,fog),1.0);\n"
+	"}\n";
+
+
+static GLfloat *
+addMeshVertex(GLfloat *v, double px, double py, double pz,
+			  double nx, double ny, double nz)
+{
+	*v++ = px; *v++ = py; *v++ = pz;
+	*v++ = nx; *v++ = ny; *v++ = nz;
+	return v;
+}
+
+/* The same triangles as fishList: the cone that cone() makes from the
+   origin to (0, 0, 10), and the sphere that unit_sphere() makes, turned,
+   scaled and moved the same way, with its strip unrolled into triangles. */
+static int
+createFishMesh(GLfloat **meshRet)
+{
+	int		faces = FISH_FACES;
+	int		stripSize = faces * (faces+1) * 2;
+	int		nVertices = faces*3 + (stripSize-2)*3;
+	GLfloat	*mesh = (GLfloat *)malloc(nVertices * MESH_STRIDE * sizeof(GLfloat));
+	GLfloat	*strip = (GLfloat *)malloc(stripSize * MESH_STRIDE * sizeof(GLfloat));
+	GLfloat	*v = mesh, *s = strip;
+	double	step = M_PI * 2 / faces;
+	int		i, j;
+
+	if (!mesh || !strip) {
+		free(mesh);
+		free(strip);
+		return 0;
+	}
+
+	for (i = 0; i < faces; i++) {
+		double	th0 = i * step, th1 = th0 + step, mid = th0 + step/2;
+		v = addMeshVertex(v, 2*cos(th0), -2*sin(th0), 0,
+						  cos(th0), -sin(th0), 0);
+		v = addMeshVertex(v, 0, 0, 10, cos(mid), -sin(mid), 0);
+		v = addMeshVertex(v, 2*cos(th1), -2*sin(th1), 0,
+						  cos(th1), -sin(th1), 0);
+	}
+
+	for (j = 0; j < faces; j++) {
+		double	theta1 = j * M_PI / faces - M_PI_2;
+		double	theta2 = (j+1) * M_PI / faces - M_PI_2;
+		for (i = faces; i >= 0; i--) {
+			double	theta3 = i * M_PI * 2 / faces;
+			double	x = cos(theta2) * cos(theta3);
+			double	y = sin(theta2);
+			double	z = cos(theta2) * sin(theta3);
+			s = addMeshVertex(s, 2*x, -2*z, 2*y - 0.3, x, -z, y);
+			x = cos(theta1) * cos(theta3);
+			y = sin(theta1);
+			z = cos(theta1) * sin(theta3);
+			s = addMeshVertex(s, 2*x, -2*z, 2*y - 0.3, x, -z, y);
+		}
+	}
+
+	/* Every other triangle of a strip is wound the other way. */
+	for (i = 0; i < stripSize-2; i++) {
+		int		a = (i & 1) ? i+1 : i;
+		int		b = (i & 1) ? i : i+1;
+		memcpy(v, strip + a*MESH_STRIDE, MESH_STRIDE * sizeof(GLfloat));
+		v += MESH_STRIDE;
+		memcpy(v, strip + b*MESH_STRIDE, MESH_STRIDE * sizeof(GLfloat));
+		v += MESH_STRIDE;
+		memcpy(v, strip + (i+2)*MESH_STRIDE, MESH_STRIDE * sizeof(GLfloat));
+		v += MESH_STRIDE;
+	}
+
+	free(strip);
+	*meshRet = mesh;
+	return nVertices;
+}
+
+glschool_instancing *
+glschool_initInstancing(Bool doFog)
+{
+	glschool_instancing	*gi;
+	GLint				gl_major, gl_minor, glsl_major, glsl_minor;
+	GLboolean			gl_gles3;
+	const GLchar		*vertex_shader_source[2];
+	const GLchar		*fragment_shader_source[2];
+	GLfloat				*mesh = 0;
+
+	if (!glsl_GetGlAndGlslVersions(&gl_major, &gl_minor,
+								   &glsl_major, &glsl_minor, &gl_gles3))
+		return 0;
+	if (!gl_gles3) {
+		/* glVertexAttribDivisor is in OpenGL 3.3. */
+		if (gl_major < 3 || (gl_major == 3 && gl_minor < 3) ||
+			glsl_major < 1 || (glsl_major == 1 && glsl_minor < 30))
+			return 0;
+		vertex_shader_source[0] = instancing_version_3_0;
+		fragment_shader_source[0] = instancing_version_3_0;
+	} else {
+		if (gl_major < 3 || glsl_major < 3)
+			return 0;
+		vertex_shader_source[0] = instancing_version_3_0_es;
+		fragment_shader_source[0] = instancing_version_3_0_es;
+	}
+	vertex_shader_source[1] = instancing_vertex_shader;
+	fragment_shader_source[1] = instancing_fragment_shader;
+
+	gi = (glschool_instancing *)calloc(1, sizeof(*gi));
+	if (!gi) return 0;
+
+	if (!glsl_CompileAndLinkShaders(2, vertex_shader_source,
+									2, fragment_shader_source,
+									&gi->program)) {
+		free(gi);
+		return 0;
+	}
+
+	gi->posIndex = glGetAttribLocation(gi->program, "VertexPosition");
+	gi->normIndex = glGetAttribLocation(gi->program, "VertexNormal");
+	gi->fishPosIndex = glGetAttribLocation(gi->program, "FishPosition");
+	gi->fishRotIndex = glGetAttribLocation(gi->program, "FishRotation");
+	gi->fishColIndex = glGetAttribLocation(gi->program, "FishColor");
+	gi->projIndex = glGetUniformLocation(gi->program, "MatProj");
+	gi->lightIndex = glGetUniformLocation(gi->program, "LightPosition");
+	gi->fogIndex = glGetUniformLocation(gi->program, "FogDensity");
+	if (gi->posIndex == -1 || gi->normIndex == -1 ||
+		gi->fishPosIndex == -1 || gi->fishRotIndex == -1 ||
+		gi->fishColIndex == -1 || gi->projIndex == -1) {
+		glDeleteProgram(gi->program);
+		free(gi);
+		return 0;
+	}
+
+	gi->nVertices = createFishMesh(&mesh);
+	if (!gi->nVertices) {
+		glDeleteProgram(gi->program);
+		free(gi);
+		return 0;
+	}
+
+	glGenBuffers(1, &gi->meshBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, gi->meshBuffer);
+	glBufferData(GL_ARRAY_BUFFER,
+				 gi->nVertices * MESH_STRIDE * sizeof(GLfloat),
+				 mesh, GL_STATIC_DRAW);
+	glGenBuffers(1, &gi->instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	free(mesh);
+
+	gi->fogDensity = doFog ? .0025 : 0;
+	return gi;
+}
+
+void
+glschool_freeInstancing(glschool_instancing *gi)
+{
+	if (!gi) return;
+	glDeleteBuffers(1, &gi->meshBuffer);
+	glDeleteBuffers(1, &gi->instanceBuffer);
+	glDeleteProgram(gi->program);
+	free(gi->instances);
+	free(gi);
+}
+
+static GLfloat *
+getInstances(glschool_instancing *gi, int nFish)
+{
+	if (nFish > gi->instancesSize) {
+		free(gi->instances);
+		gi->instances = (GLfloat *)malloc(nFish * INSTANCE_STRIDE * sizeof(GLfloat));
+		gi->instancesSize = gi->instances ? nFish : 0;
+	}
+	return gi->instances;
+}
+
+static void
+drawInstances(glschool_instancing *gi, int nFish)
+{
+	GLint	viewport[4];
+	GLfloat	proj[16];
+	GLfloat	light[3] = {0.0, 50.0, -50.0};
+	GLsizei	stride = INSTANCE_STRIDE * sizeof(GLfloat);
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glsl_Identity(proj);
+	glsl_Perspective(proj, 60.0, (GLfloat)viewport[2] / (GLfloat)viewport[3],
+					 0.1, 451.0);
+
+	glUseProgram(gi->program);
+	glUniformMatrix4fv(gi->projIndex, 1, GL_FALSE, proj);
+	glUniform3fv(gi->lightIndex, 1, light);
+	glUniform1f(gi->fogIndex, gi->fogDensity);
+
+	glBindBuffer(GL_ARRAY_BUFFER, gi->meshBuffer);
+	glEnableVertexAttribArray(gi->posIndex);
+	glVertexAttribPointer(gi->posIndex, 3, GL_FLOAT, GL_FALSE,
+						  MESH_STRIDE * sizeof(GLfloat), (const void *)0);
+	glEnableVertexAttribArray(gi->normIndex);
+	glVertexAttribPointer(gi->normIndex, 3, GL_FLOAT, GL_FALSE,
+						  MESH_STRIDE * sizeof(GLfloat),
+						  (const void *)(3 * sizeof(GLfloat)));
+
+	glBindBuffer(GL_ARRAY_BUFFER, gi->instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, nFish * stride, gi->instances,
+				 GL_STREAM_DRAW);
+	glEnableVertexAttribArray(gi->fishPosIndex);
+	glVertexAttribPointer(gi->fishPosIndex, 3, GL_FLOAT, GL_FALSE, stride,
+						  (const void *)0);
+	glVertexAttribDivisor(gi->fishPosIndex, 1);
+	glEnableVertexAttribArray(gi->fishRotIndex);
+	glVertexAttribPointer(gi->fishRotIndex, 4, GL_FLOAT, GL_FALSE, stride,
+						  (const void *)(3 * sizeof(GLfloat)));
+	glVertexAttribDivisor(gi->fishRotIndex, 1);
+	glEnableVertexAttribArray(gi->fishColIndex);
+	glVertexAttribPointer(gi->fishColIndex, 3, GL_FLOAT, GL_FALSE, stride,
+						  (const void *)(7 * sizeof(GLfloat)));
+	glVertexAttribDivisor(gi->fishColIndex, 1);
+
+	glFrontFace(GL_CCW);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, gi->nVertices, nFish);
+
+	glVertexAttribDivisor(gi->fishPosIndex, 0);
+	glVertexAttribDivisor(gi->fishRotIndex, 0);
+	glVertexAttribDivisor(gi->fishColIndex, 0);
+	glDisableVertexAttribArray(gi->posIndex);
+	glDisableVertexAttribArray(gi->normIndex);
+	glDisableVertexAttribArray(gi->fishPosIndex);
+	glDisableVertexAttribArray(gi->fishRotIndex);
+	glDisableVertexAttribArray(gi->fishColIndex);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+}
+
+#else /* !USE_INSTANCING */
+
+glschool_instancing *
+glschool_initInstancing(Bool doFog)
+{
+	return 0;
+}
+
+void
+glschool_freeInstancing(glschool_instancing *gi)
+{
+}
+
+#endif /* !USE_INSTANCING */
+
 void
 glschool_drawSchool(XColor *colors, School *s,
 		   GLuint bboxList, GLuint goalList, GLuint fishList,
-		   int rotCounter, Bool drawGoal_p, Bool drawBBox_p,
+		   glschool_instancing *instancing, int rotCounter, Bool drawGoal_p, Bool drawBBox_p,
            int fish_polys, int box_polys, unsigned long *polys)
 {
 	double			xVect[3];
@@ -235,6 +568,9 @@ glschool_drawSchool(XColor *colors, School *s,
 	Fish			*f = (Fish *)0;
 	int				nFish = SCHOOL_NFISH(s);
 	Fish			*theFishes = SCHOOL_FISHES(s);
+#ifdef USE_INSTANCING
+	GLfloat			*inst = instancing ? getInstances(instancing, nFish) : 0;
+#endif
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -258,6 +594,30 @@ glschool_drawSchool(XColor *colors, School *s,
 		if (FISH_VZ(f) < 0.0) rotTheta = 180.0 - rotTheta;
 
 		glschool_getColorVect(colors, (int)(colTheta+240)%360, colorVect);
+
+#ifdef USE_INSTANCING
+		if (inst) {
+			/* The quaternion for glRotatef(180+rotTheta, xVect). */
+			double	len = sqrt(xVect[0]*xVect[0] + xVect[1]*xVect[1] +
+							   xVect[2]*xVect[2]);
+			double	half = (180.0+rotTheta) * M_PI / 360.0;
+			double	sh = len > 0.0 ? sin(half) / len : 0.0;
+
+			*inst++ = FISH_X(f);
+			*inst++ = FISH_Y(f);
+			*inst++ = FISH_Z(f);
+			*inst++ = xVect[0] * sh;
+			*inst++ = xVect[1] * sh;
+			*inst++ = xVect[2] * sh;
+			*inst++ = len > 0.0 ? cos(half) : 1.0;
+			*inst++ = colorVect[0];
+			*inst++ = colorVect[1];
+			*inst++ = colorVect[2];
+			*polys += fish_polys;
+			continue;
+		}
+#endif
+
 		glColor3f(colorVect[0], colorVect[1], colorVect[2]);
 
 		glPushMatrix();
@@ -270,5 +630,9 @@ glschool_drawSchool(XColor *colors, School *s,
 		glPopMatrix();
 	}
 
+#ifdef USE_INSTANCING
+	if (inst) drawInstances(instancing, nFish);
+#endif
+
 	glFinish();
 }
@@ -24,7 +24,16 @@ extern void glschool_getColorVect(XColor *, int, double *);
 extern int glschool_drawBoundingBox(BBox *, Bool);
 extern int glschool_createBBoxList(BBox *, GLuint *, int);
 extern void glschool_createDrawLists(BBox *, GLuint *, GLuint *, GLuint *, int *, int *, Bool);
-extern void glschool_drawSchool(XColor *, School *, GLuint, GLuint, GLuint, int, Bool, Bool, 
+
+/* Shaders that draw every fish with one instanced call, on OpenGL 3.3 or
+   OpenGL ES 3.0 and later.  glschool_initInstancing returns NULL if they
+   are not available, in which case the fish are drawn with fishList. */
+typedef struct glschool_instancing glschool_instancing;
+extern glschool_instancing *glschool_initInstancing(Bool);
+extern void glschool_freeInstancing(glschool_instancing *);
+
+extern void glschool_drawSchool(XColor *, School *, GLuint, GLuint, GLuint,
+                       glschool_instancing *, int, Bool, Bool, 
                        int, int, unsigned long *);
 
 #endif /* __GLSCHOOL_GL_H__ */
@@ -15,6 +15,7 @@
 #include "xlockmoreI.h"
 #include "grab-ximage.h"
 #include "grabclient.h"
+#include "imgfilter.h"
 #include "pow2.h"
 #include "visual.h"
 #include "xshm.h"
@@ -222,7 +223,7 @@ convert_ximage_to_rgba32 (Screen *screen, XImage *image)
 
 #endif /* REFORMAT_IMAGE_DATA */
 
-/* Shrinks the XImage by a factor of two.
+/* Shrinks the XImage by a factor of two, averaging each 2x2 block.
    We use this when mipmapping fails on large textures.
  */
 static void
@@ -230,7 +231,6 @@ halve_image (XImage *ximage, XRectangle *geom)
 {
   int w2 = ximage->width/2;
   int h2 = ximage->height/2;
-  int x, y;
   XImage *ximage2;
 
   if (w2 <= 32 || h2 <= 32)   /* let's not go crazy here, man. */
@@ -249,17 +249,14 @@ halve_image (XImage *ximage, XRectangle *geom)
   XInitImage (ximage2);
 
   ximage2->data = (char *) calloc (h2, ximage2->bytes_per_line);
-  if (!ximage2->data)
+  if (!ximage2->data ||
+      !imgfilter_scale_ximage (ximage, ximage2, 0))
     {
       fprintf (stderr, "%s: out of memory (scaling %dx%d image to %dx%d)\n",
                progname, ximage->width, ximage->height, w2, h2);
       exit (1);
     }
 
-  for (y = 0; y < h2; y++)
-    for (x = 0; x < w2; x++)
-      XPutPixel (ximage2, x, y, XGetPixel (ximage, x*2, y*2));
-
   free (ximage->data);
   *ximage = *ximage2;
   ximage2->data = 0;
@@ -11,6 +11,10 @@
  * This implements the "ping" sensor for sonar.
  */
 
+#ifdef __linux__
+# define _GNU_SOURCE	/* for sendmmsg() and recvmmsg() */
+#endif
+
 #include "screenhackI.h"
 #include "sonar.h"
 #include "version.h"
@@ -77,6 +81,12 @@
 # endif
 #endif /* HAVE_ICMP || HAVE_ICMPHDR */
 
+/* Linux can send or receive a whole batch of packets with one system call.
+   Elsewhere, it's one sendto() or recvfrom() per packet. */
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+# define HAVE_MMSG
+#endif
+
 #if defined(HAVE_ICMP)
 # define HAVE_PING
 # define ICMP             icmp
@@ -131,15 +141,41 @@ sonar_init_ping (Display *dpy, char **error_ret, char **desc_ret,
  */
 static int global_icmpsock = 0;
 
-/* Set by a signal handler. */
-static int timer_expired;
 
+/* Pings are sent, and replies read, this many at a time. */
+#define PING_BATCH 64
+
+/* No more than this many pings are sent per scan, even if the frame rate
+   has fallen so far behind that more than that are due. */
+#define PING_MAX_PER_SCAN (PING_BATCH * 8)
+
+/* Big enough for any packet that send_pings() builds, or the reply to it
+   with an IP header in front. */
+#define PING_PACKET_SIZE 512
+
+/* A power of 2.  The ping timeout is divided into this many ticks, less
+   one, so that no ping is ever more than one trip around the wheel away
+   from timing out. */
+#define PING_WHEEL_SLOTS 256
 
 
 static u_short checksum(u_short *, int);
-static long delta(struct timeval *, struct timeval *);
 
 
+/* A ping that has been sent, and not yet answered or timed out.  It is in
+   one of the probes[] hash chains, keyed by the address and sequence number
+   in the packet, and in one of the wheel[] slots, by when it times out.
+ */
+typedef struct ping_probe ping_probe;
+struct ping_probe {
+  sonar_bogie *bogie;		/* in 'targets' */
+  unsigned hash;
+  u_short seq;
+  double sent;
+  ping_probe *hash_next, **hash_prev;
+  ping_probe *wheel_next, **wheel_prev;
+};
+
 typedef struct {
   Display *dpy;                 /* Only used to get *useThreads. */
 
@@ -147,7 +183,7 @@ typedef struct {
   int icmpsock;			/* socket for sending pings */
   int pid;			/* our process ID */
   int seq;			/* packet sequence number */
-  int timeout;			/* packet timeout */
+  int timeout;			/* packet timeout, in milliseconds */
 
   int target_count;
   sonar_bogie *targets;		/* the hosts we will ping;
@@ -155,6 +191,18 @@ typedef struct {
   sonar_bogie *last_pinged;	/* pointer into 'targets' list */
   double last_ping_time;
 
+  ping_probe **probes;		/* hash table of outstanding pings */
+  unsigned probe_mask;		/* its size, less one */
+  ping_probe *free_probes;
+
+  ping_probe *wheel[PING_WHEEL_SLOTS];
+  double start_time;
+  double wheel_tick;		/* seconds per slot */
+  int wheel_ticks;		/* slots per timeout */
+  long wheel_now;		/* the last tick that has been expired */
+
+  u_char (*packets)[PING_PACKET_SIZE];	/* PING_BATCH of them */
+
   Bool resolve_p;
   Bool times_p;
   Bool debug_p;
@@ -551,68 +599,82 @@ found_duplicate_host (const ping_data *pd, sonar_bogie **list,
 }
 
 
+/* The part of the bogie's sockaddr that says which host it is.
+ */
+static const void *
+address_key (const ping_bogie *pb, size_t *size)
+{
+  const struct sockaddr *addr = (const struct sockaddr *) &pb->address;
+  switch (addr->sa_family)
+    {
+    case AF_INET:
+      *size = sizeof (struct in_addr);
+      return &((const struct sockaddr_in *) addr)->sin_addr;
+#ifdef AF_INET6
+    case AF_INET6:
+      *size = 16;
+      return &((const struct sockaddr_in6 *) addr)->sin6_addr;
+#endif
+    default:
+      /* Fallback behavior: Just memcmp the two addresses.
+
+         For this to work, unused space in the sockaddr must be
+         set to zero. Which may actually be the case:
+         - async_addr_from_name_finish won't put garbage into
+           sockaddr_in.sin_zero or elsewhere unless getaddrinfo
+           does.
+         - ping_bogie is allocated with calloc(). */
+      *size = pb->addrlen;
+      return addr;
+    }
+}
+
+
+static Bool
+same_address (const ping_bogie *pb1, const ping_bogie *pb2)
+{
+  size_t size1, size2;
+  const void *key1 = address_key (pb1, &size1);
+  const void *key2 = address_key (pb2, &size2);
+  return (((const struct sockaddr *) &pb1->address)->sa_family ==
+          ((const struct sockaddr *) &pb2->address)->sa_family &&
+          size1 == size2 &&
+          !memcmp (key1, key2, size1));
+}
+
+
+/* FNV-1a. */
+static unsigned
+hash_bytes (unsigned hash, const void *bytes, size_t size)
+{
+  const u_char *b = (const u_char *) bytes;
+  while (size--)
+    hash = (hash ^ *b++) * 16777619u;
+  return hash;
+}
+
+
+static unsigned
+hash_address (const ping_bogie *pb)
+{
+  size_t size;
+  const void *key = address_key (pb, &size);
+  return hash_bytes (2166136261u, key, size);
+}
+
+
 static sonar_bogie **
 find_duplicate_host (const ping_data *pd, sonar_bogie **list,
                      sonar_bogie *bogie)
 {
   const ping_bogie *pb = (const ping_bogie *) bogie->closure;
-  const struct sockaddr *addr1 = (const struct sockaddr *) &(pb->address);
 
   while(*list)
     {
       const ping_bogie *pb2 = (const ping_bogie *) (*list)->closure;
 
-      if (!pb2->lookup_addr)
-        {
-          const struct sockaddr *addr2 =
-            (const struct sockaddr *) &(pb2->address);
-
-          if (addr1->sa_family == addr2->sa_family)
-            {
-              switch (addr1->sa_family)
-                {
-                case AF_INET:
-                  {
-                    unsigned long ip1 =
-                      ((const struct sockaddr_in *)addr1)->sin_addr.s_addr;
-                    const struct sockaddr_in *i2 =
-                      (const struct sockaddr_in *)addr2;
-                    unsigned long ip2 = i2->sin_addr.s_addr;
-
-                    if (ip1 == ip2)
-                      return found_duplicate_host (pd, list, bogie);
-                  }
-                  break;
-#ifdef AF_INET6
-                case AF_INET6:
-                  {
-                    if (! memcmp(
-                            &((const struct sockaddr_in6 *)addr1)->sin6_addr,
-                            &((const struct sockaddr_in6 *)addr2)->sin6_addr,
-                            16))
-                      return found_duplicate_host (pd, list, bogie);
-                  }
-                  break;
-#endif
-                default:
-                  {
-                    /* Fallback behavior: Just memcmp the two addresses.
-
-                       For this to work, unused space in the sockaddr must be
-                       set to zero. Which may actually be the case:
-                       - async_addr_from_name_finish won't put garbage into
-                         sockaddr_in.sin_zero or elsewhere unless getaddrinfo
-                         does.
-                       - ping_bogie is allocated with calloc(). */
-
-                    if (pb->addrlen == pb2->addrlen &&
-                        ! memcmp(addr1, addr2, pb->addrlen))
-                      return found_duplicate_host (pd, list, bogie);
-                  }
-                  break;
-                }
-            }
-        }
+      if (!pb2->lookup_addr && same_address (pb, pb2))
+        return found_duplicate_host (pd, list, bogie);
 
       list = &(*list)->next;
     }
@@ -621,31 +683,58 @@ find_duplicate_host (const ping_data *pd, sonar_bogie **list,
 }
 
 
+/* Keeps the first of any hosts with the same address.  This hashes the
+   addresses, since a /16 has a lot of hosts to compare with each other.
+ */
 static sonar_bogie *
 delete_duplicate_hosts (sonar_sensor_data *ssd, sonar_bogie *list)
 {
   ping_data *pd = (ping_data *) ssd->closure;
-  sonar_bogie *head = list;
-  sonar_bogie *sb = head;
+  sonar_bogie **seen;
+  sonar_bogie **sbp;
+  unsigned mask = 63;
+  int count = 0;
+
+  for (sbp = &list; *sbp; sbp = &(*sbp)->next)
+    count++;
+  while (mask < count * 2)
+    mask = mask * 2 + 1;
 
-  while (sb)
+  seen = (sonar_bogie **) calloc (mask + 1, sizeof(*seen));
+  if (!seen) return list;
+
+  sbp = &list;
+  while (*sbp)
     {
+      sonar_bogie *sb = *sbp;
       ping_bogie *pb = (ping_bogie *) sb->closure;
+      Bool dup_p = False;
 
       if (!pb->lookup_addr)
         {
-          sonar_bogie **sb2 = find_duplicate_host (pd, &sb->next, sb);
-          if (sb2)
-            *sb2 = (*sb2)->next;
-            /* #### sb leaked */
-          else
-            sb = sb->next;
+          unsigned i = hash_address (pb) & mask;
+          for (; seen[i]; i = (i + 1) & mask)
+            if (same_address (pb, (ping_bogie *) seen[i]->closure))
+              {
+                dup_p = True;
+                break;
+              }
+          if (!dup_p)
+            seen[i] = sb;
+        }
+
+      if (dup_p)
+        {
+          found_duplicate_host (pd, sbp, sb);
+          *sbp = sb->next;
+          sonar_free_bogie (ssd, sb);
         }
       else
-        sb = sb->next;
+        sbp = &sb->next;
     }
 
-  return head;
+  free (seen);
+  return list;
 }
 
 
@@ -683,19 +772,21 @@ subnet_hosts (sonar_sensor_data *ssd, char **error_ret, char **desc_ret,
   ping_data *pd = (ping_data *) ssd->closure;
   unsigned long h_mask;   /* host order */
   unsigned long h_base;   /* host order */
+  unsigned long h_scan;   /* host order: the first address to ping */
   char address[BUFSIZ];
   char *p;
-  int i;
+  long i;
+  int scan_width = subnet_width;
   sonar_bogie *new;
   sonar_bogie *list = 0;
   char buf[1024];
 
-  if (subnet_width < 24)
+  if (subnet_width < 16)
     {
       sprintf (buf,
                "Pinging %lu hosts is a bad\n"
                "idea.  Please use a subnet\n"
-               "mask of 24 bits or more.",
+               "mask of 16 bits or more.",
                (unsigned long) (1L << (32 - subnet_width)) - 1);
       *error_ret = strdup(buf);
       return 0;
@@ -791,6 +882,9 @@ subnet_hosts (sonar_sensor_data *ssd, char **error_ret, char **desc_ret,
           in = in2;
           subnet_width = mask_width (mask);
 
+          /* The local network may be big, but only ping our neighbors. */
+          scan_width = subnet_width < 24 ? 24 : subnet_width;
+
           /* Take the first non-loopback network: prefer en0 over en1. */
           if (in.s_addr && subnet_width)
             break;
@@ -889,17 +983,19 @@ subnet_hosts (sonar_sensor_data *ssd, char **error_ret, char **desc_ret,
     *desc_ret = strdup (buf2);
   }
 
-  for (i = 255; i >= 0; i--) {
+  h_scan = h_base & width_mask (scan_width);
+  for (i = (1L << (32 - scan_width)) - 1; i >= 0; i--) {
     unsigned int a, b, c, d;
-    int ip = (h_base & 0xFFFFFF00L) | i;     /* host order */
-      
+    unsigned long ip = h_scan | i;           /* host order */
+
     if ((ip & h_mask) != (h_base & h_mask))  /* skip out-of-subnet host */
       continue;
     else if (subnet_width == 31)	     /* 1-bit bridge: 2 hosts */
       ;
-    else if ((ip & ~h_mask) == 0)	     /* skip network address */
+    else if ((ip & ~h_mask & 0xFFFFFFFFL) == 0)   /* skip network address */
       continue;
-    else if ((ip & ~h_mask) == ~h_mask)	     /* skip broadcast address */
+    else if ((ip & ~h_mask & 0xFFFFFFFFL) ==
+             (~h_mask & 0xFFFFFFFFL))        /* skip broadcast address */
       continue;
 
     unpack_addr (htonl (ip), &a, &b, &c, &d);
@@ -920,7 +1016,7 @@ subnet_hosts (sonar_sensor_data *ssd, char **error_ret, char **desc_ret,
       }
 
     p = address + strlen(address) + 1;
-    sprintf(p, "%d", i);
+    sprintf(p, "%ld", i);
 
     new = bogie_for_host (ssd, address, NULL);
     if (new)
@@ -934,13 +1030,123 @@ subnet_hosts (sonar_sensor_data *ssd, char **error_ret, char **desc_ret,
 }
 
 
-/* Send a ping packet.
+/* Returns the current time in seconds as a double.
+ */
+static double
+double_time (void)
+{
+  struct timeval now;
+# ifdef GETTIMEOFDAY_TWO_ARGS
+  struct timezone tzp;
+  gettimeofday(&now, &tzp);
+# else
+  gettimeofday(&now);
+# endif
+
+  return (now.tv_sec + ((double) now.tv_usec * 0.000001));
+}
+
+
+/* Outstanding pings are looked up by the address and sequence number that
+   were put in the packet, so these hash the same bytes that send_pings()
+   puts there and get_ping() finds in the reply.
+ */
+static unsigned
+hash_probe (const void *addr, socklen_t addrlen, u_short seq)
+{
+  unsigned hash = hash_bytes (2166136261u, &addrlen, sizeof(addrlen));
+  hash = hash_bytes (hash, addr, addrlen);
+  return hash_bytes (hash, &seq, sizeof(seq));
+}
+
+
+static long
+wheel_tick (const ping_data *pd, double now)
+{
+  return (long) ((now - pd->start_time) / pd->wheel_tick);
+}
+
+
+/* Forgets an outstanding ping, because it was answered or timed out.
+ */
+static void
+free_probe (ping_data *pd, ping_probe *p)
+{
+  if ((*p->hash_prev = p->hash_next))
+    p->hash_next->hash_prev = p->hash_prev;
+  if ((*p->wheel_prev = p->wheel_next))
+    p->wheel_next->wheel_prev = p->wheel_prev;
+  p->hash_next = pd->free_probes;
+  pd->free_probes = p;
+}
+
+
+/* Remembers that a ping was sent, until the ping timeout.
  */
 static void
-send_ping (ping_data *pd, const sonar_bogie *b)
+add_probe (ping_data *pd, sonar_bogie *b, u_short seq, double now)
+{
+  ping_bogie *pb = (ping_bogie *) b->closure;
+  ping_probe *p = pd->free_probes;
+  ping_probe **head;
+
+  if (p)
+    pd->free_probes = p->hash_next;
+  else if (! (p = (ping_probe *) malloc (sizeof(*p))))
+    return;  /* Out of memory: the reply will be unexpected. */
+
+  p->bogie = b;
+  p->seq = seq;
+  p->sent = now;
+  p->hash = hash_probe (&pb->address, pb->addrlen, seq);
+
+  head = &pd->probes[p->hash & pd->probe_mask];
+  if ((p->hash_next = *head))
+    p->hash_next->hash_prev = &p->hash_next;
+  p->hash_prev = head;
+  *head = p;
+
+  head = &pd->wheel[(wheel_tick (pd, now) + pd->wheel_ticks) &
+                    (PING_WHEEL_SLOTS - 1)];
+  if ((p->wheel_next = *head))
+    p->wheel_next->wheel_prev = &p->wheel_next;
+  p->wheel_prev = head;
+  *head = p;
+}
+
+
+/* Turns the wheel up to now, forgetting every ping that has timed out.
+   Replies to those are ignored, if they ever arrive.
+ */
+static void
+expire_probes (ping_data *pd, double now)
+{
+  long tick = wheel_tick (pd, now);
+  long t = pd->wheel_now;
+
+  if (tick - t > PING_WHEEL_SLOTS)
+    t = tick - PING_WHEEL_SLOTS;
+  while (t < tick)
+    {
+      ping_probe **slot = &pd->wheel[++t & (PING_WHEEL_SLOTS - 1)];
+      while (*slot)
+        {
+          if (pd->debug_p > 2)
+            fprintf (stderr, "%s:   timed out: %s icmp_seq=%d\n",
+                     progname, (*slot)->bogie->name, (*slot)->seq);
+          free_probe (pd, *slot);
+        }
+    }
+  pd->wheel_now = tick;
+}
+
+
+/* Fills in a ping packet.  Returns its size.
+ */
+static int
+make_ping (ping_data *pd, const sonar_bogie *b, u_short seq, u_char *packet)
 {
   ping_bogie *pb = (ping_bogie *) b->closure;
-  u_char *packet;
   struct ICMP *icmph;
   const char *token = "org.jwz.xscreensaver.sonar";
   char *host_id;
@@ -951,17 +1157,17 @@ send_ping (ping_data *pd, const sonar_bogie *b)
                  strlen(token) + 1 +
                  strlen(pd->version) + 1);
 
-  /* Create the ICMP packet */
+  if (pcktsiz > PING_PACKET_SIZE) abort();
+  memset (packet, 0, pcktsiz);
 
-  if (! (packet = (u_char *) calloc(1, pcktsiz)))
-    return;  /* Out of memory */
+  /* Create the ICMP packet */
 
   icmph = (struct ICMP *) packet;
   ICMP_TYPE(icmph) = ICMP_ECHO;
   ICMP_CODE(icmph) = 0;
   ICMP_CHECKSUM(icmph) = 0;
   ICMP_ID(icmph) = pd->pid;
-  ICMP_SEQ(icmph) = pd->seq++;
+  ICMP_SEQ(icmph) = seq;
   /* struct timeval needs alignment, so we first use aligned buffer for
      gettimeofday() and later copy the result to packet buffer
    */
@@ -979,35 +1185,77 @@ send_ping (ping_data *pd, const sonar_bogie *b)
      just to give a clue to anyone sniffing and wondering what's up.
    */
   host_id = (char *) &packet[sizeof(struct ICMP) + sizeof(struct timeval)];
-  *(socklen_t *)host_id = pb->addrlen;
+  memcpy(host_id, &pb->addrlen, sizeof(socklen_t));
   host_id += sizeof(socklen_t);
   memcpy(host_id, &pb->address, pb->addrlen);
   host_id += pb->addrlen;
   sprintf (host_id, "%.20s %.20s", token, pd->version);
 
   ICMP_CHECKSUM(icmph) = checksum((u_short *)packet, pcktsiz);
+  return pcktsiz;
+}
+
+
+/* Send ping packets, up to PING_BATCH at a time.
+ */
+static void
+send_pings (ping_data *pd, sonar_bogie **bogies, int count)
+{
+  double now = double_time();
+  int sizes[PING_BATCH];
+  int i, sent;
 
-  /* Send it */
+  if (count > PING_BATCH) abort();
 
-  if (sendto(pd->icmpsock, packet, pcktsiz, 0, 
-             (struct sockaddr *)&pb->address, sizeof(pb->address))
-      != pcktsiz)
+  for (i = 0; i < count; i++)
     {
-#if 0
-      char buf[BUFSIZ];
-      sprintf(buf, "%s: pinging %.100s", progname, b->name);
-      perror(buf);
-#endif
+      u_short seq = pd->seq++;
+      sizes[i] = make_ping (pd, bogies[i], seq, pd->packets[i]);
+      add_probe (pd, bogies[i], seq, now);
     }
 
-  free (packet);
-}
+  /* Send them.  The socket doesn't block, so if the kernel's buffer is
+     full, the rest are dropped, and those hosts will just time out. */
 
-/* signal handler */
-static void
-sigcatcher (int sig)
-{
-  timer_expired = 1;
+# ifdef HAVE_MMSG
+  {
+    struct mmsghdr msgs[PING_BATCH];
+    struct iovec iov[PING_BATCH];
+    memset (msgs, 0, count * sizeof(*msgs));
+    for (i = 0; i < count; i++)
+      {
+        ping_bogie *pb = (ping_bogie *) bogies[i]->closure;
+        iov[i].iov_base = pd->packets[i];
+        iov[i].iov_len = sizes[i];
+        msgs[i].msg_hdr.msg_name = &pb->address;
+        msgs[i].msg_hdr.msg_namelen = sizeof(pb->address);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+    for (sent = 0; sent < count; )
+      {
+        int n = sendmmsg (pd->icmpsock, msgs + sent, count - sent, 0);
+        if (n <= 0) break;
+        sent += n;
+      }
+  }
+# else  /* !HAVE_MMSG */
+  for (sent = 0; sent < count; sent++)
+    {
+      ping_bogie *pb = (ping_bogie *) bogies[sent]->closure;
+      if (sendto (pd->icmpsock, pd->packets[sent], sizes[sent], 0,
+                  (struct sockaddr *)&pb->address, sizeof(pb->address))
+          != sizes[sent])
+        break;
+    }
+# endif /* !HAVE_MMSG */
+
+  if (sent < count && pd->debug_p)
+    {
+      char buf[BUFSIZ];
+      sprintf (buf, "%s: pinging %.100s", progname, bogies[sent]->name);
+      perror (buf);
+    }
 }
 
 
@@ -1067,240 +1315,249 @@ copy_ping_bogie (sonar_sensor_data *ssd, const sonar_bogie *b)
 }
 
 
-/* Look for all outstanding ping replies.
+/* Checks one packet that came in.  Returns a new bogie if it's the reply
+   to an outstanding ping.
  */
 static sonar_bogie *
-get_ping (sonar_sensor_data *ssd)
+ping_reply (sonar_sensor_data *ssd, const u_char *packet, int result,
+            double now)
 {
   ping_data *pd = (ping_data *) ssd->closure;
-  struct sockaddr from;
-  socklen_t fromlen;
-  int result;
-  u_char packet[1024];
-  struct timeval now;
-  struct timeval then;
-  struct ip *ip;
+  const struct ip *ip;
   int iphdrlen;
-  struct ICMP *icmph;
-  sonar_bogie *bl = 0;
+  struct ICMP icmph;
   sonar_bogie *new = 0;
-  struct sigaction sa;
-  struct itimerval it;
-  fd_set rfds;
-  struct timeval tv;
+  ping_probe *probe = 0;
 
-  /* Set up a signal to interrupt our wait for a packet */
+  if (result < (int) sizeof(struct ip))
+    return 0;
+  ip = (const struct ip *) packet;
+  iphdrlen = IP_HDRLEN(ip) << 2;
+  if (result < iphdrlen + (int) sizeof(icmph))
+    return 0;
+  memcpy (&icmph, &packet[iphdrlen], sizeof(icmph));
 
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = 0;
-  sa.sa_handler = sigcatcher;
-  if (sigaction(SIGALRM, &sa, 0) == -1) 
-    {
-      char msg[1024];
-      sprintf(msg, "%s: unable to trap SIGALRM", progname);
-      perror(msg);
-      exit(1);
-    }
+  /* Ignore anything but ICMP Replies */
+  if (ICMP_TYPE(&icmph) != ICMP_ECHOREPLY) 
+    return 0;
 
-  /* Set up a timer to interupt us if we don't get a packet */
+  /* Ignore packets not set from us */
+  if (ICMP_ID(&icmph) != pd->pid)
+    return 0;
 
-  it.it_interval.tv_sec = 0;
-  it.it_interval.tv_usec = 0;
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = pd->timeout;
-  timer_expired = 0;
-  setitimer(ITIMER_REAL, &it, 0);
+  /* Find the bogie in 'targets' that corresponds to this packet
+     and copy it, so that this bogie stays in the same spot (th)
+     on the screen, and so that we don't have to resolve it again.
 
-  /* Wait for a result packet */
+     We could find the bogie by comparing ip->ip_src.s_addr to
+     pb->address, but it is possible that, in certain weird router
+     or NAT situations, that the reply will come back from a 
+     different address than the one we sent it to.  So instead,
+     we parse the sockaddr out of the reply packet payload.
+   */
+  {
+    const u_char *host_id =
+      &packet[iphdrlen + sizeof(struct ICMP) + sizeof(struct timeval)];
+    socklen_t addrlen;
 
-  fromlen = sizeof(from);
-  while (! timer_expired)
+    /* Ensure that a maliciously-crafted return packet can't
+       make us overflow in memcmp. */
+    if (host_id + sizeof(addrlen) <= packet + result)
+      {
+        memcpy (&addrlen, host_id, sizeof(addrlen));
+        host_id += sizeof(addrlen);
+        if (addrlen <= sizeof(async_netdb_sockaddr_storage_t) &&
+            host_id + addrlen <= packet + result)
+          {
+            unsigned hash = hash_probe (host_id, addrlen, ICMP_SEQ(&icmph));
+            for (probe = pd->probes[hash & pd->probe_mask];
+                 probe;
+                 probe = probe->hash_next)
+              {
+                ping_bogie *pb = (ping_bogie *) probe->bogie->closure;
+                if (probe->hash == hash &&
+                    probe->seq == ICMP_SEQ(&icmph) &&
+                    addrlen == pb->addrlen &&
+                    !memcmp (&pb->address, host_id, addrlen))
+                  break;
+              }
+          }
+      }
+  }
+
+  if (! probe)      /* not in targets, or timed out? */
     {
-      tv.tv_usec = pd->timeout;
-      tv.tv_sec = 0;
-#if 0
-      /* This breaks on BSD, which uses bzero() in the definition of FD_ZERO */
-      FD_ZERO(&rfds);
-#else
-      memset (&rfds, 0, sizeof(rfds));
-#endif
-      FD_SET(pd->icmpsock, &rfds);
-      /* only wait a little while, in case we raced with the timer expiration.
-         From Valentijn Sessink <valentyn@openoffice.nl> */
-      if (select(pd->icmpsock + 1, &rfds, 0, 0, &tv) >0)
+      if (pd->debug_p)
         {
-          result = (int)recvfrom (pd->icmpsock, packet, sizeof(packet),
-                             0, &from, &fromlen);
-
-          /* Check the packet */
+          unsigned int a, b, c, d;
+          unpack_addr (ip->ip_src.s_addr, &a, &b, &c, &d);
+          fprintf (stderr, 
+                   "%s: UNEXPECTED PING REPLY! "
+                   "%4d bytes, icmp_seq=%-4d from %d.%d.%d.%d\n",
+                   progname, result, ICMP_SEQ(&icmph), a, b, c, d);
+        }
+      return 0;
+    }
 
-# ifdef GETTIMEOFDAY_TWO_ARGS
-          gettimeofday(&now, (struct timezone *) 0);
-# else
-          gettimeofday(&now);
-# endif
-          ip = (struct ip *) packet;
-          iphdrlen = IP_HDRLEN(ip) << 2;
-          icmph = (struct ICMP *) &packet[iphdrlen];
-           /* struct timeval data in packet is not aligned, move the data to
-              the aligned buffer
-             */
-          memcpy(&then, &packet[iphdrlen + sizeof(struct ICMP)], sizeof then);
+  {
+    sonar_bogie *b = probe->bogie;
+    ping_bogie *pb = (ping_bogie *) b->closure;
+    double msec = (now - probe->sent) * 1000;
 
+    free_probe (pd, probe);
 
-          /* Ignore anything but ICMP Replies */
-          if (ICMP_TYPE(icmph) != ICMP_ECHOREPLY) 
-            continue;
+    /* Check to see if the name lookup is done. */
+    if (pb->lookup_name &&
+        async_name_from_addr_is_done (pb->lookup_name))
+      {
+        char *host = NULL;
 
-          /* Ignore packets not set from us */
-          if (ICMP_ID(icmph) != pd->pid)
-	    continue;
+        async_name_from_addr_finish (pb->lookup_name, &host, NULL);
 
-          /* Find the bogie in 'targets' that corresponds to this packet
-             and copy it, so that this bogie stays in the same spot (th)
-             on the screen, and so that we don't have to resolve it again.
+        if (pd->debug_p > 1)
+          fprintf (stderr, "%s:   %s => %s\n",
+                   progname, b->name,
+                   host ? host : "<unknown>");
 
-             We could find the bogie by comparing ip->ip_src.s_addr to
-             pb->address, but it is possible that, in certain weird router
-             or NAT situations, that the reply will come back from a 
-             different address than the one we sent it to.  So instead,
-             we parse the sockaddr out of the reply packet payload.
-           */
+        if (host)
           {
-            const socklen_t *host_id = (socklen_t *) &packet[
-              iphdrlen + sizeof(struct ICMP) + sizeof(struct timeval)];
+            free(b->name);
+            b->name = host;
+          }
 
-            sonar_bogie *b;
+        pb->lookup_name = NULL;
+      }
 
-            /* Ensure that a maliciously-crafted return packet can't
-               make us overflow in memcmp. */
-            if (result > 0 && (const u_char *)(host_id + 1) <= packet + result)
-              {
-                const u_char *host_end = (const u_char *)(host_id + 1) +
-                                         *host_id;
-
-                if ((const u_char *)(host_id + 1) <= host_end &&
-                    host_end <= packet + result)
-                  {
-                    for (b = pd->targets; b; b = b->next)
-                      {
-                        ping_bogie *pb = (ping_bogie *)b->closure;
-                        if (*host_id == pb->addrlen &&
-                            !memcmp(&pb->address, host_id + 1, pb->addrlen) )
-                          {
-                            /* Check to see if the name lookup is done. */
-                            if (pb->lookup_name &&
-                                async_name_from_addr_is_done (pb->lookup_name))
-                              {
-                                char *host = NULL;
-
-                                async_name_from_addr_finish (pb->lookup_name,
-                                                             &host, NULL);
-
-                                if (pd->debug_p > 1)
-                                  fprintf (stderr, "%s:   %s => %s\n",
-                                           progname, b->name,
-                                           host ? host : "<unknown>");
-
-                                if (host)
-                                  {
-                                    free(b->name);
-                                    b->name = host;
-                                  }
-
-                                pb->lookup_name = NULL;
-                              }
-
-                            new = copy_ping_bogie (ssd, b);
-                            break;
-                          }
-                      }
-                  }
-              }
+    new = copy_ping_bogie (ssd, b);
+
+    if (pd->times_p)
+      {
+        if (new->desc) free (new->desc);
+        new->desc = (char *) malloc (30);
+        if      (msec > 99) sprintf (new->desc, "%.0f ms", msec);
+        else if (msec >  9) sprintf (new->desc, "%.1f ms", msec);
+        else if (msec >  1) sprintf (new->desc, "%.2f ms", msec);
+        else                sprintf (new->desc, "%.3f ms", msec);
+      }
+
+    if (pd->debug_p && pd->times_p)  /* ping-like stdout log */
+      {
+        char *s = strdup(new->name);
+        char *s2 = s;
+        if (strlen(s) > 28)
+          {
+            s2 = s + strlen(s) - 28;
+            memcpy (s2, "...", 3);
           }
+        fprintf (stdout, 
+                 "%3d bytes from %28s: icmp_seq=%-4d time=%s\n",
+                 result, s2, ICMP_SEQ(&icmph), new->desc);
+        fflush (stdout);
+        free(s);
+      }
 
-          if (! new)      /* not in targets? */
-            {
-              unsigned int a, b, c, d;
-              unpack_addr (ip->ip_src.s_addr, &a, &b, &c, &d);
-              fprintf (stderr, 
-                       "%s: UNEXPECTED PING REPLY! "
-                       "%4d bytes, icmp_seq=%-4d from %d.%d.%d.%d\n",
-                       progname, result, ICMP_SEQ(icmph), a, b, c, d);
-              continue;
-            }
+    /* The radius must be between 0.0 and 1.0.
+       We want to display ping times on a logarithmic scale,
+       with the three rings being 2.5, 70 and 2,000 milliseconds.
+     */
+    if (msec <= 0) msec = 0.001;
+    new->r = log (msec * 10) / log (20000);
 
-          new->next = bl;
-          bl = new;
+    /* Don't put anyone *too* close to the center of the screen. */
+    if (new->r < 0) new->r = 0;
+    if (new->r < 0.1) new->r += 0.1;
+  }
 
-          {
-            double msec = delta(&then, &now) / 1000.0;
+  return new;
+}
 
-            if (pd->times_p)
-              {
-                if (new->desc) free (new->desc);
-                new->desc = (char *) malloc (30);
-                if      (msec > 99) sprintf (new->desc, "%.0f ms", msec);
-                else if (msec >  9) sprintf (new->desc, "%.1f ms", msec);
-                else if (msec >  1) sprintf (new->desc, "%.2f ms", msec);
-                else                sprintf (new->desc, "%.3f ms", msec);
-              }
 
-            if (pd->debug_p && pd->times_p)  /* ping-like stdout log */
-              {
-                char *s = strdup(new->name);
-                char *s2 = s;
-                if (strlen(s) > 28)
-                  {
-                    s2 = s + strlen(s) - 28;
-                    memcpy (s2, "...", 3);
-                  }
-                fprintf (stdout, 
-                         "%3d bytes from %28s: icmp_seq=%-4d time=%s\n",
-                         result, s2, ICMP_SEQ(icmph), new->desc);
-                fflush (stdout);
-                free(s);
-              }
+/* Reads all of the ping replies that have arrived, without waiting for
+   any more.
+ */
+static sonar_bogie *
+get_ping (sonar_sensor_data *ssd)
+{
+  ping_data *pd = (ping_data *) ssd->closure;
+  sonar_bogie *bl = 0;
+  int batches;
+
+  /* A flood of replies can wait until the next frame. */
+  for (batches = 0; batches < PING_MAX_PER_SCAN / PING_BATCH; batches++)
+    {
+      int sizes[PING_BATCH];
+      int i, count = 0;
+      double now;
+
+# ifdef HAVE_MMSG
+      struct mmsghdr msgs[PING_BATCH];
+      struct iovec iov[PING_BATCH];
+      memset (msgs, 0, sizeof(msgs));
+      for (i = 0; i < PING_BATCH; i++)
+        {
+          iov[i].iov_base = pd->packets[i];
+          iov[i].iov_len = PING_PACKET_SIZE;
+          msgs[i].msg_hdr.msg_iov = &iov[i];
+          msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+      count = recvmmsg (pd->icmpsock, msgs, PING_BATCH, 0, NULL);
+      for (i = 0; i < count; i++)
+        sizes[i] = msgs[i].msg_len;
+# else  /* !HAVE_MMSG */
+      for (count = 0; count < PING_BATCH; count++)
+        {
+          sizes[count] = (int) recvfrom (pd->icmpsock, pd->packets[count],
+                                         PING_PACKET_SIZE, 0, NULL, NULL);
+          if (sizes[count] < 0)
+            break;
+        }
+# endif /* !HAVE_MMSG */
 
-            /* The radius must be between 0.0 and 1.0.
-               We want to display ping times on a logarithmic scale,
-               with the three rings being 2.5, 70 and 2,000 milliseconds.
-             */
-            if (msec <= 0) msec = 0.001;
-            new->r = log (msec * 10) / log (20000);
+      if (count <= 0)
+        break;
 
-            /* Don't put anyone *too* close to the center of the screen. */
-            if (new->r < 0) new->r = 0;
-            if (new->r < 0.1) new->r += 0.1;
-          }
+      now = double_time();
+      for (i = 0; i < count; i++)
+        {
+          sonar_bogie *new = ping_reply (ssd, pd->packets[i], sizes[i], now);
+          if (new)
+            {
+              new->next = bl;
+              bl = new;
+            }
         }
+
+      if (count < PING_BATCH)
+        break;
     }
 
   return bl;
 }
 
 
-/* difference between the two times in microseconds.
- */
-static long
-delta (struct timeval *then, struct timeval *now) 
-{
-  return (((now->tv_sec - then->tv_sec) * 1000000) + 
-          (now->tv_usec - then->tv_usec));  
-}
-
-
 static void
 ping_free_data (sonar_sensor_data *ssd, void *closure)
 {
   ping_data *pd = (ping_data *) closure;
   sonar_bogie *b = pd->targets;
+  int i;
   while (b)
     {
       sonar_bogie *b2 = b->next;
       sonar_free_bogie (ssd, b);
       b = b2;
     }
+  for (i = 0; i < PING_WHEEL_SLOTS; i++)
+    while (pd->wheel[i])
+      free_probe (pd, pd->wheel[i]);
+  while (pd->free_probes)
+    {
+      ping_probe *p = pd->free_probes;
+      pd->free_probes = p->hash_next;
+      free (p);
+    }
+  free (pd->probes);
+  free (pd->packets);
   free (pd);
 }
 
@@ -1319,23 +1576,6 @@ ping_free_bogie_data (sonar_sensor_data *sd, void *closure)
 }
 
 
-/* Returns the current time in seconds as a double.
- */
-static double
-double_time (void)
-{
-  struct timeval now;
-# ifdef GETTIMEOFDAY_TWO_ARGS
-  struct timezone tzp;
-  gettimeofday(&now, &tzp);
-# else
-  gettimeofday(&now);
-# endif
-
-  return (now.tv_sec + ((double) now.tv_usec * 0.000001));
-}
-
-
 static void
 free_bogie_after_lookup(sonar_sensor_data *ssd, sonar_bogie **sbp,
                         sonar_bogie **sb)
@@ -1349,20 +1589,19 @@ free_bogie_after_lookup(sonar_sensor_data *ssd, sonar_bogie **sbp,
 }
 
 
-/* Pings the next bogie, if it's time.
-   Returns all outstanding ping replies.
+/* Returns the bogie after the last one pinged, once its address is known.
+   Returns NULL if we're out of bogies, or if it's still being looked up.
  */
 static sonar_bogie *
-ping_scan (sonar_sensor_data *ssd)
+next_target (sonar_sensor_data *ssd)
 {
   ping_data *pd = (ping_data *) ssd->closure;
-  double now = double_time();
-  double ping_cycle = 10;   /* re-ping a given host every 10 seconds */
-  double ping_interval = ping_cycle / pd->target_count;
 
-  if (now > pd->last_ping_time + ping_interval)   /* time to ping someone */
+  for (;;)
     {
       struct sonar_bogie **sbp;
+      sonar_bogie *sb;
+      ping_bogie *pb;
 
       if (pd->last_pinged)
         {
@@ -1374,81 +1613,131 @@ ping_scan (sonar_sensor_data *ssd)
         sbp = &pd->targets;
 
       if (!*sbp)
-        /* Aaaaand we're out of bogies. */
-        pd->last_pinged = NULL;
-      else
         {
-          sonar_bogie *sb = *sbp;
-          ping_bogie *pb = (ping_bogie *)sb->closure;
-          if (pb->lookup_addr &&
-              async_addr_from_name_is_done (pb->lookup_addr))
+          /* Aaaaand we're out of bogies. */
+          pd->last_pinged = NULL;
+          return NULL;
+        }
+
+      sb = *sbp;
+      pb = (ping_bogie *)sb->closure;
+      if (pb->lookup_addr &&
+          async_addr_from_name_is_done (pb->lookup_addr))
+        {
+          if (async_addr_from_name_finish (pb->lookup_addr, &pb->address,
+                                           &pb->addrlen, NULL))
             {
-              if (async_addr_from_name_finish (pb->lookup_addr, &pb->address,
-                                               &pb->addrlen, NULL))
+              char *fallback = pb->fallback;
+              pb->fallback = NULL;
+
+              if (pd->debug_p)
+                fprintf (stderr, "%s:   could not resolve host:  %s\n",
+                         progname, sb->name);
+
+              free_bogie_after_lookup (ssd, sbp, &sb);
+
+              /* Insert the fallback bogie right where the old one was. */
+              if (fallback)
                 {
-                  char *fallback = pb->fallback;
-                  pb->fallback = NULL;
-
-                  if (pd->debug_p)
-                    fprintf (stderr, "%s:   could not resolve host:  %s\n",
-                             progname, sb->name);
-
-                  free_bogie_after_lookup (ssd, sbp, &sb);
-
-                  /* Insert the fallback bogie right where the old one was. */
-                  if (fallback)
-                    {
-                      sonar_bogie *new_bogie = bogie_for_host (ssd, fallback,
-                                                               NULL);
-                      if (new_bogie) {
-                        new_bogie->next = *sbp;
-
-                        if (! ((ping_bogie *)new_bogie->closure)->lookup_addr &&
-                            ! find_duplicate_host(pd, &pd->targets, new_bogie))
-                          *sbp = new_bogie;
-                        else
-                          sonar_free_bogie (ssd, new_bogie);
-                      }
-
-                      free (fallback);
-                    }
+                  sonar_bogie *new_bogie = bogie_for_host (ssd, fallback,
+                                                           NULL);
+                  if (new_bogie) {
+                    new_bogie->next = *sbp;
+
+                    if (! ((ping_bogie *)new_bogie->closure)->lookup_addr &&
+                        ! find_duplicate_host(pd, &pd->targets, new_bogie))
+                      *sbp = new_bogie;
+                    else
+                      sonar_free_bogie (ssd, new_bogie);
+                  }
+
+                  free (fallback);
                 }
-              else
+            }
+          else
+            {
+              if (pd->debug_p > 1)
                 {
-                  if (pd->debug_p > 1)
-                    {
-                      fprintf (stderr, "%s:   %s => ", progname, sb->name);
-                      print_address (stderr, 0, &pb->address, pb->addrlen);
-                      putc('\n', stderr);
-                    }
-
-                  if (! is_address_ok (pd->debug_p, sb))
-                    free_bogie_after_lookup (ssd, sbp, &sb);
-                  else if (find_duplicate_host (pd, &pd->targets, sb))
-                    /* Tricky: find_duplicate_host skips the current bogie when
-                       scanning the targets list because pb->lookup_addr hasn't
-                       been NULL'd yet.
-
-                       Not that it matters much, but behavior here is to
-                       keep the existing address.
-                     */
-                    free_bogie_after_lookup (ssd, sbp, &sb);
+                  fprintf (stderr, "%s:   %s => ", progname, sb->name);
+                  print_address (stderr, 0, &pb->address, pb->addrlen);
+                  putc('\n', stderr);
                 }
 
-              if (sb)
-                pb->lookup_addr = NULL;
+              if (! is_address_ok (pd->debug_p, sb))
+                free_bogie_after_lookup (ssd, sbp, &sb);
+              else if (find_duplicate_host (pd, &pd->targets, sb))
+                /* Tricky: find_duplicate_host skips the current bogie when
+                   scanning the targets list because pb->lookup_addr hasn't
+                   been NULL'd yet.
+
+                   Not that it matters much, but behavior here is to
+                   keep the existing address.
+                 */
+                free_bogie_after_lookup (ssd, sbp, &sb);
             }
 
-          if (sb && !pb->lookup_addr)
-            {
-              if (!pb->addrlen) abort();
-              send_ping (pd, sb);
-              pd->last_pinged = sb;
-            }
+          if (sb)
+            pb->lookup_addr = NULL;
         }
 
+      if (!sb)
+        continue;  /* It's gone; try whatever took its place. */
+      if (pb->lookup_addr)
+        return NULL;
+
+      if (!pb->addrlen) abort();
+      pd->last_pinged = sb;
+      return sb;
+    }
+}
+
+
+/* Pings the bogies that are due, and forgets the pings that have timed out.
+   Returns all outstanding ping replies.  This never waits for anything, so
+   that a big subnet doesn't slow down the animation: pings go out in
+   batches, replies are read as they arrive, and a ping that isn't answered
+   in time is dropped when the timer wheel comes around to it.
+ */
+static sonar_bogie *
+ping_scan (sonar_sensor_data *ssd)
+{
+  ping_data *pd = (ping_data *) ssd->closure;
+  double now = double_time();
+  double ping_cycle = 10;   /* re-ping a given host every 10 seconds */
+  double ping_interval = ping_cycle / pd->target_count;
+  long due = (long) ((now - pd->last_ping_time) / ping_interval);
+
+  expire_probes (pd, now);
+
+  if (due > PING_MAX_PER_SCAN ||   /* fell behind; don't try to catch up */
+      due > pd->target_count)
+    {
+      due = (PING_MAX_PER_SCAN < pd->target_count
+             ? PING_MAX_PER_SCAN : pd->target_count);
       pd->last_ping_time = now;
     }
+  else
+    pd->last_ping_time += due * ping_interval;
+
+  while (due > 0)
+    {
+      sonar_bogie *batch[PING_BATCH];
+      int count = 0;
+
+      while (count < PING_BATCH && count < due)
+        {
+          sonar_bogie *sb = next_target (ssd);
+          if (!sb)
+            break;
+          batch[count++] = sb;
+        }
+
+      if (count)
+        send_pings (pd, batch, count);
+      if (count < PING_BATCH || count >= due)
+        break;
+      due -= count;
+    }
 
   return get_ping (ssd);
 }
@@ -1736,7 +2025,11 @@ sonar_init_ping (Display *dpy, char **error_ret, char **desc_ret,
 
   pd->pid = getpid() & 0xFFFF;
   pd->seq = 0;
-  pd->timeout = timeout;
+  pd->timeout = timeout > 0 ? timeout : 1;
+
+  /* Replies are read whenever they have arrived, never waited for. */
+  if (socket_initted_p)
+    fcntl (pd->icmpsock, F_SETFL, fcntl (pd->icmpsock, F_GETFL) | O_NONBLOCK);
 
   /* Generate a list of targets */
 
@@ -1770,6 +2063,38 @@ sonar_init_ping (Display *dpy, char **error_ret, char **desc_ret,
       return 0;
     }
 
+  /* Outstanding pings: about a third of the hosts at a time, with the
+     default timeout of 3 seconds and a ping every 10 seconds. */
+  {
+    unsigned size = 64;
+    while (size < pd->target_count && size < 0x10000)
+      size *= 2;
+    pd->probes = (ping_probe **) calloc (size, sizeof(*pd->probes));
+    pd->probe_mask = size - 1;
+    pd->packets = (u_char (*)[PING_PACKET_SIZE])
+      calloc (PING_BATCH, PING_PACKET_SIZE);
+    if (!pd->probes || !pd->packets)
+      {
+        if (! *error_ret)
+          *error_ret = strdup ("Out of memory!\n"
+                               "Simulating instead.");
+        ping_free_data (ssd, pd);
+        free (ssd);
+        return 0;
+      }
+  }
+
+  pd->start_time = double_time();
+  pd->last_ping_time = pd->start_time;
+  pd->wheel_tick = pd->timeout / 1000.0 / (PING_WHEEL_SLOTS - 1);
+  if (pd->wheel_tick < 0.001)
+    pd->wheel_tick = 0.001;
+  pd->wheel_ticks = (int) ceil (pd->timeout / 1000.0 / pd->wheel_tick);
+  if (pd->wheel_ticks < 1)
+    pd->wheel_ticks = 1;
+  if (pd->wheel_ticks > PING_WHEEL_SLOTS - 1)
+    pd->wheel_ticks = PING_WHEEL_SLOTS - 1;
+
   /* Distribute them evenly around the display field, clockwise.
      Even on a /24, allocated IPs tend to cluster together, so
      don't put any two hosts closer together than N degrees to
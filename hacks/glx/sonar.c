@@ -904,21 +904,6 @@ static void _print_error (int gai_error, int errno_error, FILE *stream)
   fputs (gai_error == EAI_SYSTEM ? strerror(errno_error) : gai_strerror(gai_error), stream);
 }
 
-#   if ASYNC_NETDB_USE_GAI
-
-static void _print_thread (pthread_t thread, FILE *stream)
-{
-#     ifdef __linux__
-    fprintf (stream, "%#lx", thread);
-#     elif defined __APPLE__ && defined __MACH__
-    fprintf (stream, "%p", thread);
-#     else
-    putc ('?', stream);
-#     endif
-}
-
-#   endif /* ASYNC_NETDB_USE_GAI */
-
 # endif /* TEST_ASYNC_NETDB */
 
 
@@ -988,10 +973,6 @@ init_sensor (ModeInfo *mi)
       {
         fputs ("Looking up hostname from address: ", stderr);
         _print_sockaddr (&addr, sizeof(addr), stderr);
-#   if ASYNC_NETDB_USE_GAI
-        fputs (" @ ", stderr);
-        _print_thread (sp->query0->io.thread, stderr);
-#   endif
         putc ('\n', stderr);
       }
 
@@ -1016,12 +997,7 @@ init_sensor (ModeInfo *mi)
 
     assert (sp->query1);
 
-    fprintf (stderr, "Looking up address from hostname: %s", host);
-#   if ASYNC_NETDB_USE_GAI
-    fputs (" @ ", stderr);
-    _print_thread (sp->query1->io.thread, stderr);
-#   endif
-    putc ('\n', stderr);
+    fprintf (stderr, "Looking up address from hostname: %s\n", host);
 
     if (!(random () & 3))
       {
@@ -105,6 +105,15 @@ typedef struct {
   int *line_widths;
   int total_lines;
 
+  /* Each line is drawn from a display list of its own, made the first
+     time it is drawn, and text_list draws all of them in their places.
+     That only changes when the text scrolls up by a line, so on most
+     frames the whole crawl is drawn by one glCallList. */
+  GLuint *line_lists;
+  GLuint *line_textures;	/* with textures_p */
+  Bool text_list_valid_p;
+  int text_polygons;
+
   double star_theta;
   double char_width;
   double line_height;
@@ -290,12 +299,12 @@ get_more_lines (sws_configuration *sc)
    */
   while (target > 0)
     {
-      int c = textclient_getc (sc->tc);
-      if (c <= 0)
+      int n = textclient_read (sc->tc, sc->buf + sc->buf_tail, target);
+      if (n <= 0)
         break;
-      sc->buf[sc->buf_tail++] = (char) c;
+      sc->buf_tail += n;
       sc->buf[sc->buf_tail] = 0;
-      target--;
+      target -= n;
     }
 
   while (sc->total_lines < max_lines)
@@ -480,6 +489,97 @@ draw_string (sws_configuration *sc, GLfloat x, GLfloat y, const char *s)
 }
 
 
+/* Whether the crawl is drawn from display lists.  Text drawn with
+   shaders can't be compiled into one, so then each line is drawn by
+   print_texture_string on each frame, as is everything in debug mode.
+ */
+static Bool
+retained_p (sws_configuration *sc)
+{
+  return (!debug_p &&
+          !(textures_p && texture_font_shaders_p (sc->texfont)));
+}
+
+
+/* Makes the display list for one line, if it doesn't have one yet.
+ */
+static void
+make_line_list (sws_configuration *sc, int i)
+{
+  const char *s = sc->lines[i];
+  GLuint list;
+
+  if (sc->line_lists[i] || !s || !*s) return;
+
+  list = glGenLists (1);
+  if (textures_p)
+    {
+      XCharStruct e;
+      int tex_width, tex_height;
+      GLfloat qx0, qy0, qx1, qy1;
+      GLfloat tx0, ty0, tx1, ty1;
+      Bool alpha_p = glIsEnabled (GL_ALPHA_TEST);
+      Bool blend_p = glIsEnabled (GL_BLEND);
+      GLint oblend;
+
+      /* Render the line into a texture of its own, as print_texture_string
+         would, but only once.  This sets the texture's parameters, and
+         also turns on blending and alpha testing, which it sets back the
+         way it found them, as print_texture_string does. */
+      glGetIntegerv (GL_BLEND_DST, &oblend);
+      glGenTextures (1, &sc->line_textures[i]);
+      glBindTexture (GL_TEXTURE_2D, sc->line_textures[i]);
+      string_to_texture (sc->texfont, s, &e, &tex_width, &tex_height);
+      enable_texture_string_parameters (sc->texfont);
+      glBlendFunc (GL_SRC_ALPHA, oblend);
+      if (!alpha_p) glDisable (GL_ALPHA_TEST);
+      if (!blend_p) glDisable (GL_BLEND);
+      check_gl_error ("line texture");
+
+      qx0 =  e.lbearing;
+      qy0 = -e.descent;
+      qx1 =  e.rbearing;
+      qy1 =  e.ascent;
+
+      tx0 = 0;
+      ty1 = 0;
+      tx1 = (e.rbearing - e.lbearing) / (GLfloat) tex_width;
+      ty0 = (e.ascent + e.descent)    / (GLfloat) tex_height;
+
+      glNewList (list, GL_COMPILE);
+      glBindTexture (GL_TEXTURE_2D, sc->line_textures[i]);
+      glBegin (GL_QUADS);
+      glTexCoord2f (tx0, ty0); glVertex3f (qx0, qy0, 0);
+      glTexCoord2f (tx1, ty0); glVertex3f (qx1, qy0, 0);
+      glTexCoord2f (tx1, ty1); glVertex3f (qx1, qy1, 0);
+      glTexCoord2f (tx0, ty1); glVertex3f (qx0, qy1, 0);
+      glEnd();
+      glEndList ();
+    }
+  else
+    {
+      glNewList (list, GL_COMPILE);
+      while (*s)
+        glutStrokeCharacter (GLUT_FONT, *s++);
+      glEndList ();
+    }
+
+  sc->line_lists[i] = list;
+}
+
+
+static void
+free_line_list (sws_configuration *sc, int i)
+{
+  if (sc->line_lists[i])
+    glDeleteLists (sc->line_lists[i], 1);
+  if (sc->line_textures[i])
+    glDeleteTextures (1, &sc->line_textures[i]);
+  sc->line_lists[i] = 0;
+  sc->line_textures[i] = 0;
+}
+
+
 static void
 grid (double width, double height, double xspacing, double yspacing, double z)
 {
@@ -604,6 +704,7 @@ ENTRYPOINT void
 reshape_sws (ModeInfo *mi, int width, int height)
 {
   sws_configuration *sc = &scs[MI_SCREEN(mi)];
+  GLfloat old_thickness = sc->line_thickness;
 
   /* Set up matrices for perspective text display
    */
@@ -690,6 +791,9 @@ reshape_sws (ModeInfo *mi, int width, int height)
 
   if (sc->line_thickness < 1.2)
     sc->line_thickness = 1.0;
+
+  if (sc->line_thickness != old_thickness)
+    sc->text_list_valid_p = False;  /* it has the glLineWidth calls */
 }
 
 
@@ -737,6 +841,8 @@ init_sws (ModeInfo *mi)
   /* Unchecked malloc. :( */
   sc->lines = (char **) calloc (max_lines+1, sizeof(char *));
   sc->line_widths = (int *) calloc (max_lines+1, sizeof(int));
+  sc->line_lists = (GLuint *) calloc (max_lines+1, sizeof(GLuint));
+  sc->line_textures = (GLuint *) calloc (max_lines+1, sizeof(GLuint));
 
   if ((sc->glx_context = init_GL(mi)) != NULL) {
     gl_init(mi);
@@ -882,6 +988,87 @@ draw_stars (ModeInfo *mi)
   glPopMatrix ();
 }
 
+/* Draws each line in its place on the crawl, and returns the number of
+   polygons.  Unless debug_p, this is only run while compiling text_list,
+   and the lines come from their own display lists.
+ */
+static int
+draw_lines (sws_configuration *sc)
+{
+  int polygons = 0;
+  int i;
+
+  for (i = 0; i < sc->total_lines; i++)
+    {
+      double fade = (fade_p ? 1.0 * i / sc->total_lines : 1.0);
+      int offscreen_lines = 2;
+
+      double x = -0.5;
+      double y =  ((sc->total_lines - (i + offscreen_lines) - 1)
+                   * sc->line_height);
+      double xoff = 0;
+      char *line = sc->lines[i];
+
+      if (debug_p)
+        {
+          double xx = x * 1.4;  /* a little more to the left */
+          char n[20];
+          sprintf(n, "%d:", i);
+          glColor3f (1.0, 1.0, 1.0);
+          draw_string (sc, xx / sc->font_scale, y / sc->font_scale, n);
+        }
+
+      if (!line || !*line)
+        continue;
+
+      if (sc->line_thickness != 1 && !textures_p)
+        {
+          int max_thick_lines = MAX_THICK_LINES;
+          GLfloat thinnest_line = 1.0;
+          GLfloat thickest_line = sc->line_thickness;
+          GLfloat range = thickest_line - thinnest_line;
+          GLfloat thickness;
+
+          int j = sc->total_lines - i - 1;
+
+          if (j > max_thick_lines)
+            thickness = thinnest_line;
+          else
+            thickness = (thinnest_line +
+                         (range * ((max_thick_lines - j) /
+                                   (GLfloat) max_thick_lines)));
+
+          glLineWidth (thickness);
+        }
+
+      if (alignment >= 0)
+        {
+          int n = sc->line_widths[i];
+          xoff = 1.0 - (n * sc->font_scale);
+        }
+
+      if (alignment == 0)
+        xoff /= 2;
+
+      glColor3f (fade, fade, 0.5 * fade);
+      if (! retained_p (sc))
+        draw_string (sc, (x + xoff) / sc->font_scale, y / sc->font_scale,
+                     line);
+      else
+        {
+          glPushMatrix ();
+          glTranslatef ((x + xoff) / sc->font_scale, y / sc->font_scale, 0);
+          glCallList (sc->line_lists[i]);
+          glPopMatrix ();
+        }
+      if (textures_p)
+        polygons += strlen (line);
+    }
+
+  return polygons;
+}
+
+
 ENTRYPOINT void
 draw_sws (ModeInfo *mi)
 {
@@ -947,67 +1134,44 @@ draw_sws (ModeInfo *mi)
 
   glColor3f (1.0, 1.0, 0.4);
 
-  mi->polygon_count = 0;
-
   glPushMatrix ();
   glScalef (sc->font_scale, sc->font_scale, sc->font_scale);
-  for (i = 0; i < sc->total_lines; i++)
+  if (! retained_p (sc))
+    mi->polygon_count = draw_lines (sc);
+  else
     {
-      double fade = (fade_p ? 1.0 * i / sc->total_lines : 1.0);
-      int offscreen_lines = 2;
-
-      double x = -0.5;
-      double y =  ((sc->total_lines - (i + offscreen_lines) - 1)
-                   * sc->line_height);
-      double xoff = 0;
-      char *line = sc->lines[i];
+      Bool alpha_p = glIsEnabled (GL_ALPHA_TEST);
+      Bool blend_p = glIsEnabled (GL_BLEND);
+      GLint oblend = GL_ONE_MINUS_SRC_ALPHA;
 
-      if (debug_p)
+      if (! sc->text_list_valid_p)
         {
-          double xx = x * 1.4;  /* a little more to the left */
-          char n[20];
-          sprintf(n, "%d:", i);
-          glColor3f (1.0, 1.0, 1.0);
-          draw_string (sc, xx / sc->font_scale, y / sc->font_scale, n);
+          /* Lists can't be made while another is being compiled. */
+          for (i = 0; i < sc->total_lines; i++)
+            make_line_list (sc, i);
+          glNewList (sc->text_list, GL_COMPILE);
+          sc->text_polygons = draw_lines (sc);
+          glEndList ();
+          sc->text_list_valid_p = True;
         }
 
-      if (!line || !*line)
-        continue;
-
-      if (sc->line_thickness != 1 && !textures_p)
+      /* Blend and alpha test as print_texture_string would, and then put
+         them back for the stars and everything else. */
+      if (textures_p)
         {
-          int max_thick_lines = MAX_THICK_LINES;
-          GLfloat thinnest_line = 1.0;
-          GLfloat thickest_line = sc->line_thickness;
-          GLfloat range = thickest_line - thinnest_line;
-          GLfloat thickness;
-
-          int j = sc->total_lines - i - 1;
-
-          if (j > max_thick_lines)
-            thickness = thinnest_line;
-          else
-            thickness = (thinnest_line +
-                         (range * ((max_thick_lines - j) /
-                                   (GLfloat) max_thick_lines)));
-
-          glLineWidth (thickness);
+          glGetIntegerv (GL_BLEND_DST, &oblend);
+          glEnable (GL_BLEND);
+          glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+          glEnable (GL_ALPHA_TEST);
         }
-
-      if (alignment >= 0)
+      glCallList (sc->text_list);
+      if (textures_p)
         {
-          int n = sc->line_widths[i];
-          xoff = 1.0 - (n * sc->font_scale);
+          glBlendFunc (GL_SRC_ALPHA, oblend);
+          if (!alpha_p) glDisable (GL_ALPHA_TEST);
+          if (!blend_p) glDisable (GL_BLEND);
         }
-
-      if (alignment == 0)
-        xoff /= 2;
-
-      glColor3f (fade, fade, 0.5 * fade);
-      draw_string (sc, (x + xoff) / sc->font_scale, y / sc->font_scale,
-                   line);
-      if (textures_p)
-        mi->polygon_count += strlen (line);
+      mi->polygon_count = sc->text_polygons;
     }
   glPopMatrix ();
 
@@ -1022,6 +1186,7 @@ draw_sws (ModeInfo *mi)
       /* Drop the oldest line off the end. */
       if (sc->lines[0])
         free (sc->lines[0]);
+      free_line_list (sc, 0);
 
       /* Scroll the contents of the lines array toward 0. */
       if (sc->total_lines > 0)
@@ -1029,8 +1194,12 @@ draw_sws (ModeInfo *mi)
           for (i = 1; i < sc->total_lines; i++) {
             sc->lines[i-1] = sc->lines[i];
             sc->line_widths[i-1] = sc->line_widths[i];
+            sc->line_lists[i-1] = sc->line_lists[i];
+            sc->line_textures[i-1] = sc->line_textures[i];
           }
           sc->lines[--sc->total_lines] = 0;
+          sc->line_lists[sc->total_lines] = 0;
+          sc->line_textures[sc->total_lines] = 0;
         }
 
       /* Bring in new lines at the end. */
@@ -1041,6 +1210,8 @@ draw_sws (ModeInfo *mi)
            here so that new text still pulls in from the bottom of
            the screen, isntead of just appearing. */
         sc->total_lines = max_lines;
+
+      sc->text_list_valid_p = False;
     }
 
   glPopMatrix ();
@@ -1064,7 +1235,12 @@ free_sws (ModeInfo *mi)
   if (sc->buf) free (sc->buf);
   if (sc->line_widths) free (sc->line_widths);
   for (i = 0; i < sc->total_lines; i++)
-    if (sc->lines[i]) free (sc->lines[i]);
+    {
+      if (sc->lines[i]) free (sc->lines[i]);
+      if (sc->line_lists) free_line_list (sc, i);
+    }
+  if (sc->line_lists) free (sc->line_lists);
+  if (sc->line_textures) free (sc->line_textures);
   if (sc->lines) free (sc->lines);
   if (glIsList(sc->star_list)) glDeleteLists(sc->star_list, 1);
   if (glIsList(sc->text_list)) glDeleteLists(sc->text_list, 1);
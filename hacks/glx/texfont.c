@@ -804,6 +804,17 @@ enable_texture_string_parameters (texture_font_data *data)
 }
 
 
+Bool
+texture_font_shaders_p (texture_font_data *data)
+{
+# ifdef HAVE_GLSL
+  return data->use_shaders;
+# else
+  return False;
+# endif
+}
+
+
 /* Draws the string in the scene at the origin.
    Newlines and tab stops are honored.
    Any numbers inside [] will be rendered as a subscript.
@@ -61,6 +61,12 @@ void string_to_texture (texture_font_data *, const char *,
  */
 void enable_texture_string_parameters (texture_font_data *);
 
+/* True if print_texture_string draws this font with GLSL shaders rather
+   than fixed-function quads, so what it draws can't be put in a display
+   list.
+ */
+Bool texture_font_shaders_p (texture_font_data *);
+
 
 /* True if the string appears to be a "missing" character.  Since there is
    no way to tell whether a font contains a character or has substituted a
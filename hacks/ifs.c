@@ -36,6 +36,8 @@ Multi-coloured mode added by Jack Grahl <j.grahl@ucl.ac.uk>, Jan 2007
 #include <math.h>
 
 #include "screenhack.h"
+#include "accumimage.h"
+#include "thread_util.h"
 
 typedef struct {
   float r, s, tx, ty;   /* Rotation, Scale, Translation X & Y */
@@ -51,21 +53,13 @@ typedef struct {
 struct state {
   Display *dpy;
   Window window;
-  GC gc;
-  Drawable backbuffer;
+  accumimage *accum;
   XColor *colours;
   int ncolours;
   int ccolour;
   int blackColor, whiteColor;
 
-  int width, widthb, height;
-  int width8, height8;
-  unsigned int *board;
-  XRectangle pointbuf[1000];
-  int npoints;
-  int xmin, xmax, ymin, ymax;
-  int x, y;
-  int pscale;
+  int width, height;
 
   int delay;
 
@@ -78,9 +72,6 @@ struct state {
   Bool translate, scale, rotate;
 };
 
-#define getdot(x,y) (st->board[((y)*st->widthb)+((x)>>5)] &  (1<<((x) & 31)))
-#define setdot(x,y) (st->board[((y)*st->widthb)+((x)>>5)] |= (1<<((x) & 31)))
-
 static double
 myrandom(float up)
 {
@@ -101,14 +92,11 @@ static const char *ifs_defaults [] = {
   "*rotate:		True",
   "*recurse:		False",
   "*multi:              True",
-# ifdef HAVE_JWXYZ	/* Don't second-guess Quartz's double-buffering */
-  "*doubleBuffer:	False",
-#else
-  "*doubleBuffer:	True",
-#endif
+  "*doubleBuffer:	False",	/* unused: each frame is drawn at once */
 #ifdef HAVE_MOBILE
   "*ignoreRotation:     True",
 #endif
+  THREAD_DEFAULTS
   0
 };
 
@@ -125,49 +113,16 @@ static XrmOptionDescRec ifs_options [] = {
   { "-iterate",		".recurse",	XrmoptionNoArg, "False" },
   { "-multi",           ".multi",       XrmoptionNoArg, "True" },
   { "-no-multi",        ".multi",       XrmoptionNoArg, "False" },
-  { "-db",		".doubleBuffer",XrmoptionNoArg, "True" },
+  { "-db",		".doubleBuffer",XrmoptionNoArg, "True" },  /* unused */
   { "-no-db",		".doubleBuffer",XrmoptionNoArg, "False" },
+  THREAD_OPTIONS
   { 0, 0, 0, 0 }
 };
 
 
-/* Draw all the queued points on the backbuffer */
-static void
-drawpoints(struct state *st)
-{
-  XFillRectangles(st->dpy, st->backbuffer, st->gc, st->pointbuf, st->npoints);
-  st->npoints = 0;
-}
-
-/* Set a point to be drawn, if it hasn't been already.
+/* Count a hit on a point.
  * Expects coordinates in 256ths of a pixel. */
-static void
-sp(struct state *st, int x, int y)
-{
-  if (x < 0 || x >= st->width8 || y < 0 || y >= st->height8)
-    return;
-
-  x >>= 8;
-  y >>= 8;
-
-  if (getdot(x, y)) return;
-  setdot(x, y);
-
-  if (x < st->xmin) st->xmin = x;
-  if (x > st->xmax) st->xmax = x;
-  if (y < st->ymin) st->ymin = y;
-  if (y > st->ymax) st->ymax = y;
-
-  st->pointbuf[st->npoints].x = x;
-  st->pointbuf[st->npoints].y = y;
-  st->pointbuf[st->npoints].width =
-    st->pointbuf[st->npoints].height = st->pscale;
-  st->npoints++;
-
-  if (st->npoints >= countof(st->pointbuf)) {
-    drawpoints(st);
-  }
-}
+#define sp(b,x,y,c) ACCUMIMAGE_PLOT ((b), (x) >> 8, (y) >> 8, (c))
 
 
 /* Precompute integer values for matrix multiplication and vector
@@ -273,43 +228,75 @@ mutate(struct state *st, Lens *l)
 /* Calls itself <lensnum> times - with results from each lens/function.  *
  * After <length> calls to itself, it stops iterating and draws a point. */
 static void
-recurse(struct state *st, int x, int y, int length, int p)
+recurse(struct state *st, accumimage_buffer *b, int x, int y, int length,
+        int p, int c)
 {
   int i;
   Lens *l;
 
   if (length == 0) {
     if (p == 0) 
-      sp(st, x, y);
+      sp(b, x, y, c);
     else {
       l = &st->lenses[p];
-      sp(st, STEPX(l, x, y), STEPY(l, x, y));
+      sp(b, STEPX(l, x, y), STEPY(l, x, y), c);
     }
   }
   else {
     for (i = 0; i < st->lensnum; i++) {
       l = &st->lenses[i];
-      recurse(st, STEPX(l, x, y), STEPY(l, x, y), length - 1, p);
+      recurse(st, b, STEPX(l, x, y), STEPY(l, x, y), length - 1, p, c);
     }
   }
 }
 
+/* Does this thread's share of what recurse() would do: the subtrees are *
+ * dealt out as many levels down as it takes for each thread to get a    *
+ * few of them.                                                          */
+static void
+recurse_share(struct state *st, accumimage_buffer *b, int x, int y,
+              int length, int p, int c, unsigned thread, unsigned nthreads)
+{
+  long branches = 1, k;
+  int levels = 0;
+
+  while (levels < length && branches < 4 * (long) nthreads) {
+    branches *= st->lensnum;
+    levels++;
+  }
+
+  for (k = thread; k < branches; k += nthreads) {
+    long path = k;
+    int xx = x, yy = y, tx, j;
+    for (j = 0; j < levels; j++) {
+      Lens *l = &st->lenses[path % st->lensnum];
+      path /= st->lensnum;
+      tx = STEPX(l, xx, yy);
+      yy = STEPY(l, xx, yy);
+      xx = tx;
+    }
+    recurse(st, b, xx, yy, length - levels, p, c);
+  }
+}
+
 /* Performs <count> random lens transformations, drawing a point at each
- * iteration after the first 10.
+ * iteration after the first 10.  In multi mode, each point is drawn as it
+ * is, and then through each of the other lenses, each in its own colour.
  */
 static void
-iterate(struct state *st, int count, int p)
+iterate(struct state *st, accumimage_buffer *b, long count)
 {
-  int i;
+  long i;
+  int j, c;
   Lens *l;
-  int x = st->x;
-  int y = st->y;
+  int x = st->width << 7;
+  int y = st->height << 7;
   int tx;
 
-# define STEP()                              \
-    l = &st->lenses[random() % st->lensnum]; \
-    tx = STEPX(l, x, y);                     \
-    y = STEPY(l, x, y);                      \
+# define STEP()                                          \
+    l = &st->lenses[accumimage_random(b) % st->lensnum]; \
+    tx = STEPX(l, x, y);                                 \
+    y = STEPY(l, x, y);                                  \
     x = tx
 
   for (i = 0; i < 10; i++) {
@@ -318,19 +305,48 @@ iterate(struct state *st, int count, int p)
 
   for ( ; i < count; i++) {
     STEP();
-    if (p == 0)
-      sp(st, x, y);
+    if (!st->multi)
+      sp(b, x, y, st->ccolour);
     else
-      {
-	l = &st->lenses[p];
-	sp(st, STEPX(l, x, y), STEPY(l, x, y));
+      for (j = 0; j < st->lensnum; j++) {
+        c = (st->ccolour * (j+1)) % st->ncolours;
+        if (j == 0)
+          sp(b, x, y, c);
+        else {
+          l = &st->lenses[j];
+          sp(b, STEPX(l, x, y), STEPY(l, x, y), c);
+        }
       }
   }
 
 # undef STEP
+}
 
-  st->x = x;
-  st->y = y;
+/* One thread's share of the points of a frame. */
+static void
+ifs_points (void *closure, accumimage_buffer *b,
+            unsigned thread, unsigned nthreads)
+{
+  struct state *st = (struct state *) closure;
+  int x = st->width << 7;
+  int y = st->height << 7;
+  int i;
+
+  if (st->recurse) {
+    if (st->multi)
+      for (i = 0; i < st->lensnum; i++)
+        recurse_share(st, b, x, y, st->length - 1, i,
+                      (st->ccolour * (i+1)) % st->ncolours,
+                      thread, nthreads);
+    else
+      recurse_share(st, b, x, y, st->length, 0, st->ccolour,
+                    thread, nthreads);
+  }
+  else {
+    long count = pow(st->lensnum, st->multi ? st->length - 1 : st->length);
+    iterate(st, b, (count * (thread+1) / nthreads -
+                    count * thread / nthreads + 10));
+  }
 }
 
 /* Come on and iterate, iterate, iterate and sing... *
@@ -341,69 +357,23 @@ ifs_draw (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
   int i;
-  int xmin = st->xmin, xmax = st->xmax, ymin = st->ymin, ymax = st->ymax;
-  int partcolor, x, y;
-  
-
-  /* erase whatever was drawn in the previous frame */
-  if (xmin <= xmax && ymin <= ymax) {
-    XSetForeground(st->dpy, st->gc, st->blackColor);
-    XFillRectangle(st->dpy, st->backbuffer, st->gc,
-		   xmin, ymin,
-		   xmax - xmin + 1 * st->pscale,
-                   ymax - ymin + 1 * st->pscale);
-    st->xmin = st->width  + 1;
-    st->xmax = st->ymax =  -1;
-    st->ymin = st->height + 1;
+
+  if (!st->accum) {
+    st->accum = accumimage_new(st->dpy, st->window,
+                               st->colours, st->ncolours, st->blackColor);
+    if (!st->accum) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
   }
 
   st->ccolour++;
   st->ccolour %= st->ncolours;
 
-  /* calculate and draw points for this frame */
-  x = st->width << 7;
-  y = st->height << 7;
-  
-  if (st->multi) {
-    for (i = 0; i < st->lensnum; i++) {  
-      partcolor = st->ccolour * (i+1);
-      partcolor %= st->ncolours;
-      XSetForeground(st->dpy, st->gc, st->colours[partcolor].pixel);
-      memset(st->board, 0, st->widthb * st->height * sizeof(*st->board));
-      if (st->recurse)   
-	recurse(st, x, y, st->length - 1, i);
-      else
-	iterate(st, pow(st->lensnum, st->length - 1), i);
-      if (st->npoints) 
-	drawpoints(st);
-    }
-  } 
-  else {
-    
-    XSetForeground(st->dpy, st->gc, st->colours[st->ccolour].pixel);
-    memset(st->board, 0, st->widthb * st->height * sizeof(*st->board));
-    if (st->recurse)
-      recurse(st, x, y, st->length, 0);
-    else
-      iterate(st, pow(st->lensnum, st->length), 0);
-    if (st->npoints)
-      drawpoints(st);
-  }
-  
-  /* if we just drew into a buffer, copy the changed area (including
-   * erased area) to screen */
-  if (st->backbuffer != st->window
-      && ((st->xmin <= st->xmax && st->ymin <= st->ymax)
-	  || (xmin <= xmax && ymin <= ymax))) {
-    if (st->xmin < xmin) xmin = st->xmin;
-    if (st->xmax > xmax) xmax = st->xmax;
-    if (st->ymin < ymin) ymin = st->ymin;
-    if (st->ymax > ymax) ymax = st->ymax;
-    XCopyArea(st->dpy, st->backbuffer, st->window, st->gc,
-	      xmin, ymin,
-	      xmax - xmin + 1, ymax - ymin + 1,
-	      xmin, ymin);
-  }
+  /* calculate and draw points for this frame, over the previous one */
+  accumimage_clear(st->accum);
+  accumimage_run(st->accum, ifs_points, st);
+  accumimage_draw(st->accum);
 
   for(i = 0; i < st->lensnum; i++) {
     mutate(st, &st->lenses[i]);
@@ -428,16 +398,9 @@ ifs_init (Display *d_arg, Window w_arg)
 
   st->blackColor = BlackPixel(st->dpy, DefaultScreen(st->dpy));
   st->whiteColor = WhitePixel(st->dpy, DefaultScreen(st->dpy));
-  st->gc = XCreateGC(st->dpy, st->window, 0, NULL);
 
   XGetWindowAttributes (st->dpy, st->window, &xgwa);
   ifs_reshape(st->dpy, st->window, st, xgwa.width, xgwa.height);
-	
-  st->pscale = 1;
-  if (xgwa.width > 2560 || xgwa.height > 2560)
-    st->pscale *= 3;  /* Retina displays */
-  /* We aren't increasing the spacing between the pixels, just the size. */
-
 
   st->ncolours = get_integer_resource(st->dpy, "colors", "Colors");
   if (st->ncolours < st->lensnum)
@@ -485,41 +448,13 @@ ifs_reshape (Display *dpy, Window window, void *closure,
 	     unsigned int w, unsigned int h)
 {
   struct state *st = (struct state *)closure;
-  XWindowAttributes xgwa;
-
-  /* oh well, we need the screen depth anyway */
-  XGetWindowAttributes (st->dpy, st->window, &xgwa);
 
-  st->width = xgwa.width;
-  st->widthb = ((xgwa.width + 31) >> 5);
-  st->height = xgwa.height;
-  st->width8 = xgwa.width << 8;
-  st->height8 = xgwa.height << 8;
-
-  if (!st->xmax && !st->ymax && !st->xmin && !st->ymin) {
-    st->xmin = xgwa.width + 1;
-    st->xmax = st->ymax = -1;
-    st->ymin = xgwa.height + 1;
-  }
-
-  if (st->backbuffer != None && st->backbuffer != st->window) {
-    XFreePixmap(st->dpy, st->backbuffer);
-    st->backbuffer = None;
-  }
-
-  if (get_boolean_resource (st->dpy, "doubleBuffer", "Boolean")) {
-    st->backbuffer = XCreatePixmap(st->dpy, st->window, st->width, st->height, xgwa.depth);
-    XSetForeground(st->dpy, st->gc, st->blackColor);
-    XFillRectangle(st->dpy, st->backbuffer, st->gc,
-		   0, 0, st->width, st->height);
-  } else {
-    st->backbuffer = st->window;
-    XClearWindow(st->dpy, st->window);
-  }
+  st->width = w;
+  st->height = h;
 
-  if (st->board) free(st->board);
-  st->board = (unsigned int *)calloc(st->widthb * st->height, sizeof(unsigned int));
-  if (!st->board) exit(1);
+  /* The next frame makes a new one of the new size. */
+  accumimage_free(st->accum);
+  st->accum = 0;
 }
 
 static Bool
@@ -547,12 +482,9 @@ ifs_free (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
 
-  if (st->board) free(st->board);
+  accumimage_free(st->accum);
   if (st->lenses) free(st->lenses);
   if (st->colours) free(st->colours);
-  if (st->backbuffer != None && st->backbuffer != st->window)
-    XFreePixmap(st->dpy, st->backbuffer);
-  XFreeGC (dpy, st->gc);
   free(st);
 }
 
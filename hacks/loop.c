@@ -103,6 +103,7 @@ static const char sccsid[] = "@(#)loop.c	5.01 2000/03/15 xlockmore";
 # include "xlock.h"		/* in xlockmore distribution */
 #endif /* STANDALONE */
 #include "automata.h"
+#include "xbatch.h"
 
 #ifdef MODE_loop
 
@@ -221,6 +222,7 @@ typedef struct {
 	unsigned long colors[COLORS];
 	GC          stippledGC;
 	Pixmap      pixmaps[COLORS];
+	xbatch     *batch;
 	union {
 		XPoint      hexagon[6];
 	} shape;
@@ -831,8 +833,34 @@ withinBounds(loopstruct * lp, int col, int row)
 		col >= 1 && col < lp->bncols - 1 - (local_neighbors == 6 && (row % 2)));
 }
 
+/* Selects the batch's GC and color for cells of this state. */
 static void
-fillcell(ModeInfo * mi, GC gc, int col, int row)
+set_state_gc(ModeInfo * mi, int state)
+{
+	loopstruct *lp = &loops[MI_SCREEN(mi)];
+	XGCValues   gcv;
+
+	if (MI_NPIXELS(mi) >= COLORS) {
+		xbatch_set_foreground(lp->batch, MI_GC(mi), lp->colors[state]);
+	} else {
+		/* Cells already batched need the old stipple. */
+		xbatch_flush(lp->batch);
+#ifdef DO_STIPPLE
+		gcv.stipple = lp->pixmaps[state];
+#endif /* DO_STIPPLE */
+		gcv.foreground = MI_WHITE_PIXEL(mi);
+		gcv.background = MI_BLACK_PIXEL(mi);
+		XChangeGC(MI_DISPLAY(mi), lp->stippledGC,
+#ifdef DO_STIPPLE
+			  GCStipple |
+#endif /* DO_STIPPLE */
+                          GCForeground | GCBackground, &gcv);
+		xbatch_set_gc(lp->batch, lp->stippledGC);
+	}
+}
+
+static void
+fillcell(ModeInfo * mi, int col, int row)
 {
 	loopstruct *lp = &loops[MI_SCREEN(mi)];
 
@@ -842,13 +870,13 @@ fillcell(ModeInfo * mi, GC gc, int col, int row)
 		lp->shape.hexagon[0].x = lp->xb + ccol * lp->xs;
 		lp->shape.hexagon[0].y = lp->yb + crow * lp->ys;
 		if (lp->xs == 1 && lp->ys == 1)
-			XDrawPoint(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_point(lp->batch,
 				lp->shape.hexagon[0].x, lp->shape.hexagon[0].y);
 		else
-			XFillPolygon(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+			xbatch_fill_polygon(lp->batch,
 				lp->shape.hexagon, 6, Convex, CoordModePrevious);
 	} else {
-		XFillRectangle(MI_DISPLAY(mi), MI_WINDOW(mi), gc,
+		xbatch_fill_rectangle(lp->batch,
 			lp->xb + lp->xs * col, lp->yb + lp->ys * row,
 			lp->xs - (lp->xs > 3), lp->ys - (lp->ys > 3));
 	}
@@ -857,27 +885,8 @@ fillcell(ModeInfo * mi, GC gc, int col, int row)
 static void
 drawcell(ModeInfo * mi, int col, int row, int state)
 {
-	loopstruct *lp = &loops[MI_SCREEN(mi)];
-	XGCValues   gcv;
-	GC          gc;
-
-	if (MI_NPIXELS(mi) >= COLORS) {
-		gc = MI_GC(mi);
-		XSetForeground(MI_DISPLAY(mi), gc, lp->colors[state]);
-	} else {
-#ifdef DO_STIPPLE
-		gcv.stipple = lp->pixmaps[state];
-#endif /* DO_STIPPLE */
-		gcv.foreground = MI_WHITE_PIXEL(mi);
-		gcv.background = MI_BLACK_PIXEL(mi);
-		XChangeGC(MI_DISPLAY(mi), lp->stippledGC,
-#ifdef DO_STIPPLE
-			  GCStipple |
-#endif /* DO_STIPPLE */
-                          GCForeground | GCBackground, &gcv);
-		gc = lp->stippledGC;
-	}
-	fillcell(mi, gc, col, row);
+	set_state_gc(mi, state);
+	fillcell(mi, col, row);
 }
 
 #ifdef DEBUG
@@ -937,6 +946,10 @@ free_loop(ModeInfo * mi)
 		XFreeGC(display, lp->stippledGC);
 		lp->stippledGC = None;
 	}
+	if (lp->batch != NULL) {
+		xbatch_free(lp->batch);
+		lp->batch = (xbatch *) NULL;
+	}
 	if (lp->oldcells != NULL) {
 		(void) free((void *) lp->oldcells);
 		lp->oldcells = (unsigned char *) NULL;
@@ -971,68 +984,12 @@ static Bool
 draw_state(ModeInfo * mi, int state)
 {
 	loopstruct *lp = &loops[MI_SCREEN(mi)];
-	Display    *display = MI_DISPLAY(mi);
-	GC          gc;
-	XGCValues   gcv;
 	CellList   *current = lp->cellList[state];
 
-	if (MI_NPIXELS(mi) >= COLORS) {
-		gc = MI_GC(mi);
-		XSetForeground(display, gc, lp->colors[state]);
-	} else {
-#ifdef DO_STIPPLE
-		gcv.stipple = lp->pixmaps[state];
-#endif /* DO_STIPPLE */
-		gcv.foreground = MI_WHITE_PIXEL(mi);
-		gcv.background = MI_BLACK_PIXEL(mi);
-		XChangeGC(display, lp->stippledGC,
-#ifdef DO_STIPPLE
-			  GCStipple |
-#endif /* DO_STIPPLE */
-                          GCForeground | GCBackground, &gcv);
-		gc = lp->stippledGC;
-	}
-
-	if (local_neighbors == 6) {       /* Draw right away, slow */
-		while (current) {
-			int	 col, row, ccol, crow;
-
-			col = current->pt.x;
-			row = current->pt.y;
-			ccol = 2 * col + !(row & 1), crow = 2 * row;
-			lp->shape.hexagon[0].x = lp->xb + ccol * lp->xs;
-			lp->shape.hexagon[0].y = lp->yb + crow * lp->ys;
-			if (lp->xs == 1 && lp->ys == 1)
-				XDrawPoint(display, MI_WINDOW(mi), gc,
-					lp->shape.hexagon[0].x, lp->shape.hexagon[0].y);
-			else
-				XFillPolygon(display, MI_WINDOW(mi), gc,
-				  	lp->shape.hexagon, 6, Convex, CoordModePrevious);
-			current = current->next;
-		}
-	} else {
-		/* Take advantage of XFillRectangles */
-		XRectangle *rects;
-		int         nrects = 0;
-
-		/* Create Rectangle list from part of the cellList */
-		if ((rects = (XRectangle *) malloc(lp->ncells[state] *
-				sizeof (XRectangle))) == NULL) {
-			return False;
-		}
-
-		while (current) {
-			rects[nrects].x = lp->xb + current->pt.x * lp->xs;
-			rects[nrects].y = lp->yb + current->pt.y * lp->ys;
-			rects[nrects].width = lp->xs - (lp->xs > 3);
-			rects[nrects].height = lp->ys - (lp->ys > 3);
-			current = current->next;
-			nrects++;
-		}
-		/* Finally get to draw */
-		XFillRectangles(display, MI_WINDOW(mi), gc, rects, nrects);
-		/* Free up rects list and the appropriate part of the cellList */
-		(void) free((void *) rects);
+	set_state_gc(mi, state);
+	while (current) {
+		fillcell(mi, current->pt.x, current->pt.y);
+		current = current->next;
 	}
 	free_state(lp, state);
 	return True;
@@ -1450,6 +1407,11 @@ init_loop (ModeInfo * mi)
 	lp = &loops[MI_SCREEN(mi)];
 
 	lp->redrawing = 0;
+	if (lp->batch == NULL &&
+	    (lp->batch = xbatch_new(MI_DISPLAY(mi), MI_WINDOW(mi))) == NULL) {
+		free_loop(mi);
+		return;
+	}
 
     if (MI_WIDTH(mi) < 100 || MI_HEIGHT(mi) < 100)  /* tiny window */
       size = MIN(MI_WIDTH(mi), MI_HEIGHT(mi));
@@ -1658,6 +1620,7 @@ draw_loop (ModeInfo * mi)
 			return;
 		}
 	if (++lp->generation > MI_CYCLES(mi) || lp->dead) {
+		xbatch_flush(lp->batch);
 		init_loop(mi);
 		return;
 	} else
@@ -1676,6 +1639,7 @@ draw_loop (ModeInfo * mi)
 			}
 		}
 	}
+	xbatch_flush(lp->batch);
 }
 
 #ifndef STANDALONE
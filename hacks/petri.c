@@ -63,6 +63,7 @@
 #include <math.h>
 #include "screenhack.h"
 #include "spline.h"
+#include "xbatch.h"
 
 #define FLOAT float
 #define RAND_FLOAT (((FLOAT) (random() & 0xffff)) / ((FLOAT) 0x10000))
@@ -95,6 +96,7 @@ struct state {
   int blastcount;
 
   GC *coloredGCs;
+  xbatch *batch;
 
   int windowWidth;
   int windowHeight;
@@ -470,12 +472,14 @@ setup_display (struct state *st)
 
 static void drawblock (struct state *st, int x, int y, unsigned char c)
 {
+  xbatch_set_gc (st->batch, st->coloredGCs[c]);
   if (st->xSize == 1 && st->ySize == 1)
-    XDrawPoint (st->dpy, st->window, st->coloredGCs[c], x + st->xOffset, y + st->yOffset);
+    xbatch_point (st->batch, x + st->xOffset, y + st->yOffset);
   else
-    XFillRectangle (st->dpy, st->window, st->coloredGCs[c],
-		    x * st->xSize + st->xOffset, y * st->ySize + st->yOffset,
-		    st->xSize, st->ySize);
+    xbatch_fill_rectangle (st->batch,
+			   x * st->xSize + st->xOffset,
+			   y * st->ySize + st->yOffset,
+			   st->xSize, st->ySize);
 }
 
 static void setup_arr (struct state *st)
@@ -661,6 +665,9 @@ static void update (struct state *st)
 	    killcell (st, a);
     }
 
+    /* A dead cell may be reborn below, and randblip may clear the window. */
+    xbatch_flush (st->batch);
+
     randblip (st, (st->head->next) == st->tail);
 
     for (a = st->head->next; a != st->tail; a = a->next)
@@ -674,6 +681,7 @@ static void update (struct state *st)
 	    drawblock (st, cell_x(a), cell_y(a), a->col + st->count);
 	}
     }
+    xbatch_flush (st->batch);
 }
 
 static void *
@@ -685,6 +693,12 @@ petri_init (Display *dpy, Window win)
 
     st->delay = get_integer_resource (st->dpy, "delay", "Delay");
     st->orthlim = 1;
+    st->batch = xbatch_new (dpy, win);
+    if (!st->batch)
+      {
+        fprintf (stderr, "%s: out of memory\n", progname);
+        exit (1);
+      }
 
     setup_display (st);
     setup_arr (st);
@@ -720,6 +734,7 @@ petri_free (Display *dpy, Window window, void *closure)
   if (st->arr) free (st->arr);
   if (st->head) free (st->head);
   if (st->tail) free (st->tail);
+  xbatch_free (st->batch);
   if (st->coloredGCs) {
     int i;
     for (i = 0; i < st->count*2; i++)
@@ -17,6 +17,7 @@
 #include "textclient.h"
 #include "ximage-loader.h"
 #include "utf8wc.h"
+#include "cellimage.h"
 
 #ifndef HAVE_JWXYZ
 # include <X11/Intrinsic.h>
@@ -47,10 +48,6 @@
 typedef struct {
   unsigned char name;
   int width, height;
-  Pixmap pixmap;
-#ifdef FUZZY_BORDER
-  Pixmap pixmap2;
-#endif /* FUZZY_BORDER */
   Bool blank_p;
 } p_char;
 
@@ -88,7 +85,7 @@ typedef struct {
 #ifdef FUZZY_BORDER
   GC gc2;
 #endif /* FUZZY_BORDER */
-  GC *gcs;
+  cellimage *ci;		/* the cell for each char, one ramp per state */
   XImage *font_bits;
 
   int cursor_x, cursor_y;
@@ -107,7 +104,7 @@ typedef struct {
 
 static void capture_font_bits (p_state *state);
 static p_char *make_character (p_state *state, int c);
-static void char_to_pixmap (p_state *state, p_char *pc, int c);
+static void char_to_glyph (p_state *state, p_char *pc, int c);
 
 
 /* About font metrics:
@@ -155,7 +152,6 @@ static void *
 phosphor_init (Display *dpy, Window window)
 {
   int i;
-  unsigned long flags;
   p_state *state = (p_state *) calloc (sizeof(*state), 1);
   char *fontname = get_string_resource (dpy, "font", "Font");
   XftFont *font;
@@ -239,11 +235,10 @@ phosphor_init (Display *dpy, Window window)
                                     state->grid_width * state->grid_height);
   state->chars = (p_char **) calloc (sizeof(p_char *), 256);
 
-  state->gcs = (GC *) calloc (sizeof(GC), state->ticks + 1);
-
   {
     int ncolors = MAX (1, state->ticks - 3);
     XColor *colors = (XColor *) calloc (ncolors, sizeof(XColor));
+    unsigned long *pixels;
     int h1, h2;
     double s1, s2, v1, v2;
 
@@ -299,7 +294,7 @@ phosphor_init (Display *dpy, Window window)
           flare = white.pixel;
       }
 
-    /* Now, GCs all around.
+    /* Now, line widths for drawing the characters.
      */
     state->gcv.cap_style = CapRound;
 #ifdef FUZZY_BORDER
@@ -314,29 +309,45 @@ phosphor_init (Display *dpy, Window window)
       state->gcv.line_width = 1;
 #endif /* !FUZZY_BORDER */
 
-    flags = (GCForeground | GCBackground | GCCapStyle | GCLineWidth);
-
-    state->gcv.background = bg;
-    state->gcv.foreground = bg;
-    state->gcs[BLANK] = XCreateGC (state->dpy, state->window, flags,
-                                   &state->gcv);
-
-    state->gcv.foreground = flare;
-    state->gcs[FLARE] = XCreateGC (state->dpy, state->window, flags,
-                                   &state->gcv);
+    pixels = (unsigned long *) calloc (sizeof(*pixels), state->ticks);
+    pixels[BLANK]  = bg;
+    pixels[FLARE]  = flare;
+    pixels[NORMAL] = fg;
+    for (i = 0; i < ncolors; i++)
+      pixels[STATE_MAX + i] = colors[i].pixel;
 
-    state->gcv.foreground = fg;
-    state->gcs[NORMAL] = XCreateGC (state->dpy, state->window, flags,
-                                    &state->gcv);
+    free (colors);
 
-    for (i = 0; i < ncolors; i++)
+    /* Characters are drawn into an image on the client side, and each state
+       is a ramp: level 0 is the background, and level 1 is the ink.  With
+       FUZZY_BORDER, the ink is a wide stroke in the color two steps further
+       faded, with a narrower stroke, level 2, in this state's color.
+     */
+    state->ci = cellimage_new (dpy, window,
+                               state->char_width  * state->scale,
+                               state->char_height * state->scale,
+                               256, state->ticks, bg);
+    if (!state->ci)
       {
-        state->gcv.foreground = colors[i].pixel;
-        state->gcs[STATE_MAX + i] = XCreateGC (state->dpy, state->window,
-                                               flags, &state->gcv);
+        fprintf (stderr, "%s: out of memory\n", progname);
+        exit (1);
       }
 
-    free (colors);
+    for (i = 0; i < state->ticks; i++)
+      {
+        unsigned long ink = (i == BLANK ? bg : pixels[i]);
+# ifdef FUZZY_BORDER
+        unsigned long edge = (i == BLANK ? bg :
+                              i + 2 < state->ticks ? pixels[i + 2] :
+                              ink);
+# else /* !FUZZY_BORDER */
+        unsigned long edge = ink;
+# endif /* !FUZZY_BORDER */
+        cellimage_set_ramp (state->ci, i, 0, bg);
+        cellimage_set_ramp (state->ci, i, 1, edge);
+        cellimage_set_ramp (state->ci, i, 2, ink);
+      }
+    free (pixels);
   }
 
   capture_font_bits (state);
@@ -617,19 +628,25 @@ make_character (p_state *state, int c)
   pc->name = (unsigned char) c;
   pc->width =  state->scale * state->char_width;
   pc->height = state->scale * state->char_height;
-  char_to_pixmap (state, pc, c);
+  char_to_glyph (state, pc, c);
   return pc;
 }
 
 
+/* Draws the character with lines, since that handles scaling and the
+   rounded strokes, and then makes the result into a glyph of cellimage.
+ */
 static void
-char_to_pixmap (p_state *state, p_char *pc, int c)
+char_to_glyph (p_state *state, p_char *pc, int c)
 {
   Pixmap p = 0;
   GC gc;
+  XImage *im;
+  unsigned char *levels;
 #ifdef FUZZY_BORDER
   Pixmap p2 = 0;
   GC gc2;
+  XImage *im2;
 #endif /* FUZZY_BORDER */
   int from, to;
   int x1, y;
@@ -690,9 +707,29 @@ char_to_pixmap (p_state *state, p_char *pc, int c)
   /*  if (pc->blank_p && c == CURSOR_INDEX)
     abort();*/
 
-  pc->pixmap = p;
+  im = XGetImage (state->dpy, p, 0, 0, width, height, 1, XYPixmap);
 #ifdef FUZZY_BORDER
-  pc->pixmap2 = p2;
+  im2 = XGetImage (state->dpy, p2, 0, 0, width, height, 1, XYPixmap);
+#endif /* FUZZY_BORDER */
+  levels = (unsigned char *) malloc (width * height);
+  for (y = 0; y < height; y++)
+    for (x1 = 0; x1 < width; x1++)
+      {
+        int level = (XGetPixel (im, x1, y) ? 1 : 0);
+#ifdef FUZZY_BORDER
+        if (XGetPixel (im2, x1, y))
+          level = 2;
+#endif /* FUZZY_BORDER */
+        levels[y * width + x1] = level;
+      }
+  cellimage_set_glyph (state->ci, c, levels, width);
+  free (levels);
+
+  XDestroyImage (im);
+  XFreePixmap (state->dpy, p);
+#ifdef FUZZY_BORDER
+  XDestroyImage (im2);
+  XFreePixmap (state->dpy, p2);
 #endif /* FUZZY_BORDER */
 }
 
@@ -1353,42 +1390,14 @@ update_display (p_state *state, Bool changed_only)
         tx = x * width  + state->xmargin;
         ty = y * height + state->ymargin;
 
-        if (cell->state == BLANK || cell->p_char->blank_p)
-          {
-            XFillRectangle (state->dpy, state->window, state->gcs[BLANK],
-                            tx, ty, width, height);
-          }
-        else
-          {
-#ifdef FUZZY_BORDER
-            GC gc1 = state->gcs[cell->state];
-            GC gc2 = ((cell->state + 2) < state->ticks
-                      ? state->gcs[cell->state + 2]
-                      : 0);
-            GC gc3 = (gc2 ? gc2 : gc1);
-            if (gc3)
-              XCopyPlane (state->dpy, cell->p_char->pixmap, state->window, gc3,
-                          0, 0, width, height, tx, ty, 1L);
-            if (gc2)
-              {
-                XSetClipMask (state->dpy, gc1, cell->p_char->pixmap2);
-                XSetClipOrigin (state->dpy, gc1, tx, ty);
-                XFillRectangle (state->dpy, state->window, gc1,
-                                tx, ty, width, height);
-                XSetClipMask (state->dpy, gc1, None);
-              }
-#else /* !FUZZY_BORDER */
-
-            XCopyPlane (state->dpy,
-                        cell->p_char->pixmap, state->window,
-                        state->gcs[cell->state],
-                        0, 0, width, height, tx, ty, 1L);
-
-#endif /* !FUZZY_BORDER */
-          }
-
+        /* The BLANK ramp is all background, as is a blank character. */
+        cellimage_draw (state->ci, tx, ty,
+                        (cell->p_char ? cell->p_char->name : ' '),
+                        cell->state);
         cell->changed = False;
       }
+
+  cellimage_put (state->ci, !changed_only);
 }
 
 
@@ -1413,7 +1422,10 @@ phosphor_reshape (Display *dpy, Window window, void *closure,
                  unsigned int w, unsigned int h)
 {
   p_state *state = (p_state *) closure;
-  Bool changed_p = resize_grid (state);
+  Bool changed_p;
+
+  cellimage_resize (state->ci);
+  changed_p = resize_grid (state);
 
   if (! changed_p) return;
 
@@ -1453,16 +1465,9 @@ phosphor_free (Display *dpy, Window window, void *closure)
 #ifdef FUZZY_BORDER
   if (state->gc2) XFreeGC (dpy, state->gc2);
 #endif /* FUZZY_BORDER */
-  for (i = 0; i < state->ticks; i++)
-    if (state->gcs[i]) XFreeGC (dpy, state->gcs[i]);
-  free (state->gcs);
-  for (i = 0; i < 256; i++) {
-    XFreePixmap (dpy, state->chars[i]->pixmap);
-#ifdef FUZZY_BORDER
-    XFreePixmap (dpy, state->chars[i]->pixmap2);
-#endif /* FUZZY_BORDER */
+  cellimage_free (state->ci);
+  for (i = 0; i < 256; i++)
     free (state->chars[i]);
-  }
   XDestroyImage (state->font_bits);
   free (state->chars);
   free (state->cells);
@@ -49,6 +49,13 @@
 typedef enum {ripple_drop, ripple_blob, ripple_box, ripple_stir} ripple_mode;
 
 #include "xshm.h"
+#include "thread_util.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#define CARD32 unsigned int
 
 #define TABLE 256
 
@@ -83,6 +90,7 @@ struct state {
   int rshift;
   int gshift;
   int bshift;
+  CARD32 rgb_mask;	/* all three, in place, for bright32() */
 
   double stir_ang;
 
@@ -93,7 +101,13 @@ struct state {
   int duration;
   time_t start_time;
 
-  void (*draw_transparent) (struct state *st, short *src);
+  void (*draw_transparent) (struct state *st, short *src, int y0, int y1);
+  void (*draw) (struct state *st, short *src, int y0, int y1);
+
+  /* The wave and the drawing are done in bands of rows, one per thread. */
+  struct threadpool pool;
+  enum { RIPPLE_TEMP, RIPPLE_SMOOTH, RIPPLE_STEP, RIPPLE_DRAW } phase;
+  short *src, *dest;
 
   async_load_state *img_loader;
 
@@ -123,8 +137,6 @@ static const double drop_dist[] =
                              - (((x)>>3)&0x11111111))
 
 
-static unsigned long grayscale(struct state *st, unsigned long color);
-
 /*      -------------------------------------------             */
 
 
@@ -141,97 +153,196 @@ map_color(struct state *st, int grey)
 }
 
 
+/* Rows of 32-bit images, for the fast versions of the drawing routines. */
+#define ROW32(img,y) ((CARD32 *) ((img)->data + (y) * (img)->bytes_per_line))
+
+
+/* Decides whether the 2x2 block at (across, down) needs drawing, and
+   works out the light for it. */
+static inline Bool
+ripple_light(struct state *st, const short *src, char *dirty, int *dx_ret)
+{
+  int v1 = src[0];
+  int v2 = src[1];
+  int v3 = src[st->width];
+  int v4 = src[st->width + 1];
+  if ((v1 == 0 && v2 == 0 && v3 == 0 && v4 == 0)) {
+    if (*dirty > 0)
+      (*dirty)--;
+  } else
+    *dirty = DIRTY;
+
+  if (st->light > 0)
+    *dx_ret = ((v3 - v1) + (v4 - v2)) << st->light; /* light from top */
+  else
+    *dx_ret = 0;
+  return *dirty > 0;
+}
+
+
+/* Draws rows y0 ... y1-1 of ripple cells. */
 static void
-draw_ripple(struct state *st, short *src)
+draw_ripple(struct state *st, short *src, int y0, int y1)
 {
   int across, down;
-  char *dirty = st->dirty_buffer;
-
-  for (down = 0; down < st->height - 1; down++, src += 1, dirty += 1)
-    for (across = 0; across < st->width - 1; across++, src++, dirty++) {
-      int v1, v2, v3, v4;
-      v1 = (int)*src;
-      v2 = (int)*(src + 1);
-      v3 = (int)*(src + st->width);
-      v4 = (int)*(src + st->width + 1);
-      if ((v1 == 0 && v2 == 0 && v3 == 0 && v4 == 0)) {
-        if (*dirty > 0)
-          (*dirty)--;
-      } else
-        *dirty = DIRTY;
-
-      if (*dirty > 0) {
-        int dx;
-        if (st->light > 0) {
-          dx = ((v3 - v1) + (v4 - v2)) << st->light; /* light from top */
-        } else
-          dx = 0;
+
+  for (down = y0; down < y1; down++) {
+    short *s = src + down * st->width;
+    char *dirty = st->dirty_buffer + down * st->width;
+    for (across = 0; across < st->width - 1; across++) {
+      int dx, v1 = s[across];
+      if (ripple_light(st, s + across, dirty + across, &dx)) {
+        int v2 = s[across + 1];
+        int v3 = s[across + st->width];
+        int v4 = s[across + st->width + 1];
         XPutPixel(st->buffer_map,(across<<1),  (down<<1),  map_color(st, dx + v1));
         XPutPixel(st->buffer_map,(across<<1)+1,(down<<1),  map_color(st, dx + ((v1 + v2) >> 1)));
         XPutPixel(st->buffer_map,(across<<1),  (down<<1)+1,map_color(st, dx + ((v1 + v3) >> 1)));
         XPutPixel(st->buffer_map,(across<<1)+1,(down<<1)+1,map_color(st, dx + ((v1 + v4) >> 1)));
       }
     }
+  }
+}
+
+
+static void
+draw_ripple_32(struct state *st, short *src, int y0, int y1)
+{
+  int across, down;
+
+  for (down = y0; down < y1; down++) {
+    short *s = src + down * st->width;
+    char *dirty = st->dirty_buffer + down * st->width;
+    CARD32 *out0 = ROW32(st->buffer_map, down<<1);
+    CARD32 *out1 = ROW32(st->buffer_map, (down<<1)+1);
+    for (across = 0; across < st->width - 1; across++) {
+      int dx, v1 = s[across];
+      if (ripple_light(st, s + across, dirty + across, &dx)) {
+        int v2 = s[across + 1];
+        int v3 = s[across + st->width];
+        int v4 = s[across + st->width + 1];
+        out0[(across<<1)]   = map_color(st, dx + v1);
+        out0[(across<<1)+1] = map_color(st, dx + ((v1 + v2) >> 1));
+        out1[(across<<1)]   = map_color(st, dx + ((v1 + v3) >> 1));
+        out1[(across<<1)+1] = map_color(st, dx + ((v1 + v4) >> 1));
+      }
+    }
+  }
 }
 
 
 /*      -------------------------------------------             */
 
 
-/* Uses the horizontal gradient as an offset to create a warp effect  */
-static void
-draw_transparent_vanilla(struct state *st, short *src)
+/* Uses the horizontal gradient as an offset to create a warp effect.
+   Works out where in the original image the 2x2 block at (across, down)
+   comes from, and whether it needs drawing. */
+static inline Bool
+refract(struct state *st, const short *src, char *dirty,
+        int across, int down, int *gradx_ret, int *gradx1_ret,
+        int *grady_ret, int *grady1_ret)
 {
-  int across, down, pixel;
-  char *dirty = st->dirty_buffer;
+  int gradx, grady, gradx1, grady1;
+  int x0, x1, x2, y1, y2;
+
+  x0 = src[0];
+  x1 = src[1];
+  x2 = src[2];
+  y1 = src[st->width];
+  y2 = src[2*st->width];
+
+  gradx = (x1 - x0);
+  grady = (y1 - x0);
+  gradx1= (x2 - x1);
+  grady1= (y2 - y1);
+  gradx1 = 1 + (gradx + gradx1) / 2;
+  grady1 = 1 + (grady + grady1) / 2;
+
+  if ((2*across+MIN(gradx,gradx1) < 0) ||
+      (2*across+MAX(gradx,gradx1) >= st->bigwidth)) {
+    gradx = 0;
+    gradx1= 1;
+  }
+  if ((2*down+MIN(grady,grady1) < 0) ||
+      (2*down+MAX(grady,grady1) >= st->bigheight)) {
+    grady = 0;
+    grady1 = 1;
+  }
 
-  pixel = 0;
-  for (down = 0; down < st->height - 2; down++, pixel += 2)
-    for (across = 0; across < st->width-2; across++, pixel++) {
-      int gradx, grady, gradx1, grady1;
-      int x0, x1, x2, y1, y2;
-
-      x0 = src[pixel];
-      x1 = src[pixel + 1];
-      x2 = src[pixel + 2];
-      y1 = src[pixel + st->width];
-      y2 = src[pixel + 2*st->width];
-
-      gradx = (x1 - x0);
-      grady = (y1 - x0);
-      gradx1= (x2 - x1);
-      grady1= (y2 - y1);
-      gradx1 = 1 + (gradx + gradx1) / 2;
-      grady1 = 1 + (grady + grady1) / 2;
-
-      if ((2*across+MIN(gradx,gradx1) < 0) ||
-          (2*across+MAX(gradx,gradx1) >= st->bigwidth)) {
-        gradx = 0;
-        gradx1= 1;
-      }
-      if ((2*down+MIN(grady,grady1) < 0) ||
-          (2*down+MAX(grady,grady1) >= st->bigheight)) {
-        grady = 0;
-        grady1 = 1;
-      }
+  if ((gradx == 0 && gradx1 == 1 && grady == 0 && grady1 == 1)) {
+    if (*dirty > 0)
+      (*dirty)--;
+  } else
+    *dirty = DIRTY;
+
+  *gradx_ret = gradx;
+  *gradx1_ret = gradx1;
+  *grady_ret = grady;
+  *grady1_ret = grady1;
+  return *dirty > 0;
+}
+
+
+/* The vertical gradient, for lighting from the top. */
+static inline int
+refract_light(struct state *st, const short *src, int grady)
+{
+  if (4-st->light >= 0)
+    return (grady + (src[st->width+1]-src[1])) >> (4-st->light);
+  else
+    return (grady + (src[st->width+1]-src[1])) << (st->light-4);
+}
 
-      if ((gradx == 0 && gradx1 == 1 && grady == 0 && grady1 == 1)) {
-        if (dirty[pixel] > 0)
-          dirty[pixel]--;
-      } else
-        dirty[pixel] = DIRTY;
 
-      if (dirty[pixel] > 0) {
+static void
+draw_transparent_vanilla(struct state *st, short *src, int y0, int y1)
+{
+  int across, down;
+
+  for (down = y0; down < y1; down++) {
+    short *s = src + down * st->width;
+    char *dirty = st->dirty_buffer + down * st->width;
+    for (across = 0; across < st->width-2; across++) {
+      int gradx, grady, gradx1, grady1;
+      if (refract(st, s + across, dirty + across, across, down,
+                  &gradx, &gradx1, &grady, &grady1)) {
         XPutPixel(st->buffer_map, (across<<1),  (down<<1),
-                  grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady)));
+                  XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady));
         XPutPixel(st->buffer_map, (across<<1)+1,(down<<1),
-                  grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady)));
+                  XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady));
         XPutPixel(st->buffer_map, (across<<1),  (down<<1)+1,
-                  grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady1)));
+                  XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady1));
         XPutPixel(st->buffer_map, (across<<1)+1,(down<<1)+1,
-                  grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady1)));
+                  XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady1));
+      }
+    }
+  }
+}
+
+
+static void
+draw_transparent_vanilla_32(struct state *st, short *src, int y0, int y1)
+{
+  int across, down;
+
+  for (down = y0; down < y1; down++) {
+    short *s = src + down * st->width;
+    char *dirty = st->dirty_buffer + down * st->width;
+    CARD32 *out0 = ROW32(st->buffer_map, down<<1);
+    CARD32 *out1 = ROW32(st->buffer_map, (down<<1)+1);
+    for (across = 0; across < st->width-2; across++) {
+      int gradx, grady, gradx1, grady1;
+      if (refract(st, s + across, dirty + across, across, down,
+                  &gradx, &gradx1, &grady, &grady1)) {
+        const CARD32 *in0 = ROW32(st->orig_map, (down<<1) + grady)  + (across<<1);
+        const CARD32 *in1 = ROW32(st->orig_map, (down<<1) + grady1) + (across<<1);
+        out0[(across<<1)]   = in0[gradx];
+        out0[(across<<1)+1] = in0[gradx1];
+        out1[(across<<1)]   = in1[gradx];
+        out1[(across<<1)+1] = in1[gradx1];
       }
     }
+  }
 }
 
 
@@ -274,6 +385,26 @@ bright(struct state *st, int dx, unsigned long color)
 }
 
 
+/* The same as bright(), for when each of red, green and blue is one byte
+   of a 32-bit pixel, in whatever order: add to every byte, and then keep
+   only the color ones. */
+static inline CARD32
+bright32(struct state *st, int dx, CARD32 color)
+{
+  int b0 = (int) (color & 0xFF) + dx;
+  int b1 = (int) ((color >> 8) & 0xFF) + dx;
+  int b2 = (int) ((color >> 16) & 0xFF) + dx;
+  int b3 = (int) (color >> 24) + dx;
+  b0 = b0 < 0 ? 0 : b0 > 0xFF ? 0xFF : b0;
+  b1 = b1 < 0 ? 0 : b1 > 0xFF ? 0xFF : b1;
+  b2 = b2 < 0 ? 0 : b2 > 0xFF ? 0xFF : b2;
+  b3 = b3 < 0 ? 0 : b3 > 0xFF ? 0xFF : b3;
+  return ((((CARD32) b3 << 24) | ((CARD32) b2 << 16) |
+           ((CARD32) b1 << 8)  |  (CARD32) b0)
+          & st->rgb_mask);
+}
+
+
 static unsigned long
 grayscale(struct state *st, unsigned long color)
 {
@@ -321,164 +452,134 @@ grayscale(struct state *st, unsigned long color)
 
 
 static void
-draw_transparent_light(struct state *st, short *src)
+draw_transparent_light(struct state *st, short *src, int y0, int y1)
 {
-  int across, down, pixel;
-  char *dirty = st->dirty_buffer;
+  int across, down;
 
-  pixel = 0;
-  for (down = 0; down < st->height - 2; down++, pixel += 2)
-    for (across = 0; across < st->width-2; across++, pixel++) {
+  for (down = y0; down < y1; down++) {
+    short *s = src + down * st->width;
+    char *dirty = st->dirty_buffer + down * st->width;
+    for (across = 0; across < st->width-2; across++) {
       int gradx, grady, gradx1, grady1;
-      int x0, x1, x2, y1, y2;
-
-      x0 = src[pixel];
-      x1 = src[pixel + 1];
-      x2 = src[pixel + 2];
-      y1 = src[pixel + st->width];
-      y2 = src[pixel + 2*st->width];
-
-      gradx = (x1 - x0);
-      grady = (y1 - x0);
-      gradx1= (x2 - x1);
-      grady1= (y2 - y1);
-      gradx1 = 1 + (gradx + gradx1) / 2;
-      grady1 = 1 + (grady + grady1) / 2;
-
-      if ((2*across+MIN(gradx,gradx1) < 0) ||
-          (2*across+MAX(gradx,gradx1) >= st->bigwidth)) {
-        gradx = 0;
-        gradx1= 1;
-      }
-      if ((2*down+MIN(grady,grady1) < 0) ||
-          (2*down+MAX(grady,grady1) >= st->bigheight)) {
-        grady = 0;
-        grady1 = 1;
-      }
-
-      if ((gradx == 0 && gradx1 == 1 && grady == 0 && grady1 == 1)) {
-        if (dirty[pixel] > 0)
-          dirty[pixel]--;
-      } else
-        dirty[pixel] = DIRTY;
-
-      if (dirty[pixel] > 0) {
-        int dx;
-
-        /* light from top */
-        if (4-st->light >= 0)
-          dx = (grady + (src[pixel+st->width+1]-x1)) >> (4-st->light);
-        else
-          dx = (grady + (src[pixel+st->width+1]-x1)) << (st->light-4);
+      if (refract(st, s + across, dirty + across, across, down,
+                  &gradx, &gradx1, &grady, &grady1)) {
+        int dx = refract_light(st, s + across, grady);
 
         if (dx != 0) {
           XPutPixel(st->buffer_map, (across<<1),  (down<<1),
-                    bright(st, dx, grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady))));
+                    bright(st, dx, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady)));
           XPutPixel(st->buffer_map, (across<<1)+1,(down<<1),
-                    bright(st, dx, grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady))));
+                    bright(st, dx, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady)));
           XPutPixel(st->buffer_map, (across<<1),  (down<<1)+1,
-                    bright(st, dx, grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady1))));
+                    bright(st, dx, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady1)));
           XPutPixel(st->buffer_map, (across<<1)+1,(down<<1)+1,
-                    bright(st, dx, grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady1))));
+                    bright(st, dx, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady1)));
         } else {
           /* Could use XCopyArea, but XPutPixel is faster */
           XPutPixel(st->buffer_map, (across<<1),  (down<<1),
-                    grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady)));
+                    XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady));
           XPutPixel(st->buffer_map, (across<<1)+1,(down<<1),
-                    grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady)));
+                    XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady));
           XPutPixel(st->buffer_map, (across<<1),  (down<<1)+1,
-                    grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady1)));
+                    XGetPixel(st->orig_map, (across<<1) + gradx, (down<<1) + grady1));
           XPutPixel(st->buffer_map, (across<<1)+1,(down<<1)+1,
-                    grayscale(st, XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady1)));
+                    XGetPixel(st->orig_map, (across<<1) + gradx1,(down<<1) + grady1));
         }
       }
     }
+  }
 }
 
 
-/*      -------------------------------------------             */
+static void
+draw_transparent_light_32(struct state *st, short *src, int y0, int y1)
+{
+  int across, down;
 
+  for (down = y0; down < y1; down++) {
+    short *s = src + down * st->width;
+    char *dirty = st->dirty_buffer + down * st->width;
+    CARD32 *out0 = ROW32(st->buffer_map, down<<1);
+    CARD32 *out1 = ROW32(st->buffer_map, (down<<1)+1);
+    for (across = 0; across < st->width-2; across++) {
+      int gradx, grady, gradx1, grady1;
+      if (refract(st, s + across, dirty + across, across, down,
+                  &gradx, &gradx1, &grady, &grady1)) {
+        int dx = refract_light(st, s + across, grady);
+        const CARD32 *in0 = ROW32(st->orig_map, (down<<1) + grady)  + (across<<1);
+        const CARD32 *in1 = ROW32(st->orig_map, (down<<1) + grady1) + (across<<1);
 
-#if 0
-/* Doesn't go any faster and doesn't work at all colour depths */
+        if (dx != 0) {
+          out0[(across<<1)]   = bright32(st, dx, in0[gradx]);
+          out0[(across<<1)+1] = bright32(st, dx, in0[gradx1]);
+          out1[(across<<1)]   = bright32(st, dx, in1[gradx]);
+          out1[(across<<1)+1] = bright32(st, dx, in1[gradx1]);
+        } else {
+          out0[(across<<1)]   = in0[gradx];
+          out0[(across<<1)+1] = in0[gradx1];
+          out1[(across<<1)]   = in1[gradx];
+          out1[(across<<1)+1] = in1[gradx1];
+        }
+      }
+    }
+  }
+}
+
+
+/* Applies grayscale() to the grabbed image once, rather than to every
+   pixel drawn from it.  This also clears any bits of the pixels beyond the
+   depth, which XGetPixel would have masked off, and the _32 routines
+   don't. */
 static void
-draw_transparent16l(short *src)
+prepare_image(struct state *st, XImage *image)
 {
-  int across, down, bigpix, pixel;
-  char *dirty = st->dirty_buffer;
-  unsigned short *buffer, *orig;
+  int across, down;
+  for (down = 0; down < image->height; down++)
+    for (across = 0; across < image->width; across++)
+      XPutPixel(image, across, down,
+                grayscale(st, XGetPixel(image, across, down)));
+}
 
-  buffer = (unsigned short *) st->buffer_map->data;
-  orig = (unsigned short *) st->orig_map->data;
 
-  for (pixel = bigpix = down = 0;
-       down < st->height - 2;
-       down++, pixel += 2, bigpix += st->bigwidth+4)
-    for (across = 0; across < st->width-2; across++, pixel++, bigpix+=2) {
-      int gradx, grady, gradx1, grady1;
-      int x0, x1, x2, y1, y2;
-
-      x0 = src[pixel];
-      x1 = src[pixel + 1];
-      x2 = src[pixel + 2];
-      y1 = src[pixel + st->width];
-      y2 = src[pixel + 2*st->width];
-
-      gradx = (x1 - x0);
-      grady = (y1 - x0);
-      gradx1= (x2 - x1);
-      grady1= (y2 - y1);
-      gradx1 = 1 + (gradx + gradx1) / 2;
-      grady1 = 1 + (grady + grady1) / 2;
-
-      if ((2*across+MIN(gradx,gradx1) < 0) ||
-          (2*across+MAX(gradx,gradx1) >= st->bigwidth)) {
-        gradx = 0;
-        gradx1= 1;
-      }
-      if ((2*down+MIN(grady,grady1) < 0) ||
-          (2*down+MAX(grady,grady1) >= st->bigheight)) {
-        grady = 0;
-        grady1 = 1;
-      }
+static Bool
+bigendian (void)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  u.i = 1;
+  return !u.c[0];
+}
 
-      if ((gradx == 0 && gradx1 == 1 && grady == 0 && grady1 == 1)) {
-        if (dirty[pixel] > 0)
-          dirty[pixel]--;
-      } else
-        dirty[pixel] = DIRTY;
 
-      if (dirty[pixel] > 0) {
-        unsigned short *dest = buffer + bigpix;
-        unsigned short *image = orig + bigpix;
-        int dx;
+static Bool
+fast_image (XImage *image)
+{
+  return (image->format == ZPixmap &&
+          image->bits_per_pixel == 32 &&
+          image->byte_order == (bigendian() ? MSBFirst : LSBFirst));
+}
 
-        /* light from top */
-        if (4-st->light >= 0)
-          dx = (grady + (src[pixel+st->width+1]-x1)) >> (4-st->light);
-        else
-          dx = (grady + (src[pixel+st->width+1]-x1)) << (st->light-4);
 
-        grady *= st->bigwidth;
-        grady1*= st->bigwidth;
+/* Picks the drawing routine for the images at hand.  The _32 ones are for
+   32-bit images in our own byte order, which is most of them, and read and
+   write pixels directly. */
+static void
+choose_draw(struct state *st)
+{
+  Bool fast = fast_image(st->buffer_map);
 
-        if (dx != 0) {
-          *dest++ = dobright(dx, *(image + gradx  + grady));
-          *dest   = dobright(dx, *(image + gradx1 + grady));
-          dest   += st->bigwidth - 1;
-          *dest++ = dobright(dx, *(image + gradx  + grady1));
-          *dest   = dobright(dx, *(image + gradx1 + grady1));
-        } else {
-          *dest++ = *(image + gradx  + grady);
-          *dest   = *(image + gradx1 + grady);
-          dest   += st->bigwidth - 1;
-          *dest++ = *(image + gradx  + grady1);
-          *dest   = *(image + gradx1 + grady1);
-        }
-      }
-    }
+  if (!st->transparent)
+    st->draw = fast ? draw_ripple_32 : draw_ripple;
+  else if (!fast || !fast_image(st->orig_map))
+    st->draw = st->draw_transparent;
+  else if (st->draw_transparent == draw_transparent_vanilla)
+    st->draw = draw_transparent_vanilla_32;
+  else if (st->rmask == 0xFF && st->gmask == 0xFF && st->bmask == 0xFF &&
+           !(st->rshift & 7) && !(st->gshift & 7) && !(st->bshift & 7))
+    /* Each of red, green and blue is a whole byte, for bright32(). */
+    st->draw = draw_transparent_light_32;
+  else
+    st->draw = st->draw_transparent;
 }
-#endif
 
 
 /*      -------------------------------------------             */
@@ -798,20 +899,9 @@ init_ripples(struct state *st, int ndrops, int splash)
     add_drop(st, ripple_blob, splash);
 
   if (st->transparent) {
-    if (st->grayscale_p)
-    {
-      int across, down;
-      for (down = 0; down < st->bigheight; down++)
-        for (across = 0; across < st->bigwidth; across++)
-          XPutPixel(st->buffer_map, across, down,
-                    grayscale(st, XGetPixel(st->orig_map, across, down)));
-    }
-    else
-    {  
     /* There's got to be a better way of doing this  XCopyArea? */
     memcpy(st->buffer_map->data, st->orig_map->data,
            st->bigheight * st->buffer_map->bytes_per_line);
-    }
   } else {
     int across, down, color;
 
@@ -821,6 +911,7 @@ init_ripples(struct state *st, int ndrops, int splash)
         XPutPixel(st->buffer_map,across,  down,  color);
   }
 
+  choose_draw(st);
   DisplayImage(st);
 }
 
@@ -861,65 +952,263 @@ init_ripples(struct state *st, int ndrops, int splash)
  n>4 (eg 8 or 12) more fluid, waves die out slowly
  */
 
+/* The wave is computed a band of rows per thread, eight cells at a time
+   where SSE2 is available.  The vector code widens to 32 bits and narrows
+   back, so that it comes out exactly the same as the int arithmetic of
+   the scalar code.  Rows y0 ... y1-1 must be inside the border. */
+
+#ifdef __SSE2__
+
+# define LOAD(p) _mm_loadu_si128 ((const __m128i *) (p))
+# define STORE(p,v) _mm_storeu_si128 ((__m128i *) (p), (v))
+
+/* Sign-extends the low or high four of eight shorts. */
+# define WIDEN_LO(v) _mm_srai_epi32 (_mm_unpacklo_epi16 ((v), (v)), 16)
+# define WIDEN_HI(v) _mm_srai_epi32 (_mm_unpackhi_epi16 ((v), (v)), 16)
+
+/* Truncates to shorts, the way assigning an int to a short does. */
+static inline __m128i
+narrow(__m128i lo, __m128i hi)
+{
+  return _mm_packs_epi32 (_mm_srai_epi32 (_mm_slli_epi32 (lo, 16), 16),
+                          _mm_srai_epi32 (_mm_slli_epi32 (hi, 16), 16));
+}
+
+/* ((left + right + up + down) / 2) - old, rounding toward zero. */
+static inline __m128i
+wave4(__m128i l, __m128i r, __m128i u, __m128i d, __m128i old)
+{
+  __m128i sum = _mm_add_epi32 (_mm_add_epi32 (l, r), _mm_add_epi32 (u, d));
+  sum = _mm_add_epi32 (sum, _mm_srli_epi32 (sum, 31));
+  return _mm_sub_epi32 (_mm_srai_epi32 (sum, 1), old);
+}
+
+/* The same for eight shorts at s and d. */
+static inline void
+wave8(const short *s, const short *d, int w, __m128i *lo, __m128i *hi)
+{
+  __m128i l = LOAD (s - 1), r = LOAD (s + 1);
+  __m128i u = LOAD (s - w), dn = LOAD (s + w);
+  __m128i old = LOAD (d);
+  *lo = wave4 (WIDEN_LO (l), WIDEN_LO (r), WIDEN_LO (u), WIDEN_LO (dn),
+               WIDEN_LO (old));
+  *hi = wave4 (WIDEN_HI (l), WIDEN_HI (r), WIDEN_HI (u), WIDEN_HI (dn),
+               WIDEN_HI (old));
+}
+
+#endif /* __SSE2__ */
+
+
 static void
-ripple(struct state *st)
+ripple_temp_rows(struct state *st, const short *src, const short *dest,
+                 int y0, int y1)
 {
-  int across, down, pixel;
-  short *src, *dest;
+  int w = st->width;
+  int across, down;
 
+  for (down = y0; down < y1; down++) {
+    const short *s = src + down * w;
+    const short *d = dest + down * w;
+    short *t = st->temp + down * w;
+    across = 1;
+#ifdef __SSE2__
+    for (; across + 8 <= w - 1; across += 8) {
+      __m128i lo, hi;
+      wave8 (s + across, d + across, w, &lo, &hi);
+      STORE (t + across, narrow (lo, hi));
+    }
+#endif
+    for (; across < w - 1; across++)
+      t[across] = (((s[across - 1] + s[across + 1] +
+                     s[across - w] + s[across + w]) / 2)) - d[across];
+  }
+}
+
+
+/* Smooth the output */
+static void
+ripple_smooth_rows(struct state *st, short *dest, int y0, int y1)
+{
+  int w = st->width;
+  int fluidity = st->fluidity;
+  int across, down;
+
+  for (down = y0; down < y1; down++) {
+    const short *t = st->temp + down * w;
+    short *d = dest + down * w;
+    across = 1;
+#ifdef __SSE2__
+    {
+      /* The sums of nine shorts fit in a float's mantissa with room to
+         spare, so multiplying by 1/9 and truncating is exact. */
+      const __m128 ninth = _mm_set1_ps (1.0f / 9);
+      const __m128i zero = _mm_setzero_si128 ();
+      const __m128i shift = _mm_cvtsi32_si128 (fluidity);
+      for (; across + 8 <= w - 1; across += 8) {
+        const short *c = t + across;
+        __m128i v[9], out[2];
+        int half, i;
+        v[0] = LOAD (c - w - 1); v[1] = LOAD (c - w); v[2] = LOAD (c - w + 1);
+        v[3] = LOAD (c - 1);     v[4] = LOAD (c);     v[5] = LOAD (c + 1);
+        v[6] = LOAD (c + w - 1); v[7] = LOAD (c + w); v[8] = LOAD (c + w + 1);
+        for (half = 0; half < 2; half++) {
+          __m128i sum = zero, center, damp;
+          for (i = 0; i < 9; i++)
+            sum = _mm_add_epi32 (sum, (half
+                                       ? WIDEN_HI (v[i])
+                                       : WIDEN_LO (v[i])));
+          center = half ? WIDEN_HI (v[4]) : WIDEN_LO (v[4]);
+          damp = _mm_cvttps_epi32 (_mm_mul_ps (_mm_cvtepi32_ps (sum), ninth));
+          damp = _mm_sub_epi32 (damp, _mm_sra_epi32 (damp, shift));
+          /* Close enough for government work */
+          out[half] = _mm_andnot_si128 (_mm_cmpeq_epi32 (center, zero), damp);
+        }
+        STORE (d + across, narrow (out[0], out[1]));
+      }
+    }
+#endif
+    for (; across < w - 1; across++) {
+      if (t[across] != 0) { /* Close enough for government work */
+        int damp =
+          (t[across - 1] + t[across + 1] +
+           t[across - w] + t[across + w] +
+           t[across - w - 1] + t[across - w + 1] +
+           t[across + w - 1] + t[across + w + 1] +
+           t[across]) / 9;
+        d[across] = damp - (damp >> fluidity);
+      } else
+        d[across] = 0;
+    }
+  }
+}
+
+
+static void
+ripple_step_rows(struct state *st, const short *src, short *dest,
+                 int y0, int y1)
+{
+  int w = st->width;
+  int fluidity = st->fluidity;
+  int across, down;
+
+  for (down = y0; down < y1; down++) {
+    const short *s = src + down * w;
+    short *d = dest + down * w;
+    across = 1;
+#ifdef __SSE2__
+    {
+      const __m128i shift = _mm_cvtsi32_si128 (fluidity);
+      for (; across + 8 <= w - 1; across += 8) {
+        __m128i lo, hi;
+        wave8 (s + across, d + across, w, &lo, &hi);
+        lo = _mm_sub_epi32 (lo, _mm_sra_epi32 (lo, shift));
+        hi = _mm_sub_epi32 (hi, _mm_sra_epi32 (hi, shift));
+        STORE (d + across, narrow (lo, hi));
+      }
+    }
+#endif
+    for (; across < w - 1; across++) {
+      int damp =
+        (((s[across - 1] + s[across + 1] +
+           s[across - w] + s[across + w]) / 2)) - d[across];
+      d[across] = damp - (damp >> fluidity);
+    }
+  }
+}
+
+
+typedef struct {
+  struct state *st;
+  unsigned id;
+} ripple_thread;
+
+
+static int
+ripple_thread_create(void *self, struct threadpool *pool, unsigned id)
+{
+  ripple_thread *t = (ripple_thread *) self;
+  t->st = GET_PARENT_OBJ(struct state, pool, pool);
+  t->id = id;
+  return 0;
+}
+
+
+static void
+ripple_thread_destroy(void *self)
+{
+}
+
+
+static void
+ripple_thread_run(void *self)
+{
+  ripple_thread *t = (ripple_thread *) self;
+  struct state *st = t->st;
+  unsigned n = st->pool.count;
+  int first, rows, y0, y1;
+
+  if (st->phase == RIPPLE_DRAW) {
+    first = 0;
+    rows = st->height - (st->transparent ? 2 : 1);
+  } else {
+    first = 1;
+    rows = st->height - 2;
+  }
+  if (rows <= 0) return;
+  y0 = first + (int) ((long) rows * t->id / n);
+  y1 = first + (int) ((long) rows * (t->id + 1) / n);
+
+  switch (st->phase) {
+  case RIPPLE_TEMP:
+    ripple_temp_rows(st, st->src, st->dest, y0, y1);
+    break;
+  case RIPPLE_SMOOTH:
+    ripple_smooth_rows(st, st->dest, y0, y1);
+    break;
+  case RIPPLE_STEP:
+    ripple_step_rows(st, st->src, st->dest, y0, y1);
+    break;
+  case RIPPLE_DRAW:
+    st->draw(st, st->dest, y0, y1);
+    break;
+  }
+}
+
+
+static void
+ripple_run(struct state *st, int phase)
+{
+  st->phase = phase;
+  threadpool_run(&st->pool, ripple_thread_run);
+  threadpool_wait(&st->pool);
+}
+
+
+static void
+ripple(struct state *st)
+{
   if (st->draw_toggle == 0) {
-    src = st->bufferA;
-    dest = st->bufferB;
+    st->src = st->bufferA;
+    st->dest = st->bufferB;
     st->draw_toggle = 1;
   } else {
-    src = st->bufferB;
-    dest = st->bufferA;
+    st->src = st->bufferB;
+    st->dest = st->bufferA;
     st->draw_toggle = 0;
   }
 
   switch (st->draw_count) {
   case 0: case 1:
-    pixel = 1 * st->width + 1;
-    for (down = 1; down < st->height - 1; down++, pixel += 2 * 1)
-      for (across = 1; across < st->width - 1; across++, pixel++) {
-        st->temp[pixel] =
-          (((src[pixel - 1] + src[pixel + 1] +
-             src[pixel - st->width] + src[pixel + st->width]) / 2)) - dest[pixel];
-      }
-
-    /* Smooth the output */
-    pixel = 1 * st->width + 1;
-    for (down = 1; down < st->height - 1; down++, pixel += 2 * 1)
-      for (across = 1; across < st->width - 1; across++, pixel++) {
-        if (st->temp[pixel] != 0) { /* Close enough for government work */
-          int damp =
-            (st->temp[pixel - 1] + st->temp[pixel + 1] +
-             st->temp[pixel - st->width] + st->temp[pixel + st->width] +
-             st->temp[pixel - st->width - 1] + st->temp[pixel - st->width + 1] +
-             st->temp[pixel + st->width - 1] + st->temp[pixel + st->width + 1] +
-             st->temp[pixel]) / 9;
-          dest[pixel] = damp - (damp >> st->fluidity);
-        } else
-          dest[pixel] = 0;
-      }
+    ripple_run(st, RIPPLE_TEMP);
+    ripple_run(st, RIPPLE_SMOOTH);
     break;
   case 2: case 3:
-    pixel = 1 * st->width + 1;
-    for (down = 1; down < st->height - 1; down++, pixel += 2 * 1)
-      for (across = 1; across < st->width - 1; across++, pixel++) {
-        int damp =
-          (((src[pixel - 1] + src[pixel + 1] +
-             src[pixel - st->width] + src[pixel + st->width]) / 2)) - dest[pixel];
-        dest[pixel] = damp - (damp >> st->fluidity);
-      }
+    ripple_run(st, RIPPLE_STEP);
     break;
   }
   if (++st->draw_count > 3) st->draw_count = 0;
 
-  if (st->transparent)
-    st->draw_transparent(st, dest);
-  else
-    draw_ripple(st, dest);
+  ripple_run(st, RIPPLE_DRAW);
 }
 
 
@@ -928,6 +1217,12 @@ ripple(struct state *st)
 static void *
 ripples_init (Display *disp, Window win)
 {
+  static const struct threadpool_class cls = {
+    sizeof(ripple_thread),
+    ripple_thread_create,
+    ripple_thread_destroy
+  };
+  int error;
   struct state *st = (struct state *) calloc (1, sizeof(*st));
   st->dpy = disp;
   st->window = win;
@@ -973,6 +1268,8 @@ ripples_init (Display *disp, Window win)
     set_mask(&st->gmask, &st->gshift);
     set_mask(&st->bmask, &st->bshift);
     if (st->rmask == 0) st->draw_transparent = draw_transparent_vanilla;
+    st->rgb_mask = ((st->rmask << st->rshift) | (st->gmask << st->gshift) |
+                    (st->bmask << st->bshift));
 
     /* Adjust the shift value "light" when we don't have 8 bits per colour */
     maxbits = MIN(MIN(BITCOUNT(st->rmask), BITCOUNT(st->gmask)), BITCOUNT(st->bmask));
@@ -989,6 +1286,12 @@ ripples_init (Display *disp, Window win)
     }
     st->draw_transparent = draw_transparent_vanilla;
   }
+
+  error = threadpool_create(&st->pool, &cls, disp, hardware_concurrency(disp));
+  if (error) {
+    fprintf(stderr, "%s: threadpool: %s\n", progname, strerror(error));
+    exit(1);
+  }
   
   if (!st->transparent)
     init_ripples(st, 0, -SPLASH); /* Start off without any drops */
@@ -1012,6 +1315,7 @@ ripples_draw (Display *dpy, Window window, void *closure)
         st->orig_map = XGetImage (st->dpy, st->window, 0, 0, 
                                   xgwa.width, xgwa.height,
                                   ~0L, ZPixmap);
+        prepare_image(st, st->orig_map);
         init_ripples(st, 0, -SPLASH); /* Start off without any drops */
       }
       return st->delay;
@@ -1065,6 +1369,7 @@ static void
 ripples_free (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
+  threadpool_destroy (&st->pool);
   if (st->bufferA) free (st->bufferA);
   if (st->bufferB) free (st->bufferB);
   if (st->temp) free (st->temp);
@@ -1091,6 +1396,7 @@ static const char *ripples_defaults[] =
   "*fluidity: 		6",
   "*light: 		4",
   "*grayscale: 		False",
+  THREAD_DEFAULTS
 #ifdef HAVE_XSHM_EXTENSION
   "*useSHM: True",
 #else
@@ -1119,6 +1425,7 @@ static XrmOptionDescRec ripples_options[] =
   {"-grayscale",	".grayscale",	XrmoptionNoArg, "True"},
   {"-shm",	".useSHM",	XrmoptionNoArg, "True"},
   {"-no-shm",	".useSHM",	XrmoptionNoArg, "False"},
+  THREAD_OPTIONS
   {0, 0, 0, 0}
 };
 
@@ -50,6 +50,7 @@
 
 #include "screenhack.h"
 #include "ximage-loader.h"
+#include "imgfilter.h"
 #include <limits.h>
 
 # undef MAX
@@ -597,54 +598,19 @@ FlamePasteData(struct state *st,
 static XImage *
 double_ximage (Display *dpy, Visual *visual, XImage *image)
 {
-  int x, y;
   XImage *out = XCreateImage (dpy, visual, image->depth, ZPixmap, 0, 0,
                               image->width * 2, image->height * 2, 8, 0);
   out->data = (char *) malloc (out->height * out->bytes_per_line);
-  for (y = 0; y < image->width; y++)
-    for (x = 0; x < image->height; x++)
-      {
-	unsigned long p = XGetPixel (image, x, y);
-	XPutPixel (out, x*2,   y*2,   p);
-	XPutPixel (out, x*2+1, y*2,   p);
-	XPutPixel (out, x*2,   y*2+1, p);
-	XPutPixel (out, x*2+1, y*2+1, p);
-      }
+  if (!out->data || !imgfilter_scale_ximage (image, out, 0))
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      exit (1);
+    }
   XDestroyImage (image);
   return out;
 }
 
 
-static unsigned char *
-gaussian_blur (unsigned char *in, int w, int h, double r)
-{
-  unsigned char *out = malloc(w * h);
-  int rs = (int) ((r * 2.57) + 0.5);
-  int i, j;
-
-  for (i = 0; i < h; i ++)
-    for (j = 0; j < w; j++) 
-      {
-        double val = 0, wsum = 0;
-        int ix, iy;
-        for (iy = i-rs; iy<i+rs+1; iy++)
-          for (ix = j-rs; ix<j+rs+1; ix++)
-            {
-              int x = MIN(w-1, MAX(0, ix));
-              int y = MIN(h-1, MAX(0, iy));
-              int dsq = (ix-j)*(ix-j)+(iy-i)*(iy-i);
-              double wght = exp (-dsq / (2*r*r)) / (M_PI*2*r*r);
-              val += in[y*w+x] * wght;
-              wsum += wght;
-            }
-        out[i*w+j] = val/wsum;            
-      }
-
-  free (in);
-  return out;
-}
-
-
 static unsigned char *
 loadBitmap (struct state *st)
 {
@@ -698,7 +664,8 @@ loadBitmap (struct state *st)
 
   /* If we enlarged the image, file off the sharp edges. */
   if (blur > 0)
-    result = gaussian_blur (result, image->width, image->height, blur * 1.7);
+    imgfilter_gaussian_blur (result, image->width, image->height,
+                             image->width, 1, blur * 1.7, 0);
 
   st->theimx = image->width;
   st->theimy = image->height;
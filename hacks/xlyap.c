@@ -39,6 +39,8 @@
 #include "screenhack.h"
 #include "yarandom.h"
 #include "hsv.h"
+#include "iterimage.h"
+#include "thread_util.h"
 
 #ifndef HAVE_JWXYZ
 # include <X11/cursorfont.h> 
@@ -79,6 +81,7 @@ static const char *xlyap_defaults [] = {
 #ifdef HAVE_MOBILE
   "*ignoreRotation:     True",
 #endif
+  THREAD_DEFAULTS
   0
 };
 
@@ -108,6 +111,7 @@ static XrmOptionDescRec xlyap_options [] = {
   { "-w", ".aRange",            XrmoptionSepArg, 0 },   /* r */
   { "-delay", ".delay",         XrmoptionSepArg, 0 },   /* delay */
   { "-linger", ".linger",       XrmoptionSepArg, 0 },   /* linger */
+  THREAD_OPTIONS
   { 0, 0, 0, 0 }
 };
 
@@ -233,6 +237,9 @@ struct state {
 
   int ncolors;
   XColor colors[MAXCOLOR];
+  unsigned long pixels[MAXCOLOR];	/* the foreground of each Data_GC */
+
+  iterimage *iter;
 };
 
 
@@ -285,9 +292,11 @@ static void init_color(struct state *);
 static void parseargs(struct state *);
 static void Clear(struct state *);
 static void setupmem(struct state *);
-static int complyap(struct state *);
+static void lyap_row(void *, int y, int x0, int dx, int n,
+                     unsigned long *pixels);
 static Bool Getkey(struct state *, XKeyEvent *);
 static int sendpoint(struct state *, double expo);
+static int exponent_color(struct state *, double expo);
 /*static void save_to_file(struct state *);*/
 static void setforcing(struct state *);
 static void check_params(struct state *, int mapnum, int parnum);
@@ -310,135 +319,218 @@ static void print_values(struct state *);
 /****************************************************************************/
 
 
+/* The Lyapunov exponents are computed for LANES neighboring points at a
+ * time, all of which have the same 'b' and are forced in step, so that each
+ * stage of an iteration is one loop across the lanes, which the compiler
+ * can vectorize.  A lane whose derivative hits zero drops out of the sums,
+ * and once they all have the rest of the iterations are skipped.
+ */
+#define LANES 8
+
+static int
+map_number(PFD map)
+{
+  int i;
+  for (i = 0; i < NUMMAPS; i++)
+    if (Maps[i] == map)
+      return i;
+  return 0;
+}
+
+static void
+map_lanes(int map, double *x, const double *r)
+{
+  int j;
+  double d;
+  switch (map) {
+  case 0:
+    for (j = 0; j < LANES; j++)
+      x[j] = r[j] * x[j] * (1.0 - x[j]);
+    break;
+  case 1:
+    for (j = 0; j < LANES; j++)
+      x[j] = r[j] * sin(M_PI * x[j]);
+    break;
+  case 2:
+    for (j = 0; j < LANES; j++) {
+      d = 1.0 - x[j];
+      x[j] = r[j] * x[j] * d * d;
+    }
+    break;
+  case 3:
+    for (j = 0; j < LANES; j++)
+      x[j] = r[j] * x[j] * x[j] * (1.0 - x[j]);
+    break;
+  default:
+    for (j = 0; j < LANES; j++) {
+      d = 1.0 - x[j];
+      x[j] = r[j] * x[j] * x[j] * d * d;
+    }
+    break;
+  }
+}
+
+/* The absolute value of the derivative. */
+static void
+deriv_lanes(int map, const double *x, const double *r, double *dx)
+{
+  int j;
+  double d;
+  switch (map) {
+  case 0:
+    for (j = 0; j < LANES; j++)
+      dx[j] = fabs(r[j] - (2.0 * r[j] * x[j]));
+    break;
+  case 1:
+    for (j = 0; j < LANES; j++)
+      dx[j] = fabs(r[j] * M_PI * cos(M_PI * x[j]));
+    break;
+  case 2:
+    for (j = 0; j < LANES; j++)
+      dx[j] = fabs(r[j] * (1.0 - (4.0 * x[j]) + (3.0 * x[j] * x[j])));
+    break;
+  case 3:
+    for (j = 0; j < LANES; j++)
+      dx[j] = fabs(r[j] * ((2.0 * x[j]) - (3.0 * x[j] * x[j])));
+    break;
+  default:
+    for (j = 0; j < LANES; j++) {
+      d = x[j] * x[j];
+      dx[j] = fabs(r[j] * ((2.0 * x[j]) - (6.0 * d) + (4.0 * x[j] * d)));
+    }
+    break;
+  }
+}
+
+/* Random forcing for each lane, as setforcing() does, but from a generator
+ * of our own, since this runs on several threads.
+ */
+static void
+random_forcing(struct state *st, int (*forcing)[MAXINDEX], ya_rand_state *rng)
+{
+  unsigned int r[LANES * MAXINDEX];
+  int i, j;
+  ya_random_fill_r(rng, r, LANES * MAXINDEX);
+  for (j = 0; j < LANES; j++)
+    for (i = 0; i < MAXINDEX; i++)
+      forcing[j][i] = (r[j * MAXINDEX + i] > st->prob) ? 0 : 1;
+}
+
+/* Each lane's r for step bindex of the forcing sequence.  Without -R every
+ * lane follows st->forcing, so r is all of a or all of b; with it, each
+ * lane has a sequence of its own, as each point did when done one at a time.
+ */
+static const double *
+lane_r(struct state *st, int (*forcing)[MAXINDEX], int bindex,
+       const double *a, const double *b, double *r)
+{
+  int j;
+  if (!st->Rflag)
+    return st->forcing[bindex] ? b : a;
+  for (j = 0; j < LANES; j++)
+    r[j] = forcing[j][bindex] ? b[j] : a[j];
+  return r;
+}
+
 /* complyap() is the guts of the program. This is where the Lyapunov exponent
  * is calculated. For each iteration (past some large number of iterations)
  * calculate the logarithm of the absolute value of the derivative at that
  * point. Then average them over some large number of iterations. Some small
  * speed up is achieved by utilizing the fact that log(a*b) = log(a) + log(b).
+ *
+ * This does it for up to LANES points of row y, x0 + dx apart.
  */
-static int
-complyap(struct state *st)
+static void
+complyap(struct state *st, int y, int x0, int dx, int n,
+         unsigned long *pixels)
 {
-  int i, bindex;
-  double total, prod, x, dx, r;
-
-  if (st->maxcolor > MAXCOLOR)
-    abort();
-
-  if (!st->run)
-    return TRUE;
-  st->a += st->a_inc;
-  if (st->a >= st->max_a) {
-    if (sendpoint(st, st->lyapunov) == TRUE)
-      return FALSE;
-    else {
-      FlushBuffer(st);
-      /*      if (savefile)
-              save_to_file(); */
-      return TRUE;
-    }
+  double a[LANES], b[LANES], x[LANES], d[LANES], prod[LANES], total[LANES];
+  double rl[LANES];
+  int count[LANES];
+  int forcing[LANES][MAXINDEX];
+  ya_rand_state rng;
+  int map = map_number(st->map);
+  const double *r;
+  int i, j, bindex = 0, live = n;
+
+  for (j = 0; j < LANES; j++) {
+    /* Spare lanes repeat the last point. */
+    int px = x0 + (j < n ? j : n-1) * dx;
+    a[j] = st->min_a + (px + 1) * st->a_inc;
+    b[j] = st->min_b + y * st->b_inc;
+    x[j] = st->start_x;
+    prod[j] = 1.0;
+    total[j] = 0.0;
+    count[j] = 0;
   }
-  if (st->b >= st->max_b) {
-    FlushBuffer(st);
-    /*    if (savefile)
-          save_to_file();*/
-    return TRUE;
+  if (st->Rflag) {
+    /* Seeded from the points, so the picture doesn't depend on which
+       thread drew what.  Never 0, which would mean ya_random(). */
+    ya_rand_state_init(&rng, (unsigned int) (y * 65599 + x0) + 1);
+    random_forcing(st, forcing, &rng);
   }
-  prod = 1.0;
-  total = 0.0;
-  bindex = 0;
-  x = st->start_x;
-  r = (st->forcing[bindex]) ? st->b : st->a;
-#ifdef MAPS
-  findex = 0;
-  map = Maps[st->Forcing[findex]];
-#endif
-  for (i=0;i<st->settle;i++) {     /* Here's where we let the thing */
-    x = st->map (x, r);  /* "settle down". There is usually */
-    if (++bindex >= st->maxindex) { /* some initial "noise" in the */
-      bindex = 0;    /* iterations. How can we optimize */
-      if (st->Rflag)      /* the value of settle ??? */
-        setforcing(st);
+  r = lane_r(st, forcing, bindex, a, b, rl);
+
+  for (i = 0; i < st->settle; i++) {  /* Here's where we let the thing */
+    map_lanes(map, x, r);             /* "settle down". There is usually */
+    if (++bindex >= st->maxindex) {   /* some initial "noise" in the */
+      bindex = 0;                     /* iterations. How can we optimize */
+      if (st->Rflag)                  /* the value of settle ??? */
+        random_forcing(st, forcing, &rng);
     }
-    r = (st->forcing[bindex]) ? st->b : st->a;
-#ifdef MAPS
-    if (++findex >= funcmaxindex)
-      findex = 0;
-    map = Maps[st->Forcing[findex]];
-#endif
+    r = lane_r(st, forcing, bindex, a, b, rl);
   }
-#ifdef MAPS
-  deriv = Derivs[st->Forcing[findex]];
-#endif
-  if (st->useprod) {      /* using log(a*b) */
-    for (i=0;i<st->dwell;i++) {
-      x = st->map (x, r);
-      dx = st->deriv (x, r); /* ABS is a macro, so don't be fancy */
-      dx = ABS(dx);
-      if (dx == 0.0) /* log(0) is nasty so break out. */
-        {
-          i++;
-          break;
+
+  for (i = 0; i < st->dwell && live > 0; i++) {
+    map_lanes(map, x, r);
+    deriv_lanes(map, x, r, d);
+    for (j = 0; j < n; j++) {
+      if (count[j])
+        continue;
+      if (st->useprod ? d[j] == 0.0 : x[j] == 0.0) {
+        /* log(0) is nasty so break out. */
+        count[j] = i + 1;
+        live--;
+      } else if (st->useprod) {
+        prod[j] *= d[j];
+        /* we need to prevent overflow and underflow */
+        if ((prod[j] > 1.0e12) || (prod[j] < 1.0e-12)) {
+          total[j] += log(prod[j]);
+          prod[j] = 1.0;
         }
-      prod *= dx;
-      /* we need to prevent overflow and underflow */
-      if ((prod > 1.0e12) || (prod < 1.0e-12)) {
-        total += log(prod);
-        prod = 1.0;
+      } else {
+        total[j] += log(d[j]);
       }
-      if (++bindex >= st->maxindex) {
-        bindex = 0;
-        if (st->Rflag)
-          setforcing(st);
-      }
-      r = (st->forcing[bindex]) ? st->b : st->a;
-#ifdef MAPS
-      if (++findex >= funcmaxindex)
-        findex = 0;
-      map = Maps[st->Forcing[findex]];
-      deriv = Derivs[st->Forcing[findex]];
-#endif
     }
-    total += log(prod);
-    st->lyapunov = (total * M_LOG2E) / (double)i;   
-  }
-  else {        /* use log(a) + log(b) */
-    for (i=0;i<st->dwell;i++) {
-      x = st->map (x, r);
-      dx = st->deriv (x, r); /* ABS is a macro, so don't be fancy */
-      dx = ABS(dx);
-      if (x == 0.0)  /* log(0) check */
-        {
-          i++;
-          break;
-        }
-      total += log(dx);
-      if (++bindex >= st->maxindex) {
-        bindex = 0;
-        if (st->Rflag)
-          setforcing(st);
-      }
-      r = (st->forcing[bindex]) ? st->b : st->a;
-#ifdef MAPS
-      if (++findex >= funcmaxindex)
-        findex = 0;
-      map = Maps[st->Forcing[findex]];
-      deriv = Derivs[st->Forcing[findex]];
-#endif
+    if (++bindex >= st->maxindex) {
+      bindex = 0;
+      if (st->Rflag)
+        random_forcing(st, forcing, &rng);
     }
-    st->lyapunov = (total * M_LOG2E) / (double)i;
+    r = lane_r(st, forcing, bindex, a, b, rl);
   }
 
-  if (sendpoint(st, st->lyapunov) == TRUE)
-    return FALSE;
-  else {
-    FlushBuffer(st);
-    /*    if (savefile)
-          save_to_file();*/
-    return TRUE;
+  for (j = 0; j < n; j++) {
+    double expo;
+    if (st->useprod)
+      total[j] += log(prod[j]);
+    expo = (total[j] * M_LOG2E) / (double) (count[j] ? count[j] : i);
+    st->exponents[st->frame][y * st->width + x0 + j * dx] = expo;
+    pixels[j] = st->pixels[exponent_color(st, expo)];
   }
 }
 
+/* Called by iterimage, on several threads at once. */
+static void
+lyap_row(void *closure, int y, int x0, int dx, int n, unsigned long *pixels)
+{
+  struct state *st = (struct state *) closure;
+  int i;
+  for (i = 0; i < n; i += LANES)
+    complyap(st, y, x0 + i * dx, dx, (n - i < LANES ? n - i : LANES),
+             pixels + i);
+}
+
 static double
 logistic(double x, double r)        /* the familiar logistic map */
 {
@@ -529,6 +621,8 @@ init_data(struct state *st)
   if (st->show)
     show_defaults(st);
   InitBuffer(st);
+  if (st->iter)
+    iterimage_restart(st->iter);
 }
 
 #if 0
@@ -564,9 +658,9 @@ init_color(struct state *st)
       gcv.background = BlackPixelOfScreen(st->screen);
       st->Data_GC[i] = XCreateGC(st->dpy, st->canvas, GCBackground, &gcv);
     }
-    XSetForeground(st->dpy, st->Data_GC[i],
-                   st->colors[((int) ((i / ((float)st->maxcolor)) *
-                                      st->ncolors))].pixel);
+    st->pixels[i] = st->colors[((int) ((i / ((float)st->maxcolor)) *
+                                       st->ncolors))].pixel;
+    XSetForeground(st->dpy, st->Data_GC[i], st->pixels[i]);
   }
 }
 
@@ -903,6 +997,7 @@ Getkey(struct state *st, XKeyEvent *event)
 /*      st->rubber_data.p_max = st->max_a;
       st->rubber_data.q_max = st->max_b;*/
       Clear(st);
+      Redraw(st);
       return True;
     case 'M': if (st->minlyap > 0.005)
         st->minlyap -= 0.005;
@@ -982,10 +1077,41 @@ Getkey(struct state *st, XKeyEvent *event)
  * also greatly effect what details are seen. Play around with this.
  */
 static int
-sendpoint(struct state *st, double expo)
+exponent_color(struct state *st, double expo)
 {
   double tmpexpo;
+  int color;
 
+  tmpexpo = (st->negative) ? expo : -1.0 * expo;
+  if (tmpexpo > 0) {
+    if (!mono_p) {
+      color = (int)(tmpexpo*st->lowrange/st->maxexp);
+      color = ((color % st->lowrange) + st->startcolor);
+    }
+    else
+      color = 0;
+  }
+  else {
+    if (!mono_p) {
+      color = (int)(tmpexpo*st->numfreecols/st->minexp);
+      color = ((color % st->numfreecols) + st->mincolindex);
+    }
+    else
+      color = 1;
+  }
+
+  /* Guard against bogus color values. Shouldn't be necessary but paranoia
+     is good. */
+  if (color < 0)
+    color = 0;
+  else if (color >= st->maxcolor)
+    color = st->maxcolor - 1;
+  return color;
+}
+
+static int
+sendpoint(struct state *st, double expo)
+{
   if (st->maxcolor > MAXCOLOR)
     abort();
 
@@ -999,25 +1125,7 @@ sendpoint(struct state *st, double expo)
 #endif
 
   st->point.x++;
-  tmpexpo = (st->negative) ? expo : -1.0 * expo;
-  if (tmpexpo > 0) {
-    if (!mono_p) {
-      st->sendpoint_index = (int)(tmpexpo*st->lowrange/st->maxexp);
-      st->sendpoint_index = ((st->sendpoint_index % st->lowrange) + 
-                             st->startcolor);
-    }
-    else
-      st->sendpoint_index = 0;
-  }
-  else {
-    if (!mono_p) {
-      st->sendpoint_index = (int)(tmpexpo*st->numfreecols/st->minexp);
-      st->sendpoint_index = ((st->sendpoint_index % st->numfreecols)
-                             + st->mincolindex);
-    }
-    else
-      st->sendpoint_index = 1;
-  }
+  st->sendpoint_index = exponent_color(st, expo);
   BufferPoint(st, st->sendpoint_index, st->point.x, st->point.y);
   if (st->save) {
     if (st->frame > MAXFRAMES)
@@ -1066,6 +1174,8 @@ resize(struct state *st)
   st->b = /*st->rubber_data.q_min = */st->min_b;
 /*  st->rubber_data.p_max = st->max_a;
   st->rubber_data.q_max = st->max_b;*/
+  iterimage_free(st->iter);  /* the wrong size now */
+  st->iter = 0;
   freemem(st);
   setupmem(st);
   for (n=0;n<MAXFRAMES;n++)
@@ -1114,6 +1224,8 @@ Redraw(struct state *st)
   st->b = st->min_b;
   st->expind[st->frame] = 0;
   st->resized[st->frame] = 0;
+  if (st->iter)
+    iterimage_restart(st->iter);
 }
 
 static void
@@ -1844,7 +1956,6 @@ static unsigned long
 xlyap_draw (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
-  int i;
 
   if (!st->run && st->reset_countdown) {
     st->reset_countdown--;
@@ -1862,13 +1973,23 @@ xlyap_draw (Display *dpy, Window window, void *closure)
     }
   }
 
-  for (i = 0; i < 2000; i++)
-    if (complyap(st) == TRUE)
-      {
-        st->run = 0;
-        st->reset_countdown = st->linger;
-        break;
-      }
+  if (!st->run)
+    return st->delay;
+
+  if (!st->iter) {
+    st->iter = iterimage_new(st->dpy, st->canvas, lyap_row, st);
+    if (!st->iter) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+  }
+
+  /* Fill in the exponents for a while, leaving time for events. */
+  if (iterimage_step(st->iter, 0.05)) {
+    st->expind[st->frame] = st->width * st->height;
+    st->run = 0;
+    st->reset_countdown = st->linger;
+  }
   return st->delay;
 }
 
@@ -1921,6 +2042,7 @@ xlyap_free (Display *dpy, Window window, void *closure)
   int i;
   struct state *st = (struct state *) closure;
 
+  iterimage_free (st->iter);
   freemem (st);
 
 #ifdef BACKING_PIXMAP
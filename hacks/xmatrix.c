@@ -54,6 +54,7 @@
 
 #include "screenhack.h"
 #include "textclient.h"
+#include "cellimage.h"
 #include "ximage-loader.h"
 #include <stdio.h>
 #include <sys/wait.h>
@@ -159,7 +160,6 @@ typedef struct {
   Display *dpy;
   Window window;
   XWindowAttributes xgwa;
-  GC draw_gc, erase_gc, scratch_gc;
   int grid_width, grid_height;
   int char_width, char_height;
   m_cell *cells;
@@ -203,14 +203,18 @@ typedef struct {
   int cursor_x, cursor_y;
   XtIntervalId cursor_timer;
 
-  Pixmap images[CHAR_MAPS];
+  /* Each map as indexes into its palette, which is ramp 'map' of ci. */
+  unsigned char *images[CHAR_MAPS];
+  unsigned long palettes[CHAR_MAPS][256];
   int image_width, image_height;
   Bool images_flipped_p;
+  cellimage *ci;
 
   int nglyphs;
   const int *glyph_map;
 
   unsigned long colors[5];
+  unsigned long bg_pixel;
   int delay;
 } m_state;
 
@@ -249,11 +253,58 @@ double_pixmap (Display *dpy, Visual *visual, int depth, Pixmap pixmap,
 }
 
 
+/* Converts the pixmap to one byte per pixel, each an index into the map's
+   palette.  The images have at most 256 colors, so this loses nothing.
+ */
+static void
+pixmap_to_levels (m_state *state, int which, Pixmap pixmap)
+{
+  XImage *im = XGetImage (state->dpy, pixmap, 0, 0,
+                          state->image_width, state->image_height,
+                          ~0L, (state->xgwa.depth > 1 ? ZPixmap : XYPixmap));
+  unsigned long *palette = state->palettes[which];
+  unsigned char *levels = (unsigned char *)
+    malloc (state->image_width * state->image_height);
+  int ncolors = 0, last = 0;
+  int x, y;
+
+  if (!levels)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      exit (1);
+    }
+
+  for (y = 0; y < state->image_height; y++)
+    for (x = 0; x < state->image_width; x++)
+      {
+        unsigned long p = XGetPixel (im, x, y);
+        if (!ncolors || palette[last] != p)
+          {
+            for (last = 0; last < ncolors; last++)
+              if (palette[last] == p)
+                break;
+            if (last == ncolors)
+              {
+                if (ncolors < countof(state->palettes[which]))
+                  palette[ncolors++] = p;
+                else
+                  last = ncolors - 1;
+              }
+          }
+        levels[y * state->image_width + x] = last;
+      }
+
+  XDestroyImage (im);
+  state->images[which] = levels;
+}
+
+
 static void
 load_images_1 (Display *dpy, m_state *state, int which)
 {
   const unsigned char *png = 0;
   unsigned long size = 0;
+  Pixmap pixmap;
   if (which == 1)
     {
       if (state->small_p)
@@ -268,19 +319,20 @@ load_images_1 (Display *dpy, m_state *state, int which)
       else
         png = matrix2_png, size = sizeof(matrix2_png);
     }
-  state->images[which] =
-    image_data_to_pixmap (state->dpy, state->window, png, size,
-                          &state->image_width, &state->image_height, 0);
+  pixmap = image_data_to_pixmap (state->dpy, state->window, png, size,
+                                 &state->image_width, &state->image_height, 0);
 
   if (state->xgwa.width > 1920 || state->xgwa.height > 1920)
     { /* Retina displays */
-      state->images[which] =
-        double_pixmap (state->dpy, state->xgwa.visual,
-                       state->xgwa.depth, state->images[which],
-                       state->image_width, state->image_height);
+      pixmap = double_pixmap (state->dpy, state->xgwa.visual,
+                              state->xgwa.depth, pixmap,
+                              state->image_width, state->image_height);
       state->image_width *= 2;
       state->image_height *= 2;
     }
+
+  pixmap_to_levels (state, which, pixmap);
+  XFreePixmap (state->dpy, pixmap);
 }
 
 
@@ -292,31 +344,44 @@ load_images (Display *dpy, m_state *state)
 }
 
 
+/* Hands the characters of one map to the cellimage, mirrored left to
+   right if the images are flipped.  The glyph of character g of a map is
+   (map * CHAR_COLS * CHAR_ROWS) + (g - 1).
+ */
 static void
-flip_images_1 (m_state *state, int which)
+load_glyphs_1 (m_state *state, int which)
 {
-  XImage *im = XGetImage (state->dpy, state->images[which], 0, 0,
-                          state->image_width, state->image_height,
-                          ~0L, (state->xgwa.depth > 1 ? ZPixmap : XYPixmap));
-  int x, y, xx;
   int ww = state->char_width;
-  unsigned long *row = (unsigned long *) malloc (sizeof(*row) * ww);
+  int hh = state->char_height;
+  unsigned char *cell = (unsigned char *) malloc (ww * hh);
+  int i, x, y;
 
-  for (y = 0; y < state->image_height; y++)
+  for (i = 0; i < countof(state->palettes[which]); i++)
+    cellimage_set_ramp (state->ci, which, i, state->palettes[which][i]);
+
+  for (i = 0; i < CHAR_COLS * CHAR_ROWS; i++)
     {
-      for (x = 0; x < CHAR_COLS; x++)
-        {
-          for (xx = 0; xx < ww; xx++)
-            row[xx] = XGetPixel (im, (x * ww) + xx, y);
-          for (xx = 0; xx < ww; xx++)
-            XPutPixel (im, (x * ww) + xx, y, row[ww - xx - 1]);
-        }
+      const unsigned char *from =
+        (state->images[which] +
+         (i / CHAR_COLS) * hh * state->image_width +
+         (i % CHAR_COLS) * ww);
+      for (y = 0; y < hh; y++)
+        for (x = 0; x < ww; x++)
+          cell[y * ww + x] = from[y * state->image_width +
+                                  (state->images_flipped_p
+                                   ? ww - x - 1
+                                   : x)];
+      cellimage_set_glyph (state->ci, which * CHAR_COLS * CHAR_ROWS + i,
+                           cell, ww);
     }
+  free (cell);
+}
 
-  XPutImage (state->dpy, state->images[which], state->draw_gc, im, 0, 0, 0, 0,
-             state->image_width, state->image_height);
-  XDestroyImage (im);
-  free (row);
+static void
+load_glyphs (m_state *state)
+{
+  load_glyphs_1 (state, PLAIN_MAP);
+  load_glyphs_1 (state, GLOW_MAP);
 }
 
 static void
@@ -325,8 +390,7 @@ flip_images (m_state *state, Bool flipped_p)
   if (flipped_p != state->images_flipped_p)
     {
       state->images_flipped_p = flipped_p;
-      flip_images_1 (state, 1);
-      flip_images_1 (state, 2);
+      load_glyphs (state);
     }
 }
 
@@ -612,7 +676,6 @@ set_mode (m_state *state, m_mode mode)
 static void *
 xmatrix_init (Display *dpy, Window window)
 {
-  XGCValues gcv;
   char *insert, *mode;
   int i;
   m_state *state = (m_state *) calloc (sizeof(*state), 1);
@@ -638,17 +701,8 @@ xmatrix_init (Display *dpy, Window window)
 
   load_images (dpy, state);
 
-  gcv.foreground = get_pixel_resource(state->dpy, state->xgwa.colormap,
-                                      "foreground", "Foreground");
-  gcv.background = get_pixel_resource(state->dpy, state->xgwa.colormap,
-                                      "background", "Background");
-  state->draw_gc = XCreateGC (state->dpy, state->window,
-                              GCForeground|GCBackground, &gcv);
-  gcv.foreground = gcv.background;
-  state->erase_gc = XCreateGC (state->dpy, state->window,
-                               GCForeground|GCBackground, &gcv);
-
-  state->scratch_gc = XCreateGC (state->dpy, state->window, 0, &gcv);
+  state->bg_pixel = get_pixel_resource(state->dpy, state->xgwa.colormap,
+                                       "background", "Background");
 
   /* Allocate colors for SYSTEM FAILURE box */
   {
@@ -664,13 +718,24 @@ xmatrix_init (Display *dpy, Window window)
       if (XAllocColor (state->dpy, state->xgwa.colormap, &boxcolors[i]))
         state->colors[i] = boxcolors[i].pixel;
       else
-        state->colors[i] = gcv.foreground;  /* default black */
+        state->colors[i] = state->bg_pixel;  /* default black */
     }
   }
 
   state->char_width =  state->image_width  / CHAR_COLS;
   state->char_height = state->image_height / CHAR_ROWS;
 
+  state->ci = cellimage_new (dpy, window,
+                             state->char_width, state->char_height,
+                             CHAR_MAPS * CHAR_COLS * CHAR_ROWS, CHAR_MAPS,
+                             state->bg_pixel);
+  if (!state->ci)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      exit (1);
+    }
+  load_glyphs (state);
+
   state->grid_width  = state->xgwa.width  / state->char_width;
   state->grid_height = state->xgwa.height / state->char_height;
   state->grid_width++;
@@ -1055,27 +1120,23 @@ redraw_cells (m_state *state, Bool active)
 
 
         if (cell->glyph == 0 && !cursor_p && !use_back_p)
-          XFillRectangle (state->dpy, state->window, state->erase_gc,
+          cellimage_fill (state->ci,
                           (x + state->left_margin) * state->char_width,
                           (y + state->top_margin)  * state->char_height,
                           state->char_width,
-                          state->char_height);
+                          state->char_height,
+                          state->bg_pixel);
         else
           {
             int g = (cursor_p ? CURSOR_GLYPH : cell->glyph);
-            int cx = (g - 1) % CHAR_COLS;
-            int cy = (g - 1) / CHAR_COLS;
             int map = ((cell->glow != 0 || cell->spinner) ? GLOW_MAP :
                        PLAIN_MAP);
 
-            XCopyArea (state->dpy, state->images[map],
-                       state->window, state->draw_gc,
-                       cx * state->char_width,
-                       cy * state->char_height,
-                       state->char_width,
-                       state->char_height,
-                       (x + state->left_margin) * state->char_width,
-                       (y + state->top_margin)  * state->char_height);
+            cellimage_draw (state->ci,
+                            (x + state->left_margin) * state->char_width,
+                            (y + state->top_margin)  * state->char_height,
+                            map * CHAR_COLS * CHAR_ROWS + (g - 1),
+                            map);
           }
         if (!use_back_p)
         cell->changed = 0;
@@ -1094,6 +1155,8 @@ redraw_cells (m_state *state, Bool active)
             cell->changed = 1;
           }
       }
+
+  cellimage_put (state->ci, False);
 }
 
 
@@ -1178,22 +1241,25 @@ hack_text (m_state *state)
             cx += state->left_margin;
             cy += state->top_margin;
 
-            XFillRectangle (state->dpy, state->window, state->erase_gc,
+            cellimage_fill (state->ci,
                             cx * state->char_width,
                             cy * state->char_height,
                             strlen(s) * state->char_width,
-                            state->char_height * 1.6);
+                            state->char_height * 1.6,
+                            state->bg_pixel);
 
+            /* Outlines, as XDrawRectangle would draw them. */
             for (i = -2; i < 3; i++)
               {
-                XGCValues gcv;
-                gcv.foreground = state->colors[i + 2];
-                XChangeGC (state->dpy, state->scratch_gc, GCForeground, &gcv);
-                XDrawRectangle (state->dpy, state->window, state->scratch_gc,
-                                cx * state->char_width - i,
-                                cy * state->char_height - i,
-                                strlen(s) * state->char_width + (2 * i),
-                                (state->char_height * 1.6) + (2 * i));
+                unsigned long p = state->colors[i + 2];
+                int bx = cx * state->char_width - i;
+                int by = cy * state->char_height - i;
+                int bw = strlen(s) * state->char_width + (2 * i);
+                int bh = (state->char_height * 1.6) + (2 * i);
+                cellimage_fill (state->ci, bx,      by,      bw + 1, 1, p);
+                cellimage_fill (state->ci, bx,      by + bh, bw + 1, 1, p);
+                cellimage_fill (state->ci, bx,      by,      1, bh + 1, p);
+                cellimage_fill (state->ci, bx + bw, by,      1, bh + 1, p);
               }
 
             /* If we don't clear these, part of the box may get overwritten */
@@ -1684,6 +1750,7 @@ xmatrix_reshape (Display *dpy, Window window, void *closure,
   int ow = state->grid_width;
   int oh = state->grid_height;
   XGetWindowAttributes (state->dpy, state->window, &state->xgwa);
+  cellimage_resize (state->ci);
   state->grid_width  = state->xgwa.width  / state->char_width;
   state->grid_height = state->xgwa.height / state->char_height;
   state->grid_width++;
@@ -1751,6 +1818,7 @@ xmatrix_reshape (Display *dpy, Window window, void *closure,
       state->feeders = nfeeders;
 
       XClearWindow (dpy, window);
+      cellimage_clear (state->ci);
     }
 
   if (state->tc)
@@ -1767,6 +1835,12 @@ xmatrix_event (Display *dpy, Window window, void *closure, XEvent *event)
 {
   m_state *state = (m_state *) closure;
 
+ if (event->xany.type == Expose)
+   {
+     cellimage_put (state->ci, True);
+     return True;
+   }
+
  if (event->xany.type == KeyPress)
    {
      KeySym keysym;
@@ -1851,15 +1925,13 @@ xmatrix_free (Display *dpy, Window window, void *closure)
     textclient_close (state->tc);
   if (state->cursor_timer)
     XtRemoveTimeOut (state->cursor_timer);
-  XFreeGC (dpy, state->draw_gc);
-  XFreeGC (dpy, state->erase_gc);
-  XFreeGC (dpy, state->scratch_gc);
   free (state->cells);
   free (state->background);
   free (state->feeders);
   if (state->tracing) free (state->tracing);
   for (i = 0; i < CHAR_MAPS; i++)
-    if (state->images[i]) XFreePixmap (dpy, state->images[i]);
+    free (state->images[i]);
+  cellimage_free (state->ci);
   free (state);
 }
 
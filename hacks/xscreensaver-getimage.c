@@ -78,12 +78,14 @@
 #include "yarandom.h"
 #include "grabclient.h"
 #include "screenshot.h"
+#include "imagecache.h"
 #include "resources.h"
 #include "colors.h"
 #include "colorbars.h"
 #include "visual.h"
 #include "xmu.h"
 #include "vroot.h"
+#include "imgfilter.h"
 #include "../driver/prefs.h"
 
 #include "../driver/blurb.c"	/* Eh, this is awful but so what */
@@ -340,10 +342,8 @@ colorbars (Screen *screen, Visual *visual, Drawable drawable, Colormap cmap,
 
 
 /* Scales an XImage, modifying it in place.
-   This doesn't do dithering or smoothing, so it might have artifacts.
    If out of memory, returns False, and the XImage will have been
    destroyed and freed.
-   #### Maybe convert the XImage to a GdkImage and use GDK's scaler.
  */
 static Bool
 scale_ximage (Screen *screen, Visual *visual,
@@ -351,15 +351,14 @@ scale_ximage (Screen *screen, Visual *visual,
 {
   Display *dpy = DisplayOfScreen (screen);
   int depth = visual_depth (screen, visual);
-  int x, y;
-  double xscale, yscale;
 
   XImage *ximage2 = XCreateImage (dpy, visual, depth,
                                   ZPixmap, 0, 0,
                                   new_width, new_height, 8, 0);
   ximage2->data = (char *) calloc (ximage2->height, ximage2->bytes_per_line);
 
-  if (!ximage2->data)
+  if (!ximage2->data ||
+      !imgfilter_scale_ximage (ximage, ximage2, 0))
     {
       fprintf (stderr, "%s: out of memory scaling %dx%d image to %dx%d\n",
                blurb(),
@@ -374,14 +373,6 @@ scale_ximage (Screen *screen, Visual *visual,
       return False;
     }
 
-  /* Brute force scaling... */
-  xscale = (double) ximage->width  / ximage2->width;
-  yscale = (double) ximage->height / ximage2->height;
-  for (y = 0; y < ximage2->height; y++)
-    for (x = 0; x < ximage2->width; x++)
-      XPutPixel (ximage2, x, y,
-                 XGetPixel (ximage, x * xscale, y * yscale));
-
   free (ximage->data);
   ximage->data = 0;
 
@@ -404,12 +395,13 @@ read_file_gdk (Screen *screen, Window window, Drawable drawable,
                const char *filename, Bool verbose_p,
                XRectangle *geom_ret)
 {
-  GdkPixbuf *pb;
+  GdkPixbuf *pb = 0;
   Display *dpy = DisplayOfScreen (screen);
   unsigned int win_width, win_height, win_depth;
   XGCValues gcv;
   GC gc;
   GError *gerr = 0;
+  XRectangle geom;
 
   /* Find the size of the Drawable. */
   {
@@ -431,7 +423,36 @@ read_file_gdk (Screen *screen, Window window, Drawable drawable,
   g_type_init();
 # endif
 
-  pb = gdk_pixbuf_new_from_file (filename, &gerr);
+  /* If the image is much bigger than the window, have the loader shrink it
+     while decoding (for JPEG, that's done in the IDCT) instead of decoding
+     it at full size and then scaling it down.  Ask for a square so that
+     there's enough left however the embedded orientation turns it. */
+  {
+    int fw = 0, fh = 0;
+    if (gdk_pixbuf_get_file_info (filename, &fw, &fh) && fw > 0 && fh > 0)
+      {
+        int sx, sy, dx, dy, w2, h2, m;
+        compute_image_scaling (fw, fh, win_width, win_height, False,
+                               &sx, &sy, &dx, &dy, &w2, &h2);
+        m = (w2 > h2 ? w2 : h2);
+        if (m > 0 && m * 2 <= (fw > fh ? fw : fh))
+          {
+            if (verbose_p)
+              fprintf (stderr, "%s: loading %dx%d at %dx%d\n",
+                       blurb(), fw, fh, m, m);
+            pb = gdk_pixbuf_new_from_file_at_scale (filename, m, m, TRUE,
+                                                    &gerr);
+          }
+      }
+  }
+
+  if (!pb && gerr)
+    {
+      g_error_free (gerr);
+      gerr = 0;
+    }
+  if (!pb)
+    pb = gdk_pixbuf_new_from_file (filename, &gerr);
 
   if (!pb)
     {
@@ -480,6 +501,11 @@ read_file_gdk (Screen *screen, Window window, Drawable drawable,
       if (srcx > 0) w -= srcx;
       if (srcy > 0) h -= srcy;
 
+      geom.x = destx;
+      geom.y = desty;
+      geom.width  = w;
+      geom.height = h;
+
       gcv.foreground = BlackPixelOfScreen (screen);
       gc = XCreateGC (dpy, drawable, GCForeground, &gcv);
 
@@ -554,6 +580,10 @@ read_file_gdk (Screen *screen, Window window, Drawable drawable,
           XFillRectangle (dpy, drawable, gc, 0, 0, win_width, win_height);
 
         XPutImage (dpy, drawable, gc, image, srcx, srcy, destx, desty, w, h);
+        if (visual_class (screen, xgwa.visual) == TrueColor)
+          image_cache_save (screen, xgwa.visual, filename,
+                            win_width, win_height, image, srcx, srcy,
+                            &geom, verbose_p);
         XDestroyImage (image);
       }
 # endif /* !HAVE_GDK_PIXBUF_XLIB */
@@ -561,12 +591,7 @@ read_file_gdk (Screen *screen, Window window, Drawable drawable,
       XFreeGC (dpy, gc);
 
       if (geom_ret)
-        {
-          geom_ret->x = destx;
-          geom_ret->y = desty;
-          geom_ret->width  = w;
-          geom_ret->height = h;
-        }
+        *geom_ret = geom;
     }
 
   return True;
@@ -794,11 +819,62 @@ jpg_error_exit (j_common_ptr cinfo)
 }
 
 
-/* Reads a JPEG file, returns an RGB XImage of it.
+/* Packs 8-bit RGB into the pixel layout that read_jpeg_ximage uses for
+   each depth.  For PseudoColor, remap_image() fixes it up afterward. */
+static unsigned long
+jpeg_rgb_pixel (int depth, unsigned char r, unsigned char g, unsigned char b)
+{
+  if (depth > 16)
+    return (r << 16) | (g << 8) | b;
+  else if (depth == 8)
+    return ((r >> 5) | ((g >> 5) << 3) | ((b >> 6) << 6));
+  else if (depth == 12)
+    return ((r >> 4) | ((g >> 4) << 4) | ((b >> 4) << 8));
+  else if (depth == 15)
+    /* Gah! I don't understand why these are in the other order. */
+    return (((r >> 3) << 10) | ((g >> 3) << 5) | ((b >> 3)));
+  else if (depth == 16)
+    return (((r >> 3) << 11) | ((g >> 2) << 5) | ((b >> 3)));
+  else
+    abort();
+}
+
+
+/* Packs rows of the RGB output of the scaler into the XImage.
+ */
+typedef struct {
+  XImage *ximage;
+  int depth;
+  const unsigned char *band;	/* RGB of row y0 */
+  int y0;
+} jpeg_pack_closure;
+
+static void
+jpeg_pack_rows (void *closure, int ya, int yb)
+{
+  jpeg_pack_closure *c = (jpeg_pack_closure *) closure;
+  int x, y;
+  /* Distinct rows of a ZPixmap don't share memory, so XPutPixel from
+     several threads at once is fine. */
+  for (y = ya; y < yb; y++)
+    {
+      const unsigned char *p = c->band + y * c->ximage->width * 3;
+      for (x = 0; x < c->ximage->width; x++, p += 3)
+        XPutPixel (c->ximage, x, c->y0 + y,
+                   jpeg_rgb_pixel (c->depth, p[0], p[1], p[2]));
+    }
+}
+
+
+/* Reads a JPEG file, returns an RGB XImage of it, scaled and positioned to
+   fit a win_width x win_height drawable as per compute_image_scaling().
  */
 static XImage *
 read_jpeg_ximage (Screen *screen, Visual *visual, Drawable drawable,
-                  Colormap cmap, const char *filename, Bool verbose_p)
+                  Colormap cmap, const char *filename,
+                  int win_width, int win_height,
+                  int *srcx, int *srcy, int *destx, int *desty,
+                  Bool verbose_p)
 {
   Display *dpy = DisplayOfScreen (screen);
   int depth = visual_depth (screen, visual);
@@ -807,8 +883,19 @@ read_jpeg_ximage (Screen *screen, Visual *visual, Drawable drawable,
   XImage *ximage = 0;
   struct jpeg_decompress_struct cinfo;
   getimg_jpg_error_mgr jerr;
-  JSAMPARRAY scanbuf = 0;
-  int y;
+  imgfilter_scaler *scaler = 0;
+  imgfilter_threads *threads = 0;
+  jpeg_pack_closure pack;
+
+  /* Source scanlines rows_first ... rows_first + rows_count - 1. */
+  unsigned char *rows = 0;
+  int rows_first = 0, rows_count = 0, rows_size = 0;
+
+  /* RGB of the output rows of the current band. */
+  unsigned char *band = 0;
+  const int band_rows = 64;
+
+  int w2, h2, denom, y, stride;
 
   jerr.filename = filename;
   jerr.screen = screen;
@@ -837,68 +924,127 @@ read_jpeg_ximage (Screen *screen, Visual *visual, Drawable drawable,
   jpeg_stdio_src (&cinfo, in);
   jpeg_read_header (&cinfo, TRUE);
 
+  compute_image_scaling (cinfo.image_width, cinfo.image_height,
+                         win_width, win_height, verbose_p,
+                         srcx, srcy, destx, desty, &w2, &h2);
+  if (w2 < 1) w2 = 1;
+  if (h2 < 1) h2 = 1;
+
+  /* Let the IDCT do the bulk of the shrinking: pick the largest 1/N that
+     still leaves at least as many pixels as we need. */
+  for (denom = 8; denom > 1; denom /= 2)
+    if ((cinfo.image_width  + denom - 1) / denom >= w2 &&
+        (cinfo.image_height + denom - 1) / denom >= h2)
+      break;
+
   /* set some decode parameters */
   cinfo.out_color_space = JCS_RGB;
   cinfo.quantize_colors = FALSE;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
 
   jpeg_start_decompress (&cinfo);
 
-  ximage = XCreateImage (dpy, visual, depth, ZPixmap, 0, 0,
-                         cinfo.output_width, cinfo.output_height,
-                         8, 0);
+  if (verbose_p && denom > 1)
+    fprintf (stderr, "%s: decoding %dx%d at 1/%d: %dx%d\n", blurb(),
+             cinfo.image_width, cinfo.image_height, denom,
+             cinfo.output_width, cinfo.output_height);
+
+  ximage = XCreateImage (dpy, visual, depth, ZPixmap, 0, 0, w2, h2, 8, 0);
   if (ximage)
     ximage->data = (char *) calloc (ximage->height, ximage->bytes_per_line);
-
-  if (ximage && ximage->data)
-    scanbuf = (*cinfo.mem->alloc_sarray) ((j_common_ptr) &cinfo, JPOOL_IMAGE,
-                                          cinfo.rec_outbuf_height *
-                                          cinfo.output_width *
-                                          cinfo.output_components,
-                                          1);
-  if (!ximage || !ximage->data || !scanbuf)
+  if (!ximage || !ximage->data)
     {
       fprintf (stderr, "%s: out of memory loading %dx%d file %s\n",
-               blurb(), ximage->width, ximage->height, filename);
+               blurb(), w2, h2, filename);
       goto FAIL;
     }
 
-  y = 0;
-  while (cinfo.output_scanline < cinfo.output_height)
+  stride = cinfo.output_width * 3;
+  scaler = imgfilter_scaler_new (cinfo.output_width, cinfo.output_height,
+                                 w2, h2, 3);
+  band = (unsigned char *) malloc (band_rows * w2 * 3);
+  if (!scaler || !band)
     {
-      int n = jpeg_read_scanlines (&cinfo, scanbuf, 1);
-      int i;
-      for (i = 0; i < n; i++)
+      fprintf (stderr, "%s: out of memory scaling %s\n", blurb(), filename);
+      goto FAIL;
+    }
+
+  threads = imgfilter_threads_new (dpy);  /* NULL is fine */
+
+  pack.ximage = ximage;
+  pack.depth = depth;
+  pack.band = band;
+
+  /* Do the output in bands, holding onto only the source rows that each
+     band needs.
+   */
+  for (y = 0; y < h2; )
+    {
+      int y1 = y + band_rows;
+      int need0, need1;
+      if (y1 > h2) y1 = h2;
+
+      imgfilter_scaler_rows (scaler, y, y1, &need0, &need1);
+
+      /* Keep the rows that overlap with the previous band. */
+      if (rows_count && need0 > rows_first)
         {
-          int x;
-          for (x = 0; x < ximage->width; x++)
+          int keep = rows_first + rows_count - need0;
+          if (keep < 0) keep = 0;
+          memmove (rows, rows + (rows_count - keep) * stride, keep * stride);
+          rows_count = keep;
+        }
+      rows_first = need0;
+
+      if (need1 - need0 > rows_size)
+        {
+          rows_size = need1 - need0;
+          rows = (unsigned char *) realloc (rows, rows_size * stride);
+          if (!rows)
             {
-              int j = x * cinfo.output_components;
-              unsigned char r = scanbuf[i][j];
-              unsigned char g = scanbuf[i][j+1];
-              unsigned char b = scanbuf[i][j+2];
-              unsigned long pixel;
-
-              if (depth > 16)
-                pixel = (r << 16) | (g << 8) | b;
-              else if (depth == 8)
-                pixel = ((r >> 5) | ((g >> 5) << 3) | ((b >> 6) << 6));
-              else if (depth == 12)
-                pixel = ((r >> 4) | ((g >> 4) << 4) | ((b >> 4) << 8));
-              else if (depth == 15)
-                /* Gah! I don't understand why these are in the other
-                   order. */
-                pixel = (((r >> 3) << 10) | ((g >> 3) << 5) | ((b >> 3)));
-              else if (depth == 16)
-                pixel = (((r >> 3) << 11) | ((g >> 2) << 5) | ((b >> 3)));
-              else
-                abort();
+              fprintf (stderr, "%s: out of memory loading %s\n",
+                       blurb(), filename);
+              goto FAIL;
+            }
+        }
 
-              XPutPixel (ximage, x, y, pixel);
+      while (rows_first + rows_count < need1)
+        {
+          JSAMPROW row = rows + rows_count * stride;
+          if (cinfo.output_scanline >= cinfo.output_height)
+            {
+              /* Truncated file: repeat the last row, if we still have
+                 it, else fill with black. */
+              if (rows_count > 0)
+                memcpy (row, row - stride, stride);
+              else
+                memset (row, 0, stride);
             }
-          y++;
+          else if (jpeg_read_scanlines (&cinfo, &row, 1) != 1)
+            break;
+          rows_count++;
         }
+
+      if (! imgfilter_scaler_run (scaler, rows, stride, rows_first,
+                                  band, w2 * 3, y, y1, threads))
+        {
+          fprintf (stderr, "%s: out of memory scaling %s\n",
+                   blurb(), filename);
+          goto FAIL;
+        }
+
+      pack.y0 = y;
+      if (threads)
+        threads->stripe (threads, jpeg_pack_rows, &pack, y1 - y);
+      else
+        jpeg_pack_rows (&pack, 0, y1 - y);
+      y = y1;
     }
 
+  imgfilter_threads_free (threads);
+  threads = 0;
+
   if (cinfo.output_scanline < cinfo.output_height)
     /* don't goto FAIL -- we might have viewable partial data. */
     jpeg_abort_decompress (&cinfo);
@@ -909,6 +1055,9 @@ read_jpeg_ximage (Screen *screen, Visual *visual, Drawable drawable,
   fclose (in);
   in = 0;
 
+  free (rows);
+  free (band);
+  imgfilter_scaler_free (scaler);
   return ximage;
 
  FAIL:
@@ -919,7 +1068,10 @@ read_jpeg_ximage (Screen *screen, Visual *visual, Drawable drawable,
       ximage->data = 0;
     }
   if (ximage) XDestroyImage (ximage);
-  if (scanbuf) free (scanbuf);
+  imgfilter_threads_free (threads);
+  if (rows) free (rows);
+  if (band) free (band);
+  imgfilter_scaler_free (scaler);
   return 0;
 }
 
@@ -938,9 +1090,10 @@ read_file_jpeglib (Screen *screen, Window window, Drawable drawable,
   int class, depth;
   Colormap cmap;
   unsigned int win_width, win_height, win_depth;
-  int srcx, srcy, destx, desty, w2, h2;
+  int srcx, srcy, destx, desty;
   GC gc;
   XGCValues gcv;
+  XRectangle geom;
 
   /* Find the size of the Drawable, and the Visual/Colormap of the Window. */
   {
@@ -967,20 +1120,17 @@ read_file_jpeglib (Screen *screen, Window window, Drawable drawable,
       return False;
     }
 
-  /* Read the file...
+  /* Read the file, scaling it as we go...
    */
-  ximage = read_jpeg_ximage (screen, visual, drawable, cmap,
-                             filename, verbose_p);
+  ximage = read_jpeg_ximage (screen, visual, drawable, cmap, filename,
+                             win_width, win_height,
+                             &srcx, &srcy, &destx, &desty, verbose_p);
   if (!ximage) return False;
 
-  /* Scale it, if necessary...
-   */
-  compute_image_scaling (ximage->width, ximage->height,
-                         win_width, win_height, verbose_p,
-                         &srcx, &srcy, &destx, &desty, &w2, &h2);
-  if (ximage->width != w2 || ximage->height != h2)
-    if (! scale_ximage (screen, visual, ximage, w2, h2))
-      return False;
+  geom.x = destx;
+  geom.y = desty;
+  geom.width  = ximage->width;
+  geom.height = ximage->height;
 
   /* Allocate a colormap, if we need to...
    */
@@ -989,6 +1139,9 @@ read_file_jpeglib (Screen *screen, Window window, Drawable drawable,
       allocate_cubic_colormap (screen, visual, cmap, verbose_p);
       remap_image (screen, cmap, ximage, verbose_p);
     }
+  else if (class == TrueColor)
+    image_cache_save (screen, visual, filename, win_width, win_height,
+                      ximage, srcx, srcy, &geom, verbose_p);
 
   /* Finally, put the resized image on the drawable.
    */
@@ -1001,12 +1154,7 @@ read_file_jpeglib (Screen *screen, Window window, Drawable drawable,
   XFreeGC (dpy, gc);
 
   if (geom_ret)
-    {
-      geom_ret->x = destx;
-      geom_ret->y = desty;
-      geom_ret->width  = ximage->width;
-      geom_ret->height = ximage->height;
-    }
+    *geom_ret = geom;
 
   free (ximage->data);
   ximage->data = 0;
@@ -1017,6 +1165,55 @@ read_file_jpeglib (Screen *screen, Window window, Drawable drawable,
 #endif /* HAVE_JPEGLIB */
 
 
+/* If the given image file has already been decoded and scaled to the size
+   of this Drawable, renders it from the image cache.  Returns False if not.
+ */
+static Bool
+display_cached_file (Screen *screen, Window window, Drawable drawable,
+                     const char *filename, Bool verbose_p,
+                     XRectangle *geom_ret)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  XWindowAttributes xgwa;
+  unsigned int win_width, win_height, win_depth;
+  int srcx, srcy;
+  XRectangle geom;
+  XImage *ximage;
+  XGCValues gcv;
+  GC gc;
+
+  XGetWindowAttributes (dpy, window, &xgwa);
+  if (visual_class (screen, xgwa.visual) != TrueColor)
+    return False;
+
+  {
+    Window root;
+    int x, y;
+    unsigned int bw;
+    XGetGeometry (dpy, drawable,
+                  &root, &x, &y, &win_width, &win_height, &bw, &win_depth);
+  }
+
+  ximage = image_cache_load (screen, xgwa.visual, filename,
+                             win_width, win_height, &srcx, &srcy, &geom,
+                             verbose_p);
+  if (!ximage) return False;
+
+  gcv.foreground = BlackPixelOfScreen (screen);
+  gc = XCreateGC (dpy, drawable, GCForeground, &gcv);
+  if (geom.width != win_width || geom.height != win_height)
+    XFillRectangle (dpy, drawable, gc, 0, 0, win_width, win_height);
+  XPutImage (dpy, drawable, gc, ximage,
+             srcx, srcy, geom.x, geom.y, ximage->width, ximage->height);
+  XFreeGC (dpy, gc);
+  image_cache_free (ximage);
+
+  if (geom_ret)
+    *geom_ret = geom;
+  return True;
+}
+
+
 /* Reads the given image file and renders it on the Drawable.
    Returns False if it fails.
  */
@@ -1028,6 +1225,10 @@ display_file (Screen *screen, Window window, Drawable drawable,
   if (verbose_p)
     fprintf (stderr, "%s: loading \"%s\"\n", blurb(), filename);
 
+  if (display_cached_file (screen, window, drawable, filename, verbose_p,
+                           geom_ret))
+    return True;
+
 # if defined(HAVE_GDK_PIXBUF)
   if (read_file_gdk (screen, window, drawable, filename, verbose_p, geom_ret))
     return True;
@@ -2152,6 +2353,7 @@ mapper (XrmDatabase *db, XrmBindingList bindings, XrmQuarkList quarks,
    "      --images  / --no-images     whether to allow image file loading\n"  \
    "      --video   / --no-video      whether to allow video grabs\n"	      \
    "      --desktop / --no-desktop    whether to allow desktop screen grabs\n"\
+   "      --threads / --no-threads    whether to scale images on all CPUs\n"  \
    "      --directory <path>          where to find image files to load\n"    \
    "      --file <filename>           load this image file\n"                 \
    "\n"									      \
@@ -2177,6 +2379,8 @@ main (int argc, char **argv)
   int i;
 
   Bool verbose_p, grab_desktop_p, grab_video_p, random_image_p;
+  char *xs_threads;
+  const char *threads_arg = 0;
   char *image_directory;
 
   progname = argv[0];
@@ -2231,6 +2435,7 @@ main (int argc, char **argv)
   grab_video_p    = get_boolean_resource(dpy, "grabVideoFrames", "Boolean");
   random_image_p  = get_boolean_resource(dpy, "chooseRandomImages", "Boolean");
   image_directory = get_string_resource (dpy, "imageDirectory", "String");
+  xs_threads      = get_string_resource (dpy, "useThreads", "Boolean");
 
   if (!strncmp (image_directory, "~/", 2))
     {
@@ -2265,6 +2470,8 @@ main (int argc, char **argv)
       else if (!strcmp (argv[i], "-no-video"))   grab_video_p = False;
       else if (!strcmp (argv[i], "-images"))     random_image_p = True;
       else if (!strcmp (argv[i], "-no-images"))  random_image_p = False;
+      else if (!strcmp (argv[i], "-threads"))    threads_arg = "True";
+      else if (!strcmp (argv[i], "-no-threads")) threads_arg = "False";
       else if (!strcmp (argv[i], "-file"))       file = argv[++i];
       else if (!strcmp (argv[i], "-directory") || !strcmp (argv[i], "-dir"))
         image_directory = argv[++i];
@@ -2335,6 +2542,29 @@ main (int argc, char **argv)
       goto LOSE;
     }
 
+  /* The JPEG scaler runs on a threadpool, which only makes threads if
+     useThreads is set under our own name.  Use the command line if given,
+     else any setting that applies to us, else the one for xscreensaver,
+     else default it on, as the hacks do.
+   */
+  {
+    char *s2 = get_string_resource (dpy, "useThreads", "Boolean");
+    const char *v = (threads_arg ? threads_arg :
+                     s2 ? 0 :
+                     xs_threads ? xs_threads :
+                     "True");
+    if (v)
+      {
+        XrmDatabase db = XtDatabase (dpy);
+        char *key = (char *) malloc (strlen (progname) + 20);
+        sprintf (key, "%s.useThreads", progname);
+        XrmPutStringResource (&db, key, v);
+        free (key);
+      }
+    if (s2) free (s2);
+    if (xs_threads) free (xs_threads);
+  }
+
 
 #ifdef DEBUG
   if (verbose_p)       /* Print out all the resources we can see. */
@@ -0,0 +1,391 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * Density histograms of plotted points, tone-mapped onto the window.
+ * See accumimage.h.
+ */
+
+#include "utils.h"
+#include "accumimage.h"
+#include "thread_util.h"
+#include "xshm.h"
+#include <errno.h>
+#include <math.h>
+
+#undef MIN
+#undef MAX
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+
+/* Each thread has up to 16 bytes per pixel of its own, so on a big screen
+   with many CPUs, use fewer threads rather than eat all of memory. */
+#define MAX_BUFFER_BYTES (128L * 1024 * 1024)
+
+/* Gamma applied to the log density, to lift the faint parts. */
+#define GAMMA 2.2
+#define GAMMA_STEPS 1024
+
+enum { PLOT, MERGE, TONE };
+
+typedef struct {
+  struct accumimage *parent;
+  unsigned id;
+} accumimage_thread;
+
+struct accumimage {
+  Display *dpy;
+  Window window;
+  GC gc;
+  XImage *image;
+  XShmSegmentInfo shm_info;
+  int width, height;
+
+  int ncolors;
+  unsigned long *pixels;	/* from the caller's colors */
+  unsigned char (*rgb)[3];	/* the same, as bytes */
+  unsigned long background;
+  unsigned char bg_rgb[3];
+  Bool true_color;
+  unsigned long channel[3][256];	/* byte to pixel bits, per channel */
+  unsigned char gamma[GAMMA_STEPS + 1];	/* 0-1 to 0-255 */
+
+  float *counts, *sums;		/* the sum of all threads' hits */
+  unsigned int *last;		/* on visuals without color masks */
+  float max;
+
+  struct threadpool pool;
+  accumimage_buffer *buffers;	/* one per thread */
+  float *band_max;		/* the busiest pixel in each thread's rows */
+  int phase;
+  accumimage_fn fn;
+  void *closure;
+};
+
+
+/* Adds up every thread's hits on rows y0 ... y1-1, and clears them. */
+static void
+merge_rows (accumimage *ai, unsigned id, int y0, int y1)
+{
+  long i0 = (long) y0 * ai->width, i1 = (long) y1 * ai->width;
+  float max = 0;
+  unsigned b;
+  long i;
+
+  for (b = 0; b < ai->pool.count; b++)
+    {
+      unsigned int *counts = ai->buffers[b].counts;
+      unsigned int *sums = ai->buffers[b].sums;
+      unsigned int *last = ai->buffers[b].last;
+      if (sums)
+        {
+          for (i = i0; i < i1; i++)
+            {
+              ai->counts[i] += counts[i];
+              ai->sums[3*i]   += sums[3*i];
+              ai->sums[3*i+1] += sums[3*i+1];
+              ai->sums[3*i+2] += sums[3*i+2];
+            }
+          memset (sums + 3*i0, 0, 3 * (i1 - i0) * sizeof(*sums));
+        }
+      else
+        for (i = i0; i < i1; i++)
+          if (counts[i])
+            {
+              ai->counts[i] += counts[i];
+              ai->last[i] = last[i];
+            }
+      memset (counts + i0, 0, (i1 - i0) * sizeof(*counts));
+    }
+
+  for (i = i0; i < i1; i++)
+    max = MAX (max, ai->counts[i]);
+  ai->band_max[id] = max;
+}
+
+
+static void
+tone_rows (accumimage *ai, int y0, int y1)
+{
+  double scale = ai->max > 0 ? GAMMA_STEPS / log1p (ai->max) : 0;
+  int x, y;
+
+  for (y = y0; y < y1; y++)
+    {
+      long row = (long) y * ai->width;
+      const float *counts = ai->counts + row;
+      for (x = 0; x < ai->width; x++)
+        {
+          unsigned long p = ai->background;
+          float n = counts[x];
+          if (n > 0)
+            {
+              if (ai->true_color)
+                {
+                  const float *sum = ai->sums + 3 * (row + x);
+                  int a = ai->gamma[MIN (GAMMA_STEPS,
+                                         (int) (log1p (n) * scale))];
+                  int fg[3], i;
+                  const unsigned char *bg = ai->bg_rgb;
+                  for (i = 0; i < 3; i++)
+                    fg[i] = MIN (255, (int) (sum[i] / n + 0.5));
+                  p = (ai->channel[0][bg[0] + (fg[0] - bg[0]) * a / 255] |
+                       ai->channel[1][bg[1] + (fg[1] - bg[1]) * a / 255] |
+                       ai->channel[2][bg[2] + (fg[2] - bg[2]) * a / 255]);
+                }
+              else
+                p = ai->pixels[MIN ((int) ai->last[row + x], ai->ncolors - 1)];
+            }
+          XPutPixel (ai->image, x, y, p);
+        }
+    }
+}
+
+
+static void
+accumimage_thread_run (void *self)
+{
+  accumimage_thread *t = (accumimage_thread *) self;
+  accumimage *ai = t->parent;
+  int y0 = (int) ((long) ai->height * t->id       / ai->pool.count);
+  int y1 = (int) ((long) ai->height * (t->id + 1) / ai->pool.count);
+
+  switch (ai->phase) {
+  case PLOT:
+    ai->fn (ai->closure, &ai->buffers[t->id], t->id, ai->pool.count);
+    break;
+  case MERGE:
+    merge_rows (ai, t->id, y0, y1);
+    break;
+  case TONE:
+    tone_rows (ai, y0, y1);
+    break;
+  }
+}
+
+
+static int
+accumimage_thread_create (void *self, struct threadpool *pool, unsigned id)
+{
+  accumimage_thread *t = (accumimage_thread *) self;
+  accumimage *ai = GET_PARENT_OBJ (accumimage, pool, pool);
+  accumimage_buffer *b = &ai->buffers[id];
+  long size = (long) ai->width * ai->height;
+  t->parent = ai;
+  t->id = id;
+  b->width  = ai->width;
+  b->height = ai->height;
+  b->rgb    = (const unsigned char (*)[3]) ai->rgb;
+  b->counts = (unsigned int *) calloc (size, sizeof(*b->counts));
+  if (ai->true_color)
+    b->sums = (unsigned int *) calloc (size * 3, sizeof(*b->sums));
+  else
+    b->last = (unsigned int *) calloc (size, sizeof(*b->last));
+  if (b->counts && (b->sums || b->last))
+    return 0;
+  free (b->counts);
+  free (b->sums);
+  free (b->last);
+  return ENOMEM;
+}
+
+
+static void
+accumimage_thread_destroy (void *self)
+{
+  accumimage_thread *t = (accumimage_thread *) self;
+  accumimage_buffer *b = &t->parent->buffers[t->id];
+  free (b->counts);
+  free (b->sums);
+  free (b->last);
+}
+
+
+/* Fills a table from 8 bits to wherever this channel lives in a pixel. */
+static void
+channel_table (unsigned long *table, unsigned long mask)
+{
+  int shift = 0, bits = 0, i;
+  while (mask && !(mask & 1)) mask >>= 1, shift++;
+  while (mask & 1) mask >>= 1, bits++;
+  for (i = 0; i < 256; i++)
+    table[i] = ((((unsigned long) i * ((1UL << bits) - 1) + 127) / 255)
+                << shift);
+}
+
+
+accumimage *
+accumimage_new (Display *dpy, Window window,
+                const XColor *colors, int ncolors,
+                unsigned long background)
+{
+  static const struct threadpool_class cls = {
+    sizeof(accumimage_thread),
+    accumimage_thread_create,
+    accumimage_thread_destroy
+  };
+  XWindowAttributes xgwa;
+  XGCValues gcv;
+  XColor bg;
+  unsigned nthreads;
+  long size;
+  int i;
+  accumimage *ai = (accumimage *) calloc (1, sizeof(*ai));
+  if (!ai) return 0;
+
+  XGetWindowAttributes (dpy, window, &xgwa);
+  ai->dpy = dpy;
+  ai->window = window;
+  ai->width  = MAX (1, xgwa.width);
+  ai->height = MAX (1, xgwa.height);
+  size = (long) ai->width * ai->height;
+
+  ai->ncolors = MAX (1, ncolors);
+  ai->pixels = (unsigned long *) calloc (ai->ncolors, sizeof(*ai->pixels));
+  ai->rgb = (unsigned char (*)[3]) calloc (ai->ncolors, sizeof(*ai->rgb));
+  ai->counts = (float *) calloc (size, sizeof(*ai->counts));
+  if (!ai->pixels || !ai->rgb || !ai->counts)
+    goto FAIL;
+
+  for (i = 0; i < ncolors; i++)
+    {
+      ai->pixels[i] = colors[i].pixel;
+      ai->rgb[i][0] = colors[i].red   >> 8;
+      ai->rgb[i][1] = colors[i].green >> 8;
+      ai->rgb[i][2] = colors[i].blue  >> 8;
+    }
+  if (ncolors <= 0)
+    {
+      ai->pixels[0] = WhitePixelOfScreen (xgwa.screen);
+      ai->rgb[0][0] = ai->rgb[0][1] = ai->rgb[0][2] = 0xFF;
+    }
+
+  ai->background = background;
+  bg.pixel = background;
+  XQueryColor (dpy, xgwa.colormap, &bg);
+  ai->bg_rgb[0] = bg.red   >> 8;
+  ai->bg_rgb[1] = bg.green >> 8;
+  ai->bg_rgb[2] = bg.blue  >> 8;
+
+  for (i = 0; i <= GAMMA_STEPS; i++)
+    ai->gamma[i] = 255 * pow ((double) i / GAMMA_STEPS, 1 / GAMMA) + 0.5;
+
+  ai->image = create_xshm_image (dpy, xgwa.visual, xgwa.depth, ZPixmap,
+                                 &ai->shm_info, ai->width, ai->height);
+  if (!ai->image)
+    goto FAIL;
+
+  ai->true_color = (ai->image->red_mask && ai->image->green_mask &&
+                    ai->image->blue_mask);
+  if (ai->true_color)
+    {
+      channel_table (ai->channel[0], ai->image->red_mask);
+      channel_table (ai->channel[1], ai->image->green_mask);
+      channel_table (ai->channel[2], ai->image->blue_mask);
+      ai->sums = (float *) calloc (size * 3, sizeof(*ai->sums));
+    }
+  else
+    ai->last = (unsigned int *) calloc (size, sizeof(*ai->last));
+  if (!ai->sums && !ai->last)
+    {
+      destroy_xshm_image (dpy, ai->image, &ai->shm_info);
+      goto FAIL;
+    }
+
+  nthreads = hardware_concurrency (dpy);
+  nthreads = MIN (nthreads, MAX (1, MAX_BUFFER_BYTES /
+                                 (size * (ai->true_color ? 16 : 8))));
+  ai->buffers = (accumimage_buffer *)
+    calloc (nthreads, sizeof(*ai->buffers));
+  ai->band_max = (float *) calloc (nthreads, sizeof(*ai->band_max));
+  if (!ai->buffers || !ai->band_max ||
+      threadpool_create (&ai->pool, &cls, dpy, nthreads))
+    {
+      destroy_xshm_image (dpy, ai->image, &ai->shm_info);
+      goto FAIL;
+    }
+
+  ai->gc = XCreateGC (dpy, window, 0, &gcv);
+  return ai;
+
+ FAIL:
+  free (ai->buffers);
+  free (ai->band_max);
+  free (ai->pixels);
+  free (ai->rgb);
+  free (ai->counts);
+  free (ai->sums);
+  free (ai->last);
+  free (ai);
+  return 0;
+}
+
+
+void
+accumimage_free (accumimage *ai)
+{
+  if (!ai) return;
+  threadpool_destroy (&ai->pool);
+  destroy_xshm_image (ai->dpy, ai->image, &ai->shm_info);
+  XFreeGC (ai->dpy, ai->gc);
+  free (ai->buffers);
+  free (ai->band_max);
+  free (ai->pixels);
+  free (ai->rgb);
+  free (ai->counts);
+  free (ai->sums);
+  free (ai->last);
+  free (ai);
+}
+
+
+void
+accumimage_clear (accumimage *ai)
+{
+  long size = (long) ai->width * ai->height;
+  memset (ai->counts, 0, size * sizeof(*ai->counts));
+  if (ai->sums)
+    memset (ai->sums, 0, size * 3 * sizeof(*ai->sums));
+  ai->max = 0;
+}
+
+
+void
+accumimage_run (accumimage *ai, accumimage_fn fn, void *closure)
+{
+  unsigned i;
+
+  for (i = 0; i < ai->pool.count; i++)
+    ya_rand_state_init (&ai->buffers[i].rng, 0);
+
+  ai->fn = fn;
+  ai->closure = closure;
+  ai->phase = PLOT;
+  threadpool_run (&ai->pool, accumimage_thread_run);
+  threadpool_wait (&ai->pool);
+
+  ai->phase = MERGE;
+  threadpool_run (&ai->pool, accumimage_thread_run);
+  threadpool_wait (&ai->pool);
+
+  ai->max = 0;
+  for (i = 0; i < ai->pool.count; i++)
+    ai->max = MAX (ai->max, ai->band_max[i]);
+}
+
+
+void
+accumimage_draw (accumimage *ai)
+{
+  ai->phase = TONE;
+  threadpool_run (&ai->pool, accumimage_thread_run);
+  threadpool_wait (&ai->pool);
+  put_xshm_image (ai->dpy, ai->window, ai->gc, ai->image, 0, 0, 0, 0,
+                  ai->width, ai->height, &ai->shm_info);
+}
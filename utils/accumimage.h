@@ -0,0 +1,95 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+#ifndef __XSCREENSAVER_ACCUMIMAGE_H__
+#define __XSCREENSAVER_ACCUMIMAGE_H__
+
+#include "yarandom.h"
+
+/* A density histogram for hacks that throw millions of points at the
+   window, such as the chaos game of an iterated function system.
+
+   Rather than drawing each point, the caller's function counts hits per
+   pixel, along with the color of each hit.  It runs on every CPU at once,
+   each thread with its own counts and its own random number generator, and
+   the counts are summed when they have all finished.  Then the picture is
+   tone-mapped all at once: each pixel gets the average RGB of its hits,
+   scaled by the log of how many there were relative to the busiest pixel,
+   so that sparse wisps and dense cores both show up.  That is the look of
+   Scott Draves's "Fractal Flames".
+
+   It is the colors that are averaged, not their indexes: colormaps are
+   often cyclic, and the index halfway between two hits can be a color
+   that neither of them had.
+
+   On visuals without color masks, pixels are just on or off, in the color
+   of the last hit.
+ */
+
+typedef struct accumimage accumimage;
+
+/* One thread's share.  Plot into it with ACCUMIMAGE_PLOT. */
+typedef struct {
+  int width, height;
+  const unsigned char (*rgb)[3];	/* the caller's colors, as bytes */
+  unsigned int *counts;		/* hits per pixel */
+  unsigned int *sums;		/* red, green and blue of those hits, summed */
+  unsigned int *last;		/* or the last color index, if no sums */
+  ya_rand_state rng;		/* for accumimage_random */
+} accumimage_buffer;
+
+/* C is an index into the colors given to accumimage_new. */
+#define ACCUMIMAGE_PLOT(B,X,Y,C) do {					\
+    accumimage_buffer *_b = (B);					\
+    int _x = (X), _y = (Y);						\
+    if ((unsigned) _x < (unsigned) _b->width &&				\
+        (unsigned) _y < (unsigned) _b->height) {			\
+      long _i = (long) _y * _b->width + _x;				\
+      int _c = (C);							\
+      _b->counts[_i]++;							\
+      if (_b->sums) {							\
+        unsigned int *_s = _b->sums + 3 * _i;				\
+        _s[0] += _b->rgb[_c][0];					\
+        _s[1] += _b->rgb[_c][1];					\
+        _s[2] += _b->rgb[_c][2];					\
+      } else								\
+        _b->last[_i] = _c;						\
+    }									\
+  } while (0)
+
+/* A generator that is private to each thread, unlike random(). */
+#define accumimage_random(B) ya_random_r (&(B)->rng)
+
+/* Called on each of 'nthreads' threads at once, with a different buffer
+   and 'thread' number on each, to plot that thread's share of the points.
+ */
+typedef void (*accumimage_fn) (void *closure, accumimage_buffer *,
+                               unsigned thread, unsigned nthreads);
+
+/* The image is the size of the window.  Color indexes are into 'colors',
+   and pixels with no hits are 'background'.  Returns NULL if out of
+   memory or threads. */
+extern accumimage *accumimage_new (Display *, Window,
+                                   const XColor *colors, int ncolors,
+                                   unsigned long background);
+extern void accumimage_free (accumimage *);
+
+/* Forgets all hits. */
+extern void accumimage_clear (accumimage *);
+
+/* Runs fn on every thread and adds up the hits.  The random number
+   generators are reseeded from random() each time. */
+extern void accumimage_run (accumimage *, accumimage_fn, void *closure);
+
+/* Tone-maps all the hits so far and puts the image on the window. */
+extern void accumimage_draw (accumimage *);
+
+#endif /* __XSCREENSAVER_ACCUMIMAGE_H__ */
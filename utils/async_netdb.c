@@ -24,12 +24,38 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 /* This is very much system-dependent, but hopefully 128K covers it just about
 everywhere. The threads here shouldn't need much. */
 #define ASYNC_NETDB_STACK 131072
 
+/* Resolver threads are started as the queue backs up, up to this many. They
+   spend nearly all of their time waiting on the network, not the CPU. */
+#define ASYNC_NETDB_THREADS 8
+
+/* How many answers are remembered, and for how long, in seconds. getaddrinfo
+   doesn't say what the TTL of a DNS record was, so these are guesses. Of the
+   errors, only EAI_NONAME is remembered: EAI_AGAIN is a nameserver that
+   didn't answer this time, and the next lookup should ask again. */
+#define ASYNC_NETDB_CACHE_SIZE 1024
+#define ASYNC_NETDB_CACHE_TTL  300
+#define ASYNC_NETDB_NEGATIVE_TTL 60
+
+#ifdef SELFTEST
+static int _stub_getnameinfo (const struct sockaddr *addr, socklen_t addrlen,
+                              char *host, socklen_t hostlen,
+                              char *serv, socklen_t servlen, int flags);
+static int _stub_getaddrinfo (const char *node, const char *service,
+                              const struct addrinfo *hints,
+                              struct addrinfo **res);
+static void _stub_freeaddrinfo (struct addrinfo *res);
+# define getnameinfo _stub_getnameinfo
+# define getaddrinfo _stub_getaddrinfo
+# define freeaddrinfo _stub_freeaddrinfo
+#endif /* SELFTEST */
+
 #if ASYNC_NETDB_USE_GAI
 
 # define _get_addr_family(addr) ((addr)->x_sockaddr_storage.ss_family)
@@ -37,13 +63,331 @@ everywhere. The threads here shouldn't need much. */
 
 static int _has_threads;
 
-int _async_netdb_is_done (struct io_thread *io)
+/* Everything below is guarded by _mutex: the queue, the status of every
+   request, and the cache. */
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _queued_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _done_cond = PTHREAD_COND_INITIALIZER;
+
+static struct _async_netdb_request *_queue_head = NULL;
+static struct _async_netdb_request **_queue_tail = &_queue_head;
+static unsigned _queue_length = 0;
+
+static unsigned _thread_count = 0;
+static unsigned _idle_count = 0;
+
+/* Small enough to hold an AF_INET or AF_INET6 address, which is all that
+   Sonar deals with; anything bigger isn't cached. */
+typedef union {
+  struct sockaddr_in x_sockaddr_in;
+  struct sockaddr_in6 x_sockaddr_in6;
+} _async_netdb_cache_addr_t;
+
+/* An entry remembers one lookup, in either direction: 'name' is the key
+   when by_name, otherwise it's the answer, or NULL if there wasn't one. */
+struct _async_netdb_cache_entry
 {
-  if (_has_threads >= 0)
-    return io_thread_is_done (io);
+  unsigned hash;
+  int by_name;
+  time_t expires;
+  int gai_error;
+  char *name;
+  socklen_t addrlen;
+  _async_netdb_cache_addr_t addr;
+};
+
+static struct _async_netdb_cache_entry *_cache = NULL;
+
+static unsigned
+_hash_bytes (unsigned hash, const void *bytes, size_t size)
+{
+  /* FNV-1a. */
+  const unsigned char *b = (const unsigned char *)bytes;
+  while (size--)
+    hash = (hash ^ *b++) * 16777619u;
+  return hash;
+}
+
+/* Only the address itself is compared, not the port or whatever else is
+   in the sockaddr. */
+static unsigned
+_hash_addr (const async_netdb_sockaddr_storage_t *addr, const void **raw,
+            size_t *size)
+{
+  switch (_get_addr_family (addr))
+    {
+    case AF_INET:
+      *raw = &addr->x_sockaddr_in.sin_addr;
+      *size = sizeof (addr->x_sockaddr_in.sin_addr);
+      break;
+    case AF_INET6:
+      *raw = &addr->x_sockaddr_in6.sin6_addr;
+      *size = sizeof (addr->x_sockaddr_in6.sin6_addr);
+      break;
+    default:
+      *raw = NULL;
+      *size = 0;
+      return 0;
+    }
+  return _hash_bytes (2166136261u + _get_addr_family (addr), *raw, *size);
+}
+
+static unsigned
+_hash_name (const char *name)
+{
+  return _hash_bytes (2166136261u, name, strlen (name));
+}
+
+/* Call with _mutex held. Returns NULL on a miss. */
+static struct _async_netdb_cache_entry *
+_cache_find_addr (const async_netdb_sockaddr_storage_t *addr)
+{
+  const void *raw;
+  size_t size;
+  unsigned hash = _hash_addr (addr, &raw, &size);
+  struct _async_netdb_cache_entry *e;
+
+  if (!_cache || !raw)
+    return NULL;
+  e = &_cache[hash % ASYNC_NETDB_CACHE_SIZE];
+  if (e->expires && !e->by_name && e->hash == hash &&
+      e->addr.x_sockaddr_in.sin_family == _get_addr_family (addr) &&
+      time (NULL) < e->expires)
+    {
+      const void *e_raw;
+      size_t e_size;
+      _hash_addr ((const async_netdb_sockaddr_storage_t *)&e->addr,
+                  &e_raw, &e_size);
+      if (e_size == size && !memcmp (e_raw, raw, size))
+        return e;
+    }
+  return NULL;
+}
+
+static struct _async_netdb_cache_entry *
+_cache_find_name (const char *name)
+{
+  unsigned hash = _hash_name (name);
+  struct _async_netdb_cache_entry *e;
+
+  if (!_cache)
+    return NULL;
+  e = &_cache[hash % ASYNC_NETDB_CACHE_SIZE];
+  if (e->expires && e->by_name && e->hash == hash &&
+      !strcmp (e->name, name) && time (NULL) < e->expires)
+    return e;
+  return NULL;
+}
+
+/* Call with _mutex held. Evicts whatever was in the slot. Does nothing if
+   the answer isn't worth remembering, or there's no memory for it. */
+static void
+_cache_store (int by_name, const char *name,
+              const async_netdb_sockaddr_storage_t *addr, socklen_t addrlen,
+              int gai_error)
+{
+  struct _async_netdb_cache_entry *e;
+  unsigned hash;
+  time_t ttl;
+  char *name_copy = NULL;
+
+  switch (gai_error)
+    {
+    case 0:
+      ttl = ASYNC_NETDB_CACHE_TTL;
+      break;
+    case EAI_NONAME:
+      ttl = ASYNC_NETDB_NEGATIVE_TTL;
+      break;
+    default:
+      return;
+    }
+
+  if (by_name || !gai_error)
+    {
+      assert (name);
+      name_copy = strdup (name);
+      if (!name_copy)
+        return;
+    }
+
+  if (by_name)
+    hash = _hash_name (name);
+  else
+    {
+      const void *raw;
+      size_t size;
+      hash = _hash_addr (addr, &raw, &size);
+      if (!raw)
+        addrlen = 0;
+    }
+
+  /* A successful address from a name has to fit, and so does the key of a
+     name from an address. */
+  if ((!by_name || !gai_error) &&
+      (!addrlen || addrlen > sizeof (_async_netdb_cache_addr_t)))
+    {
+      free (name_copy);
+      return;
+    }
+
+  if (!_cache)
+    {
+      _cache = (struct _async_netdb_cache_entry *)
+        calloc (ASYNC_NETDB_CACHE_SIZE, sizeof (*_cache));
+      if (!_cache)
+        {
+          free (name_copy);
+          return;
+        }
+    }
+
+  e = &_cache[hash % ASYNC_NETDB_CACHE_SIZE];
+  free (e->name);
+  e->hash = hash;
+  e->by_name = by_name;
+  e->expires = time (NULL) + ttl;
+  e->gai_error = gai_error;
+  e->name = name_copy;
+  e->addrlen = 0;
+  memset (&e->addr, 0, sizeof (e->addr));
+  if (!by_name || !gai_error)
+    {
+      e->addrlen = addrlen;
+      memcpy (&e->addr, addr, addrlen);
+    }
+}
+
+static void *
+_async_netdb_thread (void *arg)
+{
+  /* The stack is unusually small here. If this crashes, you may need to bump
+     the value of ASYNC_NETDB_STACK. */
+
+  PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+  for (;;)
+    {
+      struct _async_netdb_request *req;
+
+      while (!_queue_head)
+        {
+          ++_idle_count;
+          PTHREAD_VERIFY (pthread_cond_wait (&_queued_cond, &_mutex));
+          --_idle_count;
+        }
+
+      req = _queue_head;
+      _queue_head = req->next;
+      if (!_queue_head)
+        _queue_tail = &_queue_head;
+      --_queue_length;
+
+      if (req->status == _async_netdb_cancelled)
+        {
+          thread_free (req);
+          continue;
+        }
+
+      req->status = _async_netdb_working;
+      PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
+
+      req->lookup (req);
+
+      PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+      if (req->status == _async_netdb_cancelled)
+        thread_free (req);
+      else
+        {
+          req->status = _async_netdb_done;
+          PTHREAD_VERIFY (pthread_cond_broadcast (&_done_cond));
+        }
+    }
+
+  return arg;
+}
+
+/* Call with _mutex held. The resolver threads are never stopped; they just
+   wait for more work. */
+static int
+_start_thread (void)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int error;
+
+  if (pthread_attr_init (&attr))
+    return 0;
+  PTHREAD_VERIFY (pthread_attr_setstacksize (&attr, ASYNC_NETDB_STACK));
+  PTHREAD_VERIFY (pthread_attr_setdetachstate (&attr,
+                                               PTHREAD_CREATE_DETACHED));
+  error = pthread_create (&thread, &attr, _async_netdb_thread, NULL);
+  assert (!error || error == EAGAIN);
+  PTHREAD_VERIFY (pthread_attr_destroy (&attr));
+
+  if (error)
+    return 0;
+  ++_thread_count;
+  return 1;
+}
+
+/* Call with _mutex held. Returns 0 if there are no threads to do the
+   lookup, in which case the request isn't queued. */
+static int
+_enqueue (struct _async_netdb_request *req,
+          void (*lookup) (struct _async_netdb_request *))
+{
+  if (_idle_count <= _queue_length && _thread_count < ASYNC_NETDB_THREADS)
+    _start_thread ();
+  if (!_thread_count)
+    return 0;
+
+  req->next = NULL;
+  req->status = _async_netdb_queued;
+  req->lookup = lookup;
+  *_queue_tail = req;
+  _queue_tail = &req->next;
+  ++_queue_length;
+  PTHREAD_VERIFY (pthread_cond_signal (&_queued_cond));
   return 1;
 }
 
+/* Waits for a resolver thread to finish with the request. */
+static void
+_wait (struct _async_netdb_request *req)
+{
+  PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+  while (req->status != _async_netdb_done)
+    PTHREAD_VERIFY (pthread_cond_wait (&_done_cond, &_mutex));
+  PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
+}
+
+/* If the request is queued or in progress, the resolver thread frees it
+   when it gets to it, without doing the lookup if it hasn't started. */
+static void
+_cancel (struct _async_netdb_request *req)
+{
+  int done;
+  PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+  done = req->status == _async_netdb_done;
+  if (!done)
+    req->status = _async_netdb_cancelled;
+  PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
+  if (done)
+    thread_free (req);
+}
+
+int _async_netdb_is_done (struct _async_netdb_request *req)
+{
+  int result = 1;
+  if (_has_threads >= 0)
+    {
+      PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+      result = req->status == _async_netdb_done;
+      PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
+    }
+  return result;
+}
+
 #else /* ASYNC_NETDB_USE_GAI */
 
 # define _get_addr_family(addr) ((addr)->x_sockaddr_in.sin_family)
@@ -99,13 +443,10 @@ static int _translate_h_errno (int error)
 
 #if ASYNC_NETDB_USE_GAI
 
-static void *
-_async_name_from_addr_thread (void *self_raw)
+static void
+_async_name_from_addr_lookup (struct _async_netdb_request *req)
 {
-  /* The stack is unusually small here. If this crashes, you may need to bump
-     the value of ASYNC_NETDB_STACK. */
-
-  async_name_from_addr_t self = (async_name_from_addr_t)self_raw;
+  async_name_from_addr_t self = (async_name_from_addr_t)req;
 
   /* getnameinfo() is thread-safe, gethostbyaddr() is not. */
   self->gai_error = getnameinfo ((void *)&self->param.addr,
@@ -117,10 +458,10 @@ _async_name_from_addr_thread (void *self_raw)
 
   self->errno_error = errno;
 
-  if (io_thread_return (&self->io))
-    thread_free(self);
-
-  return NULL;
+  PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+  _cache_store (0, self->gai_error ? NULL : self->host, &self->param.addr,
+                self->param.addrlen, self->gai_error);
+  PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
 }
 
 #endif /* ASYNC_NETDB_USE_GAI */
@@ -149,7 +490,8 @@ async_name_from_addr_start (Display *dpy, const struct sockaddr *addr,
   _has_threads = threads_available (dpy);
   if (_has_threads >= 0)
     {
-      async_name_from_addr_t self, result;
+      async_name_from_addr_t self;
+      const struct _async_netdb_cache_entry *hit;
 
       if (thread_malloc ((void **)&self, dpy,
                          sizeof (struct async_name_from_addr)))
@@ -157,12 +499,26 @@ async_name_from_addr_start (Display *dpy, const struct sockaddr *addr,
 
       _async_name_from_addr_set_param (&self->param, addr, addrlen);
 
-      result = io_thread_create (&self->io, self,
-                                 _async_name_from_addr_thread, dpy,
-                                 ASYNC_NETDB_STACK);
-      if (!result)
-        thread_free (self);
-      return result;
+      PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+      hit = _cache_find_addr (&self->param.addr);
+      if (hit)
+        {
+          self->req.status = _async_netdb_done;
+          self->gai_error = hit->gai_error;
+          self->errno_error = 0;
+          if (hit->name)
+            {
+              strncpy (self->host, hit->name, sizeof(self->host) - 1);
+              self->host[sizeof(self->host) - 1] = 0;
+            }
+        }
+      else if (!_enqueue (&self->req, _async_name_from_addr_lookup))
+        {
+          thread_free (self);
+          self = NULL;
+        }
+      PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
+      return self;
     }
 #endif /* ASYNC_NETDB_USE_GAI */
 
@@ -183,14 +539,9 @@ void
 async_name_from_addr_cancel (async_name_from_addr_t self)
 {
   if (_has_threads >= 0)
-    {
-      if(io_thread_cancel (&self->io))
-        thread_free (self);
-    }
+    _cancel (&self->req);
   else
-    {
-      free (self);
-    }
+    free (self);
 }
 #endif /* ASYNC_NETDB_USE_GAI */
 
@@ -204,7 +555,7 @@ async_name_from_addr_finish (async_name_from_addr_t self_raw,
       async_name_from_addr_t self = self_raw;
       int gai_error;
 
-      io_thread_finish (&self->io);
+      _wait (&self->req);
 
       gai_error = self->gai_error;
       if (gai_error)
@@ -280,33 +631,36 @@ _async_addr_from_name_hostname (async_addr_from_name_t self)
   return (char *)(self + 1);
 }
 
-static void
-_async_addr_from_name_free (async_addr_from_name_t self)
-{
-#if ASYNC_NETDB_USE_GAI
-  if (self->res) /* FreeBSD won't do freeaddrinfo (NULL). */
-    freeaddrinfo (self->res);
-#endif
-  thread_free (self);
-}
-
 #if ASYNC_NETDB_USE_GAI
 
-static void *
-_async_addr_from_name_thread (void *self_raw)
+static void
+_async_addr_from_name_lookup (struct _async_netdb_request *req)
 {
-  /* The stack is unusually small here. If this crashes, you may need to bump
-     the value of ASYNC_NETDB_STACK. */
+  async_addr_from_name_t self = (async_addr_from_name_t)req;
+  const char *hostname = _async_addr_from_name_hostname (self);
+  struct addrinfo *res = NULL;
 
-  async_addr_from_name_t self = (async_addr_from_name_t)self_raw;
-  self->gai_error = getaddrinfo (_async_addr_from_name_hostname (self), NULL,
-                                 NULL, &self->res);
+  self->gai_error = getaddrinfo (hostname, NULL, NULL, &res);
   self->errno_error = errno;
 
-  if (io_thread_return (&self->io))
-    _async_addr_from_name_free (self);
+  if (!self->gai_error)
+    {
+      if (!res)
+        self->gai_error = EAI_NONAME;
+      else
+        {
+          assert (res->ai_addrlen <= sizeof (async_netdb_sockaddr_storage_t));
+          memcpy (&self->addr, res->ai_addr, res->ai_addrlen);
+          self->addrlen = res->ai_addrlen;
+        }
+    }
+
+  if (res) /* FreeBSD won't do freeaddrinfo (NULL). */
+    freeaddrinfo (res);
 
-  return NULL;
+  PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+  _cache_store (1, hostname, &self->addr, self->addrlen, self->gai_error);
+  PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
 }
 
 #endif /* ASYNC_NETDB_USE_GAI */
@@ -324,16 +678,30 @@ async_addr_from_name_start (Display *dpy, const char *hostname)
 
 #if ASYNC_NETDB_USE_GAI
   _has_threads = threads_available (dpy);
-  self->res = NULL;
+  self->addrlen = 0;
   if (_has_threads >= 0)
     {
-      async_addr_from_name_t result =
-        io_thread_create (&self->io, self, _async_addr_from_name_thread, dpy,
-                          ASYNC_NETDB_STACK);
+      const struct _async_netdb_cache_entry *hit;
 
-      if (!result)
-        thread_free(result);
-      self = result;
+      PTHREAD_VERIFY (pthread_mutex_lock (&_mutex));
+      hit = _cache_find_name (hostname);
+      if (hit)
+        {
+          self->req.status = _async_netdb_done;
+          self->gai_error = hit->gai_error;
+          self->errno_error = 0;
+          if (!hit->gai_error)
+            {
+              memcpy (&self->addr, &hit->addr, hit->addrlen);
+              self->addrlen = hit->addrlen;
+            }
+        }
+      else if (!_enqueue (&self->req, _async_addr_from_name_lookup))
+        {
+          thread_free (self);
+          self = NULL;
+        }
+      PTHREAD_VERIFY (pthread_mutex_unlock (&_mutex));
     }
 #endif /* ASYNC_NETDB_USE_GAI */
 
@@ -345,14 +713,9 @@ void
 async_addr_from_name_cancel (async_addr_from_name_t self)
 {
   if (_has_threads >= 0)
-    {
-      if (io_thread_cancel (&self->io))
-        _async_addr_from_name_free (self);
-    }
+    _cancel (&self->req);
   else
-    {
-      thread_free (self);
-    }
+    thread_free (self);
 }
 #endif /* ASYNC_NETDB_USE_GAI */
 
@@ -366,7 +729,7 @@ async_addr_from_name_finish (async_addr_from_name_t self, void *addr,
   if (_has_threads >= 0)
     {
       int gai_error;
-      io_thread_finish (&self->io);
+      _wait (&self->req);
 
       gai_error = self->gai_error;
       if (errno_error)
@@ -374,19 +737,11 @@ async_addr_from_name_finish (async_addr_from_name_t self, void *addr,
 
       if (!gai_error)
         {
-          struct addrinfo *ai = self->res;
-          if (!ai)
-            gai_error = EAI_NONAME;
-          else
-            {
-              assert (ai->ai_addrlen <=
-                      sizeof (async_netdb_sockaddr_storage_t));
-              memcpy (addr, ai->ai_addr, ai->ai_addrlen);
-              *addrlen = ai->ai_addrlen;
-            }
+          memcpy (addr, &self->addr, self->addrlen);
+          *addrlen = self->addrlen;
         }
 
-      _async_addr_from_name_free (self);
+      thread_free (self);
       return gai_error;
     }
 #endif /* ASYNC_NETDB_USE_GAI */
@@ -399,7 +754,7 @@ async_addr_from_name_finish (async_addr_from_name_t self, void *addr,
     async_netdb_sockaddr_storage_t *addr_storage =
       (async_netdb_sockaddr_storage_t *)addr;
 
-    _async_addr_from_name_free (self);
+    thread_free (self);
 
     if (!he)
       return _translate_h_errno (error);
@@ -441,6 +796,241 @@ async_addr_from_name_finish (async_addr_from_name_t self, void *addr,
   }
 }
 
+
+#ifdef SELFTEST
+
+/* A stand-in for the resolver that takes STUB_LATENCY to answer, to see how
+   the queue, the cache and cancellation behave against a slow DNS server
+   without needing one:
+
+     make test-async_netdb && ./test-async_netdb
+
+   10.0.x.y has the name "host-x-y.test" when y is a multiple of 4, and no
+   name otherwise; those names resolve back to their addresses, and nothing
+   else resolves at all.
+ */
+
+# include <stdlib.h>
+# include <sys/time.h>
+
+# define STUB_LATENCY 10000 /* microseconds */
+# define STUB_HOSTS 1024
+
+static pthread_mutex_t _stub_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned _stub_calls = 0;
+
+static void
+_stub_wait (void)
+{
+  PTHREAD_VERIFY (pthread_mutex_lock (&_stub_mutex));
+  ++_stub_calls;
+  PTHREAD_VERIFY (pthread_mutex_unlock (&_stub_mutex));
+  usleep (STUB_LATENCY);
+}
+
+static unsigned
+_stub_call_count (void)
+{
+  unsigned result;
+  PTHREAD_VERIFY (pthread_mutex_lock (&_stub_mutex));
+  result = _stub_calls;
+  PTHREAD_VERIFY (pthread_mutex_unlock (&_stub_mutex));
+  return result;
+}
+
+static int
+_stub_getnameinfo (const struct sockaddr *addr, socklen_t addrlen,
+                   char *host, socklen_t hostlen,
+                   char *serv, socklen_t servlen, int flags)
+{
+  const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+  unsigned long a = ntohl (in->sin_addr.s_addr);
+  _stub_wait ();
+  if (addr->sa_family != AF_INET || (a >> 16) != 0x0A00 || (a & 3))
+    return EAI_NONAME;
+  snprintf (host, hostlen, "host-%lu-%lu.test", (a >> 8) & 0xFF, a & 0xFF);
+  return 0;
+}
+
+static int
+_stub_getaddrinfo (const char *node, const char *service,
+                   const struct addrinfo *hints, struct addrinfo **res)
+{
+  unsigned x, y;
+  char end;
+  struct addrinfo *ai;
+  struct sockaddr_in *in;
+
+  _stub_wait ();
+  if (sscanf (node, "host-%u-%u.tes%c", &x, &y, &end) != 3 || end != 't' ||
+      x > 255 || y > 255 || (y & 3))
+    return EAI_NONAME;
+
+  ai = (struct addrinfo *) calloc (1, sizeof (*ai) + sizeof (*in));
+  if (!ai)
+    return EAI_MEMORY;
+  in = (struct sockaddr_in *)(ai + 1);
+  in->sin_family = AF_INET;
+  in->sin_addr.s_addr = htonl (0x0A000000 | (x << 8) | y);
+  ai->ai_family = AF_INET;
+  ai->ai_addr = (struct sockaddr *)in;
+  ai->ai_addrlen = sizeof (*in);
+  *res = ai;
+  return 0;
+}
+
+static void
+_stub_freeaddrinfo (struct addrinfo *res)
+{
+  free (res);
+}
+
+int threads_available (Display *dpy)
+{
+  return 1;
+}
+
+static double
+_double_time (void)
+{
+  struct timeval now;
+  gettimeofday (&now, NULL);
+  return now.tv_sec + now.tv_usec * 0.000001;
+}
+
+static void
+_stub_addr (struct sockaddr_in *in, unsigned i)
+{
+  memset (in, 0, sizeof (*in));
+  in->sin_family = AF_INET;
+  in->sin_addr.s_addr = htonl (0x0A000000 | i);
+}
+
+/* Looks up every host by address, then checks the answers. */
+static int
+_names_from_addrs (unsigned first, const char *title)
+{
+  static async_name_from_addr_t lookups[STUB_HOSTS];
+  unsigned calls = _stub_call_count ();
+  double start = _double_time ();
+  int errors = 0;
+  unsigned i;
+
+  for (i = 0; i < STUB_HOSTS; i++)
+    {
+      struct sockaddr_in in;
+      _stub_addr (&in, first + i);
+      lookups[i] = async_name_from_addr_start (NULL, (void *)&in,
+                                               sizeof (in));
+      if (!lookups[i])
+        {
+          fprintf (stderr, "async_name_from_addr_start failed\n");
+          exit (1);
+        }
+    }
+
+  for (i = 0; i < STUB_HOSTS; i++)
+    {
+      char *host = NULL, expected[NI_MAXHOST];
+      unsigned a = first + i;
+      int error = async_name_from_addr_finish (lookups[i], &host, NULL);
+      sprintf (expected, "host-%u-%u.test", (a >> 8) & 0xFF, a & 0xFF);
+      if ((a & 3) ? error != EAI_NONAME :
+          (error || !host || strcmp (host, expected)))
+        {
+          fprintf (stderr, "10.0.%u.%u: wrong answer: %s\n",
+                   (a >> 8) & 0xFF, a & 0xFF,
+                   error ? gai_strerror (error) : host);
+          errors++;
+        }
+      free (host);
+    }
+
+  fprintf (stderr, "%-28s %4u lookups, %4u resolver calls, %6.3f sec\n",
+           title, STUB_HOSTS, _stub_call_count () - calls,
+           _double_time () - start);
+  return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  int errors = 0;
+  unsigned i, calls;
+  double start;
+
+  errors += _names_from_addrs (0, "Names, first time:");
+  errors += _names_from_addrs (0, "Names, cached:");
+  if (_stub_call_count () != STUB_HOSTS)
+    {
+      fprintf (stderr, "the cache didn't answer the second time\n");
+      errors++;
+    }
+
+  /* Cancelled before the resolver threads can get to them: almost none of
+     these should ever reach the resolver. */
+  calls = _stub_call_count ();
+  start = _double_time ();
+  for (i = 0; i < STUB_HOSTS; i++)
+    {
+      struct sockaddr_in in;
+      async_name_from_addr_t lookup;
+      _stub_addr (&in, STUB_HOSTS + i);
+      lookup = async_name_from_addr_start (NULL, (void *)&in, sizeof (in));
+      async_name_from_addr_cancel (lookup);
+    }
+  fprintf (stderr, "%-28s %4u lookups, %6.3f sec\n", "Cancelled:",
+           STUB_HOSTS, _double_time () - start);
+  usleep (STUB_LATENCY * 4);
+  fprintf (stderr, "%-28s %4u resolver calls\n", "",
+           _stub_call_count () - calls);
+  if (_stub_call_count () - calls > ASYNC_NETDB_THREADS * 2)
+    {
+      fprintf (stderr, "cancelled lookups reached the resolver\n");
+      errors++;
+    }
+
+  /* And back again, by name. */
+  for (i = 0; i < 2; i++)
+    {
+      async_addr_from_name_t lookups[16];
+      unsigned j;
+      calls = _stub_call_count ();
+      for (j = 0; j < 16; j++)
+        {
+          char name[64];
+          sprintf (name, "host-0-%u.test", j * 2);
+          lookups[j] = async_addr_from_name_start (NULL, name);
+        }
+      for (j = 0; j < 16; j++)
+        {
+          async_netdb_sockaddr_storage_t addr;
+          socklen_t addrlen;
+          int error = async_addr_from_name_finish (lookups[j], &addr,
+                                                   &addrlen, NULL);
+          int ok = (j & 1) ? error == EAI_NONAME :
+            (!error && addrlen == sizeof (struct sockaddr_in) &&
+             addr.x_sockaddr_in.sin_addr.s_addr == htonl (0x0A000000 | j*2));
+          if (!ok)
+            {
+              fprintf (stderr, "host-0-%u.test: wrong answer\n", j * 2);
+              errors++;
+            }
+        }
+      fprintf (stderr, "%-28s %4u lookups, %4u resolver calls\n",
+               i ? "Addresses, cached:" : "Addresses, first time:",
+               16, _stub_call_count () - calls);
+      if (i && _stub_call_count () != calls)
+        errors++;
+    }
+
+  if (errors)
+    fprintf (stderr, "%d errors\n", errors);
+  return !!errors;
+}
+
+#endif /* SELFTEST */
+
 /* Local Variables:      */
 /* mode: c               */
 /* fill-column: 78       */
@@ -31,6 +31,13 @@
 
    On systems that can't do asynchronous host lookups, the *_finish functions
    do the actual lookup.
+
+   Lookups don't get a thread apiece: they wait in a queue for one of a small,
+   fixed number of resolver threads, and the answers (including "no such
+   host") are remembered for a while, so that asking again is free. Sonar can
+   ask about every address on a /16 at once; cancelling a lookup that hasn't
+   been started yet just marks it, and it's dropped without ever reaching the
+   resolver.
  */
 
 #ifndef NI_MAXHOST
@@ -62,7 +69,22 @@ typedef union {
 	struct sockaddr_in6 x_sockaddr_in6;
 } async_netdb_sockaddr_storage_t;
 
-int _async_netdb_is_done (struct io_thread *io);
+enum _async_netdb_status
+{
+  _async_netdb_queued, _async_netdb_working, _async_netdb_done,
+  _async_netdb_cancelled
+};
+
+/* A lookup, as seen by the resolver threads. This must be the first member
+   of async_name_from_addr and async_addr_from_name. */
+struct _async_netdb_request
+{
+  struct _async_netdb_request *next; /* The rest of the queue. */
+  enum _async_netdb_status status;
+  void (*lookup) (struct _async_netdb_request *self);
+};
+
+int _async_netdb_is_done (struct _async_netdb_request *req);
 
 #else
 
@@ -93,7 +115,7 @@ const char *_async_netdb_strerror (int errcode);
 #   define gai_strerror(errcode) _async_netdb_strerror (errcode)
 # endif
 
-# define _async_netdb_is_done(io) 1
+# define _async_netdb_is_done(req) 1
 
 #endif
 
@@ -119,8 +141,11 @@ typedef struct async_name_from_addr
      3. The location that realloc() moves memory to won't be aligned.
    */
 
+#if ASYNC_NETDB_USE_GAI
+  struct _async_netdb_request req;
+#endif
+
   struct _async_name_from_addr_param param;
-  struct io_thread io;
 
   char host[NI_MAXHOST];
   int gai_error;
@@ -142,7 +167,8 @@ async_name_from_addr_t async_name_from_addr_start (Display *dpy,
    Returns NULL if the request couldn't be created (due to low memory).
  */
 
-#define async_name_from_addr_is_done(self) _async_netdb_is_done (&(self)->io)
+#define async_name_from_addr_is_done(self) \
+  _async_netdb_is_done (&(self)->req)
 
 #if ASYNC_NETDB_USE_GAI
 void async_name_from_addr_cancel (async_name_from_addr_t self);
@@ -167,12 +193,13 @@ int async_name_from_addr_finish (async_name_from_addr_t self,
 typedef struct async_addr_from_name
 {
 #if ASYNC_NETDB_USE_GAI
-  struct io_thread io;
+  struct _async_netdb_request req;
 
   int gai_error;
   int errno_error;
 
-  struct addrinfo *res;
+  socklen_t addrlen;
+  async_netdb_sockaddr_storage_t addr;
 #else
   char dont_complain_about_empty_structs;
 #endif
@@ -187,7 +214,8 @@ async_addr_from_name_t async_addr_from_name_start (Display *dpy,
    Returns NULL if the request couldn't be created (due to low memory).
  */
 
-#define async_addr_from_name_is_done(self) _async_netdb_is_done (&(self)->io)
+#define async_addr_from_name_is_done(self) \
+  _async_netdb_is_done (&(self)->req)
 
 #if ASYNC_NETDB_USE_GAI
 void async_addr_from_name_cancel (async_addr_from_name_t self);
@@ -0,0 +1,316 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * Grids of character cells, drawn on the client side.  See cellimage.h.
+ */
+
+#include "utils.h"
+#include "cellimage.h"
+#include "xshm.h"
+
+#ifdef HAVE_INTTYPES_H
+# include <inttypes.h>
+#endif
+
+#undef MIN
+#undef MAX
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+
+#define RAMP_SIZE 256
+
+struct cellimage {
+  Display *dpy;
+  Window window;
+  GC gc;
+  XImage *image;
+  XShmSegmentInfo shm_info;
+  int width, height;
+  Bool fast_p;			/* 32 bits per pixel, in our byte order */
+
+  int cell_width, cell_height;
+  int nglyphs, nramps;
+  unsigned char *glyphs;	/* cell_width * cell_height levels apiece */
+  unsigned long *ramps;		/* RAMP_SIZE pixels apiece */
+  unsigned long background;
+
+  /* The image is split into bands cell_height tall, and these are the
+     columns of each that have changed; x0 >= x1 if none. */
+  int nbands;
+  int *dirty_x0, *dirty_x1;
+};
+
+
+static Bool
+bigendian (void)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  u.i = 1;
+  return !u.c[0];
+}
+
+
+static void
+dirty (cellimage *ci, int x, int y, int w, int h)
+{
+  int b0 = y / ci->cell_height;
+  int b1 = (y + h - 1) / ci->cell_height;
+  int b;
+  for (b = b0; b <= b1; b++)
+    {
+      ci->dirty_x0[b] = MIN (ci->dirty_x0[b], x);
+      ci->dirty_x1[b] = MAX (ci->dirty_x1[b], x + w);
+    }
+}
+
+
+static void
+clean (cellimage *ci)
+{
+  int b;
+  for (b = 0; b < ci->nbands; b++)
+    {
+      ci->dirty_x0[b] = ci->width;
+      ci->dirty_x1[b] = 0;
+    }
+}
+
+
+/* Makes an image the size of the window, filled with the background.
+   If that fails, nothing is changed. */
+static Bool
+make_image (cellimage *ci)
+{
+  XWindowAttributes xgwa;
+  XImage *image;
+  XShmSegmentInfo shm_info;
+  int width, height, nbands;
+  int *x0, *x1;
+
+  XGetWindowAttributes (ci->dpy, ci->window, &xgwa);
+  width  = MAX (1, xgwa.width);
+  height = MAX (1, xgwa.height);
+  nbands = (height + ci->cell_height - 1) / ci->cell_height;
+
+  image = create_xshm_image (ci->dpy, xgwa.visual, xgwa.depth, ZPixmap,
+                             &shm_info, width, height);
+  if (!image)
+    return False;
+
+  x0 = (int *) malloc (nbands * sizeof(*x0));
+  x1 = (int *) malloc (nbands * sizeof(*x1));
+  if (!x0 || !x1)
+    {
+      free (x0);
+      free (x1);
+      destroy_xshm_image (ci->dpy, image, &shm_info);
+      return False;
+    }
+
+  free (ci->dirty_x0);
+  free (ci->dirty_x1);
+  ci->dirty_x0 = x0;
+  ci->dirty_x1 = x1;
+  ci->nbands = nbands;
+  ci->image = image;
+  ci->shm_info = shm_info;
+  ci->width  = width;
+  ci->height = height;
+  ci->fast_p = (image->bits_per_pixel == 32 &&
+                image->byte_order == (bigendian() ? MSBFirst : LSBFirst));
+  cellimage_clear (ci);
+  return True;
+}
+
+
+cellimage *
+cellimage_new (Display *dpy, Window window,
+               int cell_width, int cell_height,
+               int nglyphs, int nramps,
+               unsigned long background)
+{
+  XGCValues gcv;
+  cellimage *ci = (cellimage *) calloc (1, sizeof(*ci));
+  if (!ci) return 0;
+
+  ci->dpy = dpy;
+  ci->window = window;
+  ci->cell_width  = MAX (1, cell_width);
+  ci->cell_height = MAX (1, cell_height);
+  ci->nglyphs = nglyphs;
+  ci->nramps  = nramps;
+  ci->background = background;
+
+  ci->glyphs = (unsigned char *)
+    calloc ((long) nglyphs * ci->cell_width * ci->cell_height, 1);
+  ci->ramps = (unsigned long *)
+    calloc ((long) nramps * RAMP_SIZE, sizeof(*ci->ramps));
+  if (!ci->glyphs || !ci->ramps || !make_image (ci))
+    {
+      free (ci->glyphs);
+      free (ci->ramps);
+      free (ci->dirty_x0);
+      free (ci->dirty_x1);
+      free (ci);
+      return 0;
+    }
+
+  ci->gc = XCreateGC (dpy, window, 0, &gcv);
+  return ci;
+}
+
+
+void
+cellimage_free (cellimage *ci)
+{
+  if (!ci) return;
+  destroy_xshm_image (ci->dpy, ci->image, &ci->shm_info);
+  XFreeGC (ci->dpy, ci->gc);
+  free (ci->glyphs);
+  free (ci->ramps);
+  free (ci->dirty_x0);
+  free (ci->dirty_x1);
+  free (ci);
+}
+
+
+void
+cellimage_resize (cellimage *ci)
+{
+  XImage *old = ci->image;
+  XShmSegmentInfo old_shm_info = ci->shm_info;
+  int y, bytes;
+
+  if (!make_image (ci))
+    return;  /* Out of memory: keep drawing into the old one. */
+
+  bytes = MIN (old->bytes_per_line, ci->image->bytes_per_line);
+  for (y = 0; y < MIN (old->height, ci->height); y++)
+    memcpy (ci->image->data + (long) y * ci->image->bytes_per_line,
+            old->data + (long) y * old->bytes_per_line,
+            bytes);
+  destroy_xshm_image (ci->dpy, old, &old_shm_info);
+}
+
+
+void
+cellimage_set_glyph (cellimage *ci, int glyph,
+                     const unsigned char *levels, int stride)
+{
+  long size = (long) ci->cell_width * ci->cell_height;
+  unsigned char *g;
+  int y;
+  if (glyph < 0 || glyph >= ci->nglyphs) abort();
+  g = ci->glyphs + glyph * size;
+  for (y = 0; y < ci->cell_height; y++)
+    memcpy (g + y * ci->cell_width, levels + y * stride, ci->cell_width);
+}
+
+
+void
+cellimage_set_ramp (cellimage *ci, int ramp, int level, unsigned long pixel)
+{
+  if (ramp < 0 || ramp >= ci->nramps) abort();
+  if (level < 0 || level >= RAMP_SIZE) abort();
+  ci->ramps[ramp * RAMP_SIZE + level] = pixel;
+}
+
+
+void
+cellimage_draw (cellimage *ci, int x, int y, int glyph, int ramp)
+{
+  const unsigned char *g;
+  const unsigned long *r;
+  int x0 = MAX (0, x), x1 = MIN (ci->width,  x + ci->cell_width);
+  int y0 = MAX (0, y), y1 = MIN (ci->height, y + ci->cell_height);
+  int xx, yy;
+
+  if (glyph < 0 || glyph >= ci->nglyphs) abort();
+  if (ramp < 0 || ramp >= ci->nramps) abort();
+  if (x0 >= x1 || y0 >= y1) return;
+
+  g = ci->glyphs + (long) glyph * ci->cell_width * ci->cell_height;
+  r = ci->ramps + ramp * RAMP_SIZE;
+
+  for (yy = y0; yy < y1; yy++)
+    {
+      const unsigned char *levels = g + (yy - y) * ci->cell_width + (x0 - x);
+      if (ci->fast_p)
+        {
+          uint32_t *out = (uint32_t *)
+            (ci->image->data + (long) yy * ci->image->bytes_per_line) + x0;
+          for (xx = 0; xx < x1 - x0; xx++)
+            out[xx] = (uint32_t) r[levels[xx]];
+        }
+      else
+        for (xx = 0; xx < x1 - x0; xx++)
+          XPutPixel (ci->image, x0 + xx, yy, r[levels[xx]]);
+    }
+
+  dirty (ci, x0, y0, x1 - x0, y1 - y0);
+}
+
+
+void
+cellimage_fill (cellimage *ci, int x, int y, int w, int h,
+                unsigned long pixel)
+{
+  int x0 = MAX (0, x), x1 = MIN (ci->width,  x + w);
+  int y0 = MAX (0, y), y1 = MIN (ci->height, y + h);
+  int xx, yy;
+
+  if (x0 >= x1 || y0 >= y1) return;
+
+  for (yy = y0; yy < y1; yy++)
+    if (ci->fast_p)
+      {
+        uint32_t *out = (uint32_t *)
+          (ci->image->data + (long) yy * ci->image->bytes_per_line);
+        for (xx = x0; xx < x1; xx++)
+          out[xx] = (uint32_t) pixel;
+      }
+    else
+      for (xx = x0; xx < x1; xx++)
+        XPutPixel (ci->image, xx, yy, pixel);
+
+  dirty (ci, x0, y0, x1 - x0, y1 - y0);
+}
+
+
+void
+cellimage_clear (cellimage *ci)
+{
+  cellimage_fill (ci, 0, 0, ci->width, ci->height, ci->background);
+  clean (ci);
+}
+
+
+void
+cellimage_put (cellimage *ci, Bool all_p)
+{
+  int b;
+
+  if (all_p)
+    put_xshm_image (ci->dpy, ci->window, ci->gc, ci->image, 0, 0, 0, 0,
+                    ci->width, ci->height, &ci->shm_info);
+  else
+    for (b = 0; b < ci->nbands; b++)
+      if (ci->dirty_x0[b] < ci->dirty_x1[b])
+        {
+          int x = ci->dirty_x0[b];
+          int y = b * ci->cell_height;
+          put_xshm_image (ci->dpy, ci->window, ci->gc, ci->image, x, y, x, y,
+                          ci->dirty_x1[b] - x,
+                          MIN (ci->cell_height, ci->height - y),
+                          &ci->shm_info);
+        }
+
+  clean (ci);
+}
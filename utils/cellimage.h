@@ -0,0 +1,71 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+#ifndef __XSCREENSAVER_CELLIMAGE_H__
+#define __XSCREENSAVER_CELLIMAGE_H__
+
+/* Draws grids of character cells, such as terminals, on the client side.
+
+   Hacks like phosphor and xmatrix used to draw every changed cell with its
+   own XCopyArea or XCopyPlane, and since a fading cell changes on every
+   frame, a screen full of fading text was tens of thousands of requests
+   per frame.  Instead, cells are drawn into a window-sized XShm image, and
+   then each band of rows that changed is put on the window in one request.
+
+   Glyphs are stored as one byte per pixel, which is not a color but a
+   level: an index into a ramp of 256 pixel values.  A cell is drawn with a
+   glyph and a ramp, so the same glyph can be drawn bright, faded or
+   glowing without storing it more than once.  A glyph that is just ink or
+   no ink uses levels 0 and 1; one with an outline uses a third level, and
+   a full color image can be stored as indexes into a palette.
+
+   The image should always look like the window, so anything that is drawn
+   on the window other than cells should be drawn with cellimage_fill too.
+ */
+
+typedef struct cellimage cellimage;
+
+/* The image is the size of the window, and starts out filled with
+   'background'.  Returns NULL if out of memory. */
+extern cellimage *cellimage_new (Display *, Window,
+                                 int cell_width, int cell_height,
+                                 int nglyphs, int nramps,
+                                 unsigned long background);
+extern void cellimage_free (cellimage *);
+
+/* Matches the image to a new window size, keeping what fits. */
+extern void cellimage_resize (cellimage *);
+
+/* Sets the levels of one glyph, cell_width by cell_height, rows 'stride'
+   bytes apart. */
+extern void cellimage_set_glyph (cellimage *, int glyph,
+                                 const unsigned char *levels, int stride);
+
+/* Sets the pixel that one level of one ramp is drawn as. */
+extern void cellimage_set_ramp (cellimage *, int ramp, int level,
+                                unsigned long pixel);
+
+/* Draws a glyph with its top left corner at x, y. */
+extern void cellimage_draw (cellimage *, int x, int y, int glyph, int ramp);
+
+/* Fills a rectangle with a pixel. */
+extern void cellimage_fill (cellimage *, int x, int y, int w, int h,
+                            unsigned long pixel);
+
+/* Fills all of the image with the background, without changing the window,
+   as after XClearWindow. */
+extern void cellimage_clear (cellimage *);
+
+/* Puts whatever has been drawn since last time on the window.  If 'all_p',
+   puts all of it, as after an Expose. */
+extern void cellimage_put (cellimage *, Bool all_p);
+
+#endif /* __XSCREENSAVER_CELLIMAGE_H__ */
@@ -39,6 +39,17 @@ struct eraser_state {
   double start_time, stop_time;
   double ratio, prev_ratio;
 
+  /* How long recent steps took to draw and sync, smoothed.  On a slow or
+     remote display this is what used to stretch the erase past
+     eraseSeconds. */
+  double step_cost;
+
+  /* Primitives queued up by one step, sent as a single request each. */
+  XSegment *segs;
+  int nsegs, segs_size;
+  XRectangle *rects;
+  int nrects, rects_size;
+
   /* data for random_lines, venetian, random_squares */
   Bool horiz_p;
   Bool flip_p;
@@ -74,6 +85,55 @@ double_time (void)
 }
 
 
+static void
+add_segment (eraser_state *st, int x1, int y1, int x2, int y2)
+{
+  XSegment *s;
+  if (st->nsegs >= st->segs_size)
+    {
+      st->segs_size = st->segs_size * 2 + 256;
+      st->segs = (XSegment *)
+        realloc (st->segs, st->segs_size * sizeof(*st->segs));
+      if (! st->segs) abort();
+    }
+  s = &st->segs[st->nsegs++];
+  s->x1 = x1; s->y1 = y1;
+  s->x2 = x2; s->y2 = y2;
+}
+
+
+static void
+add_rectangle (eraser_state *st, int x, int y, int w, int h)
+{
+  XRectangle *r;
+  if (st->nrects >= st->rects_size)
+    {
+      st->rects_size = st->rects_size * 2 + 64;
+      st->rects = (XRectangle *)
+        realloc (st->rects, st->rects_size * sizeof(*st->rects));
+      if (! st->rects) abort();
+    }
+  r = &st->rects[st->nrects++];
+  r->x = x; r->y = y;
+  r->width = w; r->height = h;
+}
+
+
+/* Sends everything queued by add_segment and add_rectangle.  Xlib packs
+   these into as few protocol requests as the server's request size allows.
+ */
+static void
+flush_batch (eraser_state *st)
+{
+  if (st->nsegs)
+    XDrawSegments (st->dpy, st->window, st->bg_gc, st->segs, st->nsegs);
+  if (st->nrects)
+    XFillRectangles (st->dpy, st->window, st->bg_gc, st->rects, st->nrects);
+  st->nsegs = 0;
+  st->nrects = 0;
+}
+
+
 static void
 random_lines (eraser_state *st)
 {
@@ -103,11 +163,9 @@ random_lines (eraser_state *st)
        i++)
     {
       if (st->horiz_p)
-        XDrawLine (st->dpy, st->window, st->bg_gc, 
-                   0, st->lines[i], st->width, st->lines[i]);
+        add_segment (st, 0, st->lines[i], st->width, st->lines[i]);
       else
-        XDrawLine (st->dpy, st->window, st->bg_gc, 
-                   st->lines[i], 0, st->lines[i], st->height);
+        add_segment (st, st->lines[i], 0, st->lines[i], st->height);
     }
 
   if (st->ratio >= 1.0)
@@ -144,11 +202,9 @@ venetian (eraser_state *st)
        i++)
     {
       if (st->horiz_p)
-        XDrawLine (st->dpy, st->window, st->bg_gc, 
-                   0, st->lines[i], st->width, st->lines[i]);
+        add_segment (st, 0, st->lines[i], st->width, st->lines[i]);
       else
-        XDrawLine (st->dpy, st->window, st->bg_gc, 
-                   st->lines[i], 0, st->lines[i], st->height);
+        add_segment (st, st->lines[i], 0, st->lines[i], st->height);
     }
 
   if (st->ratio >= 1.0)
@@ -195,7 +251,7 @@ triple_wipe (eraser_state *st)
       if (st->flip_y)
         y = st->height - y, y2 = st->height - y2;
 
-      XDrawLine (st->dpy, st->window, st->bg_gc, x, y, x2, y2);
+      add_segment (st, x, y, x2, y2);
     }
 
   if (st->ratio >= 1.0)
@@ -242,7 +298,7 @@ quad_wipe (eraser_state *st)
       if (st->flip_y)
         y = st->height-y, y2 = st->height-y2;
 
-      XDrawLine (st->dpy, st->window, st->bg_gc, x, y, x2, y2);
+      add_segment (st, x, y, x2, y2);
     }
 
   if (st->ratio >= 1.0)
@@ -289,6 +345,7 @@ three_circle_wipe (eraser_state *st)
   int max = 360 * 64;
   int th, oth;
   int i;
+  XArc arcs[6];
 
   if (st->ratio == 0.0)
     st->start = random() % max;
@@ -296,22 +353,24 @@ three_circle_wipe (eraser_state *st)
   th  = max/6 * st->ratio;
   oth = max/6 * st->prev_ratio;
 
-  for (i = 0; i < 3; i++)
-    {
-      int off = i * max / 3;
-      XFillArc (st->dpy, st->window, st->bg_gc,
-                (st->width  / 2) - rad,
-                (st->height / 2) - rad, 
-                rad*2, rad*2,
-                (st->start + off + oth) % max,
-                th-oth);
-      XFillArc (st->dpy, st->window, st->bg_gc,
-                (st->width  / 2) - rad,
-                (st->height / 2) - rad, 
-                rad*2, rad*2,
-                (st->start + off - oth) % max,
-                oth-th);
+  for (i = 0; i < countof(arcs); i++)
+    {
+      int off = (i / 2) * max / 3;
+      arcs[i].x = (st->width  / 2) - rad;
+      arcs[i].y = (st->height / 2) - rad;
+      arcs[i].width = arcs[i].height = rad*2;
+      if (i & 1)
+        {
+          arcs[i].angle1 = (st->start + off - oth) % max;
+          arcs[i].angle2 = oth-th;
+        }
+      else
+        {
+          arcs[i].angle1 = (st->start + off + oth) % max;
+          arcs[i].angle2 = th-oth;
+        }
     }
+  XFillArcs (st->dpy, st->window, st->bg_gc, arcs, countof(arcs));
 }
 
 
@@ -377,7 +436,9 @@ fizzle (eraser_state *st)
   unsigned int x, y, i;
   const unsigned int size = 256;
   unsigned short *rnd;
-  XPoint *points;
+  XPoint *points, *p;
+  unsigned int chunks =
+    ((st->width + size - 1) / size) * ((st->height + size - 1) / size);
   unsigned int npoints =
     (unsigned int)(size * size * st->ratio * overshoot) -
     (unsigned int)(size * size * st->prev_ratio * overshoot);
@@ -391,8 +452,6 @@ fizzle (eraser_state *st)
 
   if (! st->fizzle_rnd)
     {
-      unsigned int chunks =
-        ((st->width + size - 1) / size) * ((st->height + size - 1) / size);
       unsigned int i;
 
       st->fizzle_rnd =
@@ -405,10 +464,12 @@ fizzle (eraser_state *st)
         st->fizzle_rnd[i] = NRAND(0x10000) | 1; /* Seed can't be 0. */
     }
 
-  points = (XPoint *) malloc ((npoints + 1) * sizeof(*points));
+  /* Every chunk's points go out in one XDrawPoints. */
+  points = (XPoint *) malloc ((npoints + 1) * chunks * sizeof(*points));
   if (! points) return;
 
   rnd = st->fizzle_rnd;
+  p = points;
 
   for (y = 0; y < st->height; y += 256)
     {
@@ -418,8 +479,8 @@ fizzle (eraser_state *st)
           unsigned short r = *rnd;
           for (i = 0; i != npoints; i++)
             {
-              points[i].x = r % size + x;
-              points[i].y = (r >> 8) % size + y;
+              p[i].x = r % size + x;
+              p[i].y = (r >> 8) % size + y;
 
               /* Xorshift. This has a period of 2^16, which exactly matches
                  the number of pixels in each 256x256 chunk.
@@ -436,16 +497,18 @@ fizzle (eraser_state *st)
 
           if (need0)
             {
-              points[npoints].x = x;
-              points[npoints].y = y;
+              p[npoints].x = x;
+              p[npoints].y = y;
             }
 
-          XDrawPoints (st->dpy, st->window, st->bg_gc,
-                       points, npoints + need0, CoordModeOrigin);
+          p += npoints + need0;
           *rnd = r;
           rnd++;
         }
     }
+
+  XDrawPoints (st->dpy, st->window, st->bg_gc,
+               points, p - points, CoordModeOrigin);
   free (points);
 }
 
@@ -456,9 +519,10 @@ spiral (eraser_state *st)
   int max_radius = (st->width > st->height ? st->width : st->height) * 0.7;
   int loops = 10;
   float max_th = M_PI * 2 * loops;
-  int i;
+  int i, n;
   int steps = 360 * loops / 4;
   float off;
+  XPoint points[64];
 
   if (st->ratio == 0.0)
     {
@@ -468,32 +532,41 @@ spiral (eraser_state *st)
 
   off = st->start * M_PI / 180;
 
+  /* Consecutive wedges share the center and an edge, so a run of them is
+     one star-shaped polygon.  Less than one turn (90 wedges) per polygon
+     keeps it from overlapping itself. */
+  points[0].x = st->width  / 2;
+  points[0].y = st->height / 2;
+  n = 1;
+
+# define EDGE(I) do {						\
+    float th = (I) * max_th / steps;				\
+    int   r  = (I) * max_radius / steps;				\
+    if (st->flip_p) th = max_th - th;				\
+    points[n].x = points[0].x + r * cos (off + th);		\
+    points[n].y = points[0].y + r * sin (off + th);		\
+    n++;							\
+  } while (0)
+
   for (i = steps * st->prev_ratio;
        i < steps * st->ratio;
        i++)
     {
-      float th1 = i     * max_th / steps;
-      float th2 = (i+1) * max_th / steps;
-      int   r1  = i     * max_radius / steps;
-      int   r2  = (i+1) * max_radius / steps;
-      XPoint points[3];
-
-      if (st->flip_p)
+      if (n == 1)
+        EDGE (i);
+      EDGE (i+1);
+      if (n == countof(points))
         {
-          th1 = max_th - th1;
-          th2 = max_th - th2;
+          XFillPolygon (st->dpy, st->window, st->bg_gc,
+                        points, n, Nonconvex, CoordModeOrigin);
+          n = 1;
         }
-
-      points[0].x = st->width  / 2;
-      points[0].y = st->height / 2;
-      points[1].x = points[0].x + r1 * cos (off + th1);
-      points[1].y = points[0].y + r1 * sin (off + th1);
-      points[2].x = points[0].x + r2 * cos (off + th2);
-      points[2].y = points[0].y + r2 * sin (off + th2);
-/*  XFillRectangle(st->dpy, st->window, st->fg_gc,0,0,st->width, st->height);*/
-      XFillPolygon (st->dpy, st->window, st->bg_gc,
-                    points, 3, Convex, CoordModeOrigin);
     }
+# undef EDGE
+
+  if (n > 2)
+    XFillPolygon (st->dpy, st->window, st->bg_gc,
+                  points, n, Nonconvex, CoordModeOrigin);
 }
 
 
@@ -532,10 +605,10 @@ random_squares (eraser_state *st)
     {
       int x = st->lines[i] % st->cols;
       int y = st->lines[i] / st->cols;
-      XFillRectangle (st->dpy, st->window, st->bg_gc,
-                      st->width  * x / st->cols,
-                      st->height * y / rows,
-                      size+1, size+1);
+      add_rectangle (st,
+                     st->width  * x / st->cols,
+                     st->height * y / rows,
+                     size+1, size+1);
     }
 
   if (st->ratio >= 1.0)
@@ -777,6 +850,8 @@ eraser_free (eraser_state *st)
   st->fn (st); /* Free any memory. May also draw, but that doesn't matter. */
   XFreeGC (st->dpy, st->fg_gc);
   XFreeGC (st->dpy, st->bg_gc);
+  if (st->segs) free (st->segs);
+  if (st->rects) free (st->rects);
   free (st);
 }
 
@@ -797,10 +872,21 @@ erase_window (Display *dpy, Window window, eraser_state *st)
   st->prev_ratio = st->ratio;
   st->ratio = (now - st->start_time) / duration;
 
+  /* If another step would not be done before the deadline, stop here:
+     eraser_free finishes the job with a single XClearWindow.  This keeps
+     slow or remote displays from dragging the erase out past eraseSeconds.
+   */
+  if (!first_p && now + st->step_cost >= st->stop_time)
+    st->ratio = 1.0;
+
   if (st->ratio < 1.0)
     {
+      double cost;
       st->fn (st);
+      flush_batch (st);
       XSync (st->dpy, False);
+      cost = double_time() - now;
+      st->step_cost = (first_p ? cost : (st->step_cost + cost) / 2);
     }
   else
     {
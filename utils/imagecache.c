@@ -0,0 +1,413 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * A cache of decoded, pre-scaled image files, shared by every hack that
+ * loads images through xscreensaver-getimage.  See imagecache.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_INTTYPES_H
+# include <inttypes.h>
+#endif
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "imagecache.h"
+#include "visual.h"
+#include "../driver/blurb.h"
+
+/* Least recently used entries are deleted past this. */
+#define IMAGE_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+#define IMAGE_CACHE_MAGIC "XSIMG001"
+
+typedef struct {
+  char magic[8];
+  int32_t width, height, depth, bits_per_pixel, bytes_per_line, byte_order;
+  uint32_t red_mask, green_mask, blue_mask;
+  int32_t dest_w, dest_h;
+  int32_t from_x, from_y;
+  int32_t geom_x, geom_y, geom_w, geom_h;
+  int64_t src_size, src_mtime;
+  int32_t name_len;	/* The source file name follows the header. */
+  int32_t data_offset;	/* Then the image data, at this offset. */
+} cache_header;
+
+/* What image_cache_free needs to unmap, hung off XImage.obdata. */
+typedef struct {
+  void *base;
+  size_t size;
+} cache_mapping;
+
+
+static char *
+cache_directory (void)
+{
+  const char *xdg = getenv ("XDG_CACHE_HOME");
+  const char *home = getenv ("HOME");
+  char *dir;
+
+  if (xdg && *xdg)
+    {
+      dir = (char *) malloc (strlen (xdg) + 20);
+      strcpy (dir, xdg);
+    }
+  else if (home && *home)
+    {
+      dir = (char *) malloc (strlen (home) + 30);
+      strcpy (dir, home);
+      strcat (dir, "/.cache");
+      mkdir (dir, 0700);
+    }
+  else
+    return 0;
+
+  strcat (dir, "/xscreensaver");
+  if (mkdir (dir, 0700) && errno != EEXIST)
+    {
+      free (dir);
+      return 0;
+    }
+  return dir;
+}
+
+
+/* FNV-1a */
+static void
+hash_bytes (unsigned long long *h, const void *data, size_t len)
+{
+  const unsigned char *s = (const unsigned char *) data;
+  while (len--)
+    {
+      *h ^= *s++;
+      *h *= 0x100000001b3ULL;
+    }
+}
+
+
+/* Fills in the fields of the header that identify the entry, and returns
+   the entry's pathname.  Free it.  Returns 0 if the source is not a file
+   we can stat.
+ */
+static char *
+cache_entry (Screen *screen, Visual *visual, const char *filename,
+             int dest_w, int dest_h, cache_header *hdr)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  struct stat st;
+  char *dir, *path;
+  int32_t v[6];
+
+  if (stat (filename, &st) || !S_ISREG (st.st_mode))
+    return 0;
+
+  memset (hdr, 0, sizeof(*hdr));
+  memcpy (hdr->magic, IMAGE_CACHE_MAGIC, sizeof(hdr->magic));
+  hdr->depth      = visual_depth (screen, visual);
+  hdr->byte_order = ImageByteOrder (dpy);
+  {
+    unsigned long r, g, b;
+    visual_rgb_masks (screen, visual, &r, &g, &b);
+    hdr->red_mask   = r;
+    hdr->green_mask = g;
+    hdr->blue_mask  = b;
+  }
+  hdr->dest_w    = dest_w;
+  hdr->dest_h    = dest_h;
+  hdr->src_size  = st.st_size;
+  hdr->src_mtime = st.st_mtime;
+  hdr->name_len  = strlen (filename);
+
+  /* The key doesn't include the file's size or date: a changed file
+     replaces its old entry instead of leaving it to age out. */
+  v[0] = dest_w;
+  v[1] = dest_h;
+  v[2] = hdr->depth;
+  v[3] = hdr->byte_order;
+  v[4] = hdr->red_mask;
+  v[5] = hdr->blue_mask;
+  hash_bytes (&h, filename, hdr->name_len);
+  hash_bytes (&h, v, sizeof(v));
+
+  dir = cache_directory ();
+  if (!dir) return 0;
+  path = (char *) malloc (strlen (dir) + 40);
+  sprintf (path, "%s/%016llx.img", dir, h);
+  free (dir);
+  return path;
+}
+
+
+XImage *
+image_cache_load (Screen *screen, Visual *visual, const char *filename,
+                  int dest_w, int dest_h,
+                  int *from_x, int *from_y,
+                  XRectangle *geom_ret, Bool verbose_p)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  cache_header want, *hdr;
+  char *path = cache_entry (screen, visual, filename, dest_w, dest_h, &want);
+  struct stat st;
+  void *base = MAP_FAILED;
+  XImage *image = 0;
+  cache_mapping *map;
+  int fd;
+
+  if (!path) return 0;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0) goto DONE;
+  if (fstat (fd, &st) || st.st_size < sizeof(*hdr)) goto DONE;
+  base = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) goto DONE;
+  hdr = (cache_header *) base;
+
+  if (memcmp (hdr->magic, want.magic, sizeof(hdr->magic)) ||
+      hdr->depth      != want.depth      ||
+      hdr->byte_order != want.byte_order ||
+      hdr->red_mask   != want.red_mask   ||
+      hdr->green_mask != want.green_mask ||
+      hdr->blue_mask  != want.blue_mask  ||
+      hdr->dest_w     != want.dest_w     ||
+      hdr->dest_h     != want.dest_h     ||
+      hdr->src_size   != want.src_size   ||
+      hdr->src_mtime  != want.src_mtime  ||
+      hdr->name_len   != want.name_len   ||
+      hdr->data_offset < 0 ||
+      hdr->data_offset < sizeof(*hdr) + hdr->name_len ||
+      hdr->width <= 0 || hdr->height <= 0 || hdr->bytes_per_line <= 0 ||
+      hdr->data_offset + (off_t) hdr->bytes_per_line * hdr->height
+        > st.st_size ||
+      memcmp ((char *) base + sizeof(*hdr), filename, hdr->name_len))
+    goto DONE;
+
+  image = XCreateImage (dpy, visual, hdr->depth, ZPixmap, 0,
+                        (char *) base + hdr->data_offset,
+                        hdr->width, hdr->height, 8, hdr->bytes_per_line);
+  if (!image) goto DONE;
+  if (image->bits_per_pixel != hdr->bits_per_pixel)
+    {
+      image->data = 0;
+      XDestroyImage (image);
+      image = 0;
+      goto DONE;
+    }
+
+  map = (cache_mapping *) malloc (sizeof(*map));
+  map->base = base;
+  map->size = st.st_size;
+  image->obdata = (XPointer) map;
+  base = MAP_FAILED;
+
+  *from_x = hdr->from_x;
+  *from_y = hdr->from_y;
+  if (geom_ret)
+    {
+      geom_ret->x      = hdr->geom_x;
+      geom_ret->y      = hdr->geom_y;
+      geom_ret->width  = hdr->geom_w;
+      geom_ret->height = hdr->geom_h;
+    }
+
+  utime (path, 0);	/* Mark it recently used. */
+
+  if (verbose_p)
+    fprintf (stderr, "%s: loaded %dx%d \"%s\" from cache %s\n", blurb(),
+             image->width, image->height, filename, path);
+
+ DONE:
+  if (base != MAP_FAILED) munmap (base, st.st_size);
+  if (fd >= 0) close (fd);
+  free (path);
+  return image;
+}
+
+
+void
+image_cache_free (XImage *image)
+{
+  cache_mapping *map = (cache_mapping *) image->obdata;
+  if (map)
+    {
+      munmap (map->base, map->size);
+      free (map);
+    }
+  image->obdata = 0;
+  image->data = 0;
+  XDestroyImage (image);
+}
+
+
+typedef struct {
+  char *path;
+  off_t size;
+  time_t mtime;
+} cache_file;
+
+static int
+cmp_cache_files (const void *a, const void *b)
+{
+  time_t ta = ((const cache_file *) a)->mtime;
+  time_t tb = ((const cache_file *) b)->mtime;
+  return (ta < tb ? -1 : ta > tb ? 1 : 0);
+}
+
+
+/* Deletes the least recently used entries until the cache fits. */
+static void
+image_cache_trim (Bool verbose_p)
+{
+  char *dir = cache_directory ();
+  DIR *d;
+  struct dirent *de;
+  cache_file *files = 0;
+  int nfiles = 0, files_size = 0, i;
+  off_t total = 0;
+
+  if (!dir) return;
+  d = opendir (dir);
+  if (!d) goto DONE;
+
+  while ((de = readdir (d)))
+    {
+      struct stat st;
+      char *path;
+      size_t L = strlen (de->d_name);
+      if (L < 5 || strcmp (de->d_name + L - 4, ".img"))
+        continue;
+      path = (char *) malloc (strlen (dir) + L + 2);
+      sprintf (path, "%s/%s", dir, de->d_name);
+      if (stat (path, &st))
+        {
+          free (path);
+          continue;
+        }
+      if (nfiles >= files_size)
+        {
+          files_size = files_size * 2 + 32;
+          files = (cache_file *) realloc (files, files_size * sizeof(*files));
+          if (!files) abort();
+        }
+      files[nfiles].path  = path;
+      files[nfiles].size  = st.st_size;
+      files[nfiles].mtime = st.st_mtime;
+      total += st.st_size;
+      nfiles++;
+    }
+  closedir (d);
+
+  qsort (files, nfiles, sizeof(*files), cmp_cache_files);
+  for (i = 0; i < nfiles && total > IMAGE_CACHE_MAX_BYTES; i++)
+    {
+      if (verbose_p)
+        fprintf (stderr, "%s: expiring %s\n", blurb(), files[i].path);
+      unlink (files[i].path);
+      total -= files[i].size;
+    }
+
+  for (i = 0; i < nfiles; i++)
+    free (files[i].path);
+  if (files) free (files);
+
+ DONE:
+  free (dir);
+}
+
+
+void
+image_cache_save (Screen *screen, Visual *visual, const char *filename,
+                  int dest_w, int dest_h,
+                  XImage *image, int from_x, int from_y,
+                  const XRectangle *geom, Bool verbose_p)
+{
+  cache_header hdr;
+  char *path = cache_entry (screen, visual, filename, dest_w, dest_h, &hdr);
+  char *tmp;
+  FILE *out;
+  size_t data_size = (size_t) image->bytes_per_line * image->height;
+  static const char pad[16] = { 0, };
+  Bool ok;
+
+  if (!path) return;
+  if (image->format != ZPixmap || image->depth != hdr.depth)
+    {
+      free (path);
+      return;
+    }
+
+  hdr.width          = image->width;
+  hdr.height         = image->height;
+  hdr.bits_per_pixel = image->bits_per_pixel;
+  hdr.bytes_per_line = image->bytes_per_line;
+  hdr.from_x = from_x;
+  hdr.from_y = from_y;
+  hdr.geom_x = geom->x;
+  hdr.geom_y = geom->y;
+  hdr.geom_w = geom->width;
+  hdr.geom_h = geom->height;
+  hdr.data_offset = (sizeof(hdr) + hdr.name_len + 15) & ~15;
+
+  /* Write a temp file and rename it, so that another getimage never maps
+     a partial entry. */
+  tmp = (char *) malloc (strlen (path) + 20);
+  sprintf (tmp, "%s.%lu", path, (unsigned long) getpid());
+
+  {
+    int fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    out = (fd >= 0 ? fdopen (fd, "wb") : 0);
+    if (fd >= 0 && !out) close (fd);
+  }
+  if (!out)
+    {
+      free (tmp);
+      free (path);
+      return;
+    }
+
+  ok = (fwrite (&hdr, sizeof(hdr), 1, out) == 1 &&
+        fwrite (filename, 1, hdr.name_len, out) == hdr.name_len &&
+        fwrite (pad, 1, hdr.data_offset - sizeof(hdr) - hdr.name_len, out)
+          == hdr.data_offset - sizeof(hdr) - hdr.name_len &&
+        fwrite (image->data, 1, data_size, out) == data_size);
+  if (fclose (out)) ok = False;
+
+  if (ok && !rename (tmp, path))
+    {
+      if (verbose_p)
+        fprintf (stderr, "%s: cached %dx%d \"%s\" as %s\n", blurb(),
+                 image->width, image->height, filename, path);
+      image_cache_trim (verbose_p);
+    }
+  else
+    unlink (tmp);
+
+  free (tmp);
+  free (path);
+}
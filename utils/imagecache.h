@@ -0,0 +1,50 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+#ifndef _XSCREENSAVER_IMAGECACHE_H_
+#define _XSCREENSAVER_IMAGECACHE_H_
+
+/* A cache of image files that have already been decoded and scaled to fit
+   a particular window size, so that the next hack that asks for the same
+   file at the same size just maps it in and does one XPutImage.
+
+   Entries live in ~/.cache/xscreensaver/ (or $XDG_CACHE_HOME) as raw
+   ZPixmap data with a small header, keyed by the file's name, the target
+   size, and the visual's pixel layout.  The file's size and modification
+   time are kept in the header, and an entry whose file has changed since
+   is not used.
+
+   Only image files are cached.  Desktop screenshots are never written to
+   disk: they may well contain the contents of a locked screen.
+ */
+
+/* Returns an image of the given file, already scaled for a dest_w x dest_h
+   drawable, or NULL if it is not in the cache.  The image data is mapped
+   read-only; release it with image_cache_free, not XDestroyImage.
+   geom_ret is the part of the drawable the image covers, and
+   from_x/from_y is where in the image to start copying, as returned by
+   compute_image_scaling().
+ */
+extern XImage *image_cache_load (Screen *, Visual *, const char *filename,
+                                 int dest_w, int dest_h,
+                                 int *from_x, int *from_y,
+                                 XRectangle *geom_ret, Bool verbose_p);
+
+/* Saves a scaled image for later image_cache_load calls.  Failure is not
+   an error, we just do without.  Trims the cache to its size limit. */
+extern void image_cache_save (Screen *, Visual *, const char *filename,
+                              int dest_w, int dest_h,
+                              XImage *, int from_x, int from_y,
+                              const XRectangle *geom, Bool verbose_p);
+
+extern void image_cache_free (XImage *);
+
+#endif /* _XSCREENSAVER_IMAGECACHE_H_ */
@@ -0,0 +1,105 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * A threadpool for imgfilter.c to split its rows across.  This is separate
+ * so that programs that use imgfilter.o without it need not link with the
+ * thread library.
+ */
+
+#include "utils.h"
+#include "imgfilter.h"
+#include "thread_util.h"
+
+typedef struct {
+  imgfilter_threads pub;	/* Must be first */
+  struct threadpool pool;
+
+  /* The current stripe call. */
+  void (*fn) (void *closure, int y0, int y1);
+  void *closure;
+  int nrows;
+} imgfilter_pool;
+
+typedef struct {
+  imgfilter_pool *parent;
+  unsigned id;
+} imgfilter_thread;
+
+
+static int
+imgfilter_thread_create (void *self, struct threadpool *pool, unsigned id)
+{
+  imgfilter_thread *t = (imgfilter_thread *) self;
+  t->parent = GET_PARENT_OBJ (imgfilter_pool, pool, pool);
+  t->id = id;
+  return 0;
+}
+
+
+static void
+imgfilter_thread_destroy (void *self)
+{
+}
+
+
+static void
+imgfilter_thread_run (void *self)
+{
+  imgfilter_thread *t = (imgfilter_thread *) self;
+  imgfilter_pool *p = t->parent;
+  int y0 = (int) ((long) p->nrows * t->id       / p->pool.count);
+  int y1 = (int) ((long) p->nrows * (t->id + 1) / p->pool.count);
+  if (y1 > y0)
+    p->fn (p->closure, y0, y1);
+}
+
+
+static void
+imgfilter_pool_stripe (imgfilter_threads *threads,
+                       void (*fn) (void *closure, int y0, int y1),
+                       void *closure, int nrows)
+{
+  imgfilter_pool *p = (imgfilter_pool *) threads;
+  p->fn = fn;
+  p->closure = closure;
+  p->nrows = nrows;
+  threadpool_run (&p->pool, imgfilter_thread_run);
+  threadpool_wait (&p->pool);
+}
+
+
+imgfilter_threads *
+imgfilter_threads_new (Display *dpy)
+{
+  static const struct threadpool_class cls = {
+    sizeof(imgfilter_thread),
+    imgfilter_thread_create,
+    imgfilter_thread_destroy
+  };
+  imgfilter_pool *p = (imgfilter_pool *) calloc (1, sizeof(*p));
+  if (!p) return 0;
+  if (threadpool_create (&p->pool, &cls, dpy, hardware_concurrency (dpy)))
+    {
+      free (p);
+      return 0;
+    }
+  p->pub.stripe = imgfilter_pool_stripe;
+  return &p->pub;
+}
+
+
+void
+imgfilter_threads_free (imgfilter_threads *threads)
+{
+  imgfilter_pool *p = (imgfilter_pool *) threads;
+  if (!p) return;
+  threadpool_destroy (&p->pool);
+  free (p);
+}
@@ -0,0 +1,747 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * Separable blurs, resampling and XImage format conversion.  See imgfilter.h.
+ *
+ * Everything is done in float, a row at a time: each filter tap is one
+ * "acc += k * row" over a whole row of interleaved channels, which the
+ * compiler vectorizes; the SSE2 versions below are for compilers that
+ * don't, or not at -O2.
+ */
+
+#include "utils.h"
+#include "imgfilter.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+
+static void
+run_stripes (imgfilter_threads *threads,
+             void (*fn) (void *closure, int y0, int y1),
+             void *closure, int nrows)
+{
+  if (nrows <= 0) return;
+  if (threads)
+    threads->stripe (threads, fn, closure, nrows);
+  else
+    fn (closure, 0, nrows);
+}
+
+
+/* acc[i] += k * src[i] */
+static void
+accumulate (float *acc, const float *src, float k, int n)
+{
+  int i = 0;
+#ifdef __SSE2__
+  __m128 kk = _mm_set1_ps (k);
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps (acc + i,
+                   _mm_add_ps (_mm_loadu_ps (acc + i),
+                               _mm_mul_ps (kk, _mm_loadu_ps (src + i))));
+#endif
+  for (; i < n; i++)
+    acc[i] += k * src[i];
+}
+
+
+/* acc[i] += k * src[i], from bytes */
+static void
+accumulate_bytes (float *acc, const unsigned char *src, float k, int n)
+{
+  int i = 0;
+#ifdef __SSE2__
+  __m128 kk = _mm_set1_ps (k);
+  __m128i z = _mm_setzero_si128 ();
+  for (; i + 16 <= n; i += 16)
+    {
+      __m128i b  = _mm_loadu_si128 ((const __m128i *) (src + i));
+      __m128i lo = _mm_unpacklo_epi8 (b, z);
+      __m128i hi = _mm_unpackhi_epi8 (b, z);
+      __m128 f0 = _mm_cvtepi32_ps (_mm_unpacklo_epi16 (lo, z));
+      __m128 f1 = _mm_cvtepi32_ps (_mm_unpackhi_epi16 (lo, z));
+      __m128 f2 = _mm_cvtepi32_ps (_mm_unpacklo_epi16 (hi, z));
+      __m128 f3 = _mm_cvtepi32_ps (_mm_unpackhi_epi16 (hi, z));
+      _mm_storeu_ps (acc+i,    _mm_add_ps (_mm_loadu_ps (acc+i),
+                                           _mm_mul_ps (kk, f0)));
+      _mm_storeu_ps (acc+i+4,  _mm_add_ps (_mm_loadu_ps (acc+i+4),
+                                           _mm_mul_ps (kk, f1)));
+      _mm_storeu_ps (acc+i+8,  _mm_add_ps (_mm_loadu_ps (acc+i+8),
+                                           _mm_mul_ps (kk, f2)));
+      _mm_storeu_ps (acc+i+12, _mm_add_ps (_mm_loadu_ps (acc+i+12),
+                                           _mm_mul_ps (kk, f3)));
+    }
+#endif
+  for (; i < n; i++)
+    acc[i] += k * src[i];
+}
+
+
+/* dst[i] = src[i] * k, rounded and clamped to 0-255. */
+static void
+store_bytes (unsigned char *dst, const float *src, float k, int n)
+{
+  int i = 0;
+#ifdef __SSE2__
+  __m128 kk = _mm_set1_ps (k);
+  for (; i + 16 <= n; i += 16)
+    {
+      /* The packs saturate, which does the clamping. */
+      __m128i a = _mm_cvtps_epi32 (_mm_mul_ps (kk, _mm_loadu_ps (src+i)));
+      __m128i b = _mm_cvtps_epi32 (_mm_mul_ps (kk, _mm_loadu_ps (src+i+4)));
+      __m128i c = _mm_cvtps_epi32 (_mm_mul_ps (kk, _mm_loadu_ps (src+i+8)));
+      __m128i d = _mm_cvtps_epi32 (_mm_mul_ps (kk, _mm_loadu_ps (src+i+12)));
+      _mm_storeu_si128 ((__m128i *) (dst + i),
+                        _mm_packus_epi16 (_mm_packs_epi32 (a, b),
+                                          _mm_packs_epi32 (c, d)));
+    }
+#endif
+  for (; i < n; i++)
+    {
+      float v = src[i] * k + 0.5f;
+      dst[i] = (v <= 0 ? 0 : v >= 255 ? 255 : (int) v);
+    }
+}
+
+
+static int
+clamp_index (int i, int n)
+{
+  return (i < 0 ? 0 : i >= n ? n-1 : i);
+}
+
+
+/* Blurs.
+ */
+
+typedef struct {
+  unsigned char *data;
+  int width, height, stride, channels;
+  int radius;
+  float *kernel;		/* 2*radius+1 taps, Gaussian only */
+  float *tmp;			/* The horizontal pass, width*channels*height */
+  Bool failed;
+} blur_closure;
+
+
+static void
+gaussian_rows_h (void *closure, int y0, int y1)
+{
+  blur_closure *c = (blur_closure *) closure;
+  int ch = c->channels;
+  int n = c->width * ch;
+  int r = c->radius;
+  float *pad = (float *) malloc ((c->width + 2*r) * ch * sizeof(*pad));
+  int x, y, i;
+
+  if (!pad)
+    {
+      c->failed = True;
+      return;
+    }
+
+  for (y = y0; y < y1; y++)
+    {
+      const unsigned char *row = c->data + y * c->stride;
+      float *out = c->tmp + y * n;
+
+      for (x = 0; x < r; x++)
+        for (i = 0; i < ch; i++)
+          {
+            pad[x * ch + i] = row[i];
+            pad[(r + c->width + x) * ch + i] = row[n - ch + i];
+          }
+      for (i = 0; i < n; i++)
+        pad[r * ch + i] = row[i];
+
+      memset (out, 0, n * sizeof(*out));
+      for (i = 0; i <= 2*r; i++)
+        accumulate (out, pad + i * ch, c->kernel[i], n);
+    }
+
+  free (pad);
+}
+
+
+static void
+gaussian_rows_v (void *closure, int y0, int y1)
+{
+  blur_closure *c = (blur_closure *) closure;
+  int n = c->width * c->channels;
+  int r = c->radius;
+  float *acc = (float *) malloc (n * sizeof(*acc));
+  int y, i;
+
+  if (!acc)
+    {
+      c->failed = True;
+      return;
+    }
+
+  for (y = y0; y < y1; y++)
+    {
+      memset (acc, 0, n * sizeof(*acc));
+      for (i = 0; i <= 2*r; i++)
+        accumulate (acc, c->tmp + clamp_index (y + i - r, c->height) * n,
+                    c->kernel[i], n);
+      store_bytes (c->data + y * c->stride, acc, 1, n);
+    }
+
+  free (acc);
+}
+
+
+Bool
+imgfilter_gaussian_blur (unsigned char *data,
+                         int width, int height, int stride,
+                         int channels, double sigma,
+                         imgfilter_threads *threads)
+{
+  blur_closure c;
+  double sum = 0;
+  int i;
+
+  if (width <= 0 || height <= 0 || sigma <= 0) return True;
+
+  memset (&c, 0, sizeof(c));
+  c.data     = data;
+  c.width    = width;
+  c.height   = height;
+  c.stride   = stride;
+  c.channels = channels;
+  c.radius   = (int) ceil (sigma * 3);
+
+  c.kernel = (float *) malloc ((2 * c.radius + 1) * sizeof(*c.kernel));
+  c.tmp = (float *) malloc (width * channels * height * sizeof(*c.tmp));
+  if (!c.kernel || !c.tmp)
+    {
+      free (c.kernel);
+      free (c.tmp);
+      return False;
+    }
+
+  for (i = -c.radius; i <= c.radius; i++)
+    sum += exp (-(i * i) / (2 * sigma * sigma));
+  for (i = -c.radius; i <= c.radius; i++)
+    c.kernel[i + c.radius] = exp (-(i * i) / (2 * sigma * sigma)) / sum;
+
+  run_stripes (threads, gaussian_rows_h, &c, height);
+  if (!c.failed)
+    run_stripes (threads, gaussian_rows_v, &c, height);
+
+  free (c.kernel);
+  free (c.tmp);
+  return !c.failed;
+}
+
+
+static void
+box_rows_h (void *closure, int y0, int y1)
+{
+  blur_closure *c = (blur_closure *) closure;
+  int ch = c->channels;
+  int w = c->width;
+  int r = c->radius;
+  int x, y, i, j;
+
+  for (y = y0; y < y1; y++)
+    {
+      const unsigned char *row = c->data + y * c->stride;
+      float *out = c->tmp + y * w * ch;
+
+      /* A running sum along the row, for each channel. */
+      for (i = 0; i < ch; i++)
+        {
+          int sum = 0;
+          for (j = -r; j <= r; j++)
+            sum += row[clamp_index (j, w) * ch + i];
+          for (x = 0; x < w; x++)
+            {
+              out[x * ch + i] = sum;
+              sum += (row[clamp_index (x + r + 1, w) * ch + i] -
+                      row[clamp_index (x - r,     w) * ch + i]);
+            }
+        }
+    }
+}
+
+
+static void
+box_rows_v (void *closure, int y0, int y1)
+{
+  blur_closure *c = (blur_closure *) closure;
+  int n = c->width * c->channels;
+  int r = c->radius;
+  float scale = 1.0f / ((2*r + 1) * (2*r + 1));
+  float *acc = (float *) calloc (n, sizeof(*acc));
+  int y, i;
+
+  if (!acc)
+    {
+      c->failed = True;
+      return;
+    }
+
+  /* The sums are of whole numbers, so sliding the window is exact. */
+  for (i = y0 - r; i <= y0 + r; i++)
+    accumulate (acc, c->tmp + clamp_index (i, c->height) * n, 1, n);
+
+  for (y = y0; y < y1; y++)
+    {
+      store_bytes (c->data + y * c->stride, acc, scale, n);
+      accumulate (acc, c->tmp + clamp_index (y + r + 1, c->height) * n,  1, n);
+      accumulate (acc, c->tmp + clamp_index (y - r,     c->height) * n, -1, n);
+    }
+
+  free (acc);
+}
+
+
+Bool
+imgfilter_box_blur (unsigned char *data,
+                    int width, int height, int stride,
+                    int channels, int radius,
+                    imgfilter_threads *threads)
+{
+  blur_closure c;
+
+  if (width <= 0 || height <= 0 || radius <= 0) return True;
+
+  memset (&c, 0, sizeof(c));
+  c.data     = data;
+  c.width    = width;
+  c.height   = height;
+  c.stride   = stride;
+  c.channels = channels;
+  c.radius   = radius;
+
+  c.tmp = (float *) malloc (width * channels * height * sizeof(*c.tmp));
+  if (!c.tmp) return False;
+
+  run_stripes (threads, box_rows_h, &c, height);
+  run_stripes (threads, box_rows_v, &c, height);
+
+  free (c.tmp);
+  return !c.failed;
+}
+
+
+/* Resampling.
+ */
+
+typedef struct {
+  int first;		/* First source pixel that contributes */
+  int count;		/* Number of source pixels that contribute */
+  int weights;		/* Index of the first weight in the weight table */
+} scale_span;
+
+struct imgfilter_scaler {
+  int src_width, src_height, dst_width, dst_height, channels;
+  scale_span *xspans, *yspans;
+  float *xweights, *yweights;
+
+  /* The current imgfilter_scaler_run. */
+  const unsigned char *src;
+  int src_stride, src_first;
+  unsigned char *dst;
+  int dst_stride, y0;
+  Bool failed;
+};
+
+
+/* For each of dst_n output pixels, which of src_n source pixels it covers,
+   and by how much. */
+static Bool
+make_scale_spans (int src_n, int dst_n, scale_span **spans_ret,
+                  float **weights_ret)
+{
+  double scale = (double) src_n / dst_n;
+  int maxn = (dst_n <= src_n ? (int) scale + 2 : 2);
+  scale_span *spans = (scale_span *) malloc (dst_n * sizeof(*spans));
+  float *w = (float *) malloc (dst_n * maxn * sizeof(*w));
+  int i, nw = 0;
+
+  if (!spans || !w)
+    {
+      free (spans);
+      free (w);
+      return False;
+    }
+
+  for (i = 0; i < dst_n; i++)
+    {
+      spans[i].weights = nw;
+
+      if (dst_n <= src_n)	/* Area average */
+        {
+          double start = i * scale;
+          double end   = (i + 1) * scale;
+          int j = start;
+          int j1 = (int) ceil (end);
+          if (j1 > src_n) j1 = src_n;
+          if (j1 <= j) j1 = j + 1;
+
+          spans[i].first = j;
+          spans[i].count = j1 - j;
+          for (; j < j1; j++)
+            {
+              double lo = (j > start ? j : start);
+              double hi = (j + 1 < end ? j + 1 : end);
+              w[nw++] = (hi > lo ? (hi - lo) / scale : 0);
+            }
+        }
+      else			/* Linear, between pixel centers */
+        {
+          double pos = (i + 0.5) * scale - 0.5;
+          int j = (int) floor (pos);
+          double f = pos - j;
+          if (j < 0)
+            j = 0, f = 0;
+          else if (j >= src_n - 1)
+            j = src_n - 1, f = 0;
+
+          spans[i].first = j;
+          spans[i].count = (f > 0 ? 2 : 1);
+          w[nw++] = 1 - f;
+          if (f > 0)
+            w[nw++] = f;
+        }
+    }
+
+  *spans_ret = spans;
+  *weights_ret = w;
+  return True;
+}
+
+
+imgfilter_scaler *
+imgfilter_scaler_new (int src_width, int src_height,
+                      int dst_width, int dst_height, int channels)
+{
+  imgfilter_scaler *s;
+  if (src_width <= 0 || src_height <= 0 ||
+      dst_width <= 0 || dst_height <= 0)
+    return 0;
+  s = (imgfilter_scaler *) calloc (1, sizeof(*s));
+  if (!s) return 0;
+  s->src_width  = src_width;
+  s->src_height = src_height;
+  s->dst_width  = dst_width;
+  s->dst_height = dst_height;
+  s->channels   = channels;
+  if (!make_scale_spans (src_width,  dst_width,  &s->xspans, &s->xweights) ||
+      !make_scale_spans (src_height, dst_height, &s->yspans, &s->yweights))
+    {
+      imgfilter_scaler_free (s);
+      return 0;
+    }
+  return s;
+}
+
+
+void
+imgfilter_scaler_free (imgfilter_scaler *s)
+{
+  if (!s) return;
+  free (s->xspans);
+  free (s->yspans);
+  free (s->xweights);
+  free (s->yweights);
+  free (s);
+}
+
+
+void
+imgfilter_scaler_rows (const imgfilter_scaler *s, int y0, int y1,
+                       int *src_first_ret, int *src_end_ret)
+{
+  /* The spans are in order, so the last one reaches the furthest. */
+  *src_first_ret = s->yspans[y0].first;
+  *src_end_ret   = s->yspans[y1-1].first + s->yspans[y1-1].count;
+}
+
+
+static void
+scale_rows (void *closure, int ya, int yb)
+{
+  imgfilter_scaler *s = (imgfilter_scaler *) closure;
+  int ch = s->channels;
+  int sn = s->src_width * ch;
+  int dn = s->dst_width * ch;
+  float *acc = (float *) malloc ((sn + dn) * sizeof(*acc));
+  float *out = acc + sn;
+  int x, y, i, j, k;
+
+  if (!acc)
+    {
+      s->failed = True;
+      return;
+    }
+
+  for (y = s->y0 + ya; y < s->y0 + yb; y++)
+    {
+      const scale_span *ys = &s->yspans[y];
+
+      /* Vertically, a whole source row at a time... */
+      memset (acc, 0, sn * sizeof(*acc));
+      for (j = 0; j < ys->count; j++)
+        accumulate_bytes (acc,
+                          s->src + (ys->first + j - s->src_first) *
+                          s->src_stride,
+                          s->yweights[ys->weights + j], sn);
+
+      /* ...then horizontally. */
+      for (x = 0; x < s->dst_width; x++)
+        {
+          const scale_span *xs = &s->xspans[x];
+          const float *wx = s->xweights + xs->weights;
+          const float *p = acc + xs->first * ch;
+          float *o = out + x * ch;
+          for (k = 0; k < ch; k++)
+            o[k] = 0;
+          for (i = 0; i < xs->count; i++, p += ch)
+            for (k = 0; k < ch; k++)
+              o[k] += p[k] * wx[i];
+        }
+
+      store_bytes (s->dst + (y - s->y0) * s->dst_stride, out, 1, dn);
+    }
+
+  free (acc);
+}
+
+
+Bool
+imgfilter_scaler_run (imgfilter_scaler *s,
+                      const unsigned char *src, int src_stride, int src_first,
+                      unsigned char *dst, int dst_stride, int y0, int y1,
+                      imgfilter_threads *threads)
+{
+  s->src = src;
+  s->src_stride = src_stride;
+  s->src_first = src_first;
+  s->dst = dst;
+  s->dst_stride = dst_stride;
+  s->y0 = y0;
+  s->failed = False;
+  run_stripes (threads, scale_rows, s, y1 - y0);
+  return !s->failed;
+}
+
+
+Bool
+imgfilter_scale (const unsigned char *src,
+                 int src_width, int src_height, int src_stride,
+                 unsigned char *dst,
+                 int dst_width, int dst_height, int dst_stride,
+                 int channels, imgfilter_threads *threads)
+{
+  imgfilter_scaler *s = imgfilter_scaler_new (src_width, src_height,
+                                              dst_width, dst_height,
+                                              channels);
+  Bool ok;
+  if (!s) return False;
+  ok = imgfilter_scaler_run (s, src, src_stride, 0, dst, dst_stride,
+                             0, dst_height, threads);
+  imgfilter_scaler_free (s);
+  return ok;
+}
+
+
+/* XImages.
+ */
+
+typedef struct {
+  int shift[4], bits[4];	/* red, green, blue, other */
+} pixel_layout;
+
+
+static Bool
+bigendian (void)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  u.i = 1;
+  return !u.c[0];
+}
+
+
+/* Returns the position of the lowest field in the mask, and its width,
+   keeping only the top 8 bits of wider fields. */
+static void
+decode_mask (unsigned long mask, int *shift_ret, int *bits_ret)
+{
+  int shift = 0, bits = 0;
+  if (mask)
+    {
+      while (! (mask & 1)) mask >>= 1, shift++;
+      while (mask & 1)     mask >>= 1, bits++;
+    }
+  if (bits > 8)
+    shift += bits - 8, bits = 8;
+  *shift_ret = shift;
+  *bits_ret = bits;
+}
+
+
+static Bool
+get_layout (XImage *image, pixel_layout *L)
+{
+  unsigned long rgb = image->red_mask | image->green_mask | image->blue_mask;
+  unsigned long all = (image->depth >= 32 ? 0xFFFFFFFFUL
+                       : (1UL << image->depth) - 1);
+  if (!image->red_mask || !image->green_mask || !image->blue_mask ||
+      image->format != ZPixmap)
+    return False;
+  decode_mask (image->red_mask,   &L->shift[0], &L->bits[0]);
+  decode_mask (image->green_mask, &L->shift[1], &L->bits[1]);
+  decode_mask (image->blue_mask,  &L->shift[2], &L->bits[2]);
+  decode_mask (all & ~rgb, &L->shift[3], &L->bits[3]);
+  return True;
+}
+
+
+/* Whether pixels are 32-bit words in our own byte order, with every field
+   a whole byte, so that we can do without XGetPixel and XPutPixel.
+   There might be no alpha byte (depth 24). */
+static Bool
+fast_layout_p (XImage *image, const pixel_layout *L)
+{
+  int i;
+  if (image->bits_per_pixel != 32 ||
+      image->byte_order != (bigendian() ? MSBFirst : LSBFirst))
+    return False;
+  for (i = 0; i < 4; i++)
+    if (L->shift[i] % 8 || (L->bits[i] != 8 && !(i == 3 && L->bits[i] == 0)))
+      return False;
+  return True;
+}
+
+
+Bool
+imgfilter_ximage_to_rgba (XImage *image, int y0, int y1,
+                          unsigned char *rgba, int stride)
+{
+  pixel_layout L;
+  int x, y, i;
+  if (!get_layout (image, &L)) return False;
+
+  if (fast_layout_p (image, &L))
+    {
+      unsigned int amask = (L.bits[3] ? 0xFF : 0);
+      for (y = y0; y < y1; y++)
+        {
+          const unsigned int *in = (const unsigned int *)
+            (image->data + y * image->bytes_per_line);
+          unsigned char *out = rgba + (y - y0) * stride;
+          for (x = 0; x < image->width; x++)
+            {
+              out[x*4]   = in[x] >> L.shift[0];
+              out[x*4+1] = in[x] >> L.shift[1];
+              out[x*4+2] = in[x] >> L.shift[2];
+              out[x*4+3] = ((in[x] >> L.shift[3]) & amask) | (amask ^ 0xFF);
+            }
+        }
+    }
+  else
+    for (y = y0; y < y1; y++)
+      {
+        unsigned char *out = rgba + (y - y0) * stride;
+        for (x = 0; x < image->width; x++)
+          {
+            unsigned long p = XGetPixel (image, x, y);
+            for (i = 0; i < 4; i++)
+              {
+                unsigned long max = (1UL << L.bits[i]) - 1;
+                *out++ = (L.bits[i] == 0 ? 0xFF :
+                          ((p >> L.shift[i]) & max) * 255 / max);
+              }
+          }
+      }
+  return True;
+}
+
+
+Bool
+imgfilter_rgba_to_ximage (const unsigned char *rgba, int stride,
+                          XImage *image, int y0, int y1)
+{
+  pixel_layout L;
+  int x, y, i;
+  if (!get_layout (image, &L)) return False;
+
+  if (fast_layout_p (image, &L))
+    {
+      unsigned int amask = (L.bits[3] ? 0xFF : 0);
+      for (y = y0; y < y1; y++)
+        {
+          unsigned int *out = (unsigned int *)
+            (image->data + y * image->bytes_per_line);
+          const unsigned char *in = rgba + (y - y0) * stride;
+          for (x = 0; x < image->width; x++)
+            out[x] = (((unsigned int) in[x*4]   << L.shift[0]) |
+                      ((unsigned int) in[x*4+1] << L.shift[1]) |
+                      ((unsigned int) in[x*4+2] << L.shift[2]) |
+                      ((unsigned int) (in[x*4+3] & amask) << L.shift[3]));
+        }
+    }
+  else
+    for (y = y0; y < y1; y++)
+      {
+        const unsigned char *in = rgba + (y - y0) * stride;
+        for (x = 0; x < image->width; x++)
+          {
+            unsigned long p = 0;
+            for (i = 0; i < 4; i++, in++)
+              if (L.bits[i])
+                p |= (unsigned long) (*in >> (8 - L.bits[i])) << L.shift[i];
+            XPutPixel (image, x, y, p);
+          }
+      }
+  return True;
+}
+
+
+Bool
+imgfilter_scale_ximage (XImage *from, XImage *to, imgfilter_threads *threads)
+{
+  pixel_layout L;
+  unsigned char *a, *b;
+  Bool ok;
+
+  if (!get_layout (from, &L))
+    {
+      /* Color-mapped: averaging pixel values would be nonsense. */
+      double xscale = (double) from->width  / to->width;
+      double yscale = (double) from->height / to->height;
+      int x, y;
+      for (y = 0; y < to->height; y++)
+        for (x = 0; x < to->width; x++)
+          XPutPixel (to, x, y, XGetPixel (from, x * xscale, y * yscale));
+      return True;
+    }
+
+  a = (unsigned char *) malloc (from->width * from->height * 4);
+  b = (unsigned char *) malloc (to->width * to->height * 4);
+  ok = (a && b);
+  if (ok)
+    {
+      imgfilter_ximage_to_rgba (from, 0, from->height, a, from->width * 4);
+      ok = imgfilter_scale (a, from->width, from->height, from->width * 4,
+                            b, to->width, to->height, to->width * 4,
+                            4, threads);
+    }
+  if (ok)
+    ok = imgfilter_rgba_to_ximage (b, to->width * 4, to, 0, to->height);
+  free (a);
+  free (b);
+  return ok;
+}
@@ -0,0 +1,109 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+#ifndef __XSCREENSAVER_IMGFILTER_H__
+#define __XSCREENSAVER_IMGFILTER_H__
+
+/* Blurring, scaling and pixel format conversion of 8-bit-per-channel
+   images, for the hacks that load or grab an image and then need it
+   smoother, smaller or bigger.
+
+   Images are arrays of bytes with 'channels' interleaved channels per
+   pixel (1 for a gray plane, 4 for RGBA) and 'stride' bytes per row.
+   The filters are separable, and their inner loops run along whole rows
+   so that they vectorize.
+
+   Every function that takes an 'imgfilter_threads' pointer accepts NULL,
+   meaning do all the work on the calling thread.  To spread the work
+   across CPUs, create one with imgfilter_threads_new, which lives in
+   imgfilter-threads.o and needs the thread library; imgfilter.o doesn't.
+
+   Functions that return Bool return False if they ran out of memory.
+ */
+
+typedef struct imgfilter_threads imgfilter_threads;
+struct imgfilter_threads {
+  /* Calls fn on consecutive bands of the rows 0 ... nrows-1, possibly in
+     parallel, and returns when they have all been done. */
+  void (*stripe) (imgfilter_threads *,
+                  void (*fn) (void *closure, int y0, int y1),
+                  void *closure, int nrows);
+};
+
+/* Returns NULL if threads can't be had, which is fine to pass around. */
+extern imgfilter_threads *imgfilter_threads_new (Display *);
+extern void imgfilter_threads_free (imgfilter_threads *);
+
+
+/* Gaussian blur, in place.  Edge pixels are repeated outward. */
+extern Bool imgfilter_gaussian_blur (unsigned char *data,
+                                     int width, int height, int stride,
+                                     int channels, double sigma,
+                                     imgfilter_threads *);
+
+/* Blurs each pixel to the average of the (2*radius+1)^2 square around it,
+   in place.  Costs the same no matter how big the radius.  Three of these
+   in a row are a passable Gaussian. */
+extern Bool imgfilter_box_blur (unsigned char *data,
+                                int width, int height, int stride,
+                                int channels, int radius,
+                                imgfilter_threads *);
+
+
+/* Resizes an image.  Along an axis that is shrinking, each output pixel is
+   the average of the area of source pixels it covers; along an axis that
+   is growing, it is a linear interpolation of the two nearest ones.
+ */
+extern Bool imgfilter_scale (const unsigned char *src,
+                             int src_width, int src_height, int src_stride,
+                             unsigned char *dst,
+                             int dst_width, int dst_height, int dst_stride,
+                             int channels, imgfilter_threads *);
+
+/* The same thing, for callers that have only some of the source rows in
+   memory at a time, such as a JPEG decoder.  imgfilter_scaler_rows says
+   which source rows are needed to produce output rows y0 ... y1-1, and
+   imgfilter_scaler_run produces them from a buffer whose first row is
+   source row 'src_first', writing output row y0 at 'dst'.
+ */
+typedef struct imgfilter_scaler imgfilter_scaler;
+extern imgfilter_scaler *imgfilter_scaler_new (int src_width, int src_height,
+                                               int dst_width, int dst_height,
+                                               int channels);
+extern void imgfilter_scaler_free (imgfilter_scaler *);
+extern void imgfilter_scaler_rows (const imgfilter_scaler *, int y0, int y1,
+                                   int *src_first_ret, int *src_end_ret);
+extern Bool imgfilter_scaler_run (imgfilter_scaler *,
+                                  const unsigned char *src, int src_stride,
+                                  int src_first,
+                                  unsigned char *dst, int dst_stride,
+                                  int y0, int y1, imgfilter_threads *);
+
+
+/* Unpacks rows y0 ... y1-1 of a TrueColor XImage into 4-channel bytes,
+   in the order red, green, blue, and then whatever bits of the depth are
+   not color, which is alpha if the image has any, else 0xFF.  Returns
+   False if the image has no color masks (PseudoColor), and does nothing.
+ */
+extern Bool imgfilter_ximage_to_rgba (XImage *, int y0, int y1,
+                                      unsigned char *rgba, int stride);
+
+/* The reverse: packs 4-channel bytes into rows y0 ... y1-1 of the XImage. */
+extern Bool imgfilter_rgba_to_ximage (const unsigned char *rgba, int stride,
+                                      XImage *, int y0, int y1);
+
+/* Scales one XImage into another of the same format, as imgfilter_scale.
+   If the format has no color masks, takes the nearest pixel instead.
+ */
+extern Bool imgfilter_scale_ximage (XImage *from, XImage *to,
+                                    imgfilter_threads *);
+
+#endif /* __XSCREENSAVER_IMGFILTER_H__ */
@@ -0,0 +1,254 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * Progressive, tiled, threaded rendering of per-pixel images.
+ * See iterimage.h.
+ */
+
+#include "utils.h"
+#include "iterimage.h"
+#include "thread_util.h"
+#include "xshm.h"
+#include <errno.h>
+#include <sys/time.h> /* for gettimeofday() */
+
+#undef MIN
+#undef MAX
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+
+/* Tiles are a multiple of 8 pixels wide, so that at any depth no two tiles
+   share a byte of the image, and of COARSEST, so that blocks don't
+   straddle tiles. */
+#define TILE_SIZE 64
+#define COARSEST  16
+
+typedef struct {
+  struct iterimage *parent;
+  unsigned id;
+  unsigned long *pixels;	/* one row of samples */
+} iterimage_thread;
+
+struct iterimage {
+  Display *dpy;
+  Window window;
+  GC gc;
+  XImage *image;
+  XShmSegmentInfo shm_info;
+  int width, height;
+  iterimage_fn fn;
+  void *closure;
+
+  struct threadpool pool;
+
+  int tiles_wide, tiles_high;
+  int block;			/* the size of the current pass, or 0 when done */
+  int next_tile;		/* the first tile of this pass not yet computed */
+  int batch_start, batch_end;	/* the tiles being computed now */
+};
+
+
+static double
+double_time (void)
+{
+  struct timeval now;
+# ifdef GETTIMEOFDAY_TWO_ARGS
+  struct timezone tzp;
+  gettimeofday(&now, &tzp);
+# else
+  gettimeofday(&now);
+# endif
+
+  return (now.tv_sec + ((double) now.tv_usec * 0.000001));
+}
+
+
+/* Fills in the samples of one tile that are new at this pass: on rows that
+   had samples at the previous pass, every other one; on the other rows,
+   all of them.  Each new sample is spread over its block, which is the
+   top left quarter of the previous pass's block, or the whole thing.
+ */
+static void
+render_tile (iterimage *ii, unsigned long *pixels, int tile)
+{
+  int s = ii->block;
+  int x0 = (tile % ii->tiles_wide) * TILE_SIZE;
+  int y0 = (tile / ii->tiles_wide) * TILE_SIZE;
+  int x1 = MIN (x0 + TILE_SIZE, ii->width);
+  int y1 = MIN (y0 + TILE_SIZE, ii->height);
+  int x, y;
+
+  for (y = y0; y < y1; y += s)
+    {
+      int first = x0, dx = s, n, i;
+      int bh = MIN (s, y1 - y);
+      if (s < COARSEST && !(y & s))
+        {
+          first += s;
+          dx += s;
+        }
+      if (first >= x1) continue;
+      n = (x1 - first + dx - 1) / dx;
+
+      ii->fn (ii->closure, y, first, dx, n, pixels);
+
+      for (i = 0, x = first; i < n; i++, x += dx)
+        {
+          int bw = MIN (s, x1 - x);
+          int xx, yy;
+          for (yy = y; yy < y + bh; yy++)
+            for (xx = x; xx < x + bw; xx++)
+              XPutPixel (ii->image, xx, yy, pixels[i]);
+        }
+    }
+}
+
+
+static void
+iterimage_thread_run (void *self)
+{
+  iterimage_thread *t = (iterimage_thread *) self;
+  iterimage *ii = t->parent;
+  int tile;
+  for (tile = ii->batch_start + t->id; tile < ii->batch_end;
+       tile += ii->pool.count)
+    render_tile (ii, t->pixels, tile);
+}
+
+
+static int
+iterimage_thread_create (void *self, struct threadpool *pool, unsigned id)
+{
+  iterimage_thread *t = (iterimage_thread *) self;
+  t->parent = GET_PARENT_OBJ (iterimage, pool, pool);
+  t->id = id;
+  t->pixels = (unsigned long *)
+    malloc ((TILE_SIZE + 1) * sizeof(*t->pixels));
+  return t->pixels ? 0 : ENOMEM;
+}
+
+
+static void
+iterimage_thread_destroy (void *self)
+{
+  iterimage_thread *t = (iterimage_thread *) self;
+  free (t->pixels);
+}
+
+
+iterimage *
+iterimage_new (Display *dpy, Window window, iterimage_fn fn, void *closure)
+{
+  static const struct threadpool_class cls = {
+    sizeof(iterimage_thread),
+    iterimage_thread_create,
+    iterimage_thread_destroy
+  };
+  XWindowAttributes xgwa;
+  XGCValues gcv;
+  iterimage *ii = (iterimage *) calloc (1, sizeof(*ii));
+  if (!ii) return 0;
+
+  XGetWindowAttributes (dpy, window, &xgwa);
+  ii->dpy = dpy;
+  ii->window = window;
+  ii->fn = fn;
+  ii->closure = closure;
+  ii->width  = MAX (1, xgwa.width);
+  ii->height = MAX (1, xgwa.height);
+  ii->tiles_wide = (ii->width  + TILE_SIZE - 1) / TILE_SIZE;
+  ii->tiles_high = (ii->height + TILE_SIZE - 1) / TILE_SIZE;
+
+  ii->image = create_xshm_image (dpy, xgwa.visual, xgwa.depth, ZPixmap,
+                                 &ii->shm_info, ii->width, ii->height);
+  if (!ii->image)
+    {
+      free (ii);
+      return 0;
+    }
+
+  if (threadpool_create (&ii->pool, &cls, dpy, hardware_concurrency (dpy)))
+    {
+      destroy_xshm_image (dpy, ii->image, &ii->shm_info);
+      free (ii);
+      return 0;
+    }
+
+  ii->gc = XCreateGC (dpy, window, 0, &gcv);
+  iterimage_restart (ii);
+  return ii;
+}
+
+
+void
+iterimage_free (iterimage *ii)
+{
+  if (!ii) return;
+  threadpool_destroy (&ii->pool);
+  destroy_xshm_image (ii->dpy, ii->image, &ii->shm_info);
+  XFreeGC (ii->dpy, ii->gc);
+  free (ii);
+}
+
+
+void
+iterimage_restart (iterimage *ii)
+{
+  ii->block = COARSEST;
+  ii->next_tile = 0;
+}
+
+
+Bool
+iterimage_step (iterimage *ii, double seconds)
+{
+  int ntiles = ii->tiles_wide * ii->tiles_high;
+  int batch = ii->pool.count;
+  double start = double_time();
+
+  while (ii->block)
+    {
+      int tile;
+      double elapsed;
+
+      ii->batch_start = ii->next_tile;
+      ii->batch_end = MIN (ntiles, ii->batch_start + batch);
+      threadpool_run (&ii->pool, iterimage_thread_run);
+      threadpool_wait (&ii->pool);
+
+      for (tile = ii->batch_start; tile < ii->batch_end; tile++)
+        {
+          int x = (tile % ii->tiles_wide) * TILE_SIZE;
+          int y = (tile / ii->tiles_wide) * TILE_SIZE;
+          put_xshm_image (ii->dpy, ii->window, ii->gc, ii->image, x, y, x, y,
+                          MIN (TILE_SIZE, ii->width - x),
+                          MIN (TILE_SIZE, ii->height - y),
+                          &ii->shm_info);
+        }
+
+      ii->next_tile = ii->batch_end;
+      if (ii->next_tile >= ntiles)
+        {
+          ii->next_tile = 0;
+          ii->block /= 2;
+        }
+
+      elapsed = double_time() - start;
+      if (elapsed >= seconds)
+        break;
+
+      /* Grow the batches while they are quick, to keep the threads busy
+         and the number of round trips down. */
+      if (elapsed < seconds / 4)
+        batch *= 2;
+    }
+
+  return !ii->block;
+}
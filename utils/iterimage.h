@@ -0,0 +1,52 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+#ifndef __XSCREENSAVER_ITERIMAGE_H__
+#define __XSCREENSAVER_ITERIMAGE_H__
+
+/* Draws a window-sized image in which every pixel is computed on its own,
+   as for escape-time fractals and Lyapunov maps, where each pixel costs
+   hundreds or thousands of iterations.
+
+   The image is rendered into an XShm image, in square tiles that are
+   spread across CPUs, and progressively: first one sample per 16x16 block,
+   then the remaining samples of each 8x8 block, and so on down to single
+   pixels, so that the whole picture shows up blocky at once and sharpens.
+   No pixel is computed twice.
+
+   The caller supplies a function that computes a run of samples along one
+   row.  Since neighboring samples take about as long as each other, it can
+   iterate several of them in lockstep, keeping a mask of those that have
+   escaped, so that the inner loop is over the run and vectorizes.
+ */
+
+typedef struct iterimage iterimage;
+
+/* Computes the pixel values of the 'n' samples on row 'y' at columns
+   x0, x0 + dx, x0 + 2*dx ...  It is called from several threads at once,
+   for different samples. */
+typedef void (*iterimage_fn) (void *closure, int y, int x0, int dx, int n,
+                              unsigned long *pixels_ret);
+
+/* Returns NULL if out of memory or threads. */
+extern iterimage *iterimage_new (Display *, Window, iterimage_fn,
+                                 void *closure);
+extern void iterimage_free (iterimage *);
+
+/* Forgets what has been computed and starts over from the coarsest pass,
+   after the picture changes.  Does not clear the window. */
+extern void iterimage_restart (iterimage *);
+
+/* Computes for about this many seconds, and puts whatever tiles are new on
+   the window.  Returns True once the image is complete. */
+extern Bool iterimage_step (iterimage *, double seconds);
+
+#endif /* __XSCREENSAVER_ITERIMAGE_H__ */
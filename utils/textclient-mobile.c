@@ -797,6 +797,21 @@ textclient_getc (text_data *d)
 }
 
 
+int
+textclient_read (text_data *d, char *buf, int n)
+{
+  int i = 0;
+  while (i < n) {
+    int c = textclient_getc (d);
+    if (c < 0) break;
+    if (c == 0) continue;
+    buf[i++] = (char) c;
+    if (c == '\r' || c == '\n') break;
+  }
+  return i;
+}
+
+
 Bool
 textclient_putc (text_data *d, XKeyEvent *k)
 {
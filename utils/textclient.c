@@ -35,6 +35,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 
 #include <signal.h>
 #include <sys/wait.h>
@@ -59,6 +60,10 @@
 
 #undef DEBUG
 
+/* Output of the program is read in chunks of up to this much, as much as
+   is waiting in the pipe.  Must be a power of 2. */
+#define RING_SIZE 65536
+
 extern const char *progname;
 
 struct text_data {
@@ -83,6 +88,12 @@ struct text_data {
 
   const char *out_buffer;
   int out_column;
+
+  /* Bytes read from the pipe and not yet returned.  The counters wrap;
+     head - tail is how many there are. */
+  unsigned char ring[RING_SIZE];
+  unsigned long ring_head, ring_tail;
+  Bool eof_p;		/* The pipe has closed, but the ring isn't empty yet. */
 };
 
 
@@ -475,7 +486,8 @@ close_pipe (text_data *d)
     }
   d->pipe = 0;
 
-
+  d->ring_head = d->ring_tail = 0;
+  d->eof_p = False;
 }
 
 
@@ -612,52 +624,90 @@ textclient_close (text_data *d)
   free (d);
 }
 
-int
-textclient_getc (text_data *d)
+/* The program's output is done: reap it and arrange to run it again.
+ */
+static void
+pipe_eof (text_data *d)
+{
+  if (d->pid)
+    {
+# ifdef DEBUG
+      fprintf (stderr, "%s: textclient: waitpid %d\n", progname, d->pid);
+# endif
+      waitpid (d->pid, NULL, 0);
+      d->pid = 0;
+    }
+
+  close_pipe (d);
+
+  if (d->out_column > 0)
+    {
+# ifdef DEBUG
+      fprintf (stderr, "%s: textclient: adding blank line at EOF\n",
+               progname);
+# endif
+      d->out_buffer = "\r\n\r\n";
+    }
+
+  start_timer (d);
+}
+
+
+/* Runs any pending timers and input callbacks, and if the pipe is
+   readable, reads as much of it as will fit into the ring.  This is only
+   done when the ring is empty, so it costs one read() per chunk rather
+   than a read() and a trip through Xt per byte.
+
+   The fd is not non-blocking, since in pty mode it is also written to;
+   but there is only one read() per time that Xt says it is readable, so
+   it never blocks.
+ */
+static void
+fill_ring (text_data *d)
 {
   XtAppContext app = XtDisplayToApplicationContext (d->dpy);
-  int ret = -1;
 
   if (XtAppPending (app) & (XtIMTimer|XtIMAlternateInput))
     XtAppProcessEvent (app, XtIMTimer|XtIMAlternateInput);
 
-  if (d->out_buffer && *d->out_buffer)
-    {
-      ret = *d->out_buffer;
-      d->out_buffer++;
-    }
-  else if (d->input_available_p && d->pipe)
+  if (d->ring_head == d->ring_tail)
+    d->ring_head = d->ring_tail = 0;	/* so the chunk can be as big as can be */
+
+  if (d->input_available_p && d->pipe && !d->eof_p)
     {
-      unsigned char s[2];
-      int n = read (fileno (d->pipe), (void *) s, 1);
+      unsigned long count = d->ring_head - d->ring_tail;
+      unsigned long start = d->ring_head & (RING_SIZE - 1);
+      unsigned long room = RING_SIZE - (start > count ? start : count);
+      int n = read (fileno (d->pipe), (void *) (d->ring + start), room);
       if (n > 0)
-        ret = s[0];
-      else		/* EOF */
-        {
-	  if (d->pid)
-	    {
-# ifdef DEBUG
-              fprintf (stderr, "%s: textclient: waitpid %d\n",
-                       progname, d->pid);
-# endif
-	      waitpid (d->pid, NULL, 0);
-              d->pid = 0;
-	    }
+        d->ring_head += n;
+      else if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        ;
+      else
+        d->eof_p = True;
+      d->input_available_p = False;
+    }
 
-          close_pipe (d);
+  if (d->eof_p && d->ring_head == d->ring_tail)
+    pipe_eof (d);
+}
 
-          if (d->out_column > 0)
-            {
-# ifdef DEBUG
-              fprintf (stderr, "%s: textclient: adding blank line at EOF\n",
-                       progname);
-# endif
-              d->out_buffer = "\r\n\r\n";
-            }
 
-          start_timer (d);
-        }
-      d->input_available_p = False;
+/* Returns the next byte, or -1 if none has arrived yet. */
+static int
+next_byte (text_data *d)
+{
+  int ret = -1;
+
+  if (d->out_buffer && *d->out_buffer)
+    {
+      ret = (unsigned char) *d->out_buffer;
+      d->out_buffer++;
+    }
+  else if (d->ring_head != d->ring_tail)
+    {
+      ret = d->ring[d->ring_tail & (RING_SIZE - 1)];
+      d->ring_tail++;
     }
 
   if (ret == '\r' || ret == '\n')
@@ -665,6 +715,20 @@ textclient_getc (text_data *d)
   else if (ret > 0)
     d->out_column++;
 
+  return ret;
+}
+
+
+int
+textclient_getc (text_data *d)
+{
+  int ret;
+
+  if (d->ring_head == d->ring_tail)
+    fill_ring (d);
+
+  ret = next_byte (d);
+
 # ifdef DEBUG
   if (ret <= 0)
     fprintf (stderr, "%s: textclient: getc: %d\n", progname, ret);
@@ -678,6 +742,31 @@ textclient_getc (text_data *d)
 }
 
 
+int
+textclient_read (text_data *d, char *buf, int n)
+{
+  int i = 0;
+
+  if (d->ring_head == d->ring_tail)
+    fill_ring (d);
+
+  while (i < n)
+    {
+      int c = next_byte (d);
+      if (c < 0) break;
+      if (c == 0) continue;
+      buf[i++] = (char) c;
+      if (c == '\r' || c == '\n') break;
+    }
+
+# ifdef DEBUG
+  fprintf (stderr, "%s: textclient: read: %d\n", progname, i);
+# endif
+
+  return i;
+}
+
+
 /* The interpretation of the ModN modifiers is dependent on what keys
    are bound to them: Mod1 does not necessarily mean "meta".  It only
    means "meta" if Meta_L or Meta_R are bound to it.  If Meta_L is on
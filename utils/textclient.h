@@ -27,6 +27,9 @@ extern void textclient_reshape (text_data *,
                                 int char_w, int char_h,
                                 int max_lines);
 extern int textclient_getc (text_data *);
+/* Copies up to n bytes into buf, stopping after a newline, and returns how
+   many: 0 if nothing has arrived yet.  NUL bytes are dropped. */
+extern int textclient_read (text_data *, char *buf, int n);
 extern Bool textclient_putc (text_data *, XKeyEvent *);
 
 # if defined(HAVE_IPHONE) || defined(HAVE_ANDROID)
@@ -0,0 +1,307 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * Batches of points and rectangles, grouped by GC and color.  See xbatch.h.
+ */
+
+#include "utils.h"
+#include "xbatch.h"
+
+/* If this many different GC/color pairs have been seen, forget them all at
+   the next flush, so that a hack that cycles through endless colors doesn't
+   grow the table forever. */
+#define MAX_GROUPS 4096
+
+typedef struct {
+  int start, npoints;
+  int shape, mode;
+} xbatch_polygon;
+
+typedef struct {
+  GC gc;
+  Bool pixel_p;
+  unsigned long pixel;
+  XPoint *points;
+  int npoints, points_size;
+  XRectangle *rects;
+  int nrects, rects_size;
+  xbatch_polygon *polys;	/* each one a run of poly_points */
+  int npolys, polys_size;
+  XPoint *poly_points;
+  int npoly_points, poly_points_size;
+} xbatch_group;
+
+struct xbatch {
+  Display *dpy;
+  Drawable drawable;
+  xbatch_group *groups;
+  int ngroups, groups_size;
+  int *table;			/* open-addressed hash of indexes into groups */
+  int table_size;		/* a power of 2 */
+  int current;			/* the group that primitives go into */
+};
+
+
+xbatch *
+xbatch_new (Display *dpy, Drawable d)
+{
+  xbatch *b = (xbatch *) calloc (1, sizeof(*b));
+  if (!b) return 0;
+  b->dpy = dpy;
+  b->drawable = d;
+  b->current = -1;
+  return b;
+}
+
+
+static void
+free_groups (xbatch *b)
+{
+  int i;
+  for (i = 0; i < b->ngroups; i++)
+    {
+      free (b->groups[i].points);
+      free (b->groups[i].rects);
+      free (b->groups[i].polys);
+      free (b->groups[i].poly_points);
+    }
+  free (b->groups);
+  free (b->table);
+  b->groups = 0;
+  b->table = 0;
+  b->ngroups = b->groups_size = b->table_size = 0;
+  b->current = -1;
+}
+
+
+void
+xbatch_free (xbatch *b)
+{
+  if (!b) return;
+  free_groups (b);
+  free (b);
+}
+
+
+static unsigned int
+hash_key (GC gc, Bool pixel_p, unsigned long pixel)
+{
+  unsigned long h = (unsigned long) gc;
+  h ^= (h >> 7);
+  h = h * 31 + (pixel_p ? pixel + 1 : 0);
+  h ^= (h >> 16);
+  h *= 0x45d9f3bUL;
+  h ^= (h >> 16);
+  return (unsigned int) h;
+}
+
+
+static void
+grow_table (xbatch *b)
+{
+  int size = b->table_size ? b->table_size * 2 : 64;
+  int i;
+  free (b->table);
+  b->table = (int *) malloc (size * sizeof(*b->table));
+  if (!b->table) abort();
+  b->table_size = size;
+  for (i = 0; i < size; i++)
+    b->table[i] = -1;
+  for (i = 0; i < b->ngroups; i++)
+    {
+      xbatch_group *g = &b->groups[i];
+      unsigned int h = hash_key (g->gc, g->pixel_p, g->pixel) & (size - 1);
+      while (b->table[h] >= 0)
+        h = (h + 1) & (size - 1);
+      b->table[h] = i;
+    }
+}
+
+
+static void
+select_group (xbatch *b, GC gc, Bool pixel_p, unsigned long pixel)
+{
+  xbatch_group *g;
+  unsigned int h;
+
+  if (b->current >= 0)
+    {
+      g = &b->groups[b->current];
+      if (g->gc == gc && g->pixel_p == pixel_p &&
+          (!pixel_p || g->pixel == pixel))
+        return;
+    }
+
+  if (b->ngroups * 2 >= b->table_size)
+    grow_table (b);
+
+  h = hash_key (gc, pixel_p, pixel) & (b->table_size - 1);
+  while (b->table[h] >= 0)
+    {
+      g = &b->groups[b->table[h]];
+      if (g->gc == gc && g->pixel_p == pixel_p &&
+          (!pixel_p || g->pixel == pixel))
+        {
+          b->current = b->table[h];
+          return;
+        }
+      h = (h + 1) & (b->table_size - 1);
+    }
+
+  if (b->ngroups >= b->groups_size)
+    {
+      b->groups_size = b->groups_size ? b->groups_size * 2 : 16;
+      b->groups = (xbatch_group *)
+        realloc (b->groups, b->groups_size * sizeof(*b->groups));
+      if (!b->groups) abort();
+    }
+
+  g = &b->groups[b->ngroups];
+  memset (g, 0, sizeof(*g));
+  g->gc = gc;
+  g->pixel_p = pixel_p;
+  g->pixel = pixel;
+  b->table[h] = b->ngroups;
+  b->current = b->ngroups++;
+}
+
+
+void
+xbatch_set_gc (xbatch *b, GC gc)
+{
+  select_group (b, gc, False, 0);
+}
+
+
+void
+xbatch_set_foreground (xbatch *b, GC gc, unsigned long pixel)
+{
+  select_group (b, gc, True, pixel);
+}
+
+
+void
+xbatch_point (xbatch *b, int x, int y)
+{
+  xbatch_group *g;
+  if (b->current < 0) abort();	/* no GC selected */
+  g = &b->groups[b->current];
+  if (g->npoints >= g->points_size)
+    {
+      g->points_size = g->points_size ? g->points_size * 2 : 256;
+      g->points = (XPoint *)
+        realloc (g->points, g->points_size * sizeof(*g->points));
+      if (!g->points) abort();
+    }
+  g->points[g->npoints].x = x;
+  g->points[g->npoints].y = y;
+  g->npoints++;
+}
+
+
+void
+xbatch_fill_rectangle (xbatch *b, int x, int y,
+                       unsigned int w, unsigned int h)
+{
+  xbatch_group *g;
+  XRectangle *r;
+  if (b->current < 0) abort();	/* no GC selected */
+  g = &b->groups[b->current];
+  if (g->nrects >= g->rects_size)
+    {
+      g->rects_size = g->rects_size ? g->rects_size * 2 : 256;
+      g->rects = (XRectangle *)
+        realloc (g->rects, g->rects_size * sizeof(*g->rects));
+      if (!g->rects) abort();
+    }
+  r = &g->rects[g->nrects++];
+  r->x = x;
+  r->y = y;
+  r->width = w;
+  r->height = h;
+}
+
+
+/* There is no plural XFillPolygon, but this still saves a GC change per
+   polygon. */
+void
+xbatch_fill_polygon (xbatch *b, const XPoint *points, int npoints,
+                     int shape, int mode)
+{
+  xbatch_group *g;
+  xbatch_polygon *p;
+  if (b->current < 0) abort();	/* no GC selected */
+  g = &b->groups[b->current];
+  if (g->npolys >= g->polys_size)
+    {
+      g->polys_size = g->polys_size ? g->polys_size * 2 : 64;
+      g->polys = (xbatch_polygon *)
+        realloc (g->polys, g->polys_size * sizeof(*g->polys));
+      if (!g->polys) abort();
+    }
+  if (g->npoly_points + npoints > g->poly_points_size)
+    {
+      while (g->npoly_points + npoints > g->poly_points_size)
+        g->poly_points_size = (g->poly_points_size
+                               ? g->poly_points_size * 2 : 256);
+      g->poly_points = (XPoint *)
+        realloc (g->poly_points,
+                 g->poly_points_size * sizeof(*g->poly_points));
+      if (!g->poly_points) abort();
+    }
+  p = &g->polys[g->npolys++];
+  p->start = g->npoly_points;
+  p->npoints = npoints;
+  p->shape = shape;
+  p->mode = mode;
+  memcpy (g->poly_points + g->npoly_points, points,
+          npoints * sizeof(*points));
+  g->npoly_points += npoints;
+}
+
+
+/* Xlib splits XDrawPoints and XFillRectangles into as many requests as the
+   server's maximum request size needs, so there's no need to chunk them.
+ */
+void
+xbatch_flush (xbatch *b)
+{
+  int i;
+  if (!b) return;
+  for (i = 0; i < b->ngroups; i++)
+    {
+      xbatch_group *g = &b->groups[i];
+      int j;
+      if (!g->nrects && !g->npoints && !g->npolys) continue;
+      if (g->pixel_p)
+        XSetForeground (b->dpy, g->gc, g->pixel);
+      if (g->nrects)
+        XFillRectangles (b->dpy, b->drawable, g->gc, g->rects, g->nrects);
+      for (j = 0; j < g->npolys; j++)
+        XFillPolygon (b->dpy, b->drawable, g->gc,
+                      g->poly_points + g->polys[j].start, g->polys[j].npoints,
+                      g->polys[j].shape, g->polys[j].mode);
+      if (g->npoints)
+        XDrawPoints (b->dpy, b->drawable, g->gc, g->points, g->npoints,
+                     CoordModeOrigin);
+      g->nrects = 0;
+      g->npoints = 0;
+      g->npolys = 0;
+      g->npoly_points = 0;
+    }
+
+  if (b->ngroups > MAX_GROUPS && b->current >= 0)
+    {
+      /* Keep the current GC and color selected. */
+      xbatch_group cur = b->groups[b->current];
+      free_groups (b);
+      select_group (b, cur.gc, cur.pixel_p, cur.pixel);
+    }
+}
@@ -0,0 +1,55 @@
+/* xscreensaver, Copyright © 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+#ifndef __XSCREENSAVER_XBATCH_H__
+#define __XSCREENSAVER_XBATCH_H__
+
+/* Collects points, filled rectangles and filled polygons, sorted by GC and
+   foreground color, and draws each group with one XDrawPoints and one
+   XFillRectangles when flushed.  Grid and cellular-automaton hacks that
+   would otherwise issue an XSetForeground and an XFillRectangle per cell
+   can use it as a drop-in replacement for those calls:
+
+      xbatch_set_foreground (b, gc, pixel);	 instead of XSetForeground
+      xbatch_fill_rectangle (b, x, y, w, h);	 instead of XFillRectangle
+      ...
+      xbatch_flush (b);				 at the end of the frame
+
+   Primitives in different groups are not drawn in the order in which they
+   were added.  If a later primitive must land on top of an earlier one in
+   a different color, or a drawing call is about to bypass the batch, call
+   xbatch_flush first.  Likewise flush before changing any other attribute
+   of a GC that has primitives pending.
+ */
+
+typedef struct xbatch xbatch;
+
+extern xbatch *xbatch_new (Display *, Drawable);
+extern void xbatch_free (xbatch *);
+
+/* Subsequent primitives are drawn with this GC as it is. */
+extern void xbatch_set_gc (xbatch *, GC);
+
+/* Subsequent primitives are drawn with this GC, with its foreground set to
+   the given pixel.  The GC's foreground is changed when the batch is
+   flushed, not now. */
+extern void xbatch_set_foreground (xbatch *, GC, unsigned long pixel);
+
+extern void xbatch_point (xbatch *, int x, int y);
+extern void xbatch_fill_rectangle (xbatch *, int x, int y,
+                                   unsigned int w, unsigned int h);
+extern void xbatch_fill_polygon (xbatch *, const XPoint *, int npoints,
+                                 int shape, int mode);
+
+/* Draws everything pending, and empties the batch. */
+extern void xbatch_flush (xbatch *);
+
+#endif /* __XSCREENSAVER_XBATCH_H__ */
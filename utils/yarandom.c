@@ -137,3 +137,159 @@ ya_rand_init(unsigned int seed)
   i1 = a[0] % VectorSize;
   i2 = (i1 + 24) % VectorSize;
 }
+
+
+/* Equivalent to calling ya_random() n times.
+
+   a[i1] is next read as a[i2] 31 steps after it was written, so any run of
+   up to 31 steps that doesn't wrap around the end of the vector has no
+   dependencies between its iterations, and the compiler is free to
+   vectorize it.
+ */
+void
+ya_random_fill (unsigned int *buf, unsigned long n)
+{
+  while (n)
+    {
+      unsigned int *p1 = a + i1, *p2 = a + i2;
+      int run = VectorSize - (i1 > i2 ? i1 : i2);
+      int j;
+      if (run > VectorSize - 24) run = VectorSize - 24;
+      if ((unsigned long) run > n) run = (int) n;
+
+      for (j = 0; j < run; j++)
+        buf[j] = p1[j] += p2[j];
+
+      buf += run;
+      n -= run;
+      i1 += run; if (i1 >= VectorSize) i1 = 0;
+      i2 += run; if (i2 >= VectorSize) i2 = 0;
+    }
+}
+
+
+/* Per-thread generators: xoshiro128**, YA_RAND_LANES streams side by side.
+   http://prng.di.unimi.it/xoshiro128starstar.c
+ */
+
+#define ROTL(X,N) (((X) << (N)) | ((X) >> (32 - (N))))
+
+static unsigned int
+lane_next (ya_rand_state *st, int k)
+{
+  unsigned int s1 = st->s[1][k];
+  unsigned int r = s1 * 5;
+  unsigned int t = s1 << 9;
+  st->s[2][k] ^= st->s[0][k];
+  st->s[3][k] ^= s1;
+  st->s[1][k] ^= st->s[2][k];
+  st->s[0][k] ^= st->s[3][k];
+  st->s[2][k] ^= t;
+  st->s[3][k] = ROTL (st->s[3][k], 11);
+  return ROTL (r, 7) * 9;
+}
+
+
+/* Advances lane k by the polynomial in jump[]. */
+static void
+lane_jump (ya_rand_state *st, int k, const unsigned int jump[4])
+{
+  unsigned int s[4] = { 0, 0, 0, 0 };
+  int i, b, j;
+  for (i = 0; i < 4; i++)
+    for (b = 0; b < 32; b++)
+      {
+        if (jump[i] & (1U << b))
+          for (j = 0; j < 4; j++)
+            s[j] ^= st->s[j][k];
+        lane_next (st, k);
+      }
+  for (j = 0; j < 4; j++)
+    st->s[j][k] = s[j];
+}
+
+/* 2^64 and 2^96 steps, respectively. */
+static const unsigned int short_jump[4] = {
+  0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+static const unsigned int long_jump[4] = {
+  0xb523952e, 0x0b6f099f, 0xccf5a0ef, 0x1c580662 };
+
+
+void
+ya_rand_state_init (ya_rand_state *st, unsigned int seed)
+{
+  int j, k;
+  if (seed == 0)
+    seed = ya_random();
+
+  /* Spread the seed over the 128 bits of lane 0 with the MurmurHash3
+     finalizer, which is a bijection: at most one word can come out zero. */
+  for (j = 0; j < 4; j++)
+    {
+      unsigned int h = seed + 0x9E3779B9U * (j + 1);
+      h ^= h >> 16; h *= 0x85EBCA6BU;
+      h ^= h >> 13; h *= 0xC2B2AE35U;
+      h ^= h >> 16;
+      st->s[j][0] = h;
+    }
+
+  /* Each further lane starts 2^64 steps past the previous one. */
+  for (k = 1; k < YA_RAND_LANES; k++)
+    {
+      for (j = 0; j < 4; j++)
+        st->s[j][k] = st->s[j][k-1];
+      lane_jump (st, k, short_jump);
+    }
+
+  st->lane = 0;
+}
+
+
+void
+ya_rand_state_jump (ya_rand_state *st)
+{
+  int k;
+  for (k = 0; k < YA_RAND_LANES; k++)
+    lane_jump (st, k, long_jump);
+}
+
+
+unsigned int
+ya_random_r (ya_rand_state *st)
+{
+  unsigned int k = st->lane;
+  st->lane = (k + 1) % YA_RAND_LANES;
+  return lane_next (st, k);
+}
+
+
+/* Produces the same values as calling ya_random_r() n times. */
+void
+ya_random_fill_r (ya_rand_state *st, unsigned int *buf, unsigned long n)
+{
+  unsigned int *s0 = st->s[0], *s1 = st->s[1], *s2 = st->s[2], *s3 = st->s[3];
+
+  for (; n && st->lane; n--)
+    *buf++ = ya_random_r (st);
+
+  /* All lanes in lockstep: one SIMD register's worth per iteration. */
+  for (; n >= YA_RAND_LANES; n -= YA_RAND_LANES, buf += YA_RAND_LANES)
+    {
+      int k;
+      for (k = 0; k < YA_RAND_LANES; k++)
+        {
+          unsigned int r = s1[k] * 5;
+          unsigned int t = s1[k] << 9;
+          buf[k] = ROTL (r, 7) * 9;
+          s2[k] ^= s0[k];
+          s3[k] ^= s1[k];
+          s1[k] ^= s2[k];
+          s0[k] ^= s3[k];
+          s2[k] ^= t;
+          s3[k] = ROTL (s3[k], 11);
+        }
+    }
+
+  for (; n; n--)
+    *buf++ = ya_random_r (st);
+}
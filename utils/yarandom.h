@@ -51,6 +51,34 @@
 extern unsigned int ya_random (void);
 extern void ya_rand_init (unsigned int);
 
+/* Fills buf with the next n values of ya_random(), but faster. */
+extern void ya_random_fill (unsigned int *buf, unsigned long n);
+
+
+/* Private generators, for use from worker threads, where ya_random() is
+   not safe to call.  This is xoshiro128** (Blackman & Vigna, 2018) run as
+   YA_RAND_LANES interleaved streams, so that ya_random_fill_r() can be
+   vectorized by the compiler.
+
+   Seeding with 0 takes a seed from ya_random(), so do that from the main
+   thread.  To give each of N worker threads its own non-overlapping stream
+   from a single seed, initialize every state with the same seed and then
+   call ya_rand_state_jump() on the i'th one i times: each jump skips 2^96
+   values.
+ */
+#define YA_RAND_LANES 4
+
+typedef struct ya_rand_state {
+  unsigned int s[4][YA_RAND_LANES];	/* Word-major, so lanes are adjacent */
+  unsigned int lane;
+} ya_rand_state;
+
+extern void ya_rand_state_init (ya_rand_state *, unsigned int seed);
+extern void ya_rand_state_jump (ya_rand_state *);
+extern unsigned int ya_random_r (ya_rand_state *);
+extern void ya_random_fill_r (ya_rand_state *,
+                              unsigned int *buf, unsigned long n);
+
 #define random()   ya_random()
 #define RAND_MAX   0xFFFFFFFF
 